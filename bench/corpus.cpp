@@ -0,0 +1,179 @@
+#include "corpus.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <unistd.h>
+
+namespace charlie {
+
+namespace {
+
+// SplitMix64. The standard distributions are implementation defined, so
+// roll our own to keep the corpus identical everywhere.
+class Random {
+public:
+  explicit Random(uint64_t seed) : mState(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (mState += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [lo, hi]
+  uint32_t Range(uint32_t lo, uint32_t hi) {
+    return lo + static_cast<uint32_t>(Next() % (hi - lo + 1));
+  }
+
+private:
+  uint64_t mState;
+};
+
+class CorpusWriter {
+public:
+  CorpusWriter(uint64_t seed) : mRandom(seed) {}
+
+  std::string &Source() {
+    return mSource;
+  }
+
+  void Identifier(uint32_t min_len, uint32_t max_len) {
+    static const char kFirst[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const char kRest[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    uint32_t len = mRandom.Range(min_len, max_len);
+    mSource += kFirst[mRandom.Range(0, sizeof(kFirst) - 2)];
+    for (uint32_t i = 1; i < len; ++i) {
+      mSource += kRest[mRandom.Range(0, sizeof(kRest) - 2)];
+    }
+    // Keep clear of keywords and of other generated names
+    mSource += '_';
+    mSource += std::to_string(mCounter++);
+  }
+
+  // 0: int, 1: float, 2: string
+  void Literal(uint32_t kind) {
+    switch (kind) {
+    case 0:
+      mSource += std::to_string(mRandom.Range(1, 2000000000));
+      break;
+    case 1:
+      mSource += std::to_string(mRandom.Range(0, 99999));
+      mSource += '.';
+      mSource += std::to_string(mRandom.Range(1, 9999));
+      break;
+    default: {
+      mSource += '"';
+      uint32_t len = mRandom.Range(4, 48);
+      for (uint32_t i = 0; i < len; ++i) {
+        mSource += static_cast<char>(mRandom.Range(0, 5) ? mRandom.Range('a', 'z') : ' ');
+      }
+      mSource += '"';
+      break;
+    }
+    }
+  }
+
+  void Struct(uint32_t num_members, uint32_t name_len) {
+    Identifier(name_len / 2, name_len);
+    mSource += " :: struct {\n";
+    for (uint32_t i = 0; i < num_members; ++i) {
+      mSource += "  ";
+      Identifier(name_len / 2, name_len);
+      // The parser wants a comma after every member, including the last
+      mSource += mRandom.Range(0, 1) ? ": int,\n" : ": float,\n";
+    }
+    mSource += "}\n\n";
+  }
+
+  void Procedure(uint32_t num_statements, uint32_t name_len) {
+    static const char *const kReturnTypes[] = {"int", "float", "string"};
+    // Every return has to match the declared return type
+    uint32_t kind = mRandom.Range(0, 2);
+    Identifier(name_len / 2, name_len);
+    mSource += " :: proc() -> ";
+    mSource += kReturnTypes[kind];
+    mSource += " {\n";
+    for (uint32_t i = 0; i < num_statements; ++i) {
+      mSource += "  return ";
+      Literal(kind);
+      mSource += ";\n";
+    }
+    mSource += "}\n\n";
+  }
+
+  Random &Rng() {
+    return mRandom;
+  }
+
+private:
+  Random mRandom;
+  std::string mSource;
+  uint64_t mCounter = 0;
+};
+
+}  // namespace
+
+const char *GetCorpusProfileName(CorpusProfile profile) {
+  const char *name = "";
+  switch (profile) {
+  case CORPUS_IDENTIFIERS: name = "identifiers"; break;
+  case CORPUS_LITERALS: name = "literals"; break;
+  case CORPUS_NESTED: name = "nested"; break;
+  case CORPUS_LONG: name = "long"; break;
+  }
+  return name;
+}
+
+std::string GenerateCorpus(CorpusProfile profile,
+                           size_t target_bytes,
+                           uint64_t seed) {
+  CorpusWriter w(seed);
+  std::string &source = w.Source();
+  source.reserve(target_bytes + 256);
+
+  while (source.size() < target_bytes) {
+    switch (profile) {
+    case CORPUS_IDENTIFIERS:
+      if (w.Rng().Range(0, 3) == 0)
+        w.Procedure(1, 48);
+      else
+        w.Struct(w.Rng().Range(4, 16), 48);
+      break;
+    case CORPUS_LITERALS:
+      w.Procedure(w.Rng().Range(4, 12), 8);
+      break;
+    case CORPUS_NESTED:
+      w.Procedure(w.Rng().Range(200, 400), 8);
+      break;
+    case CORPUS_LONG:
+      switch (w.Rng().Range(0, 2)) {
+      case 0: w.Struct(w.Rng().Range(2, 8), 16); break;
+      default: w.Procedure(w.Rng().Range(1, 8), 16); break;
+      }
+      break;
+    }
+  }
+
+  source += "main :: proc() -> int {\n  return 0;\n}\n";
+  return std::move(source);
+}
+
+std::string WriteTempSource(const std::string &source) {
+  char path[] = "/tmp/charlie-corpus-XXXXXX.ch";
+  int fd = mkstemps(path, 3);
+  if (fd < 0) {
+    perror("mkstemps");
+    exit(1);
+  }
+  close(fd);
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(source.data(), source.size());
+  return path;
+}
+
+}  // namespace charlie
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace charlie {
+
+// Shapes of synthetic Charlie source for benchmarks.
+enum CorpusProfile {
+  // Long identifiers: structs with many members and long procedure names
+  CORPUS_IDENTIFIERS,
+  // Procedures returning integer, float and string literals
+  CORPUS_LITERALS,
+  // Procedures with large bodies. The grammar has no nested statements yet,
+  // so depth here means many statements per block.
+  CORPUS_NESTED,
+  // A mix of the other profiles, meant to be generated at several MB
+  CORPUS_LONG,
+};
+
+const char *GetCorpusProfileName(CorpusProfile profile);
+
+// Generates roughly `target_bytes` of valid source in `profile` shape,
+// ending with a `main` so it also compiles as a program. The output only
+// depends on the arguments, so runs are comparable across machines and
+// builds.
+std::string GenerateCorpus(CorpusProfile profile,
+                           size_t target_bytes,
+                           uint64_t seed = 1);
+
+// Writes `source` to a fresh temporary .ch file and returns its path.
+std::string WriteTempSource(const std::string &source);
+
+}  // namespace charlie
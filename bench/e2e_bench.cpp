@@ -0,0 +1,297 @@
+// End-to-end compile throughput harness.
+//
+// Compiles generated programs of increasing size through the whole
+// pipeline (parse, codegen, optimize, emit an object file) and records wall
+// time, peak RSS and output size for each as JSON. Every size runs in its
+// own child process so peak RSS belongs to that size alone.
+//
+// With --baseline, results are compared against a stored run and any metric
+// that grew by more than --tolerance fails the benchmark. The scaling
+// exponent between consecutive sizes (1.0 is linear) is checked against
+// --max-scaling.
+//
+// Usage: e2e_bench [--reps=N] [-O<n>] [--out=<file>] [--baseline=<file>]
+//                  [--tolerance=<fraction>] [--max-scaling=<exponent>]
+
+#include "corpus.h"
+#include "../src/compiler.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace charlie;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Result {
+  size_t input_bytes = 0;
+  double wall_ms = 0;
+  uint64_t peak_rss_kb = 0;
+  uint64_t output_bytes = 0;
+  bool ok = false;
+};
+
+struct Settings {
+  unsigned reps = 5;
+  unsigned opt_level = 2;
+  std::string out;
+  std::string baseline;
+  double tolerance = 0.10;
+  double max_scaling = 1.25;
+};
+
+const size_t kSizes[] = {64 << 10, 256 << 10, 1 << 20, 4 << 20};
+
+std::string SizeName(size_t bytes) {
+  return bytes >= (1 << 20) ? std::to_string(bytes >> 20) + "M"
+                            : std::to_string(bytes >> 10) + "K";
+}
+
+// Runs in the child: compiles `path` `reps` times and reports the median.
+Result CompileInChild(const std::string &path, const Settings &settings) {
+  CompilerOptions opts;
+  opts.opt_level = settings.opt_level;
+  opts.emit = CompilerOptions::EMIT_OBJECT;
+  // Compile every declaration so time tracks input size
+  opts.dead_decl_elim = false;
+
+  Result result;
+  std::vector<double> samples;
+  CompileContext cc;
+  for (unsigned i = 0; i < settings.reps; ++i) {
+    std::stringstream diag;
+    std::string output;
+    auto start = Clock::now();
+    bool ok = CompileFile(path, opts, cc, nullptr, diag, output);
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (!ok) {
+      fprintf(stderr, "%s", diag.str().c_str());
+      return result;
+    }
+    samples.push_back(elapsed.count());
+    result.output_bytes = output.size();
+  }
+  std::sort(samples.begin(), samples.end());
+  result.wall_ms = samples[samples.size() / 2];
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  result.peak_rss_kb = usage.ru_maxrss;
+  result.ok = true;
+  return result;
+}
+
+Result Run(const std::string &path, const Settings &settings) {
+  int fds[2];
+  if (pipe(fds)) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    Result r = CompileInChild(path, settings);
+    ssize_t n = write(fds[1], &r, sizeof(r));
+    _exit(n == sizeof(r) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  Result r;
+  if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+    r.ok = false;
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    r.ok = false;
+  return r;
+}
+
+// Pulls `"key": <number>` out of one line of our own JSON output
+bool FindNumber(const std::string &line, const char *key, double &value) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos)
+    return false;
+  value = strtod(line.c_str() + pos + needle.size(), nullptr);
+  return true;
+}
+
+bool FindString(const std::string &line, const char *key, std::string &value) {
+  std::string needle = std::string("\"") + key + "\":\"";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos)
+    return false;
+  pos += needle.size();
+  size_t end = line.find('"', pos);
+  if (end == std::string::npos)
+    return false;
+  value = line.substr(pos, end - pos);
+  return true;
+}
+
+struct BaselineEntry {
+  std::string name;
+  double wall_ms;
+  double peak_rss_kb;
+  double output_bytes;
+};
+
+bool ReadBaseline(const std::string &path, std::vector<BaselineEntry> &entries) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    BaselineEntry e;
+    if (FindString(line, "name", e.name) &&
+        FindNumber(line, "wall_ms", e.wall_ms) &&
+        FindNumber(line, "peak_rss_kb", e.peak_rss_kb) &&
+        FindNumber(line, "output_bytes", e.output_bytes))
+      entries.push_back(std::move(e));
+  }
+  return !entries.empty();
+}
+
+bool ParseArgs(int argc, char **argv, Settings &settings) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "--reps=", 7)) {
+      settings.reps = atoi(arg + 7);
+    } else if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' &&
+               !arg[3]) {
+      settings.opt_level = arg[2] - '0';
+    } else if (!strncmp(arg, "--out=", 6)) {
+      settings.out = arg + 6;
+    } else if (!strncmp(arg, "--baseline=", 11)) {
+      settings.baseline = arg + 11;
+    } else if (!strncmp(arg, "--tolerance=", 12)) {
+      settings.tolerance = atof(arg + 12);
+    } else if (!strncmp(arg, "--max-scaling=", 14)) {
+      settings.max_scaling = atof(arg + 14);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--reps=N] [-O<n>] [--out=<file>] [--baseline=<file>]\n"
+              "          [--tolerance=<fraction>] [--max-scaling=<exponent>]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return settings.reps > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Settings settings;
+  if (!ParseArgs(argc, argv, settings))
+    return 1;
+
+  std::vector<std::string> names;
+  std::vector<Result> results;
+  for (size_t size : kSizes) {
+    std::string source = GenerateCorpus(CORPUS_LONG, size);
+    std::string path = WriteTempSource(source);
+    Result r = Run(path, settings);
+    remove(path.c_str());
+    if (!r.ok) {
+      fprintf(stderr, "compiling the %s program failed\n", SizeName(size).c_str());
+      return 1;
+    }
+    r.input_bytes = source.size();
+    names.push_back("long-" + SizeName(size));
+    results.push_back(r);
+    fprintf(stderr, "%-10s %10.2f ms %10.1f MiB RSS %12llu bytes out\n",
+            names.back().c_str(), r.wall_ms, r.peak_rss_kb / 1024.0,
+            static_cast<unsigned long long>(r.output_bytes));
+  }
+
+  // Time ~ size^k between consecutive sizes; k near 1 is linear
+  std::vector<double> exponents;
+  for (size_t i = 1; i < results.size(); ++i) {
+    exponents.push_back(
+      std::log(results[i].wall_ms / results[i - 1].wall_ms) /
+      std::log(double(results[i].input_bytes) / results[i - 1].input_bytes));
+  }
+
+  std::ostringstream json;
+  json << "{\"version\":\"" << CHARLIE_VERSION << "\",\"opt_level\":"
+       << settings.opt_level << ",\"reps\":" << settings.reps
+       << ",\"results\":[\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    json << "{\"name\":\"" << names[i] << "\",\"input_bytes\":" << r.input_bytes
+         << ",\"wall_ms\":" << r.wall_ms << ",\"peak_rss_kb\":" << r.peak_rss_kb
+         << ",\"output_bytes\":" << r.output_bytes << "}"
+         << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  json << "],\"scaling_exponents\":[";
+  for (size_t i = 0; i < exponents.size(); ++i) {
+    json << (i ? "," : "") << exponents[i];
+  }
+  json << "]}\n";
+
+  if (settings.out.empty()) {
+    fputs(json.str().c_str(), stdout);
+  } else {
+    std::ofstream out(settings.out, std::ios::trunc);
+    out << json.str();
+  }
+
+  bool failed = false;
+  // Small inputs are dominated by fixed costs, so only the largest step is
+  // held to the scaling limit.
+  if (!exponents.empty() && exponents.back() > settings.max_scaling) {
+    fprintf(stderr, "REGRESSION: compile time grows as size^%.2f (limit %.2f)\n",
+            exponents.back(), settings.max_scaling);
+    failed = true;
+  }
+
+  if (!settings.baseline.empty()) {
+    std::vector<BaselineEntry> baseline;
+    if (!ReadBaseline(settings.baseline, baseline)) {
+      fprintf(stderr, "cannot read baseline '%s'\n", settings.baseline.c_str());
+      return 1;
+    }
+    auto check = [&](const std::string &name, const char *metric, double base,
+                     double now) {
+      double change = base > 0 ? (now - base) / base : 0.0;
+      if (change > settings.tolerance) {
+        fprintf(stderr, "REGRESSION: %s %s %.1f -> %.1f (%+.1f%%, tolerance %.1f%%)\n",
+                name.c_str(), metric, base, now, 100 * change,
+                100 * settings.tolerance);
+        failed = true;
+      }
+    };
+    for (size_t i = 0; i < results.size(); ++i) {
+      auto it = std::find_if(baseline.begin(), baseline.end(),
+                             [&](const BaselineEntry &e) { return e.name == names[i]; });
+      if (it == baseline.end())
+        continue;
+      check(names[i], "wall_ms", it->wall_ms, results[i].wall_ms);
+      check(names[i], "peak_rss_kb", it->peak_rss_kb, results[i].peak_rss_kb);
+      check(names[i], "output_bytes", it->output_bytes, results[i].output_bytes);
+    }
+  }
+
+  return failed ? 1 : 0;
+}
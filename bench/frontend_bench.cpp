@@ -0,0 +1,123 @@
+// Lexer and parser throughput on synthetic corpora.
+//
+// Each profile is generated once, written to a temporary file (the lexer
+// reads from a file, so the page cache is part of what is measured) and then
+// lexed and parsed `repetitions` times after one warm-up run. Reported
+// numbers are medians; the spread column is the median absolute deviation as
+// a percentage of the median.
+//
+// Usage: frontend_bench [repetitions] [corpus MB]
+
+#include "corpus.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+using namespace charlie;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Summary {
+  double median;
+  double spread_pct;
+};
+
+Summary Summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  double median = samples[samples.size() / 2];
+  std::vector<double> deviations;
+  for (double s : samples) {
+    deviations.push_back(std::fabs(s - median));
+  }
+  std::sort(deviations.begin(), deviations.end());
+  double mad = deviations[deviations.size() / 2];
+  return {median, median > 0 ? 100.0 * mad / median : 0.0};
+}
+
+template <typename F>
+Summary Measure(unsigned reps, size_t &items, F &&f) {
+  items = f();  // Warm-up
+  std::vector<double> samples;
+  for (unsigned i = 0; i < reps; ++i) {
+    auto start = Clock::now();
+    size_t n = f();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    if (n != items) {
+      fprintf(stderr, "nondeterministic result: %zu vs %zu\n", n, items);
+      exit(1);
+    }
+    samples.push_back(elapsed.count());
+  }
+  return Summarize(std::move(samples));
+}
+
+size_t LexFile(const std::string &path) {
+  std::stringstream diag;
+  Lexer lexer(path, diag);
+  size_t num_tokens = 0;
+  Token tok;
+  for (lexer.GetNextToken(tok); tok.kind != TOK_EOF; lexer.GetNextToken(tok)) {
+    if (tok.kind == TOK_ERROR) {
+      fprintf(stderr, "lexing failed:\n%s", diag.str().c_str());
+      exit(1);
+    }
+    num_tokens++;
+  }
+  return num_tokens;
+}
+
+size_t ParseFile(const std::string &path) {
+  std::stringstream diag;
+  Parser parser(path, diag);
+  auto mod = parser.Parse();
+  if (!mod) {
+    fprintf(stderr, "parsing failed:\n%s", diag.str().c_str());
+    exit(1);
+  }
+  return mod->TopLevelDecls().size();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  unsigned reps = argc > 1 ? atoi(argv[1]) : 15;
+  double corpus_mb = argc > 2 ? atof(argv[2]) : 2.0;
+  if (reps == 0 || corpus_mb <= 0) {
+    fprintf(stderr, "usage: %s [repetitions] [corpus MB]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%-12s %8s | %10s %10s %7s | %10s %10s %7s\n", "profile", "MB",
+         "lex MB/s", "Mtok/s", "spread", "parse MB/s", "kdecl/s", "spread");
+
+  for (CorpusProfile profile :
+       {CORPUS_IDENTIFIERS, CORPUS_LITERALS, CORPUS_NESTED, CORPUS_LONG}) {
+    // The long profile is the one that exercises big inputs
+    size_t bytes = corpus_mb * 1024 * 1024 * (profile == CORPUS_LONG ? 4 : 1);
+    std::string source = GenerateCorpus(profile, bytes);
+    std::string path = WriteTempSource(source);
+    double mb = source.size() / (1024.0 * 1024.0);
+
+    size_t num_tokens, num_decls;
+    Summary lex = Measure(reps, num_tokens, [&] { return LexFile(path); });
+    Summary parse = Measure(reps, num_decls, [&] { return ParseFile(path); });
+
+    printf("%-12s %8.2f | %10.2f %10.2f %6.1f%% | %10.2f %10.2f %6.1f%%\n",
+           GetCorpusProfileName(profile), mb, mb / lex.median,
+           num_tokens / lex.median / 1e6, lex.spread_pct, mb / parse.median,
+           num_decls / parse.median / 1e3, parse.spread_pct);
+    fflush(stdout);
+
+    remove(path.c_str());
+  }
+  return 0;
+}
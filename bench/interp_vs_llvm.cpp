@@ -0,0 +1,168 @@
+// Compares the time to get a result from the bytecode interpreter with the
+// time the LLVM backend needs to compile, load and run the same program. The
+// workload mixes recursive calls, loops and int and float arithmetic, and is
+// scaled up row by row: the interpreter wins while start-up dominates, LLVM
+// once the program runs for long enough to repay the compile.
+//
+// Usage: interp_vs_llvm [repetitions]
+
+#include "../src/compiler.h"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace charlie;
+
+using Clock = std::chrono::steady_clock;
+
+struct Workload {
+  int fib;   // argument of the recursive fib()
+  int loop;  // trip count of the arithmetic loop in mix()
+};
+
+static std::string WriteProgram(const Workload &w) {
+  char path[] = "/tmp/charlie-bench-XXXXXX.ch";
+  int fd = mkstemps(path, 3);
+  if (fd < 0) {
+    perror("mkstemps");
+    exit(1);
+  }
+  close(fd);
+
+  std::ofstream out(path);
+  out << "fib :: proc(n: i32) -> i32 {\n"
+         "  while n < 2 {\n"
+         "    return n;\n"
+         "  }\n"
+         "  return fib(n - 1) + fib(n - 2);\n"
+         "}\n"
+         "\n"
+         "mix :: proc(n: i32) -> i32 {\n"
+         "  let h: u32 = 2166136261;\n"
+         "  let x: f64 = 0.0;\n"
+         "  for i: i32 in 0..n {\n"
+         "    h = (h + u32(i)) * 16777619;\n"
+         "    x = x + f64(i % 10) * 0.5;\n"
+         "  }\n"
+         "  return i32(h % 1000) + i32(x) % 1000;\n"
+         "}\n"
+         "\n"
+         "main :: proc() -> int {\n"
+         "  return (fib(" << w.fib << ") + mix(" << w.loop << ")) % 128;\n"
+         "}\n";
+  return path;
+}
+
+// What main() returns, with the wrap-around of generated code
+static int Expected(const Workload &w) {
+  std::vector<int32_t> fib = {0, 1};
+  for (int i = 2; i <= w.fib; ++i)
+    fib.push_back(int32_t(uint32_t(fib[i - 1]) + uint32_t(fib[i - 2])));
+
+  uint32_t h = 2166136261u;
+  double x = 0.0;
+  for (int32_t i = 0; i < w.loop; ++i) {
+    h = (h + uint32_t(i)) * 16777619u;
+    x = x + double(i % 10) * 0.5;
+  }
+  int32_t mix = int32_t(h % 1000) + int32_t(x) % 1000;
+  return int32_t(uint32_t(fib[w.fib]) + uint32_t(mix)) % 128;
+}
+
+static void ExitOnError(llvm::Error err) {
+  if (err) {
+    llvm::logAllUnhandledErrors(std::move(err), llvm::errs(), "[Bench Error] ");
+    exit(1);
+  }
+}
+
+// Links `object` in memory and calls its main()
+static int RunObject(const std::string &object) {
+  auto jit = llvm::orc::LLJITBuilder().create();
+  ExitOnError(jit.takeError());
+  ExitOnError((*jit)->addObjectFile(llvm::MemoryBuffer::getMemBufferCopy(object)));
+  auto main_sym = (*jit)->lookup("main");
+  ExitOnError(main_sym.takeError());
+  auto main_fn = reinterpret_cast<int (*)()>(main_sym->getAddress());
+  return main_fn();
+}
+
+template <typename F>
+static double MedianMillis(unsigned reps, F &&f) {
+  std::vector<double> samples;
+  for (unsigned i = 0; i < reps; ++i) {
+    auto start = Clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    samples.push_back(elapsed.count());
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+static void CheckResult(const char *backend, const Workload &w, int result) {
+  int expected = Expected(w);
+  if (result != expected) {
+    fprintf(stderr, "[Bench Error] %s: fib(%d) + mix(%d) gave %d, expected %d\n",
+            backend, w.fib, w.loop, result, expected);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned reps = argc > 1 ? atoi(argv[1]) : 5;
+
+  printf("%-16s %14s %14s %14s %10s\n",
+         "fib/loop", "interp (ms)", "llvm -O0 (ms)", "llvm -O2 (ms)", "speedup");
+
+  for (Workload w : {Workload{5, 100}, Workload{15, 10000},
+                     Workload{20, 100000}, Workload{25, 1000000}}) {
+    std::string path = WriteProgram(w);
+    std::stringstream sink;
+    CompilerOptions opts;
+
+    double interp = MedianMillis(reps, [&] {
+      int exit_code;
+      if (!InterpretFile(path, opts, sink, sink, exit_code))
+        exit(1);
+      CheckResult("interp", w, exit_code);
+    });
+
+    auto llvm_at = [&](unsigned opt_level) {
+      CompilerOptions llvm_opts = opts;
+      llvm_opts.opt_level = opt_level;
+      llvm_opts.emit = CompilerOptions::EMIT_OBJECT;
+      return MedianMillis(reps, [&] {
+        // A fresh context per run: the cost a one-shot compile pays
+        CompileContext cc;
+        std::string object;
+        if (!CompileFile(path, llvm_opts, cc, nullptr, sink, object))
+          exit(1);
+        CheckResult(opt_level ? "llvm -O2" : "llvm -O0", w, RunObject(object));
+      });
+    };
+    double llvm_o0 = llvm_at(0);
+    double llvm_o2 = llvm_at(2);
+
+    char label[32];
+    snprintf(label, sizeof(label), "%d/%d", w.fib, w.loop);
+    printf("%-16s %14.3f %14.3f %14.3f %9.2fx\n",
+           label, interp, llvm_o0, llvm_o2,
+           std::min(llvm_o0, llvm_o2) / interp);
+    unlink(path.c_str());
+  }
+  return 0;
+}
@@ -1,9 +1,5 @@
 #include "ast.h"
 
-#include <llvm/ADT/APFloat.h>
-#include <llvm/ADT/APInt.h>
-#include <llvm/IR/Verifier.h>
-
 #include <sstream>
 
 namespace charlie {
@@ -11,8 +7,25 @@ namespace charlie {
 AstDisplayVisitor::AstDisplayVisitor(std::ostream &display, uint16_t indent) :
     mDisplay(display), mIndent(indent) {}
 
+static void DisplayAnnotations(std::ostream &display,
+                               uint16_t indent,
+                               const std::vector<Annotation> &annotations) {
+  for (const auto &annotation : annotations) {
+    display << std::string(indent, ' ') << '#' << annotation.name;
+    if (!annotation.args.empty()) {
+      display << '(';
+      for (size_t i = 0; i < annotation.args.size(); ++i) {
+        display << (i ? ", " : "") << annotation.args[i];
+      }
+      display << ')';
+    }
+    display << '\n';
+  }
+}
+
 void AstDisplayVisitor::Visit(Module &mod) {
   for (const auto &decl : mod.TopLevelDecls()) {
+    DisplayAnnotations(mDisplay, mIndent, decl->Annotations());
     switch (decl->mDeclKind) {
     case TopLevelDeclaration::PROC_DEF: {
       auto pdef = static_cast<ProcedureDefinition *>(decl.get());
@@ -24,6 +37,16 @@ void AstDisplayVisitor::Visit(Module &mod) {
       sdef->Accept(*this);
       break;
     }
+    case TopLevelDeclaration::USE_DECL: {
+      auto use = static_cast<UseDeclaration *>(decl.get());
+      use->Accept(*this);
+      break;
+    }
+    case TopLevelDeclaration::CONST_DEF: {
+      auto cdef = static_cast<ConstDefinition *>(decl.get());
+      cdef->Accept(*this);
+      break;
+    }
     default: break;
     };
   }
@@ -31,9 +54,14 @@ void AstDisplayVisitor::Visit(Module &mod) {
 
 void AstDisplayVisitor::Visit(ProcedurePrototype &proto) {
   std::stringstream s;
-  s << std::string(mIndent, ' ') <<  proto.Name() << " :: proc(";
-  // TODO: Handle function arguments
-  // if (!proc_def.mArguments.empty()) {}
+  s << std::string(mIndent, ' ') <<  proto.Name() << " :: proc";
+  for (size_t i = 0; i < proto.TypeParams().size(); ++i) {
+    s << (i ? ", " : "<") << proto.TypeParams()[i];
+  }
+  s << (proto.IsGeneric() ? ">(" : "(");
+  for (size_t i = 0; i < proto.Args().size(); ++i) {
+    s << (i ? ", " : "") << proto.Args()[i].name << ": " << proto.Args()[i].type;
+  }
   if (proto.ReturnType().empty()) {
     s << ") \n";
   } else {
@@ -61,26 +89,33 @@ void AstDisplayVisitor::Visit(StructDefinition &struct_def) {
   mDisplay << s.str();
 }
 
+void AstDisplayVisitor::Visit(UseDeclaration &use_decl) {
+  mDisplay << std::string(mIndent, ' ') << "use " << use_decl.ModuleName()
+           << ";\n";
+}
+
+void AstDisplayVisitor::Visit(ConstDefinition &const_def) {
+  mDisplay << std::string(mIndent, ' ') << const_def.Name() << " :: const "
+           << const_def.Type() << " = comptime\n";
+  const_def.Initializer()->BodyBlock()->Accept(*this);
+}
+
 void AstDisplayVisitor::Visit(Block &block) {
   std::string spaces(mIndent, ' ');
   mDisplay << spaces << "{\n";
   mIndent += kDefaultIndentSpaces;
   for (auto &s : block.Statements()) {
-    switch (s->mStmtKind) {
-    case Statement::RETURN: {
-      auto return_stmt = static_cast<ReturnStatement *>(s.get());
-      return_stmt->Accept(*this);
-      break;
-    }
-    default: break;
-    };
+    VisitStatement(*s);
   }
   mIndent -= kDefaultIndentSpaces;
   mDisplay << spaces << "}\n";
 }
 
 void AstDisplayVisitor::Visit(IntegerLiteral &intlit) {
-  mDisplay << intlit.mInt;
+  if (intlit.mUnsigned)
+    mDisplay << static_cast<uint64_t>(intlit.mInt);
+  else
+    mDisplay << intlit.mInt;
 }
 
 void AstDisplayVisitor::Visit(FloatLiteral &floatlit) {
@@ -91,189 +126,288 @@ void AstDisplayVisitor::Visit(StringLiteral &strlit) {
   mDisplay << '"' << strlit.mString << '"';
 }
 
+void AstDisplayVisitor::Visit(Identifier &ident) {
+  mDisplay << ident.mName;
+}
+
+void AstDisplayVisitor::Visit(IndexExpression &index) {
+  VisitExpression(*index.mBase);
+  mDisplay << '[';
+  VisitExpression(*index.mIndex);
+  mDisplay << ']';
+}
+
+void AstDisplayVisitor::Visit(MemberExpression &member) {
+  VisitExpression(*member.mBase);
+  mDisplay << '.' << member.mMember;
+}
+
+void AstDisplayVisitor::Visit(BinaryExpression &binary) {
+  mDisplay << '(';
+  VisitExpression(*binary.mLhs);
+  mDisplay << ' ' << GetBinaryOpName(binary.mOp) << ' ';
+  VisitExpression(*binary.mRhs);
+  mDisplay << ')';
+}
+
+void AstDisplayVisitor::Visit(CallExpression &call) {
+  if (call.mAwait)
+    mDisplay << "await ";
+  mDisplay << call.mCallee << '(';
+  for (size_t i = 0; i < call.mArgs.size(); ++i) {
+    if (i)
+      mDisplay << ", ";
+    VisitExpression(*call.mArgs[i]);
+  }
+  mDisplay << ')';
+}
+
 void AstDisplayVisitor::Visit(ReturnStatement &retstmt) {
+  DisplayAnnotations(mDisplay, mIndent, retstmt.mAnnotations);
   mDisplay << std::string(mIndent, ' ') << "return ";
-  switch (retstmt.mReturnExpr->mExprKind) {
-  case Expression::INT_LITERAL: {
-    auto intlit = static_cast<IntegerLiteral *>(retstmt.mReturnExpr.get());
-    intlit->Accept(*this);
-    break;
+  VisitExpression(*retstmt.mReturnExpr);
+  mDisplay << ";\n";
+}
+
+void AstDisplayVisitor::Visit(YieldStatement &yield) {
+  mDisplay << std::string(mIndent, ' ') << "yield";
+  if (yield.mValue) {
+    mDisplay << ' ';
+    VisitExpression(*yield.mValue);
   }
-  case Expression::FLOAT_LITERAL: {
-    auto floatlit = static_cast<FloatLiteral *>(retstmt.mReturnExpr.get());
-    floatlit->Accept(*this);
-    break;
+  mDisplay << ";\n";
+}
+
+void AstDisplayVisitor::Visit(LetStatement &let) {
+  mDisplay << std::string(mIndent, ' ') << "let " << let.mName << ": " << let.mType;
+  if (let.mInit) {
+    mDisplay << " = ";
+    VisitExpression(*let.mInit);
   }
-  case Expression::STRING_LITERAL: {
-    auto strlit = static_cast<StringLiteral *>(retstmt.mReturnExpr.get());
-    strlit->Accept(*this);
-    break;
+  mDisplay << ";\n";
+}
+
+void AstDisplayVisitor::Visit(AssignStatement &assign) {
+  mDisplay << std::string(mIndent, ' ');
+  VisitExpression(*assign.mTarget);
+  mDisplay << " = ";
+  VisitExpression(*assign.mValue);
+  mDisplay << ";\n";
+}
+
+void AstDisplayVisitor::Visit(ExpressionStatement &expr_stmt) {
+  mDisplay << std::string(mIndent, ' ');
+  VisitExpression(*expr_stmt.mExpr);
+  mDisplay << ";\n";
+}
+
+void AstDisplayVisitor::Visit(WhileStatement &while_stmt) {
+  DisplayAnnotations(mDisplay, mIndent, while_stmt.mAnnotations);
+  mDisplay << std::string(mIndent, ' ') << "while ";
+  VisitExpression(*while_stmt.mCond);
+  mDisplay << '\n';
+  while_stmt.mBody->Accept(*this);
+}
+
+void AstDisplayVisitor::Visit(ForStatement &for_stmt) {
+  DisplayAnnotations(mDisplay, mIndent, for_stmt.mAnnotations);
+  mDisplay << std::string(mIndent, ' ') << (for_stmt.mParallel ? "parallel for " : "for ")
+           << for_stmt.mVar;
+  if (!for_stmt.mType.empty())
+    mDisplay << ": " << for_stmt.mType;
+  mDisplay << " in ";
+  VisitExpression(*for_stmt.mBegin);
+  mDisplay << "..";
+  VisitExpression(*for_stmt.mEnd);
+  for (size_t i = 0; i < for_stmt.mReductions.size(); ++i) {
+    const Reduction &r = for_stmt.mReductions[i];
+    mDisplay << (i ? ", " : " reduce(") << GetReductionOpName(r.op) << ": " << r.var;
   }
+  if (!for_stmt.mReductions.empty())
+    mDisplay << ')';
+  mDisplay << '\n';
+  for_stmt.mBody->Accept(*this);
+}
+
+void AstVisitor::VisitDeclaration(TopLevelDeclaration &decl) {
+  switch (decl.mDeclKind) {
+  case TopLevelDeclaration::PROC_DEF:
+    static_cast<ProcedureDefinition &>(decl).Accept(*this);
+    break;
+  case TopLevelDeclaration::STRUCT_DEF:
+    static_cast<StructDefinition &>(decl).Accept(*this);
+    break;
+  case TopLevelDeclaration::USE_DECL:
+    static_cast<UseDeclaration &>(decl).Accept(*this);
+    break;
+  case TopLevelDeclaration::CONST_DEF:
+    static_cast<ConstDefinition &>(decl).Accept(*this);
+    break;
   default: break;
   };
-  mDisplay << ";\n";
 }
 
-CodegenVisitor::CodegenVisitor() : mLLVMIrBuilder(mLLVMContext) {}
+void AstVisitor::VisitStatement(Statement &stmt) {
+  switch (stmt.mStmtKind) {
+  case Statement::RETURN:
+    static_cast<ReturnStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::LET:
+    static_cast<LetStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::ASSIGN:
+    static_cast<AssignStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::EXPR:
+    static_cast<ExpressionStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::WHILE:
+    static_cast<WhileStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::FOR:
+    static_cast<ForStatement &>(stmt).Accept(*this);
+    break;
+  case Statement::YIELD:
+    static_cast<YieldStatement &>(stmt).Accept(*this);
+    break;
+  default: break;
+  };
+}
 
-void CodegenVisitor::Visit(Module &mod) {
-  mLLVMModule = std::make_unique<llvm::Module>(mod.Name(), mLLVMContext);
+void AstVisitor::VisitExpression(Expression &expr) {
+  switch (expr.mExprKind) {
+  case Expression::INT_LITERAL:
+    static_cast<IntegerLiteral &>(expr).Accept(*this);
+    break;
+  case Expression::FLOAT_LITERAL:
+    static_cast<FloatLiteral &>(expr).Accept(*this);
+    break;
+  case Expression::STRING_LITERAL:
+    static_cast<StringLiteral &>(expr).Accept(*this);
+    break;
+  case Expression::IDENTIFIER:
+    static_cast<Identifier &>(expr).Accept(*this);
+    break;
+  case Expression::INDEX:
+    static_cast<IndexExpression &>(expr).Accept(*this);
+    break;
+  case Expression::MEMBER:
+    static_cast<MemberExpression &>(expr).Accept(*this);
+    break;
+  case Expression::BINARY:
+    static_cast<BinaryExpression &>(expr).Accept(*this);
+    break;
+  case Expression::CALL:
+    static_cast<CallExpression &>(expr).Accept(*this);
+    break;
+  default: break;
+  };
+}
+
+void RecursiveAstVisitor::Visit(Module &mod) {
   for (const auto &decl : mod.TopLevelDecls()) {
-    switch (decl->mDeclKind) {
-    case TopLevelDeclaration::PROC_DEF: {
-      auto pdef = static_cast<ProcedureDefinition *>(decl.get());
-      pdef->Accept(*this);
-      break;
-    }
-    case TopLevelDeclaration::STRUCT_DEF: {
-      auto sdef = static_cast<StructDefinition *>(decl.get());
-      sdef->Accept(*this);
-      break;
-    }
-    default: break;
-    };
+    VisitDeclaration(*decl);
   }
-  mLLVMModule->print(llvm::errs(), nullptr);
-}
-
-void CodegenVisitor::Visit(ProcedurePrototype &proto) {
-  llvm::Function *f = mLLVMModule->getFunction(proto.Name());
-  if (!f) {
-    // TODO(oakkila): Assuming all return types are int32
-    llvm::Type *return_type = llvm::Type::getInt32Ty(mLLVMContext);
-    // TODO(oakkila): Assuming we dont have arguments
-    llvm::FunctionType *ft =
-      llvm::FunctionType::get(return_type, std::vector<llvm::Type *>(), false);
-    f = llvm::Function::Create(
-      ft, llvm::Function::ExternalLinkage, proto.Name(), mLLVMModule.get());
-
-    unsigned i = 0;
-    for (auto &arg : f->args()) {
-      arg.setName(proto.Args().at(i));
-      i++;
-    }
+}
+
+void RecursiveAstVisitor::Visit(Block &block) {
+  for (const auto &stmt : block.Statements()) {
+    VisitStatement(*stmt);
   }
-  mLLVMFunction = f;
 }
 
-void CodegenVisitor::Visit(ProcedureDefinition &proc_def) {
+void RecursiveAstVisitor::Visit(ProcedurePrototype &) {}
+
+void RecursiveAstVisitor::Visit(ProcedureDefinition &proc_def) {
   proc_def.Prototype()->Accept(*this);
+  if (proc_def.BodyBlock())
+    proc_def.BodyBlock()->Accept(*this);
+}
 
-  llvm::Function *f = mLLVMFunction;
-  if (!f) {
-    mLLVMFunction = nullptr;
-    return;
-  }
+void RecursiveAstVisitor::Visit(StructDefinition &) {}
 
-  llvm::BasicBlock *bb = llvm::BasicBlock::Create(mLLVMContext, "entry", f);
-  mLLVMIrBuilder.SetInsertPoint(bb);
+void RecursiveAstVisitor::Visit(UseDeclaration &) {}
 
-  Block *body = proc_def.BodyBlock().get();
-  if (body) {
-    body->Accept(*this);
+void RecursiveAstVisitor::Visit(ConstDefinition &const_def) {
+  const_def.Initializer()->Accept(*this);
+}
 
-    llvm::Value *return_value = mLLVMValue;
-    mLLVMIrBuilder.CreateRet(return_value);
+void RecursiveAstVisitor::Visit(IntegerLiteral &) {}
 
-    llvm::verifyFunction(*f);
+void RecursiveAstVisitor::Visit(FloatLiteral &) {}
 
-    mLLVMFunction = f;
-    return;
-  }
+void RecursiveAstVisitor::Visit(StringLiteral &) {}
 
-  f->eraseFromParent();
-  mLLVMFunction = nullptr;
-}
+void RecursiveAstVisitor::Visit(Identifier &) {}
 
-void CodegenVisitor::Visit(StructDefinition &struct_def) {
-  // TODO: struct codegen
-  (void) struct_def;
+void RecursiveAstVisitor::Visit(IndexExpression &index) {
+  VisitExpression(*index.mBase);
+  VisitExpression(*index.mIndex);
 }
 
-void CodegenVisitor::Visit(Block &block) {
-  for (auto &s : block.Statements()) {
-    switch (s->mStmtKind) {
-    case Statement::RETURN: {
-      auto return_stmt = static_cast<ReturnStatement *>(s.get());
-      return_stmt->Accept(*this);
-      break;
-    }
-    default: break;
-    };
-  }
+void RecursiveAstVisitor::Visit(MemberExpression &member) {
+  VisitExpression(*member.mBase);
 }
 
-void CodegenVisitor::Visit(IntegerLiteral &intlit) {
-  mLLVMValue = llvm::ConstantInt::get(
-    mLLVMContext, llvm::APInt(/*numBits=*/32, intlit.mInt, /*isSigned=*/true));
+void RecursiveAstVisitor::Visit(BinaryExpression &binary) {
+  VisitExpression(*binary.mLhs);
+  VisitExpression(*binary.mRhs);
 }
 
-void CodegenVisitor::Visit(FloatLiteral &floatlit) {
-  mLLVMValue =
-    llvm::ConstantFP::get(mLLVMContext, llvm::APFloat(floatlit.mFloat));
+void RecursiveAstVisitor::Visit(CallExpression &call) {
+  for (auto &arg : call.mArgs) {
+    VisitExpression(*arg);
+  }
 }
 
-void CodegenVisitor::Visit(StringLiteral &strlit) {
-  llvm::Type *i8_array_type =
-    llvm::ArrayType::get(llvm::IntegerType::get(mLLVMContext, /*numbits=*/8),
-                         strlit.mString.length());
-  if (!i8_array_type) {
-    mLLVMValue = nullptr;
-    return;
-  }
+void RecursiveAstVisitor::Visit(ReturnStatement &retstmt) {
+  if (retstmt.mReturnExpr)
+    VisitExpression(*retstmt.mReturnExpr);
+}
 
-  llvm::Module *mod = mLLVMModule.get();
-  assert(mod);
-
-  // FIXME: global_str will leak
-  llvm::GlobalVariable *global_str = new llvm::GlobalVariable(
-    /*Module=*/*mod,
-    /*Type=*/i8_array_type,
-    /*isConstant=*/true,
-    /*Linkage=*/llvm::GlobalVariable::PrivateLinkage,
-    /*Initializer=*/nullptr,
-    /*Name=*/".str");
-  if (!global_str) {
-    mLLVMValue = nullptr;
-    return;
-  }
+void RecursiveAstVisitor::Visit(YieldStatement &yield) {
+  if (yield.mValue)
+    VisitExpression(*yield.mValue);
+}
 
-  global_str->setAlignment(1);
+void RecursiveAstVisitor::Visit(LetStatement &let) {
+  if (let.mInit)
+    VisitExpression(*let.mInit);
+}
 
-  llvm::Constant *const_array = llvm::ConstantDataArray::getString(
-    mLLVMContext, strlit.mString.c_str(), /*AddNull=*/false);
+void RecursiveAstVisitor::Visit(AssignStatement &assign) {
+  VisitExpression(*assign.mTarget);
+  VisitExpression(*assign.mValue);
+}
 
-  global_str->setInitializer(const_array);
+void RecursiveAstVisitor::Visit(ExpressionStatement &expr_stmt) {
+  VisitExpression(*expr_stmt.mExpr);
+}
 
-  llvm::Constant *const_int64_0 = llvm::ConstantInt::get(
-    mLLVMContext, llvm::APInt(/*numbits=*/64, 0, /*issigned=*/true));
+void RecursiveAstVisitor::Visit(WhileStatement &while_stmt) {
+  VisitExpression(*while_stmt.mCond);
+  while_stmt.mBody->Accept(*this);
+}
 
-  std::vector<llvm::Constant *> const_ptr_indices(2, const_int64_0);
-  llvm::Constant *const_ptr = llvm::ConstantExpr::getGetElementPtr(
-    i8_array_type, global_str, const_ptr_indices, /*inBounds=*/true);
+void RecursiveAstVisitor::Visit(ForStatement &for_stmt) {
+  VisitExpression(*for_stmt.mBegin);
+  VisitExpression(*for_stmt.mEnd);
+  for_stmt.mBody->Accept(*this);
+}
 
-  mLLVMValue = const_ptr;
+bool SplitArrayType(const std::string &type, std::string &element, uint64_t &count) {
+  if (type.empty() || type.back() != ']')
+    return false;
+  size_t open = type.find_last_of('[');
+  if (open == std::string::npos || open == 0)
+    return false;
+  count = std::stoull(type.substr(open + 1, type.size() - open - 2));
+  element = type.substr(0, open);
+  return true;
 }
 
-void CodegenVisitor::Visit(ReturnStatement &retstmt) {
-  switch (retstmt.mReturnExpr->mExprKind) {
-  case Expression::INT_LITERAL: {
-    auto intlit = static_cast<IntegerLiteral *>(retstmt.mReturnExpr.get());
-    intlit->Accept(*this);
-    break;
-  }
-  case Expression::FLOAT_LITERAL: {
-    auto floatlit = static_cast<FloatLiteral *>(retstmt.mReturnExpr.get());
-    floatlit->Accept(*this);
-    break;
-  }
-  case Expression::STRING_LITERAL: {
-    auto strlit = static_cast<StringLiteral *>(retstmt.mReturnExpr.get());
-    strlit->Accept(*this);
-    break;
-  }
-  default: break;
-  };
+std::string BaseTypeName(const std::string &type) {
+  return type.substr(0, type.find('['));
 }
 
 Module::Module(
@@ -282,15 +416,36 @@ Module::Module(
     mName(std::move(name)),
     mTopLevelDecls(std::move(top_level_decls)) {}
 
+std::vector<std::unique_ptr<TopLevelDeclaration>> Module::RemoveTopLevelDecls(
+  const std::function<bool(const TopLevelDeclaration &)> &pred) {
+  std::vector<std::unique_ptr<TopLevelDeclaration>> removed;
+  std::vector<std::unique_ptr<TopLevelDeclaration>> kept;
+  for (auto &decl : mTopLevelDecls) {
+    if (pred(*decl)) {
+      removed.push_back(std::move(decl));
+    } else {
+      kept.push_back(std::move(decl));
+    }
+  }
+  mTopLevelDecls = std::move(kept);
+  return removed;
+}
+
+void Module::AddTopLevelDecl(std::unique_ptr<TopLevelDeclaration> decl) {
+  mTopLevelDecls.push_back(std::move(decl));
+}
+
 void Module::Accept(AstVisitor &v) {
   v.Visit(*this);
 }
 
 ProcedurePrototype::ProcedurePrototype(std::string name,
                                        std::string return_type,
-                                       std::vector<std::string> args) :
+                                       std::vector<Parameter> args,
+                                       std::vector<std::string> type_params) :
     mName(std::move(name)),
-    mReturnType(std::move(return_type)), mArguments(std::move(args)) {}
+    mReturnType(std::move(return_type)), mArguments(std::move(args)),
+    mTypeParams(std::move(type_params)) {}
 
 void ProcedurePrototype::Accept(AstVisitor &v) {
   v.Visit(*this);
@@ -298,6 +453,19 @@ void ProcedurePrototype::Accept(AstVisitor &v) {
 
 TopLevelDeclaration::TopLevelDeclaration(DeclKind kind) : mDeclKind(kind) {}
 
+const Annotation *FindAnnotation(const std::vector<Annotation> &annotations,
+                                 const std::string &name) {
+  for (const auto &annotation : annotations) {
+    if (annotation.name == name)
+      return &annotation;
+  }
+  return nullptr;
+}
+
+const Annotation *TopLevelDeclaration::FindAnnotation(const std::string &name) const {
+  return charlie::FindAnnotation(mAnnotations, name);
+}
+
 ProcedureDefinition::ProcedureDefinition(std::unique_ptr<ProcedurePrototype> proto,
                                        std::unique_ptr<Block> block,
                                        DeclKind kind) :
@@ -318,6 +486,25 @@ void StructDefinition::Accept(AstVisitor &v) {
   v.Visit(*this);
 }
 
+UseDeclaration::UseDeclaration(std::string module_name, DeclKind kind) :
+    TopLevelDeclaration(kind), mModuleName(std::move(module_name)) {}
+
+void UseDeclaration::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+ConstDefinition::ConstDefinition(std::string name,
+                                 std::string type,
+                                 std::unique_ptr<ProcedureDefinition> initializer,
+                                 DeclKind kind) :
+    TopLevelDeclaration(kind),
+    mName(std::move(name)), mType(std::move(type)),
+    mInitializer(std::move(initializer)) {}
+
+void ConstDefinition::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
 Block::Block(std::vector<std::unique_ptr<Statement>> stmts) :
     mStatements(std::move(stmts)) {}
 
@@ -327,14 +514,14 @@ void Block::Accept(AstVisitor &v) {
 
 Expression::Expression(ExprKind kind) : mExprKind(kind) {}
 
-IntegerLiteral::IntegerLiteral(int value, ExprKind kind) :
+IntegerLiteral::IntegerLiteral(int64_t value, ExprKind kind) :
     Expression(kind), mInt(value) {}
 
 void IntegerLiteral::Accept(AstVisitor &v) {
   v.Visit(*this);
 }
 
-FloatLiteral::FloatLiteral(float value, ExprKind kind) :
+FloatLiteral::FloatLiteral(double value, ExprKind kind) :
     Expression(kind), mFloat(value) {}
 
 void FloatLiteral::Accept(AstVisitor &v) {
@@ -348,6 +535,91 @@ void StringLiteral::Accept(AstVisitor &v) {
   v.Visit(*this);
 }
 
+Identifier::Identifier(std::string name, ExprKind kind) :
+    Expression(kind), mName(std::move(name)) {}
+
+void Identifier::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+IndexExpression::IndexExpression(std::unique_ptr<Expression> base,
+                                 std::unique_ptr<Expression> index,
+                                 ExprKind kind) :
+    Expression(kind), mBase(std::move(base)), mIndex(std::move(index)) {}
+
+void IndexExpression::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+MemberExpression::MemberExpression(std::unique_ptr<Expression> base,
+                                   std::string member,
+                                   ExprKind kind) :
+    Expression(kind), mBase(std::move(base)), mMember(std::move(member)) {}
+
+void MemberExpression::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+BinaryExpression::BinaryExpression(Op op,
+                                   std::unique_ptr<Expression> lhs,
+                                   std::unique_ptr<Expression> rhs,
+                                   ExprKind kind) :
+    Expression(kind), mOp(op), mLhs(std::move(lhs)), mRhs(std::move(rhs)) {}
+
+void BinaryExpression::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+const char *GetBinaryOpName(BinaryExpression::Op op) {
+  const char *name = "";
+  switch (op) {
+  case BinaryExpression::ADD: name = "+"; break;
+  case BinaryExpression::SUB: name = "-"; break;
+  case BinaryExpression::MUL: name = "*"; break;
+  case BinaryExpression::DIV: name = "/"; break;
+  case BinaryExpression::MOD: name = "%"; break;
+  case BinaryExpression::LT: name = "<"; break;
+  case BinaryExpression::LE: name = "<="; break;
+  case BinaryExpression::GT: name = ">"; break;
+  case BinaryExpression::GE: name = ">="; break;
+  case BinaryExpression::EQ: name = "=="; break;
+  case BinaryExpression::NE: name = "!="; break;
+  default: break;
+  }
+  return name;
+}
+
+bool IsUntypedConstant(const Expression &expr) {
+  switch (expr.mExprKind) {
+  case Expression::INT_LITERAL:
+  case Expression::FLOAT_LITERAL: return true;
+  case Expression::BINARY: {
+    auto &binary = static_cast<const BinaryExpression &>(expr);
+    return !IsComparison(binary.mOp) && IsUntypedConstant(*binary.mLhs) &&
+           IsUntypedConstant(*binary.mRhs);
+  }
+  default: return false;
+  };
+}
+
+const char *DefaultConstantType(const Expression &expr) {
+  switch (expr.mExprKind) {
+  case Expression::INT_LITERAL: return "int";
+  case Expression::BINARY:
+    return DefaultConstantType(*static_cast<const BinaryExpression &>(expr).mLhs);
+  default: return "float";
+  };
+}
+
+CallExpression::CallExpression(std::string callee,
+                               std::vector<std::unique_ptr<Expression>> args,
+                               ExprKind kind) :
+    Expression(kind), mCallee(std::move(callee)), mArgs(std::move(args)) {}
+
+void CallExpression::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
 Statement::Statement(StmtKind kind) : mStmtKind(kind) {}
 
 ReturnStatement::ReturnStatement(std::unique_ptr<Expression> expr,
@@ -359,4 +631,77 @@ void ReturnStatement::Accept(AstVisitor &v) {
   v.Visit(*this);
 }
 
+YieldStatement::YieldStatement(std::unique_ptr<Expression> value, StmtKind kind) :
+    Statement(kind), mValue(std::move(value)) {}
+
+void YieldStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+ExpressionStatement::ExpressionStatement(std::unique_ptr<Expression> expr,
+                                         StmtKind kind) :
+    Statement(kind), mExpr(std::move(expr)) {}
+
+void ExpressionStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+LetStatement::LetStatement(std::string name,
+                           std::string type,
+                           std::unique_ptr<Expression> init,
+                           StmtKind kind) :
+    Statement(kind),
+    mName(std::move(name)), mType(std::move(type)), mInit(std::move(init)) {}
+
+void LetStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+AssignStatement::AssignStatement(std::unique_ptr<Expression> target,
+                                 std::unique_ptr<Expression> value,
+                                 StmtKind kind) :
+    Statement(kind),
+    mTarget(std::move(target)), mValue(std::move(value)) {}
+
+void AssignStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+LoopStatement::LoopStatement(std::unique_ptr<Block> body, StmtKind kind) :
+    Statement(kind), mBody(std::move(body)) {}
+
+WhileStatement::WhileStatement(std::unique_ptr<Expression> cond,
+                               std::unique_ptr<Block> body,
+                               StmtKind kind) :
+    LoopStatement(std::move(body), kind), mCond(std::move(cond)) {}
+
+void WhileStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
+const char *GetReductionOpName(Reduction::Op op) {
+  const char *name = "";
+  switch (op) {
+  case Reduction::ADD: name = "+"; break;
+  case Reduction::MUL: name = "*"; break;
+  case Reduction::MIN: name = "min"; break;
+  case Reduction::MAX: name = "max"; break;
+  };
+  return name;
+}
+
+ForStatement::ForStatement(std::string var,
+                           std::string type,
+                           std::unique_ptr<Expression> begin,
+                           std::unique_ptr<Expression> end,
+                           std::unique_ptr<Block> body,
+                           StmtKind kind) :
+    LoopStatement(std::move(body), kind),
+    mVar(std::move(var)), mType(std::move(type)), mBegin(std::move(begin)),
+    mEnd(std::move(end)) {}
+
+void ForStatement::Accept(AstVisitor &v) {
+  v.Visit(*this);
+}
+
 }  // namespace charlie
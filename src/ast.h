@@ -1,12 +1,10 @@
 #pragma once
 
-#include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/Module.h>
-
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace charlie {
@@ -19,12 +17,25 @@ class Block;
 class ProcedurePrototype;
 class ProcedureDefinition;
 class StructDefinition;
+class UseDeclaration;
+class ConstDefinition;
 class Expression;
 class IntegerLiteral;
 class FloatLiteral;
 class StringLiteral;
+class Identifier;
+class IndexExpression;
+class MemberExpression;
+class BinaryExpression;
+class CallExpression;
 class Statement;
 class ReturnStatement;
+class YieldStatement;
+class LetStatement;
+class AssignStatement;
+class ExpressionStatement;
+class WhileStatement;
+class ForStatement;
 
 //===----------------------------------------------------------------------===//
 // Visitors
@@ -37,12 +48,31 @@ public:
   virtual void Visit(ProcedurePrototype &proto) = 0;
   virtual void Visit(ProcedureDefinition &proc_def) = 0;
   virtual void Visit(StructDefinition &struct_def) = 0;
+  virtual void Visit(UseDeclaration &use_decl) = 0;
+  virtual void Visit(ConstDefinition &const_def) = 0;
   virtual void Visit(IntegerLiteral &intlit) = 0;
   virtual void Visit(FloatLiteral &floatlit) = 0;
   virtual void Visit(StringLiteral &strlit) = 0;
+  virtual void Visit(Identifier &ident) = 0;
+  virtual void Visit(IndexExpression &index) = 0;
+  virtual void Visit(MemberExpression &member) = 0;
+  virtual void Visit(BinaryExpression &binary) = 0;
+  virtual void Visit(CallExpression &call) = 0;
   virtual void Visit(ReturnStatement &retstmt) = 0;
+  virtual void Visit(YieldStatement &yield) = 0;
+  virtual void Visit(LetStatement &let) = 0;
+  virtual void Visit(AssignStatement &assign) = 0;
+  virtual void Visit(ExpressionStatement &expr_stmt) = 0;
+  virtual void Visit(WhileStatement &while_stmt) = 0;
+  virtual void Visit(ForStatement &for_stmt) = 0;
 
   virtual ~AstVisitor() = default;
+
+protected:
+  // Dispatch to the Visit() overload for the node's concrete kind
+  void VisitDeclaration(TopLevelDeclaration &decl);
+  void VisitStatement(Statement &stmt);
+  void VisitExpression(Expression &expr);
 };
 
 class AstDisplayVisitor : public AstVisitor {
@@ -58,32 +88,52 @@ public:
   void Visit(ProcedurePrototype &proto) override;
   void Visit(ProcedureDefinition &func_def) override;
   void Visit(StructDefinition &struct_def) override;
+  void Visit(UseDeclaration &use_decl) override;
+  void Visit(ConstDefinition &const_def) override;
   void Visit(IntegerLiteral &intlit) override;
   void Visit(FloatLiteral &floatlit) override;
   void Visit(StringLiteral &strlit) override;
+  void Visit(Identifier &ident) override;
+  void Visit(IndexExpression &index) override;
+  void Visit(MemberExpression &member) override;
+  void Visit(BinaryExpression &binary) override;
+  void Visit(CallExpression &call) override;
   void Visit(ReturnStatement &retstmt) override;
+  void Visit(YieldStatement &yield) override;
+  void Visit(LetStatement &let) override;
+  void Visit(AssignStatement &assign) override;
+  void Visit(ExpressionStatement &expr_stmt) override;
+  void Visit(WhileStatement &while_stmt) override;
+  void Visit(ForStatement &for_stmt) override;
 };
 
-class CodegenVisitor : public AstVisitor {
-  // LLVM objects
-  llvm::LLVMContext mLLVMContext;
-  llvm::IRBuilder<> mLLVMIrBuilder;
-  std::unique_ptr<llvm::Module> mLLVMModule;
-  llvm::Value *mLLVMValue;        // Set after any AST node codegen
-  llvm::Function *mLLVMFunction;  // Set after ProcedureDefinition codegen
-
+// Visits every node below the one it is given. Analyses derive from this and
+// override only the nodes they care about, calling the base implementation
+// to keep descending.
+class RecursiveAstVisitor : public AstVisitor {
 public:
-  CodegenVisitor();
-
   void Visit(Module &mod) override;
   void Visit(Block &block) override;
   void Visit(ProcedurePrototype &proto) override;
-  void Visit(ProcedureDefinition &func_def) override;
+  void Visit(ProcedureDefinition &proc_def) override;
   void Visit(StructDefinition &struct_def) override;
+  void Visit(UseDeclaration &use_decl) override;
+  void Visit(ConstDefinition &const_def) override;
   void Visit(IntegerLiteral &intlit) override;
   void Visit(FloatLiteral &floatlit) override;
-  void Visit(StringLiteral &StringLiteral) override;
+  void Visit(StringLiteral &strlit) override;
+  void Visit(Identifier &ident) override;
+  void Visit(IndexExpression &index) override;
+  void Visit(MemberExpression &member) override;
+  void Visit(BinaryExpression &binary) override;
+  void Visit(CallExpression &call) override;
   void Visit(ReturnStatement &retstmt) override;
+  void Visit(YieldStatement &yield) override;
+  void Visit(LetStatement &let) override;
+  void Visit(AssignStatement &assign) override;
+  void Visit(ExpressionStatement &expr_stmt) override;
+  void Visit(WhileStatement &while_stmt) override;
+  void Visit(ForStatement &for_stmt) override;
 };
 
 //===----------------------------------------------------------------------===//
@@ -109,18 +159,34 @@ public:
     return mTopLevelDecls;
   }
 
+  // Removes and returns the declarations for which `pred` returns true
+  std::vector<std::unique_ptr<TopLevelDeclaration>>
+  RemoveTopLevelDecls(const std::function<bool(const TopLevelDeclaration &)> &pred);
+
+  // Appends `decl`, e.g. an instance of a generic procedure
+  void AddTopLevelDecl(std::unique_ptr<TopLevelDeclaration> decl);
+
   virtual void Accept(AstVisitor &v) override;
 
 private:
   const std::string mName;
-  const std::vector<std::unique_ptr<TopLevelDeclaration>> mTopLevelDecls;
+  std::vector<std::unique_ptr<TopLevelDeclaration>> mTopLevelDecls;
 };
 
+// `name :: proc(args...) -> type`. A generic procedure, `name :: proc<T, ...>`,
+// may use its type parameters wherever it names a type; calls to it are
+// compiled against an instance for the types they pass, see CheckModule().
 class ProcedurePrototype : public Ast {
 public:
+  struct Parameter {
+    std::string name;
+    std::string type;
+  };
+
   ProcedurePrototype(std::string name,
                     std::string return_type,
-                    std::vector<std::string> args);
+                    std::vector<Parameter> args,
+                    std::vector<std::string> type_params = {});
 
   const std::string &Name() const {
     return mName;
@@ -128,33 +194,72 @@ public:
   const std::string &ReturnType() const {
     return mReturnType;
   }
-  const std::vector<std::string> &Args() const {
+  const std::vector<Parameter> &Args() const {
     return mArguments;
   }
+  const std::vector<std::string> &TypeParams() const {
+    return mTypeParams;
+  }
+  bool IsGeneric() const {
+    return !mTypeParams.empty();
+  }
 
   virtual void Accept(AstVisitor &v) override;
 
 private:
   const std::string mName;
   const std::string mReturnType;
-  const std::vector<std::string> mArguments;
+  const std::vector<Parameter> mArguments;
+  const std::vector<std::string> mTypeParams;
 };
 
 //===----------------------------------------------------------------------===//
 // Declarations
 //===----------------------------------------------------------------------===//
 
+// Array types are spelled `T[N]`, and `T[N][M]` is M arrays of T[N]. Splits
+// off the outermost dimension; returns false if `type` is not an array type.
+bool SplitArrayType(const std::string &type, std::string &element, uint64_t &count);
+
+// The named type at the bottom of `type`, e.g. "Point" for "Point[4][2]"
+std::string BaseTypeName(const std::string &type);
+
+// `#name` or `#name(arg, ...)` written before a declaration or loop
+struct Annotation {
+  std::string name;
+  std::vector<int> args;
+};
+
+// Returns the first annotation called `name`, or nullptr
+const Annotation *FindAnnotation(const std::vector<Annotation> &annotations,
+                                 const std::string &name);
+
 class TopLevelDeclaration {
 public:
   enum DeclKind {
     PROC_DEF,
     STRUCT_DEF,
+    USE_DECL,
+    CONST_DEF,
   } mDeclKind;
 
   virtual ~TopLevelDeclaration() = default;
 
+  const std::vector<Annotation> &Annotations() const {
+    return mAnnotations;
+  }
+  void SetAnnotations(std::vector<Annotation> annotations) {
+    mAnnotations = std::move(annotations);
+  }
+
+  // Returns the first annotation called `name`, or nullptr
+  const Annotation *FindAnnotation(const std::string &name) const;
+
 protected:
   TopLevelDeclaration(DeclKind kind);
+
+private:
+  std::vector<Annotation> mAnnotations;
 };
 
 class ProcedureDefinition : public TopLevelDeclaration, public Ast {
@@ -166,15 +271,31 @@ public:
   std::unique_ptr<ProcedurePrototype> &Prototype() {
     return mProto;
   }
+  const std::unique_ptr<ProcedurePrototype> &Prototype() const {
+    return mProto;
+  }
   std::unique_ptr<Block> &BodyBlock() {
     return mBlock;
   }
+  const std::unique_ptr<Block> &BodyBlock() const {
+    return mBlock;
+  }
+
+  // The types an instance of a generic procedure was made for, one per type
+  // parameter. Empty for procedures written out in the source.
+  const std::vector<std::string> &TypeArgs() const {
+    return mTypeArgs;
+  }
+  void SetTypeArgs(std::vector<std::string> type_args) {
+    mTypeArgs = std::move(type_args);
+  }
 
   virtual void Accept(AstVisitor &v) override;
 
 private:
   std::unique_ptr<ProcedurePrototype> mProto;
   std::unique_ptr<Block> mBlock;
+  std::vector<std::string> mTypeArgs;
 };
 
 class StructDefinition : public TopLevelDeclaration, public Ast {
@@ -206,6 +327,94 @@ private:
   std::vector<StructMember> mMembers;
 };
 
+// The declarations a module makes visible to modules that `use` it
+struct ModuleInterface {
+  std::string name;
+  uint64_t source_hash = 0;  // Of the source it was extracted from
+  // Size and modification time of that source when it was last found to
+  // match source_hash. A source that differs in neither is not hashed again.
+  uint64_t source_size = 0;
+  uint64_t source_mtime = 0;
+  std::vector<std::unique_ptr<ProcedurePrototype>> procedures;
+  std::vector<std::unique_ptr<StructDefinition>> structs;
+};
+
+// A value computed by the compiler, see EvaluateConstants(). Int scalars are
+// in `i`, sign- or zero-extended from their width, bools as 0 or 1, and
+// float scalars in `f`, rounded to their precision. Vectors, arrays and
+// structs hold their lanes, elements or members, in declaration order.
+struct ConstValue {
+  ConstValue() = default;
+  explicit ConstValue(std::string type) : type(std::move(type)) {}
+
+  std::string type;  // Canonical
+  int64_t i = 0;
+  double f = 0;
+  std::vector<ConstValue> elements;
+};
+
+// `name :: const type = value;` or `name :: const type = comptime { ... }`.
+// The compiler runs the initializer and the constant becomes read-only
+// data. An initializing expression is kept as a block that returns it, so
+// either way the initializer is a procedure named after the constant that
+// takes no arguments and returns `type`.
+class ConstDefinition : public TopLevelDeclaration, public Ast {
+public:
+  ConstDefinition(std::string name,
+                  std::string type,
+                  std::unique_ptr<ProcedureDefinition> initializer,
+                  DeclKind kind = CONST_DEF);
+
+  const std::string &Name() const {
+    return mName;
+  }
+  const std::string &Type() const {
+    return mType;
+  }
+  const std::unique_ptr<ProcedureDefinition> &Initializer() const {
+    return mInitializer;
+  }
+
+  // Null until EvaluateConstants() has run the initializer
+  const ConstValue *Value() const {
+    return mValue.get();
+  }
+  void SetValue(std::unique_ptr<ConstValue> value) {
+    mValue = std::move(value);
+  }
+
+  virtual void Accept(AstVisitor &v) override;
+
+private:
+  std::string mName;
+  std::string mType;
+  std::unique_ptr<ProcedureDefinition> mInitializer;
+  std::unique_ptr<ConstValue> mValue;
+};
+
+class UseDeclaration : public TopLevelDeclaration, public Ast {
+public:
+  UseDeclaration(std::string module_name, DeclKind kind = USE_DECL);
+
+  const std::string &ModuleName() const {
+    return mModuleName;
+  }
+
+  // Set by ImportResolver once the imported module has been located
+  const ModuleInterface *Interface() const {
+    return mInterface.get();
+  }
+  void SetInterface(std::unique_ptr<ModuleInterface> interface) {
+    mInterface = std::move(interface);
+  }
+
+  virtual void Accept(AstVisitor &v) override;
+
+private:
+  std::string mModuleName;
+  std::unique_ptr<ModuleInterface> mInterface;
+};
+
 class Block : public Ast {
 public:
   Block(std::vector<std::unique_ptr<Statement>> stmts);
@@ -230,6 +439,11 @@ public:
     INT_LITERAL,
     FLOAT_LITERAL,
     STRING_LITERAL,
+    IDENTIFIER,
+    INDEX,
+    MEMBER,
+    BINARY,
+    CALL,
   } mExprKind;
 
   virtual ~Expression() = default;
@@ -240,18 +454,21 @@ protected:
 
 class IntegerLiteral : public Expression, public Ast {
 public:
-  int mInt;
+  int64_t mInt;
+  // Set when the literal is above INT64_MAX. mInt then holds the bits of its
+  // uint64_t value, and only a u64 can hold it.
+  bool mUnsigned = false;
 
-  IntegerLiteral(int value, ExprKind kind = INT_LITERAL);
+  IntegerLiteral(int64_t value, ExprKind kind = INT_LITERAL);
 
   virtual void Accept(AstVisitor &v) override;
 };
 
 class FloatLiteral : public Expression, public Ast {
 public:
-  float mFloat;
+  double mFloat;
 
-  FloatLiteral(float value, ExprKind kind = FLOAT_LITERAL);
+  FloatLiteral(double value, ExprKind kind = FLOAT_LITERAL);
 
   virtual void Accept(AstVisitor &v) override;
 };
@@ -265,6 +482,104 @@ public:
   virtual void Accept(AstVisitor &v) override;
 };
 
+// A local variable
+class Identifier : public Expression, public Ast {
+public:
+  std::string mName;
+
+  Identifier(std::string name, ExprKind kind = IDENTIFIER);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `base[index]`
+class IndexExpression : public Expression, public Ast {
+public:
+  std::unique_ptr<Expression> mBase;
+  std::unique_ptr<Expression> mIndex;
+
+  IndexExpression(std::unique_ptr<Expression> base,
+                  std::unique_ptr<Expression> index,
+                  ExprKind kind = INDEX);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `base.member`
+class MemberExpression : public Expression, public Ast {
+public:
+  std::unique_ptr<Expression> mBase;
+  std::string mMember;
+
+  MemberExpression(std::unique_ptr<Expression> base,
+                   std::string member,
+                   ExprKind kind = MEMBER);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `lhs op rhs`. Both sides have the same type, except that a literal takes
+// the type of the other side.
+class BinaryExpression : public Expression, public Ast {
+public:
+  enum Op {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    // Comparisons give a bool, or a mask for vectors
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+  } mOp;
+  std::unique_ptr<Expression> mLhs;
+  std::unique_ptr<Expression> mRhs;
+
+  BinaryExpression(Op op,
+                   std::unique_ptr<Expression> lhs,
+                   std::unique_ptr<Expression> rhs,
+                   ExprKind kind = BINARY);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+const char *GetBinaryOpName(BinaryExpression::Op op);
+
+inline bool IsComparison(BinaryExpression::Op op) {
+  return op >= BinaryExpression::LT;
+}
+
+// Numeric literals and arithmetic on nothing but them. They have no type of
+// their own and take on the int or float type they are used as. Comparisons
+// are always bool.
+bool IsUntypedConstant(const Expression &expr);
+
+// The type an untyped constant has when nothing gives it one: int if its
+// leftmost literal is an int, float otherwise
+const char *DefaultConstantType(const Expression &expr);
+
+// `callee(args...)`, a procedure or a builtin such as a vector constructor.
+// Calling a #coroutine procedure creates a suspended coroutine. `await
+// callee(args...)` in a coroutine runs that one to its end instead,
+// suspending the caller each time the callee yields, and gives the value it
+// yielded last.
+class CallExpression : public Expression, public Ast {
+public:
+  std::string mCallee;
+  std::vector<std::unique_ptr<Expression>> mArgs;
+  bool mAwait = false;
+
+  CallExpression(std::string callee,
+                 std::vector<std::unique_ptr<Expression>> args,
+                 ExprKind kind = CALL);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
 //===----------------------------------------------------------------------===//
 // Statements
 //===----------------------------------------------------------------------===//
@@ -273,6 +588,12 @@ class Statement {
 public:
   enum StmtKind {
     RETURN,
+    LET,
+    ASSIGN,
+    EXPR,
+    WHILE,
+    FOR,
+    YIELD,
   } mStmtKind;
 
   virtual ~Statement() = default;
@@ -281,13 +602,139 @@ protected:
   Statement(StmtKind kind);
 };
 
+// `return value`. Annotated #tail, a returned call is a guaranteed tail call.
 class ReturnStatement : public Statement, public Ast {
 public:
+  std::vector<Annotation> mAnnotations;
   std::unique_ptr<Expression> mReturnExpr;
 
+  const Annotation *FindAnnotation(const std::string &name) const {
+    return charlie::FindAnnotation(mAnnotations, name);
+  }
+
   ReturnStatement(std::unique_ptr<Expression> expr, StmtKind kind = RETURN);
 
   virtual void Accept(AstVisitor &v) override;
 };
 
+// `yield value` or `yield` suspends a #coroutine procedure, handing value to
+// whoever resumed it. The procedure's return type is the type of the values
+// it yields.
+class YieldStatement : public Statement, public Ast {
+public:
+  std::unique_ptr<Expression> mValue;  // May be null
+
+  YieldStatement(std::unique_ptr<Expression> value, StmtKind kind = YIELD);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `let name: type` or `let name: type = init`. Without an initializer the
+// variable starts out zeroed.
+class LetStatement : public Statement, public Ast {
+public:
+  std::string mName;
+  std::string mType;
+  std::unique_ptr<Expression> mInit;  // May be null
+
+  LetStatement(std::string name,
+               std::string type,
+               std::unique_ptr<Expression> init,
+               StmtKind kind = LET);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `target = value`, where target is a variable, element or member
+class AssignStatement : public Statement, public Ast {
+public:
+  std::unique_ptr<Expression> mTarget;
+  std::unique_ptr<Expression> mValue;
+
+  AssignStatement(std::unique_ptr<Expression> target,
+                  std::unique_ptr<Expression> value,
+                  StmtKind kind = ASSIGN);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// A call made for its effect, e.g. `masked_store(a[i], v, mask)`
+class ExpressionStatement : public Statement, public Ast {
+public:
+  std::unique_ptr<Expression> mExpr;
+
+  ExpressionStatement(std::unique_ptr<Expression> expr, StmtKind kind = EXPR);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// Loops take annotations such as #vectorize(N), #unroll(N) and #no_alias
+// that become llvm.loop metadata.
+class LoopStatement : public Statement {
+public:
+  std::vector<Annotation> mAnnotations;
+  std::unique_ptr<Block> mBody;
+
+  const Annotation *FindAnnotation(const std::string &name) const {
+    return charlie::FindAnnotation(mAnnotations, name);
+  }
+
+protected:
+  LoopStatement(std::unique_ptr<Block> body, StmtKind kind);
+};
+
+// `while cond { ... }`
+class WhileStatement : public LoopStatement, public Ast {
+public:
+  std::unique_ptr<Expression> mCond;
+
+  WhileStatement(std::unique_ptr<Expression> cond,
+                 std::unique_ptr<Block> body,
+                 StmtKind kind = WHILE);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
+// `reduce(op: var)` on a parallel for. Each chunk of iterations works on a
+// private copy of var that starts at the identity of op, and the copies are
+// combined into var as chunks finish, in no particular order.
+struct Reduction {
+  enum Op {
+    ADD,
+    MUL,
+    MIN,
+    MAX,
+  } op;
+  std::string var;
+};
+
+const char *GetReductionOpName(Reduction::Op op);
+
+// `for i: T in begin..end { ... }` counts i up from begin to end, excluding
+// end, which is evaluated once before the first iteration. The type may be
+// left out to use that of begin, or of end if begin is a constant. The body
+// cannot assign to i, so the trip count is known on entry.
+//
+// `parallel for` runs chunks of the iterations on the runtime's thread pool,
+// in any order. The body is outlined into its own procedure that reaches the
+// enclosing procedure's variables through pointers.
+class ForStatement : public LoopStatement, public Ast {
+public:
+  std::string mVar;
+  std::string mType;  // Empty if not given
+  std::unique_ptr<Expression> mBegin;
+  std::unique_ptr<Expression> mEnd;
+  bool mParallel = false;
+  std::vector<Reduction> mReductions;
+
+  ForStatement(std::string var,
+               std::string type,
+               std::unique_ptr<Expression> begin,
+               std::unique_ptr<Expression> end,
+               std::unique_ptr<Block> body,
+               StmtKind kind = FOR);
+
+  virtual void Accept(AstVisitor &v) override;
+};
+
 }  // namespace charlie
@@ -0,0 +1,657 @@
+#include "bytecode.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace charlie {
+
+const char *GetOpcodeName(Opcode op) {
+  const char *name = "";
+  switch (op) {
+  case OP_LOAD_CONST: name = "load_const"; break;
+  case OP_MOVE: name = "move"; break;
+  case OP_ADD_I: name = "add_i"; break;
+  case OP_SUB_I: name = "sub_i"; break;
+  case OP_MUL_I: name = "mul_i"; break;
+  case OP_DIV_I: name = "div_i"; break;
+  case OP_MOD_I: name = "mod_i"; break;
+  case OP_DIV_U: name = "div_u"; break;
+  case OP_MOD_U: name = "mod_u"; break;
+  case OP_ADD_F: name = "add_f"; break;
+  case OP_SUB_F: name = "sub_f"; break;
+  case OP_MUL_F: name = "mul_f"; break;
+  case OP_DIV_F: name = "div_f"; break;
+  case OP_MOD_F: name = "mod_f"; break;
+  case OP_EQ_I: name = "eq_i"; break;
+  case OP_NE_I: name = "ne_i"; break;
+  case OP_LT_I: name = "lt_i"; break;
+  case OP_LE_I: name = "le_i"; break;
+  case OP_LT_U: name = "lt_u"; break;
+  case OP_LE_U: name = "le_u"; break;
+  case OP_EQ_F: name = "eq_f"; break;
+  case OP_NE_F: name = "ne_f"; break;
+  case OP_LT_F: name = "lt_f"; break;
+  case OP_LE_F: name = "le_f"; break;
+  case OP_SEXT: name = "sext"; break;
+  case OP_ZEXT: name = "zext"; break;
+  case OP_SITOF: name = "sitof"; break;
+  case OP_UITOF: name = "uitof"; break;
+  case OP_FTOSI: name = "ftosi"; break;
+  case OP_FTOUI: name = "ftoui"; break;
+  case OP_ROUND_F32: name = "round_f32"; break;
+  case OP_JUMP: name = "jump"; break;
+  case OP_JUMP_IF_NOT: name = "jump_if_not"; break;
+  case OP_CALL: name = "call"; break;
+  case OP_RETURN: name = "return"; break;
+  default: break;
+  }
+  return name;
+}
+
+std::ostream &operator<<(std::ostream &os, const Value &v) {
+  switch (v.kind) {
+  case Value::NONE: os << "<none>"; break;
+  case Value::INT: os << v.i; break;
+  case Value::FLOAT: os << v.f; break;
+  case Value::STRING: os << *v.s; break;
+  }
+  return os;
+}
+
+void BytecodeFunction::Print(std::ostream &os, const BytecodeModule &module) const {
+  os << name << ": " << num_registers << " registers, " << constants.size()
+     << " constants\n";
+  for (size_t pc = 0; pc < code.size(); ++pc) {
+    uint32_t insn = code[pc];
+    Opcode op = static_cast<Opcode>(insn & 0xff);
+    unsigned a = (insn >> 8) & 0xff;
+    unsigned b = (insn >> 16) & 0xff;
+    unsigned c = insn >> 24;
+    unsigned bx = insn >> 16;
+    os << "  " << std::setw(4) << pc << "  " << std::left << std::setw(12)
+       << GetOpcodeName(op) << std::right;
+    if (op == OP_LOAD_CONST) {
+      os << 'r' << a << ", k" << bx << "  ; " << constants[bx];
+    } else if (op == OP_MOVE || op == OP_ROUND_F32) {
+      os << 'r' << a << ", r" << b;
+    } else if (op >= OP_ADD_I && op <= OP_LE_F) {
+      os << 'r' << a << ", r" << b << ", r" << c;
+    } else if (op >= OP_SEXT && op <= OP_FTOUI) {
+      os << 'r' << a << ", r" << b << ", " << c;
+    } else if (op == OP_JUMP) {
+      os << bx;
+    } else if (op == OP_JUMP_IF_NOT) {
+      os << 'r' << a << ", " << bx;
+    } else if (op == OP_CALL) {
+      os << 'r' << a << ", " << module.functions[bx].name;
+    } else if (op == OP_RETURN) {
+      os << 'r' << a;
+    }
+    os << '\n';
+  }
+}
+
+void BytecodeModule::Print(std::ostream &os) const {
+  for (const auto &fn : functions) {
+    fn.Print(os, *this);
+  }
+}
+
+BytecodeLowering::BytecodeLowering(BytecodeModule &module, std::ostream &diag) :
+    mModule(module), mDiag(diag) {}
+
+bool BytecodeLowering::Lower(Module &mod) {
+  MemoryPhaseScope mem_scope(MEM_INTERP);
+  mod.Accept(*this);
+  return !mFailed;
+}
+
+uint8_t BytecodeLowering::NewRegister() {
+  if (mFreeRegister == 256) {
+    Unsupported("procedures needing more than 256 registers");
+    return 255;
+  }
+  uint8_t reg = static_cast<uint8_t>(mFreeRegister++);
+  mFunction->num_registers = std::max(mFunction->num_registers, mFreeRegister);
+  return reg;
+}
+
+uint16_t BytecodeLowering::AddConstant(Value v) {
+  if (mFunction->constants.size() == 65536) {
+    Unsupported("procedures with more than 65536 constants");
+    return 0;
+  }
+  mFunction->constants.push_back(v);
+  return static_cast<uint16_t>(mFunction->constants.size() - 1);
+}
+
+void BytecodeLowering::Emit(uint32_t insn) {
+  mFunction->code.push_back(insn);
+}
+
+void BytecodeLowering::Unsupported(const std::string &what) {
+  mFailed = true;
+  std::string function = mFunction ? mFunction->name : "";
+  if (!mReported.insert(function + ": " + what).second)
+    return;
+  mDiag << "[Interp Error] " << function << ": " << what
+        << " are not supported by the interpreter\n";
+}
+
+const BuiltinType *BytecodeLowering::ScalarType(const std::string &type) {
+  std::string canonical = CanonicalTypeName(type);
+  const BuiltinType *builtin = FindBuiltinType(canonical);
+  if (builtin && !builtin->lanes)
+    return builtin;
+  std::string inner;
+  if (builtin)
+    Unsupported("vectors");
+  else if (SplitAtomicType(canonical, inner))
+    Unsupported("atomics");
+  else if (SplitCoroutineType(canonical, inner))
+    Unsupported("coroutines");
+  else if (!canonical.empty() && canonical.back() == ']')
+    Unsupported("arrays");
+  else
+    Unsupported("structs");
+  return nullptr;
+}
+
+// `bits` as a value of the int `type`, extended from its width
+static Value IntValue(const BuiltinType &type, uint64_t bits) {
+  if (type.bits < 64) {
+    uint64_t sign = uint64_t(1) << (type.bits - 1);
+    bits &= (sign << 1) - 1;
+    if (type.is_signed && (bits & sign))
+      bits |= ~((sign << 1) - 1);
+  }
+  return Value::Int(static_cast<int64_t>(bits));
+}
+
+static Value FloatValue(const BuiltinType &type, double f) {
+  return Value::Float(type.bits == 32 ? static_cast<float>(f) : f);
+}
+
+void BytecodeLowering::Visit(Module &mod) {
+  // Number the procedures first, so calls can refer to ones defined later
+  for (const auto &decl : mod.TopLevelDecls()) {
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF: {
+      auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+      const std::string &name = pdef->Prototype()->Name();
+      mProcedures.emplace(name, pdef);
+      if (!pdef->BodyBlock())
+        break;
+      mModule.function_index.emplace(name, mModule.functions.size());
+      mModule.functions.emplace_back();
+      mModule.functions.back().name = name;
+      break;
+    }
+    case TopLevelDeclaration::CONST_DEF: {
+      auto cdef = static_cast<const ConstDefinition *>(decl.get());
+      mConstants.emplace(cdef->Name(), cdef);
+      break;
+    }
+    case TopLevelDeclaration::USE_DECL: {
+      const ModuleInterface *interface =
+        static_cast<const UseDeclaration &>(*decl).Interface();
+      if (!interface)
+        break;
+      for (const auto &proto : interface->procedures) {
+        mImported.insert(proto->Name());
+      }
+      break;
+    }
+    // Structs have no runtime representation
+    default: break;
+    };
+  }
+
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind == TopLevelDeclaration::PROC_DEF)
+      static_cast<ProcedureDefinition *>(decl.get())->Accept(*this);
+  }
+}
+
+void BytecodeLowering::Visit(ProcedurePrototype &proto) {
+  mFunction = &mModule.functions[mModule.function_index.at(proto.Name())];
+  mLocals.clear();
+  mFreeRegister = 0;
+  mReturnType = proto.ReturnType().empty() ? nullptr : ScalarType(proto.ReturnType());
+  // The caller leaves the arguments in the first registers
+  for (const auto &arg : proto.Args()) {
+    uint8_t reg = NewRegister();
+    if (const BuiltinType *type = ScalarType(arg.type))
+      mLocals[arg.name] = {reg, type};
+  }
+  mTempBase = mFreeRegister;
+}
+
+void BytecodeLowering::Visit(ProcedureDefinition &proc_def) {
+  // Imported procedures have no bodies to run
+  if (!proc_def.BodyBlock())
+    return;
+  proc_def.Prototype()->Accept(*this);
+  proc_def.BodyBlock()->Accept(*this);
+
+  // Falling off the end returns nothing
+  if (mFunction->code.empty() ||
+      (mFunction->code.back() & 0xff) != OP_RETURN) {
+    Emit(BytecodeFunction::EncodeABx(OP_RETURN, EmitLoadConstant(Value()), 0));
+  }
+  mFunction = nullptr;
+}
+
+void BytecodeLowering::Visit(StructDefinition &) {}
+
+void BytecodeLowering::Visit(UseDeclaration &) {}
+
+void BytecodeLowering::Visit(ConstDefinition &) {}
+
+void BytecodeLowering::Visit(Block &block) {
+  auto outer_locals = mLocals;
+  unsigned block_base = mFreeRegister;
+  unsigned outer_temp_base = mTempBase;
+  for (auto &s : block.Statements()) {
+    mTempBase = mFreeRegister;
+    VisitStatement(*s);
+    mFreeRegister = mTempBase;
+  }
+  mLocals = std::move(outer_locals);
+  mFreeRegister = block_base;
+  mTempBase = outer_temp_base;
+}
+
+//===----------------------------------------------------------------------===//
+// Expressions
+//===----------------------------------------------------------------------===//
+
+uint8_t BytecodeLowering::LowerValue(Expression &expr) {
+  if (IsUntypedConstant(expr))
+    return LowerConstantAs(expr, *FindBuiltinType(DefaultConstantType(expr)));
+  mResultType = nullptr;
+  VisitExpression(expr);
+  return mResult;
+}
+
+uint8_t BytecodeLowering::LowerValueAs(Expression &expr, const BuiltinType &type) {
+  if (IsUntypedConstant(expr))
+    return LowerConstantAs(expr, type);
+  uint8_t value = LowerValue(expr);
+  if (!mResultType || mResultType == &type)
+    return value;
+  return EmitConvert(value, *mResultType, type);
+}
+
+// Untyped constants are evaluated in the type they are used as, like
+// CodegenVisitor::EmitConstantAs()
+uint8_t BytecodeLowering::LowerConstantAs(Expression &expr, const BuiltinType &type) {
+  bool to_float = type.kind == BuiltinType::FLOAT;
+  switch (expr.mExprKind) {
+  case Expression::INT_LITERAL: {
+    int64_t i = static_cast<IntegerLiteral &>(expr).mInt;
+    mResult = EmitLoadConstant(to_float ? FloatValue(type, static_cast<double>(i))
+                                        : IntValue(type, i));
+    break;
+  }
+  case Expression::FLOAT_LITERAL: {
+    double f = static_cast<FloatLiteral &>(expr).mFloat;
+    mResult = EmitLoadConstant(to_float ? FloatValue(type, f)
+                                        : IntValue(type, static_cast<int64_t>(f)));
+    break;
+  }
+  default: {
+    auto &binary = static_cast<BinaryExpression &>(expr);
+    uint8_t lhs = LowerConstantAs(*binary.mLhs, type);
+    uint8_t rhs = LowerConstantAs(*binary.mRhs, type);
+    mResult = EmitArithmetic(binary.mOp, type, lhs, rhs);
+    break;
+  }
+  };
+  mResultType = &type;
+  return mResult;
+}
+
+void BytecodeLowering::Visit(IntegerLiteral &intlit) {
+  LowerValue(intlit);
+}
+
+void BytecodeLowering::Visit(FloatLiteral &floatlit) {
+  LowerValue(floatlit);
+}
+
+void BytecodeLowering::Visit(StringLiteral &strlit) {
+  mModule.strings.push_back(strlit.mString);
+  mResult = EmitLoadConstant(Value::String(&mModule.strings.back()));
+  mResultType = FindBuiltinType("string");
+}
+
+void BytecodeLowering::Visit(Identifier &ident) {
+  if (auto it = mLocals.find(ident.mName); it != mLocals.end()) {
+    mResult = it->second.reg;
+    mResultType = it->second.type;
+    return;
+  }
+  // CheckModule() ran the initializers of constants
+  auto it = mConstants.find(ident.mName);
+  if (it == mConstants.end() || !it->second->Value())
+    return;
+  const ConstValue &value = *it->second->Value();
+  const BuiltinType *type = ScalarType(value.type);
+  if (!type)
+    return;
+  mResult = EmitLoadConstant(type->kind == BuiltinType::FLOAT ? Value::Float(value.f)
+                                                              : Value::Int(value.i));
+  mResultType = type;
+}
+
+void BytecodeLowering::Visit(IndexExpression &) {
+  Unsupported("arrays");
+}
+
+void BytecodeLowering::Visit(MemberExpression &) {
+  Unsupported("structs");
+}
+
+void BytecodeLowering::Visit(BinaryExpression &binary) {
+  // A literal on either side takes the type of the other
+  uint8_t lhs, rhs;
+  const BuiltinType *type;
+  if (IsUntypedConstant(*binary.mLhs)) {
+    rhs = LowerValue(*binary.mRhs);
+    if (!(type = mResultType))
+      return;
+    lhs = LowerConstantAs(*binary.mLhs, *type);
+  } else {
+    lhs = LowerValue(*binary.mLhs);
+    if (!(type = mResultType))
+      return;
+    rhs = LowerValueAs(*binary.mRhs, *type);
+  }
+  mResult = EmitArithmetic(binary.mOp, *type, lhs, rhs);
+}
+
+void BytecodeLowering::Visit(CallExpression &call) {
+  const std::string &callee = call.mCallee;
+  if (call.mAwait) {
+    Unsupported("coroutines");
+    return;
+  }
+
+  if (auto it = mProcedures.find(callee); it != mProcedures.end()) {
+    const ProcedureDefinition &pdef = *it->second;
+    if (pdef.FindAnnotation("coroutine")) {
+      Unsupported("coroutines");
+      return;
+    }
+    if (!pdef.BodyBlock()) {
+      Unsupported("calls to procedures without a body");
+      return;
+    }
+    // The arguments go to consecutive registers above every live one, where
+    // the callee's window begins, and the result comes back in the first
+    const ProcedurePrototype &proto = *pdef.Prototype();
+    uint8_t base = NewRegister();
+    for (size_t i = 1; i < proto.Args().size(); ++i) {
+      NewRegister();
+    }
+    for (size_t i = 0; i < proto.Args().size(); ++i) {
+      const BuiltinType *type = ScalarType(proto.Args()[i].type);
+      if (!type)
+        return;
+      unsigned temps = mFreeRegister;
+      EmitMove(static_cast<uint8_t>(base + i), LowerValueAs(*call.mArgs[i], *type));
+      mFreeRegister = temps;
+    }
+    Emit(BytecodeFunction::EncodeABx(OP_CALL, base, mModule.function_index.at(callee)));
+    mFreeRegister = base + 1;
+    mResult = base;
+    mResultType = proto.ReturnType().empty() ? nullptr : ScalarType(proto.ReturnType());
+    return;
+  }
+  if (mImported.count(callee)) {
+    Unsupported("calls to other modules");
+    return;
+  }
+
+  // Conversions
+  if (const BuiltinType *to = FindBuiltinType(callee); to && !to->lanes) {
+    Expression &arg = *call.mArgs[0];
+    if (IsUntypedConstant(arg)) {
+      mResult = LowerConstantAs(arg, *to);
+    } else {
+      uint8_t value = LowerValue(arg);
+      if (!mResultType)
+        return;
+      mResult = EmitConvert(value, *mResultType, *to);
+    }
+    mResultType = to;
+    return;
+  }
+  if (FindBuiltinType(callee))
+    Unsupported("vectors");
+  else
+    Unsupported("calls to '" + callee + "'");
+}
+
+uint8_t BytecodeLowering::EmitLoadConstant(Value v) {
+  uint8_t reg = NewRegister();
+  Emit(BytecodeFunction::EncodeABx(OP_LOAD_CONST, reg, AddConstant(v)));
+  return reg;
+}
+
+uint8_t BytecodeLowering::EmitArithmetic(BinaryExpression::Op op,
+                                         const BuiltinType &type,
+                                         uint8_t lhs,
+                                         uint8_t rhs) {
+  static constexpr struct {
+    Opcode f, s, u;
+    bool swap;  // Whether the operands are swapped
+  } kOpcodes[] = {
+    {OP_ADD_F, OP_ADD_I, OP_ADD_I, false},  // ADD
+    {OP_SUB_F, OP_SUB_I, OP_SUB_I, false},  // SUB
+    {OP_MUL_F, OP_MUL_I, OP_MUL_I, false},  // MUL
+    {OP_DIV_F, OP_DIV_I, OP_DIV_U, false},  // DIV
+    {OP_MOD_F, OP_MOD_I, OP_MOD_U, false},  // MOD
+    {OP_LT_F, OP_LT_I, OP_LT_U, false},     // LT
+    {OP_LE_F, OP_LE_I, OP_LE_U, false},     // LE
+    {OP_LT_F, OP_LT_I, OP_LT_U, true},      // GT
+    {OP_LE_F, OP_LE_I, OP_LE_U, true},      // GE
+    {OP_EQ_F, OP_EQ_I, OP_EQ_I, false},     // EQ
+    {OP_NE_F, OP_NE_I, OP_NE_I, false},     // NE
+  };
+  const auto &spec = kOpcodes[op];
+  bool is_float = type.kind == BuiltinType::FLOAT;
+  Opcode opcode = is_float ? spec.f : type.is_signed ? spec.s : spec.u;
+  uint8_t result = NewRegister();
+  Emit(BytecodeFunction::EncodeABC(opcode, result, spec.swap ? rhs : lhs,
+                                   spec.swap ? lhs : rhs));
+  if (IsComparison(op)) {
+    mResultType = FindBuiltinType("bool");
+    return result;
+  }
+  if (is_float && type.bits == 32)
+    Emit(BytecodeFunction::EncodeABC(OP_ROUND_F32, result, result, 0));
+  else if (!is_float)
+    EmitExtend(result, type);
+  mResultType = &type;
+  return result;
+}
+
+void BytecodeLowering::EmitExtend(uint8_t reg, const BuiltinType &type) {
+  if (type.bits < 64)
+    Emit(BytecodeFunction::EncodeABC(type.is_signed ? OP_SEXT : OP_ZEXT, reg, reg, type.bits));
+}
+
+// Like CodegenVisitor::EmitBuiltin()
+uint8_t BytecodeLowering::EmitConvert(uint8_t value,
+                                      const BuiltinType &from,
+                                      const BuiltinType &to) {
+  bool from_float = from.kind == BuiltinType::FLOAT;
+  bool to_float = to.kind == BuiltinType::FLOAT;
+  Opcode op;
+  if (from_float && to_float)
+    op = to.bits == 32 && from.bits == 64 ? OP_ROUND_F32 : OP_MOVE;
+  else if (from_float)
+    op = to.is_signed ? OP_FTOSI : OP_FTOUI;
+  else if (to_float)
+    op = from.is_signed ? OP_SITOF : OP_UITOF;
+  else if (to.bits < 64)
+    op = to.is_signed ? OP_SEXT : OP_ZEXT;
+  else
+    op = OP_MOVE;
+  mResultType = &to;
+  // Widening floats and converting to 64-bit ints only changes the type
+  if (op == OP_MOVE)
+    return value;
+  uint8_t result = NewRegister();
+  Emit(BytecodeFunction::EncodeABC(op, result, value, to.bits));
+  return result;
+}
+
+void BytecodeLowering::EmitMove(uint8_t dst, uint8_t src) {
+  if (dst == src)
+    return;
+  // Nothing else reads a temporary, so the instruction that computed it can
+  // write `dst` directly. A call's register is also where its arguments go.
+  auto &code = mFunction->code;
+  if (src >= mTempBase && !code.empty()) {
+    uint32_t &last = code.back();
+    Opcode op = static_cast<Opcode>(last & 0xff);
+    bool writes_a = op != OP_JUMP && op != OP_JUMP_IF_NOT && op != OP_CALL && op != OP_RETURN;
+    if (writes_a && ((last >> 8) & 0xff) == src) {
+      last = (last & ~0xff00u) | uint32_t(dst) << 8;
+      return;
+    }
+  }
+  Emit(BytecodeFunction::EncodeABC(OP_MOVE, dst, src, 0));
+}
+
+size_t BytecodeLowering::EmitJump(Opcode op, uint8_t a, size_t target) {
+  Emit(BytecodeFunction::EncodeABx(op, a, 0));
+  size_t jump = mFunction->code.size() - 1;
+  PatchJump(jump, target);
+  return jump;
+}
+
+void BytecodeLowering::PatchJump(size_t jump, size_t target) {
+  if (target > 0xffff) {
+    Unsupported("procedures longer than 65536 instructions");
+    return;
+  }
+  uint32_t &insn = mFunction->code[jump];
+  insn = (insn & 0xffff) | uint32_t(target) << 16;
+}
+
+//===----------------------------------------------------------------------===//
+// Statements
+//===----------------------------------------------------------------------===//
+
+void BytecodeLowering::Visit(ReturnStatement &retstmt) {
+  uint8_t value = mReturnType ? LowerValueAs(*retstmt.mReturnExpr, *mReturnType)
+                              : LowerValue(*retstmt.mReturnExpr);
+  Emit(BytecodeFunction::EncodeABx(OP_RETURN, value, 0));
+}
+
+void BytecodeLowering::Visit(YieldStatement &) {
+  Unsupported("coroutines");
+}
+
+void BytecodeLowering::Visit(LetStatement &let) {
+  const BuiltinType *type = ScalarType(let.mType);
+  uint8_t reg = NewRegister();
+  mTempBase = mFreeRegister;
+  if (!type)
+    return;
+  // Registers are reused, so a variable without an initializer is zeroed
+  if (let.mInit) {
+    EmitMove(reg, LowerValueAs(*let.mInit, *type));
+  } else {
+    Value zero = type->kind == BuiltinType::FLOAT ? Value::Float(0) : Value::Int(0);
+    Emit(BytecodeFunction::EncodeABx(OP_LOAD_CONST, reg, AddConstant(zero)));
+  }
+  mLocals[let.mName] = {reg, type};
+}
+
+void BytecodeLowering::Visit(AssignStatement &assign) {
+  if (assign.mTarget->mExprKind != Expression::IDENTIFIER) {
+    VisitExpression(*assign.mTarget);
+    return;
+  }
+  auto it = mLocals.find(static_cast<Identifier &>(*assign.mTarget).mName);
+  if (it == mLocals.end())
+    return;
+  // Like generated code, the value takes the target's type after it is
+  // evaluated on its own
+  const Local &local = it->second;
+  uint8_t value = LowerValue(*assign.mValue);
+  if (!mResultType)
+    return;
+  if (mResultType != local.type)
+    value = EmitConvert(value, *mResultType, *local.type);
+  EmitMove(local.reg, value);
+}
+
+void BytecodeLowering::Visit(ExpressionStatement &expr) {
+  LowerValue(*expr.mExpr);
+}
+
+void BytecodeLowering::Visit(WhileStatement &loop) {
+  size_t start = mFunction->code.size();
+  size_t exit = EmitJump(OP_JUMP_IF_NOT, LowerValue(*loop.mCond));
+  mFreeRegister = mTempBase;
+  loop.mBody->Accept(*this);
+  EmitJump(OP_JUMP, 0, start);
+  PatchJump(exit, mFunction->code.size());
+}
+
+// Parallel loops run their iterations in order, which is one of the orders
+// they may run in
+void BytecodeLowering::Visit(ForStatement &loop) {
+  uint8_t counter = NewRegister();
+  uint8_t end = NewRegister();
+  uint8_t one = NewRegister();
+  mTempBase = mFreeRegister;
+
+  // A constant begin takes the type of end, see CheckModule()
+  const BuiltinType *type = nullptr;
+  if (!loop.mType.empty()) {
+    if (!(type = ScalarType(loop.mType)))
+      return;
+    EmitMove(counter, LowerValueAs(*loop.mBegin, *type));
+    EmitMove(end, LowerValueAs(*loop.mEnd, *type));
+  } else if (IsUntypedConstant(*loop.mBegin)) {
+    uint8_t value = LowerValue(*loop.mEnd);
+    if (!(type = mResultType))
+      return;
+    EmitMove(end, value);
+    EmitMove(counter, LowerConstantAs(*loop.mBegin, *type));
+  } else {
+    uint8_t value = LowerValue(*loop.mBegin);
+    if (!(type = mResultType))
+      return;
+    EmitMove(counter, value);
+    EmitMove(end, LowerValueAs(*loop.mEnd, *type));
+  }
+  Emit(BytecodeFunction::EncodeABx(OP_LOAD_CONST, one, AddConstant(Value::Int(1))));
+  mFreeRegister = mTempBase;
+
+  size_t start = mFunction->code.size();
+  uint8_t cond = NewRegister();
+  Emit(BytecodeFunction::EncodeABC(type->is_signed ? OP_LT_I : OP_LT_U, cond, counter, end));
+  size_t exit = EmitJump(OP_JUMP_IF_NOT, cond);
+  mFreeRegister = mTempBase;
+
+  auto outer_locals = mLocals;
+  mLocals[loop.mVar] = {counter, type};
+  loop.mBody->Accept(*this);
+  mLocals = std::move(outer_locals);
+
+  Emit(BytecodeFunction::EncodeABC(OP_ADD_I, counter, counter, one));
+  EmitExtend(counter, *type);
+  EmitJump(OP_JUMP, 0, start);
+  PatchJump(exit, mFunction->code.size());
+}
+
+}  // namespace charlie
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace charlie {
+
+//===----------------------------------------------------------------------===//
+// Register bytecode
+//
+// Each procedure is lowered to a BytecodeFunction that runs in its own window
+// of registers, with its parameters in the first ones. Instructions are 32
+// bits wide:
+//
+//   | op:8 | a:8 | bx:16 |      or      | op:8 | a:8 | b:8 | c:8 |
+//
+// `a` is almost always the destination register.
+//
+// Registers hold scalars. Ints of every width are kept sign or zero extended
+// to 64 bits, so arithmetic on narrower types is the 64-bit operation
+// followed by an extension from their width, and comparisons need no
+// extension at all. Bools are the ints 0 and 1. f32 arithmetic is done in
+// double precision and rounded, which gives the single precision result for
+// + - * / and %.
+//===----------------------------------------------------------------------===//
+
+enum Opcode : uint8_t {
+  OP_LOAD_CONST,  // R[a] = K[bx]
+  OP_MOVE,        // R[a] = R[b]
+
+  // R[a] = R[b] op R[c] on ints, wrapping at 64 bits
+  OP_ADD_I,
+  OP_SUB_I,
+  OP_MUL_I,
+  OP_DIV_I,  // Signed. Division by zero is a runtime error.
+  OP_MOD_I,
+  OP_DIV_U,  // Unsigned
+  OP_MOD_U,
+
+  // R[a] = R[b] op R[c] on floats
+  OP_ADD_F,
+  OP_SUB_F,
+  OP_MUL_F,
+  OP_DIV_F,
+  OP_MOD_F,
+
+  // R[a] = R[b] op R[c] as a bool. > and >= swap the operands.
+  OP_EQ_I,
+  OP_NE_I,
+  OP_LT_I,
+  OP_LE_I,
+  OP_LT_U,
+  OP_LE_U,
+  OP_EQ_F,  // Float comparisons are false if either side is NaN
+  OP_NE_F,
+  OP_LT_F,
+  OP_LE_F,
+
+  // R[a] = op R[b], where c is the width of the result
+  OP_SEXT,       // Sign extend from the low c bits
+  OP_ZEXT,       // Zero extend from the low c bits
+  OP_SITOF,      // Signed int to a float of c bits
+  OP_UITOF,      // Unsigned int to a float of c bits
+  OP_FTOSI,      // Float to a signed int of c bits, an error if out of range
+  OP_FTOUI,      // Float to an unsigned int of c bits, likewise
+  OP_ROUND_F32,  // Round to single precision
+
+  OP_JUMP,         // pc = bx
+  OP_JUMP_IF_NOT,  // if !R[a] then pc = bx
+  OP_CALL,         // R[a] = functions[bx](R[a], R[a + 1], ...)
+  OP_RETURN,       // return R[a]
+  OP_NUM_OPCODES,
+};
+
+const char *GetOpcodeName(Opcode op);
+
+struct Value {
+  enum Kind : uint8_t {
+    NONE,
+    INT,
+    FLOAT,
+    STRING,
+  } kind = NONE;
+
+  union {
+    int64_t i;
+    double f;
+    const std::string *s;
+  };
+
+  Value() : i(0) {}
+  static Value Int(int64_t v) { Value r; r.kind = INT; r.i = v; return r; }
+  static Value Float(double v) { Value r; r.kind = FLOAT; r.f = v; return r; }
+  static Value String(const std::string *v) { Value r; r.kind = STRING; r.s = v; return r; }
+};
+
+std::ostream &operator<<(std::ostream &os, const Value &v);
+
+struct BytecodeModule;
+
+struct BytecodeFunction {
+  std::string name;
+  uint32_t num_registers = 0;
+  std::vector<uint32_t> code;
+  std::vector<Value> constants;
+
+  static uint32_t EncodeABx(Opcode op, uint8_t a, uint16_t bx) {
+    return uint32_t(op) | uint32_t(a) << 8 | uint32_t(bx) << 16;
+  }
+  static uint32_t EncodeABC(Opcode op, uint8_t a, uint8_t b, uint8_t c) {
+    return uint32_t(op) | uint32_t(a) << 8 | uint32_t(b) << 16 |
+           uint32_t(c) << 24;
+  }
+
+  void Print(std::ostream &os, const BytecodeModule &module) const;
+};
+
+struct BytecodeModule {
+  std::vector<BytecodeFunction> functions;
+  std::unordered_map<std::string, uint32_t> function_index;
+  // String constants; a deque so `Value::s` pointers stay valid as it grows
+  std::deque<std::string> strings;
+
+  const BytecodeFunction *GetFunction(const std::string &name) const {
+    auto it = function_index.find(name);
+    return it == function_index.end() ? nullptr : &functions[it->second];
+  }
+
+  void Print(std::ostream &os) const;
+};
+
+// Lowers a Module to bytecode for the interpreter. Constructs the interpreter
+// cannot run are reported to `diag` and make Lower() fail: anything but int,
+// float and bool variables, i.e. arrays, structs, vectors, atomics and
+// coroutines, and calls to builtins other than scalar conversions or to
+// procedures without a body here. Parallel loops run serially.
+class BytecodeLowering : public AstVisitor {
+  // A variable and the register it lives in
+  struct Local {
+    uint8_t reg;
+    const BuiltinType *type;
+  };
+
+  BytecodeModule &mModule;
+  std::ostream &mDiag;
+  BytecodeFunction *mFunction = nullptr;  // Function being lowered
+  const BuiltinType *mReturnType = nullptr;
+  std::unordered_map<std::string, Local> mLocals;
+  std::unordered_map<std::string, const ProcedureDefinition *> mProcedures;
+  std::unordered_map<std::string, const ConstDefinition *> mConstants;
+  std::unordered_set<std::string> mImported;
+  // Registers are allocated like a stack. Variables take the next free one
+  // until their block ends, and the temporaries of a statement are released
+  // when it ends; those are the registers from mTempBase up.
+  unsigned mFreeRegister = 0;
+  unsigned mTempBase = 0;
+  uint8_t mResult = 0;                        // Register holding the last value
+  const BuiltinType *mResultType = nullptr;   // Its type, null if unknown
+  bool mFailed = false;
+  std::unordered_set<std::string> mReported;  // Each error is reported once
+
+public:
+  BytecodeLowering(BytecodeModule &module, std::ostream &diag);
+
+  // Returns false if anything in `mod` could not be lowered.
+  bool Lower(Module &mod);
+
+  void Visit(Module &mod) override;
+  void Visit(Block &block) override;
+  void Visit(ProcedurePrototype &proto) override;
+  void Visit(ProcedureDefinition &proc_def) override;
+  void Visit(StructDefinition &struct_def) override;
+  void Visit(UseDeclaration &use_decl) override;
+  void Visit(ConstDefinition &const_def) override;
+  void Visit(IntegerLiteral &intlit) override;
+  void Visit(FloatLiteral &floatlit) override;
+  void Visit(StringLiteral &strlit) override;
+  void Visit(Identifier &ident) override;
+  void Visit(IndexExpression &index) override;
+  void Visit(MemberExpression &member) override;
+  void Visit(BinaryExpression &binary) override;
+  void Visit(CallExpression &call) override;
+  void Visit(ReturnStatement &retstmt) override;
+  void Visit(YieldStatement &yield) override;
+  void Visit(LetStatement &let) override;
+  void Visit(AssignStatement &assign) override;
+  void Visit(ExpressionStatement &expr) override;
+  void Visit(WhileStatement &loop) override;
+  void Visit(ForStatement &loop) override;
+
+private:
+  uint8_t NewRegister();
+  uint16_t AddConstant(Value v);
+  void Emit(uint32_t insn);
+  void Unsupported(const std::string &what);
+
+  // The scalar `type` names, or nullptr after reporting that the
+  // interpreter cannot hold it
+  const BuiltinType *ScalarType(const std::string &type);
+
+  // Lowers `expr` and returns the register holding its value, which is
+  // only written to if it is a temporary. mResultType is set to its type.
+  uint8_t LowerValue(Expression &expr);
+  // Like LowerValue(), but converts untyped constants to `type`
+  uint8_t LowerValueAs(Expression &expr, const BuiltinType &type);
+  uint8_t LowerConstantAs(Expression &expr, const BuiltinType &type);
+
+  uint8_t EmitLoadConstant(Value v);
+  uint8_t EmitArithmetic(BinaryExpression::Op op,
+                         const BuiltinType &type,
+                         uint8_t lhs,
+                         uint8_t rhs);
+  // Narrows the 64-bit result in `reg` to `type`, if it is narrower
+  void EmitExtend(uint8_t reg, const BuiltinType &type);
+  uint8_t EmitConvert(uint8_t value, const BuiltinType &from, const BuiltinType &to);
+  // R[dst] = R[src], retargeting the instruction that computed a temporary
+  // `src` instead where possible
+  void EmitMove(uint8_t dst, uint8_t src);
+  // Emits a jump and returns its position, for PatchJump() to set the target
+  size_t EmitJump(Opcode op, uint8_t a, size_t target = 0);
+  void PatchJump(size_t jump, size_t target);
+};
+
+}  // namespace charlie
@@ -0,0 +1,265 @@
+#include "cache.h"
+#include "compiler.h"
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace charlie {
+
+// Bump when the layout of cached entries changes.
+static constexpr const char *kCacheFormat = "3";
+
+CompilationCache::CompilationCache(std::string dir, uint64_t max_bytes) :
+    mDir(std::move(dir)), mMaxBytes(max_bytes) {
+  std::error_code ec;
+  fs::create_directories(fs::path(mDir) / "objects", ec);
+  if (ec) {
+    fprintf(stderr, "[Cache Error] Failed to create '%s': %s\n",
+            mDir.c_str(), ec.message().c_str());
+  }
+}
+
+std::string CompilationCache::ComputeKey(std::string_view source,
+                                         const std::string &input,
+                                         const CompilerOptions &opts) {
+  llvm::SHA1 hasher;
+  // Separate every field with a NUL so adjacent fields cannot alias.
+  auto add = [&hasher](llvm::StringRef s) {
+    hasher.update(s);
+    hasher.update(llvm::StringRef("\0", 1));
+  };
+  add(kCacheFormat);
+  add(CHARLIE_VERSION);
+  add(std::to_string(opts.opt_level));
+  add(std::to_string(opts.emit));
+  add(opts.dead_decl_elim ? "dce" : "no-dce");
+  add(std::to_string(opts.keep.size()));
+  for (const auto &root : opts.keep)
+    add(root);
+  // An empty triple means the host, which differs between machines that
+  // share a cache, so hash what the TargetMachine is created from.
+  TargetSpec target = ResolveTarget(opts);
+  add(target.triple);
+  add(target.cpu);
+  add(target.features);
+  // The search path decides which file a `use` resolves to
+  add(std::to_string(opts.import_paths.size()));
+  for (const auto &dir : opts.import_paths)
+    add(dir);
+  // `use` looks next to the input first, and the path names the module
+  std::error_code ec;
+  fs::path path = fs::absolute(input, ec);
+  add((ec ? fs::path(input) : path).lexically_normal().string());
+  add(llvm::StringRef(source.data(), source.size()));
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+static bool HashFile(const std::string &path, std::string &digest) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  llvm::SHA1 hasher;
+  hasher.update(ss.str());
+  digest = llvm::toHex(hasher.final(), /*LowerCase=*/true);
+  return true;
+}
+
+std::string CompilationCache::EntryPath(const std::string &key) const {
+  // Fan out on the first byte to keep directories small.
+  return (fs::path(mDir) / "objects" / key.substr(0, 2) / key.substr(2))
+    .string();
+}
+
+// An entry is a dependency header followed by the output bytes:
+//
+//   <#deps>\n
+//   <sha1> <path>\n ...
+//   <output>
+bool CompilationCache::Lookup(const std::string &key, std::string &data) {
+  std::string path = EntryPath(key);
+  std::ifstream in(path, std::ios::binary);
+
+  auto miss = [this] {
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mStats.misses++;
+    return false;
+  };
+
+  size_t num_deps = 0;
+  if (!in || !(in >> num_deps) || in.get() != '\n')
+    return miss();
+  for (size_t i = 0; i < num_deps; ++i) {
+    std::string digest, dep_path, current;
+    if (!(in >> digest) || in.get() != ' ' || !std::getline(in, dep_path))
+      return miss();
+    if (!HashFile(dep_path, current) || current != digest)
+      return miss();
+  }
+
+  std::stringstream ss;
+  ss << in.rdbuf();
+  data = ss.str();
+
+  // Refresh the modification time so LRU eviction sees this as a use.
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+  std::lock_guard<std::mutex> lock(mStatsMutex);
+  mStats.hits++;
+  return true;
+}
+
+bool CompilationCache::Store(const std::string &key,
+                             const std::string &data,
+                             const std::vector<std::string> &dependencies) {
+  std::string header = std::to_string(dependencies.size()) + '\n';
+  for (const auto &dep : dependencies) {
+    std::string digest;
+    if (!HashFile(dep, digest))
+      return false;
+    header += digest + ' ' + fs::absolute(dep).string() + '\n';
+  }
+
+  fs::path final_path = EntryPath(key);
+  std::error_code ec;
+  fs::create_directories(final_path.parent_path(), ec);
+
+  // Write to a uniquely named sibling and rename it into place. rename(2) is
+  // atomic within a file system, so readers see either no entry or all of it.
+  std::random_device rd;
+  fs::path tmp_path = final_path;
+  tmp_path += ".tmp." + std::to_string(getpid()) + "." + std::to_string(rd());
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(header.data(), header.size());
+    out.write(data.data(), data.size());
+    if (!out) {
+      fprintf(stderr, "[Cache Error] Failed to write '%s'\n",
+              tmp_path.c_str());
+      fs::remove(tmp_path, ec);
+      return false;
+    }
+  }
+
+  if (rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+    perror("[Cache Error] rename");
+    fs::remove(tmp_path, ec);
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mStats.stores++;
+  }
+  Evict();
+  return true;
+}
+
+void CompilationCache::Evict() {
+  struct Entry {
+    fs::path path;
+    fs::file_time_type mtime;
+    uint64_t size;
+  };
+
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(fs::path(mDir) / "objects", ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (!it->is_regular_file(ec))
+      continue;
+    // Skip in-flight writes from other processes
+    if (it->path().filename().string().find(".tmp.") != std::string::npos)
+      continue;
+    uint64_t size = it->file_size(ec);
+    entries.push_back({it->path(), it->last_write_time(ec), size});
+    total += size;
+  }
+
+  if (total <= mMaxBytes)
+    return;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+
+  for (const auto &e : entries) {
+    if (total <= mMaxBytes)
+      break;
+    // Another process may have evicted it already; only count our removals.
+    if (fs::remove(e.path, ec)) {
+      std::lock_guard<std::mutex> lock(mStatsMutex);
+      mStats.evictions++;
+      mStats.evicted_bytes += e.size;
+    }
+    total -= e.size;
+  }
+}
+
+void CompilationCache::ReportStats(std::ostream &os) {
+  std::string stats_path = (fs::path(mDir) / "stats").string();
+  CacheStats run = Stats();
+
+  CacheStats total;
+  int fd = open(stats_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd >= 0 && flock(fd, LOCK_EX) == 0) {
+    FILE *f = fdopen(dup(fd), "r+");
+    if (f) {
+      unsigned long long h = 0, m = 0, s = 0, e = 0, b = 0;
+      if (fscanf(f, "%llu %llu %llu %llu %llu", &h, &m, &s, &e, &b) == 5) {
+        total = {h, m, s, e, b};
+      }
+      total.hits += run.hits;
+      total.misses += run.misses;
+      total.stores += run.stores;
+      total.evictions += run.evictions;
+      total.evicted_bytes += run.evicted_bytes;
+
+      rewind(f);
+      if (ftruncate(fileno(f), 0) == 0) {
+        fprintf(f, "%llu %llu %llu %llu %llu\n",
+                (unsigned long long) total.hits,
+                (unsigned long long) total.misses,
+                (unsigned long long) total.stores,
+                (unsigned long long) total.evictions,
+                (unsigned long long) total.evicted_bytes);
+      }
+      fclose(f);
+    }
+    flock(fd, LOCK_UN);
+  }
+  if (fd >= 0)
+    close(fd);
+
+  auto rate = [](const CacheStats &s) {
+    uint64_t lookups = s.hits + s.misses;
+    return lookups ? 100.0 * s.hits / lookups : 0.0;
+  };
+
+  os << "Cache statistics (" << mDir << "):\n"
+     << "  this run:   " << run.hits << " hits, " << run.misses
+     << " misses (" << rate(run) << "% hit rate), " << run.stores
+     << " stores, " << run.evictions << " evictions\n"
+     << "  cumulative: " << total.hits << " hits, " << total.misses
+     << " misses (" << rate(total) << "% hit rate), " << total.stores
+     << " stores, " << total.evictions << " evictions ("
+     << total.evicted_bytes << " bytes)\n";
+}
+
+}  // namespace charlie
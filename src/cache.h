@@ -0,0 +1,74 @@
+#pragma once
+
+#include "options.h"
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace charlie {
+
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t stores = 0;
+  uint64_t evictions = 0;
+  uint64_t evicted_bytes = 0;
+};
+
+// Content-addressed store of compiler outputs.
+//
+// Entries are keyed by a hash of everything that can change the output: the
+// source bytes, the input's absolute path, the compiler version, the
+// optimization level, the output kind, the resolved target and the import
+// search path. Writes go to a temporary file that is renamed into place, so
+// concurrent compilers sharing a cache directory never observe a partial
+// entry. The directory is kept under `max_bytes` by evicting least recently
+// used entries, where a hit counts as a use.
+//
+// Outputs that depend on other files (e.g. imported module interfaces) record
+// a hash of each dependency, and a lookup only hits while all of them are
+// unchanged.
+class CompilationCache {
+public:
+  CompilationCache(std::string dir, uint64_t max_bytes);
+
+  // `source` is the text of the file `input`
+  static std::string ComputeKey(std::string_view source,
+                                const std::string &input,
+                                const CompilerOptions &opts);
+
+  // Sets `data` to the cached output for `key`. Returns false on a miss.
+  bool Lookup(const std::string &key, std::string &data);
+
+  // Atomically publishes `data` under `key` and trims the cache to size.
+  // `dependencies` are the files other than the source that `data` was
+  // derived from.
+  bool Store(const std::string &key,
+             const std::string &data,
+             const std::vector<std::string> &dependencies = {});
+
+  CacheStats Stats() const {
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    return mStats;
+  }
+
+  // Folds this run's statistics into the cumulative totals kept in the cache
+  // directory and prints both.
+  void ReportStats(std::ostream &os);
+
+private:
+  std::string mDir;
+  uint64_t mMaxBytes;
+  // A cache may be shared by the driver's worker threads
+  mutable std::mutex mStatsMutex;
+  CacheStats mStats;
+
+  std::string EntryPath(const std::string &key) const;
+  void Evict();
+};
+
+}  // namespace charlie
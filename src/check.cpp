@@ -0,0 +1,1690 @@
+#include "check.h"
+#include "consteval.h"
+#include "generics.h"
+#include "interface.h"
+#include "parser.h"
+#include "reachability.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace charlie {
+
+// Annotations and the declarations that accept them. The ones on procedures
+// become LLVM function attributes, except #export, which keeps a procedure
+// visible outside its module, and #coroutine, which makes it one.
+static constexpr struct {
+  const char *name;
+  TopLevelDeclaration::DeclKind kind;
+  size_t num_args;
+} kAnnotations[] = {
+  {"packed_order", TopLevelDeclaration::STRUCT_DEF, 0},
+  {"align", TopLevelDeclaration::STRUCT_DEF, 1},
+  {"soa", TopLevelDeclaration::STRUCT_DEF, 0},
+  {"inline", TopLevelDeclaration::PROC_DEF, 0},
+  {"noinline", TopLevelDeclaration::PROC_DEF, 0},
+  {"hot", TopLevelDeclaration::PROC_DEF, 0},
+  {"cold", TopLevelDeclaration::PROC_DEF, 0},
+  {"pure", TopLevelDeclaration::PROC_DEF, 0},
+  {"export", TopLevelDeclaration::PROC_DEF, 0},
+  {"coroutine", TopLevelDeclaration::PROC_DEF, 0},
+};
+
+// Annotations that cannot be on the same declaration
+static constexpr const char *kConflictingAnnotations[][2] = {
+  {"inline", "noinline"},
+  {"hot", "cold"},
+  // A coroutine keeps its state in a heap frame between calls, and only its
+  // own module knows the frame's layout
+  {"coroutine", "pure"},
+  {"coroutine", "export"},
+};
+
+// Annotations on for and while loops. #vectorize(width), #unroll(count)
+// and #no_alias are passed to LLVM as loop metadata. #no_alias promises
+// that the loop has no loop-carried dependences through memory: no
+// iteration reads or writes what another one writes. Nothing checks the
+// promise, and a loop that breaks it may compute anything. #static,
+// #dynamic and #guided choose how a parallel for is split into chunks, and
+// may give the chunk size.
+static constexpr struct {
+  const char *name;
+  size_t min_args;
+  size_t max_args;
+  bool parallel_only;
+} kLoopAnnotations[] = {
+  {"vectorize", 1, 1, false},
+  {"unroll", 1, 1, false},
+  {"no_alias", 0, 0, false},
+  {"static", 0, 1, true},
+  {"dynamic", 0, 1, true},
+  {"guided", 0, 1, true},
+};
+
+// Builtins on atomic<T>, which is always their first argument. The values
+// they take come next, then optionally memory orders, seq_cst by default.
+static constexpr struct {
+  const char *name;
+  size_t num_values;
+  size_t num_orders;
+} kAtomicBuiltins[] = {
+  {"atomic_load", 0, 1},
+  {"atomic_store", 1, 1},
+  {"atomic_exchange", 1, 1},
+  // (atomic, expected, desired, success order, failure order)
+  {"atomic_compare_exchange", 2, 2},
+  {"atomic_fetch_add", 1, 1},
+  {"atomic_fetch_sub", 1, 1},
+};
+
+static constexpr const char *kMemoryOrders[] = {
+  "relaxed", "acquire", "release", "acq_rel", "seq_cst",
+};
+
+// Largest #align(N) accepted, one page
+static constexpr int kMaxAlignment = 4096;
+
+// How deep instances of generic procedures may ask for further instances,
+// which stops e.g. f<T> calling f<T[2]> from instantiating forever
+static constexpr int kMaxInstanceDepth = 64;
+
+namespace {
+
+// Points calls to generic procedures at the instances made for them
+class CalleeRewriter : public RecursiveAstVisitor {
+public:
+  explicit CalleeRewriter(const std::unordered_map<const CallExpression *, std::string> &callees) :
+      mCallees(callees) {}
+
+  using RecursiveAstVisitor::Visit;
+
+  void Visit(CallExpression &call) override {
+    if (auto it = mCallees.find(&call); it != mCallees.end())
+      call.mCallee = it->second;
+    RecursiveAstVisitor::Visit(call);
+  }
+
+private:
+  const std::unordered_map<const CallExpression *, std::string> &mCallees;
+};
+
+class ModuleChecker {
+public:
+  ModuleChecker(Module &mod, const std::vector<std::string> &extra_exports,
+                std::ostream &diag) :
+      mModule(mod), mExtraExports(extra_exports), mDiag(diag) {}
+
+  bool Check() {
+    CollectNames();
+    mExported = ExportedProcedures(mModule, {});
+    mExported.insert(mExtraExports.begin(), mExtraExports.end());
+    for (const auto &decl : mModule.TopLevelDecls()) {
+      CheckAnnotations(*decl);
+      switch (decl->mDeclKind) {
+      case TopLevelDeclaration::PROC_DEF: {
+        auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+        if (pdef->Prototype()->IsGeneric()) {
+          CheckGeneric(*pdef);
+          break;
+        }
+        CheckPrototype(*pdef->Prototype());
+        CheckBody(*pdef);
+        break;
+      }
+      case TopLevelDeclaration::STRUCT_DEF: {
+        auto sdef = static_cast<const StructDefinition *>(decl.get());
+        CheckStruct(*sdef);
+        break;
+      }
+      case TopLevelDeclaration::CONST_DEF: {
+        auto cdef = static_cast<const ConstDefinition *>(decl.get());
+        CheckConstant(*cdef);
+        break;
+      }
+      default: break;
+      };
+    }
+    // Instances are checked like the procedures written out, and may ask
+    // for more instances in turn
+    for (size_t i = 0; i < mPendingInstances.size(); ++i) {
+      auto [pdef, depth] = mPendingInstances[i];
+      mInstanceDepth = depth;
+      CheckPrototype(*pdef->Prototype());
+      CheckBody(*pdef);
+    }
+    mInstanceDepth = 0;
+    CheckStructCycles();
+    if (!mFailed) {
+      ReplaceGenerics();
+      mFailed = !EvaluateConstants(mModule, mDiag);
+    }
+    return !mFailed;
+  }
+
+private:
+  Module &mModule;
+  const std::vector<std::string> &mExtraExports;
+  std::ostream &mDiag;
+  bool mFailed = false;
+
+  // Where each top-level name came from, for duplicate reports
+  std::unordered_map<std::string, std::string> mOrigins;
+  // Struct layouts by name, local and imported
+  std::unordered_map<std::string, const StructDefinition *> mStructs;
+  // Procedure signatures by name, local and imported
+  std::unordered_map<std::string, const ProcedurePrototype *> mPrototypes;
+  // Local constants by name
+  std::unordered_map<std::string, const ConstDefinition *> mConstants;
+  // Local procedures marked #pure; imported ones carry no annotations
+  std::unordered_set<std::string> mPureProcedures;
+  // Local #coroutine procedures
+  std::unordered_set<std::string> mCoroutines;
+  // Local generic procedures, and the instances made of them so far
+  std::unordered_map<std::string, const ProcedureDefinition *> mGenerics;
+  GenericInstances mInstances;
+  // Instances still to be checked, with how deeply they were asked for
+  std::vector<std::pair<const ProcedureDefinition *, int>> mPendingInstances;
+  int mInstanceDepth = 0;
+  // The instance each call to a generic procedure goes to
+  std::unordered_map<const CallExpression *, std::string> mInstanceCallees;
+  // Local procedures with the C calling convention, the others get fastcc.
+  // Codegen keeps the extra exports external too.
+  std::unordered_set<std::string> mExported;
+  // Types of the local variables of the procedure being checked
+  std::unordered_map<std::string, std::string> mLocals;
+  // Variables of the enclosing for loops
+  std::unordered_set<std::string> mLoopVariables;
+  // Variables the body of the enclosing parallel loop shares with the code
+  // around it. Assigning them would race with other iterations.
+  std::unordered_set<std::string> mSharedVariables;
+  bool mInParallelLoop = false;
+  // Whether the procedure is #pure, and so may only call #pure procedures
+  bool mInPure = false;
+  // Whether the procedure is a #coroutine, which may yield and await
+  bool mInCoroutine = false;
+  const ProcedurePrototype *mProto = nullptr;
+  std::string mProcName;
+
+  void Error(const std::string &message) {
+    mDiag << "[Check Error] " << mModule.Name() << ": " << message << '\n';
+    mFailed = true;
+  }
+
+  void Declare(const std::string &name, const std::string &origin) {
+    auto [it, inserted] = mOrigins.emplace(name, origin);
+    if (inserted)
+      return;
+    if (it->second == origin)
+      Error("'" + name + "' is declared more than once in " + origin);
+    else
+      Error("'" + name + "' is declared by both " + it->second + " and " + origin);
+  }
+
+  void CollectNames() {
+    for (const auto &decl : mModule.TopLevelDecls()) {
+      switch (decl->mDeclKind) {
+      case TopLevelDeclaration::PROC_DEF: {
+        auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+        Declare(pdef->Prototype()->Name(), "this module");
+        mPrototypes.emplace(pdef->Prototype()->Name(), pdef->Prototype().get());
+        if (pdef->FindAnnotation("pure"))
+          mPureProcedures.insert(pdef->Prototype()->Name());
+        if (pdef->FindAnnotation("coroutine"))
+          mCoroutines.insert(pdef->Prototype()->Name());
+        if (pdef->Prototype()->IsGeneric())
+          mGenerics.emplace(pdef->Prototype()->Name(), pdef);
+        break;
+      }
+      case TopLevelDeclaration::STRUCT_DEF: {
+        auto sdef = static_cast<const StructDefinition *>(decl.get());
+        Declare(sdef->Name(), "this module");
+        mStructs.emplace(sdef->Name(), sdef);
+        break;
+      }
+      case TopLevelDeclaration::CONST_DEF: {
+        auto cdef = static_cast<const ConstDefinition *>(decl.get());
+        Declare(cdef->Name(), "this module");
+        mConstants.emplace(cdef->Name(), cdef);
+        break;
+      }
+      case TopLevelDeclaration::USE_DECL: {
+        auto use = static_cast<const UseDeclaration *>(decl.get());
+        const ModuleInterface *interface = use->Interface();
+        if (!interface)
+          break;
+        std::string origin = "module '" + use->ModuleName() + "'";
+        for (const auto &proto : interface->procedures) {
+          Declare(proto->Name(), origin);
+          mPrototypes.emplace(proto->Name(), proto.get());
+        }
+        for (const auto &sdef : interface->structs) {
+          Declare(sdef->Name(), origin);
+          mStructs.emplace(sdef->Name(), sdef.get());
+        }
+        break;
+      }
+      default: break;
+      };
+    }
+  }
+
+  static std::string Describe(const TopLevelDeclaration &decl) {
+    switch (decl.mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF:
+      return "procedure '" +
+             static_cast<const ProcedureDefinition &>(decl).Prototype()->Name() + "'";
+    case TopLevelDeclaration::STRUCT_DEF:
+      return "struct '" + static_cast<const StructDefinition &>(decl).Name() + "'";
+    case TopLevelDeclaration::USE_DECL:
+      return "use of '" + static_cast<const UseDeclaration &>(decl).ModuleName() + "'";
+    case TopLevelDeclaration::CONST_DEF:
+      return "constant '" + static_cast<const ConstDefinition &>(decl).Name() + "'";
+    default: return "declaration";
+    };
+  }
+
+  void CheckAnnotations(const TopLevelDeclaration &decl) {
+    std::unordered_set<std::string> seen;
+    for (const auto &annotation : decl.Annotations()) {
+      std::string name = "#" + annotation.name;
+      auto spec = std::find_if(std::begin(kAnnotations), std::end(kAnnotations),
+                               [&](const auto &spec) {
+                                 return annotation.name == spec.name &&
+                                        decl.mDeclKind == spec.kind;
+                               });
+      if (spec == std::end(kAnnotations)) {
+        Error("unknown annotation " + name + " on " + Describe(decl));
+        continue;
+      }
+      if (!seen.insert(annotation.name).second)
+        Error(name + " is given more than once on " + Describe(decl));
+      if (annotation.args.size() != spec->num_args) {
+        Error(name + " on " + Describe(decl) + " takes " +
+              std::to_string(spec->num_args) + " argument(s)");
+        continue;
+      }
+      if (annotation.name == "align") {
+        int n = annotation.args[0];
+        if (n <= 0 || (n & (n - 1)) || n > kMaxAlignment)
+          Error("#align(" + std::to_string(n) + ") on " + Describe(decl) +
+                " is not a power of two up to " + std::to_string(kMaxAlignment));
+      }
+    }
+    for (const auto &[a, b] : kConflictingAnnotations) {
+      if (seen.count(a) && seen.count(b))
+        Error(std::string("#") + a + " and #" + b + " are both given on " + Describe(decl));
+    }
+  }
+
+  void CheckType(const std::string &type, const std::string &context) {
+    std::string base = BaseTypeName(type);
+    if (std::string value; SplitAtomicType(base, value)) {
+      const BuiltinType *builtin = FindBuiltinType(value);
+      if (!IsArithmeticType(value) || builtin->lanes)
+        Error("'" + base + "' in " + context + " is not atomic<T> of an int or float scalar");
+      return;
+    }
+    if (std::string yield; SplitCoroutineType(base, yield)) {
+      if (base != type)
+        Error("'" + type + "' in " + context + " is an array of coroutines");
+      std::string value;
+      if (ContainsAtomic(yield) || SplitCoroutineType(yield, value))
+        Error("'" + base + "' in " + context + " cannot yield '" + yield + "'");
+      else if (!yield.empty())
+        CheckType(yield, context);
+      return;
+    }
+    if (!FindBuiltinType(base) && !mStructs.count(base))
+      Error("unknown type '" + base + "' in " + context);
+  }
+
+  void CheckBody(const ProcedureDefinition &pdef) {
+    const ProcedurePrototype &proto = *pdef.Prototype();
+    mProto = &proto;
+    mProcName = proto.Name();
+    mLocals.clear();
+    mLoopVariables.clear();
+    mSharedVariables.clear();
+    mInParallelLoop = false;
+    mInPure = pdef.FindAnnotation("pure") != nullptr;
+    mInCoroutine = mCoroutines.count(mProcName) != 0;
+    if (mInCoroutine && mProcName == "main")
+      Error("'main' cannot be a #coroutine");
+    for (const auto &arg : proto.Args()) {
+      mLocals.emplace(arg.name, arg.type);
+    }
+    if (!pdef.BodyBlock())
+      return;
+    CheckBlock(*pdef.BodyBlock());
+  }
+
+  // Variables declared in `block` go out of scope at its end. They may not
+  // shadow variables that are still visible.
+  void CheckBlock(const Block &block) {
+    auto outer = mLocals;
+    for (const auto &stmt : block.Statements()) {
+      CheckStatement(*stmt);
+    }
+    mLocals = std::move(outer);
+  }
+
+  void CheckStatement(const Statement &stmt) {
+    switch (stmt.mStmtKind) {
+    case Statement::RETURN: {
+      auto ret = static_cast<const ReturnStatement *>(&stmt);
+      if (mInParallelLoop)
+        Error("cannot return from a parallel loop in '" + mProcName + "'");
+      if (mInCoroutine) {
+        Error("cannot return from #coroutine '" + mProcName +
+              "', it yields its values and ends at the end of its body");
+        break;
+      }
+      std::string type = TypeOf(*ret->mReturnExpr);
+      CheckTailCall(*ret);
+      if (type.empty() || Matches(*ret->mReturnExpr, type, mProto->ReturnType()))
+        break;
+      if (mProto->ReturnType().empty())
+        Error("'" + mProcName + "' has no return type but returns '" + type + "'");
+      else
+        Error("'" + mProcName + "' returns '" + type + "' but is declared to return '" +
+              mProto->ReturnType() + "'");
+      break;
+    }
+    case Statement::YIELD: {
+      auto yield = static_cast<const YieldStatement *>(&stmt);
+      if (!mInCoroutine) {
+        Error("cannot yield in '" + mProcName + "', which is not a #coroutine");
+        break;
+      }
+      if (mInParallelLoop)
+        Error("cannot yield from a parallel loop in '" + mProcName + "'");
+      const std::string &expected = mProto->ReturnType();
+      if (!yield->mValue) {
+        if (!expected.empty())
+          Error("'" + mProcName + "' yields '" + expected + "' but yield has no value");
+        break;
+      }
+      std::string type = TypeOf(*yield->mValue);
+      if (type.empty() || (!expected.empty() && Matches(*yield->mValue, type, expected)))
+        break;
+      if (expected.empty())
+        Error("'" + mProcName + "' has no yield type but yields '" + type + "'");
+      else
+        Error("'" + mProcName + "' yields '" + type + "' but is declared to yield '" +
+              expected + "'");
+      break;
+    }
+    case Statement::LET: {
+      auto let = static_cast<const LetStatement *>(&stmt);
+      CheckType(let->mType, "variable '" + let->mName + "' in '" + mProcName + "'");
+      if (std::string yield; SplitCoroutineType(let->mType, yield)) {
+        // A handle owns its coroutine and destroys it at the end of the
+        // block, so it is never copied
+        auto init = let->mInit && let->mInit->mExprKind == Expression::CALL
+                      ? static_cast<const CallExpression *>(let->mInit.get())
+                      : nullptr;
+        if (!init || init->mAwait || !mCoroutines.count(init->mCallee))
+          Error("coroutine '" + let->mName + "' in '" + mProcName +
+                "' must be initialized by calling a #coroutine procedure");
+      }
+      if (let->mInit) {
+        // An atomic starts out with a value of the type it holds
+        std::string expected = let->mType;
+        if (!SplitAtomicType(let->mType, expected) && ContainsAtomic(let->mType)) {
+          Error("cannot initialize '" + let->mName + "' of type '" + let->mType + "' in '" +
+                mProcName + "', it contains atomics and would be copied");
+          DeclareLocal(let->mName, let->mType);
+          break;
+        }
+        std::string type = TypeOf(*let->mInit);
+        if (!type.empty() && !Matches(*let->mInit, type, expected))
+          Error("cannot initialize '" + let->mName + "' of type '" + let->mType +
+                "' with '" + type + "' in '" + mProcName + "'");
+      }
+      DeclareLocal(let->mName, let->mType);
+      break;
+    }
+    case Statement::ASSIGN: {
+      auto assign = static_cast<const AssignStatement *>(&stmt);
+      if (!IsLvalue(*assign->mTarget)) {
+        Error("cannot assign to a value that is not a variable in '" + mProcName + "'");
+        break;
+      }
+      CheckNotLoopVariable(*assign->mTarget);
+      CheckNotConstant(*assign->mTarget);
+      CheckNotShared(*assign->mTarget);
+      std::string target = TypeOf(*assign->mTarget);
+      std::string value = TypeOf(*assign->mValue);
+      if (std::string atomic; SplitAtomicType(target, atomic)) {
+        Error("cannot assign to '" + target + "' in '" + mProcName + "', use atomic_store()");
+        break;
+      }
+      if (ContainsAtomic(target)) {
+        Error("cannot assign to '" + target + "' in '" + mProcName +
+              "', it contains atomics and would be copied");
+        break;
+      }
+      if (std::string yield; SplitCoroutineType(target, yield)) {
+        Error("cannot assign to '" + target + "' in '" + mProcName + "'");
+        break;
+      }
+      if (!target.empty() && !value.empty() && !Matches(*assign->mValue, value, target))
+        Error("cannot assign '" + value + "' to '" + target + "' in '" + mProcName + "'");
+      break;
+    }
+    case Statement::EXPR: {
+      auto expr = static_cast<const ExpressionStatement *>(&stmt);
+      if (expr->mExpr->mExprKind != Expression::CALL)
+        Error("expression result is unused in '" + mProcName + "'");
+      std::string type = TypeOf(*expr->mExpr);
+      if (std::string yield; SplitCoroutineType(type, yield))
+        Error("coroutine created by calling '" +
+              static_cast<const CallExpression &>(*expr->mExpr).mCallee + "' in '" + mProcName +
+              "' is never run, keep it in a variable or spawn() it");
+      break;
+    }
+    case Statement::WHILE: {
+      auto loop = static_cast<const WhileStatement *>(&stmt);
+      CheckLoopAnnotations(*loop, false);
+      std::string cond = TypeOf(*loop->mCond);
+      if (!cond.empty() && cond != "bool")
+        Error("while condition is '" + cond + "' in '" + mProcName + "', expected 'bool'");
+      CheckBlock(*loop->mBody);
+      break;
+    }
+    case Statement::FOR: {
+      auto loop = static_cast<const ForStatement *>(&stmt);
+      CheckLoopAnnotations(*loop, loop->mParallel);
+      std::string begin = TypeOf(*loop->mBegin);
+      std::string end = TypeOf(*loop->mEnd);
+      std::string type = loop->mType;
+      if (!type.empty())
+        CheckType(type, "loop variable '" + loop->mVar + "' in '" + mProcName + "'");
+      else
+        type = IsUntypedConstant(*loop->mBegin) ? end : begin;
+
+      const BuiltinType *builtin = FindBuiltinType(type);
+      if (!type.empty() && (!builtin || builtin->kind != BuiltinType::INT || builtin->lanes)) {
+        Error("loop variable '" + loop->mVar + "' is '" + type + "' in '" + mProcName +
+              "', expected an int");
+      } else if (!type.empty()) {
+        if (!begin.empty() && !Matches(*loop->mBegin, begin, type))
+          Error("loop over '" + type + "' starts at '" + begin + "' in '" + mProcName + "'");
+        if (!end.empty() && !Matches(*loop->mEnd, end, type))
+          Error("loop over '" + type + "' ends at '" + end + "' in '" + mProcName + "'");
+      }
+
+      std::unordered_set<std::string> reduced = CheckReductions(*loop);
+      auto outer_shared = mSharedVariables;
+      bool outer_parallel = mInParallelLoop;
+      if (loop->mParallel) {
+        for (const auto &[name, type] : mLocals) {
+          if (!reduced.count(name))
+            mSharedVariables.insert(name);
+        }
+        mInParallelLoop = true;
+      }
+
+      auto outer = mLocals;
+      DeclareLocal(loop->mVar, type);
+      mLoopVariables.insert(loop->mVar);
+      CheckBlock(*loop->mBody);
+      mLoopVariables.erase(loop->mVar);
+      mLocals = std::move(outer);
+      mSharedVariables = std::move(outer_shared);
+      mInParallelLoop = outer_parallel;
+      break;
+    }
+    default: break;
+    };
+  }
+
+  void DeclareLocal(const std::string &name, const std::string &type) {
+    if (!mLocals.emplace(name, type).second)
+      Error("variable '" + name + "' is declared more than once in '" + mProcName + "'");
+  }
+
+  // For loops count their variable themselves
+  void CheckNotLoopVariable(const Expression &target) {
+    if (target.mExprKind != Expression::IDENTIFIER)
+      return;
+    auto &ident = static_cast<const Identifier &>(target);
+    if (mLoopVariables.count(ident.mName))
+      Error("cannot assign to loop variable '" + ident.mName + "' in '" + mProcName + "'");
+  }
+
+  // Constants are read-only data, as are their elements and members
+  void CheckNotConstant(const Expression &target) {
+    const Expression *root = &target;
+    while (root->mExprKind != Expression::IDENTIFIER) {
+      if (root->mExprKind == Expression::INDEX)
+        root = static_cast<const IndexExpression *>(root)->mBase.get();
+      else if (root->mExprKind == Expression::MEMBER)
+        root = static_cast<const MemberExpression *>(root)->mBase.get();
+      else
+        return;
+    }
+    auto &ident = static_cast<const Identifier &>(*root);
+    if (!mLocals.count(ident.mName) && mConstants.count(ident.mName))
+      Error("cannot assign to constant '" + ident.mName + "' in '" + mProcName + "'");
+  }
+
+  // Returns the names of the variables `loop` reduces
+  std::unordered_set<std::string> CheckReductions(const ForStatement &loop) {
+    std::unordered_set<std::string> reduced;
+    if (!loop.mReductions.empty() && !loop.mParallel)
+      Error("reduce() on a loop that is not parallel in '" + mProcName + "'");
+    for (const auto &reduction : loop.mReductions) {
+      const std::string &name = reduction.var;
+      auto it = mLocals.find(name);
+      if (it == mLocals.end()) {
+        Error("unknown variable '" + name + "' in reduce() in '" + mProcName + "'");
+        continue;
+      }
+      if (!reduced.insert(name).second)
+        Error("'" + name + "' is reduced more than once in '" + mProcName + "'");
+      if (mLoopVariables.count(name))
+        Error("cannot reduce loop variable '" + name + "' in '" + mProcName + "'");
+      if (mSharedVariables.count(name))
+        Error("cannot reduce '" + name + "', which is shared by the enclosing parallel loop, in '" +
+              mProcName + "'");
+      const BuiltinType *builtin = FindBuiltinType(it->second);
+      if (!IsArithmeticType(it->second) || builtin->lanes)
+        Error("cannot reduce '" + name + "' of type '" + it->second + "' with " +
+              GetReductionOpName(reduction.op) + " in '" + mProcName + "'");
+    }
+    return reduced;
+  }
+
+  // Variables declared outside a parallel loop are shared by all of its
+  // iterations. Their elements and members may still be assigned, as long as
+  // iterations do not assign the same ones.
+  void CheckNotShared(const Expression &target) {
+    if (target.mExprKind != Expression::IDENTIFIER)
+      return;
+    auto &ident = static_cast<const Identifier &>(target);
+    if (mSharedVariables.count(ident.mName))
+      Error("assigning '" + ident.mName + "' in a parallel loop races with other iterations in '" +
+            mProcName + "', reduce() it instead");
+  }
+
+  // #tail asks for a guaranteed tail call. LLVM's musttail only replaces the
+  // caller's frame with the callee's when both take the same parameters and
+  // agree on the calling convention, so anything else is an error.
+  void CheckTailCall(const ReturnStatement &ret) {
+    std::unordered_set<std::string> seen;
+    for (const auto &annotation : ret.mAnnotations) {
+      std::string name = "#" + annotation.name;
+      if (annotation.name != "tail")
+        Error("unknown annotation " + name + " on return in '" + mProcName + "'");
+      else if (!seen.insert(annotation.name).second)
+        Error(name + " is given more than once on return in '" + mProcName + "'");
+      else if (!annotation.args.empty())
+        Error(name + " on return in '" + mProcName + "' takes 0 argument(s)");
+    }
+    if (!ret.FindAnnotation("tail"))
+      return;
+    // Coroutines of the caller are destroyed after the call returns
+    for (const auto &[name, type] : mLocals) {
+      if (std::string yield; SplitCoroutineType(type, yield)) {
+        Error("cannot tail call from '" + mProcName + "' while coroutine '" + name +
+              "' is alive");
+        return;
+      }
+    }
+
+    const Expression &expr = *ret.mReturnExpr;
+    auto it = expr.mExprKind == Expression::CALL
+                ? mPrototypes.find(CalleeOf(static_cast<const CallExpression &>(expr)))
+                : mPrototypes.end();
+    if (it == mPrototypes.end()) {
+      Error("#tail return in '" + mProcName + "' does not return a call to a procedure");
+      return;
+    }
+    const ProcedurePrototype &callee = *it->second;
+    std::string prefix = "cannot tail call '" + callee.Name() + "' from '" + mProcName + "': ";
+    const auto &args = mProto->Args();
+    const auto &callee_args = callee.Args();
+    if (args.size() != callee_args.size()) {
+      Error(prefix + "'" + callee.Name() + "' takes " + std::to_string(callee_args.size()) +
+            " parameter(s) but '" + mProcName + "' takes " + std::to_string(args.size()));
+      return;
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+      if (CanonicalTypeName(args[i].type) != CanonicalTypeName(callee_args[i].type)) {
+        Error(prefix + "parameter " + std::to_string(i + 1) + " is '" + callee_args[i].type +
+              "' in '" + callee.Name() + "' but '" + args[i].type + "' in '" + mProcName + "'");
+        return;
+      }
+    }
+    // Imported procedures are exported from their own module
+    bool caller_c = mExported.count(mProcName);
+    bool callee_c = mOrigins[callee.Name()] != "this module" || mExported.count(callee.Name());
+    if (caller_c != callee_c)
+      Error(prefix + "'" + (caller_c ? mProcName : callee.Name()) +
+            "' is external and uses the C calling convention, '" +
+            (caller_c ? callee.Name() : mProcName) + "' is internal and uses fastcc");
+  }
+
+  void CheckLoopAnnotations(const LoopStatement &loop, bool parallel) {
+    std::unordered_set<std::string> seen;
+    const Annotation *schedule = nullptr;
+    for (const auto &annotation : loop.mAnnotations) {
+      std::string name = "#" + annotation.name;
+      auto spec = std::find_if(std::begin(kLoopAnnotations), std::end(kLoopAnnotations),
+                               [&](const auto &spec) { return annotation.name == spec.name; });
+      if (spec == std::end(kLoopAnnotations)) {
+        Error("unknown annotation " + name + " on loop in '" + mProcName + "'");
+        continue;
+      }
+      if (!seen.insert(annotation.name).second)
+        Error(name + " is given more than once on loop in '" + mProcName + "'");
+      if (spec->parallel_only && !parallel) {
+        Error(name + " on a loop that is not parallel in '" + mProcName + "'");
+        continue;
+      }
+      if (spec->parallel_only && schedule && schedule->name != annotation.name)
+        Error(name + " and #" + schedule->name + " are both given on loop in '" + mProcName +
+              "'");
+      if (spec->parallel_only)
+        schedule = &annotation;
+      size_t n = annotation.args.size();
+      if (n < spec->min_args || n > spec->max_args) {
+        std::string expected = std::to_string(spec->min_args);
+        if (spec->max_args != spec->min_args)
+          expected += " to " + std::to_string(spec->max_args);
+        Error(name + " on loop in '" + mProcName + "' takes " + expected + " argument(s)");
+        continue;
+      }
+      if (spec->parallel_only && n == 1 && annotation.args[0] <= 0)
+        Error(name + "(" + std::to_string(annotation.args[0]) + ") on loop in '" + mProcName +
+              "' is not a positive chunk size");
+      if (annotation.name == "vectorize") {
+        int n = annotation.args[0];
+        if (n <= 0 || (n & (n - 1)))
+          Error("#vectorize(" + std::to_string(n) + ") on loop in '" + mProcName +
+                "' is not a power of two");
+      } else if (annotation.name == "unroll") {
+        int n = annotation.args[0];
+        if (n <= 0)
+          Error("#unroll(" + std::to_string(n) + ") on loop in '" + mProcName +
+                "' is not positive");
+      }
+    }
+  }
+
+  // Variables, and elements and members of them
+  static bool IsLvalue(const Expression &expr) {
+    switch (expr.mExprKind) {
+    case Expression::IDENTIFIER: return true;
+    case Expression::INDEX:
+      return IsLvalue(*static_cast<const IndexExpression &>(expr).mBase);
+    case Expression::MEMBER:
+      return IsLvalue(*static_cast<const MemberExpression &>(expr).mBase);
+    default: return false;
+    };
+  }
+
+  // Whether `expr` of type `type` can be used where `expected` is. Untyped
+  // constants take on any int or float type of their kind, and are splatted
+  // across the lanes of vectors. An int literal that does not fit is
+  // reported here, but still matches to avoid a second error.
+  bool Matches(const Expression &expr, const std::string &type, const std::string &expected) {
+    const BuiltinType *builtin = FindBuiltinType(expected);
+    if (!builtin)
+      return CanonicalTypeName(type) == CanonicalTypeName(expected);
+    switch (expr.mExprKind) {
+    case Expression::INT_LITERAL: {
+      if (builtin->kind != BuiltinType::INT)
+        return false;
+      const BuiltinType *scalar = builtin->lanes ? FindBuiltinType(builtin->element) : builtin;
+      auto &intlit = static_cast<const IntegerLiteral &>(expr);
+      bool fits = intlit.mUnsigned ? scalar->bits == 64 && !scalar->is_signed
+                                   : IntFits(*scalar, intlit.mInt);
+      if (!fits)
+        Error((intlit.mUnsigned ? std::to_string(static_cast<uint64_t>(intlit.mInt))
+                                : std::to_string(intlit.mInt)) +
+              " does not fit in '" + expected + "' in '" + mProcName + "'");
+      return true;
+    }
+    case Expression::FLOAT_LITERAL: return builtin->kind == BuiltinType::FLOAT;
+    default:
+      if (IsUntypedConstant(expr))
+        return builtin->kind == FindBuiltinType(type)->kind;
+      return CanonicalTypeName(type) == CanonicalTypeName(expected);
+    };
+  }
+
+  // Returns the type of `expr`, or an empty string after reporting an error
+  std::string TypeOf(const Expression &expr) {
+    switch (expr.mExprKind) {
+    case Expression::INT_LITERAL: return "int";
+    case Expression::FLOAT_LITERAL: return "float";
+    case Expression::STRING_LITERAL: return "string";
+    case Expression::IDENTIFIER: {
+      auto &ident = static_cast<const Identifier &>(expr);
+      if (auto it = mLocals.find(ident.mName); it != mLocals.end())
+        return it->second;
+      if (auto it = mConstants.find(ident.mName); it != mConstants.end())
+        return it->second->Type();
+      Error("unknown variable '" + ident.mName + "' in '" + mProcName + "'");
+      return "";
+    }
+    case Expression::INDEX: {
+      auto &index = static_cast<const IndexExpression &>(expr);
+      std::string base = TypeOf(*index.mBase);
+      std::string index_type = TypeOf(*index.mIndex);
+      const BuiltinType *index_builtin = FindBuiltinType(index_type);
+      if (!index_type.empty() &&
+          (!index_builtin || index_builtin->kind != BuiltinType::INT || index_builtin->lanes))
+        Error("array index of type '" + index_type + "' in '" + mProcName +
+              "', expected an int");
+      std::string element;
+      uint64_t count;
+      if (base.empty())
+        return "";
+      if (const BuiltinType *vector = FindBuiltinType(base); vector && vector->lanes) {
+        element = vector->element;
+        count = vector->lanes;
+      } else if (!SplitArrayType(base, element, count)) {
+        Error("cannot index '" + base + "' in '" + mProcName + "'");
+        return "";
+      }
+      if (index.mIndex->mExprKind == Expression::INT_LITERAL) {
+        int64_t i = static_cast<const IntegerLiteral &>(*index.mIndex).mInt;
+        if (i < 0 || uint64_t(i) >= count)
+          Error("index " + std::to_string(i) + " is out of bounds for '" + base +
+                "' in '" + mProcName + "'");
+      }
+      return element;
+    }
+    case Expression::MEMBER: {
+      auto &member = static_cast<const MemberExpression &>(expr);
+      std::string base = TypeOf(*member.mBase);
+      if (base.empty())
+        return "";
+      auto it = mStructs.find(base);
+      if (it != mStructs.end()) {
+        for (const auto &m : it->second->Members()) {
+          if (m.name == member.mMember)
+            return m.type;
+        }
+      }
+      Error("'" + base + "' has no member '" + member.mMember + "' in '" +
+            mProcName + "'");
+      return "";
+    }
+    case Expression::BINARY: {
+      auto &binary = static_cast<const BinaryExpression &>(expr);
+      std::string lhs = TypeOf(*binary.mLhs);
+      std::string rhs = TypeOf(*binary.mRhs);
+      if (lhs.empty() || rhs.empty())
+        return "";
+      std::string op = GetBinaryOpName(binary.mOp);
+      if (!IsArithmeticType(lhs) || !IsArithmeticType(rhs)) {
+        Error("operator " + op + " needs numbers, not '" + lhs + "' and '" + rhs +
+              "', in '" + mProcName + "'");
+        return "";
+      }
+      std::string type;
+      if (Matches(*binary.mRhs, rhs, lhs))
+        type = lhs;
+      else if (Matches(*binary.mLhs, lhs, rhs))
+        type = rhs;
+      if (!type.empty())
+        return IsComparison(binary.mOp) ? ComparisonResultType(*FindBuiltinType(type))->name
+                                        : type;
+      Error("mismatched operands '" + lhs + "' " + op + " '" + rhs + "' in '" +
+            mProcName + "'");
+      return "";
+    }
+    case Expression::CALL: return TypeOfCall(static_cast<const CallExpression &>(expr));
+    default: return "";
+    };
+  }
+
+  // Checks `arg` against `expected`; returns false after reporting a mismatch
+  bool CheckArgument(const CallExpression &call, size_t i, const std::string &expected) {
+    std::string type = TypeOf(*call.mArgs[i]);
+    return !type.empty() && CheckArgumentType(call, i, type, expected);
+  }
+
+  // Like CheckArgument(), for an argument already found to be `type`
+  bool CheckArgumentType(const CallExpression &call,
+                         size_t i,
+                         const std::string &type,
+                         const std::string &expected) {
+    if (Matches(*call.mArgs[i], type, expected))
+      return true;
+    Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee + "' is '" + type +
+          "', expected '" + expected + "', in '" + mProcName + "'");
+    return false;
+  }
+
+  // The vector type of argument `i`, or nullptr after reporting an error
+  const BuiltinType *VectorArgument(const CallExpression &call, size_t i) {
+    std::string type = TypeOf(*call.mArgs[i]);
+    if (type.empty())
+      return nullptr;
+    const BuiltinType *vector = FindBuiltinType(type);
+    if (vector && vector->lanes)
+      return vector;
+    Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee + "' is '" + type +
+          "', expected a vector, in '" + mProcName + "'");
+    return nullptr;
+  }
+
+  bool CheckArgumentCount(const CallExpression &call, size_t min, size_t max) {
+    size_t n = call.mArgs.size();
+    if (n >= min && n <= max)
+      return true;
+    std::string expected = std::to_string(min);
+    if (max != min)
+      expected += max == SIZE_MAX ? " or more" : " to " + std::to_string(max);
+    Error("'" + call.mCallee + "' takes " + expected + " argument(s), given " +
+          std::to_string(n) + ", in '" + mProcName + "'");
+    return false;
+  }
+
+  // The type held by the atomic the first argument of `call` names, or an
+  // empty string after reporting an error
+  std::string AtomicArgument(const CallExpression &call) {
+    if (!IsLvalue(*call.mArgs[0])) {
+      Error("argument 1 of '" + call.mCallee + "' must be a variable or element, in '" +
+            mProcName + "'");
+      return "";
+    }
+    std::string type = TypeOf(*call.mArgs[0]);
+    if (type.empty())
+      return "";
+    std::string value;
+    if (!SplitAtomicType(type, value)) {
+      Error("argument 1 of '" + call.mCallee + "' is '" + type + "', expected an atomic, in '" +
+            mProcName + "'");
+      return "";
+    }
+    return value;
+  }
+
+  // Argument `i` must name a memory order. Acquire and release orders are
+  // only allowed where `acquire` and `release` say.
+  bool CheckMemoryOrder(const CallExpression &call, size_t i, bool acquire, bool release) {
+    const Expression &arg = *call.mArgs[i];
+    const std::string *name = arg.mExprKind == Expression::IDENTIFIER
+                                ? &static_cast<const Identifier &>(arg).mName
+                                : nullptr;
+    if (!name || std::find(std::begin(kMemoryOrders), std::end(kMemoryOrders), *name) ==
+                   std::end(kMemoryOrders)) {
+      Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee +
+            "' is not a memory order in '" + mProcName +
+            "', expected relaxed, acquire, release, acq_rel or seq_cst");
+      return false;
+    }
+    if ((!acquire && (*name == "acquire" || *name == "acq_rel")) ||
+        (!release && (*name == "release" || *name == "acq_rel"))) {
+      Error("'" + call.mCallee + "' cannot be " + *name + " in '" + mProcName + "'");
+      return false;
+    }
+    return true;
+  }
+
+  // Checks that the first argument of `call` names a coroutine, and sets
+  // `yield` to the type it yields; returns false after reporting an error
+  bool CoroutineArgument(const CallExpression &call, std::string &yield) {
+    // A coroutine created for the call alone would never be destroyed
+    if (call.mArgs[0]->mExprKind != Expression::IDENTIFIER) {
+      Error("argument 1 of '" + call.mCallee + "' must be a coroutine variable, in '" +
+            mProcName + "'");
+      return false;
+    }
+    std::string type = TypeOf(*call.mArgs[0]);
+    if (type.empty())
+      return false;
+    if (!SplitCoroutineType(type, yield)) {
+      Error("argument 1 of '" + call.mCallee + "' is '" + type +
+            "', expected a coroutine, in '" + mProcName + "'");
+      return false;
+    }
+    // Resuming runs the coroutine's body, which must not race with itself
+    auto &ident = static_cast<const Identifier &>(*call.mArgs[0]);
+    if (mSharedVariables.count(ident.mName)) {
+      Error("cannot use coroutine '" + ident.mName + "' in a parallel loop in '" + mProcName +
+            "'");
+      return false;
+    }
+    return true;
+  }
+
+  // Argument `i` must be an int literal from `min` to `max`
+  bool CheckConstantArgument(const CallExpression &call, size_t i, int64_t min, int64_t max) {
+    const Expression &arg = *call.mArgs[i];
+    int64_t value = arg.mExprKind == Expression::INT_LITERAL
+                      ? static_cast<const IntegerLiteral &>(arg).mInt
+                      : min - 1;
+    if (value >= min && value <= max)
+      return true;
+    Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee +
+          "' must be an int literal from " + std::to_string(min) + " to " +
+          std::to_string(max) + ", in '" + mProcName + "'");
+    return false;
+  }
+
+  // The type of argument `i` if it is an int or float scalar or vector of
+  // `kind`, otherwise an empty string after reporting an error
+  std::string NumberArgument(const CallExpression &call, size_t i, BuiltinType::Kind kind) {
+    std::string type = TypeOf(*call.mArgs[i]);
+    if (type.empty())
+      return "";
+    const BuiltinType *builtin = FindBuiltinType(type);
+    if (builtin && builtin->kind == kind)
+      return type;
+    Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee + "' is '" + type +
+          "', expected " + (kind == BuiltinType::INT ? "an int" : "a float") +
+          " or a vector of them, in '" + mProcName + "'");
+    return "";
+  }
+
+  // A masked load or store touches `lanes` consecutive elements from `ptr`
+  // on; `mask` must be an int vector with the same number of lanes.
+  bool CheckMaskedAccess(const CallExpression &call,
+                         size_t ptr,
+                         size_t mask,
+                         const BuiltinType &vector) {
+    if (!IsLvalue(*call.mArgs[ptr])) {
+      Error("argument " + std::to_string(ptr + 1) + " of '" + call.mCallee +
+            "' must be a variable or element, in '" + mProcName + "'");
+      return false;
+    }
+    bool ok = CheckArgument(call, ptr, vector.element);
+    const BuiltinType *mask_type = VectorArgument(call, mask);
+    if (mask_type && (mask_type->kind != BuiltinType::INT || mask_type->lanes != vector.lanes)) {
+      Error("mask of '" + call.mCallee + "' is '" + mask_type->name + "', expected " +
+            std::to_string(vector.lanes) + " int lanes, in '" + mProcName + "'");
+      return false;
+    }
+    if (!ok || !mask_type)
+      return false;
+
+    // Constant indices into arrays can be checked against the array's size
+    auto &target = *call.mArgs[ptr];
+    if (target.mExprKind != Expression::INDEX)
+      return true;
+    auto &index = static_cast<const IndexExpression &>(target);
+    std::string element;
+    uint64_t count;
+    if (index.mIndex->mExprKind != Expression::INT_LITERAL ||
+        !SplitArrayType(TypeOf(*index.mBase), element, count))
+      return true;
+    int64_t i = static_cast<const IntegerLiteral &>(*index.mIndex).mInt;
+    if (uint64_t(i) + vector.lanes > count) {
+      Error("'" + call.mCallee + "' of " + std::to_string(vector.lanes) + " lanes from index " +
+            std::to_string(i) + " is out of bounds in '" + mProcName + "'");
+      return false;
+    }
+    return true;
+  }
+
+  std::string TypeOfCall(const CallExpression &call) {
+    const std::string &callee = call.mCallee;
+
+    if (call.mAwait)
+      return TypeOfAwait(call);
+
+    // Numeric conversions, e.g. f64(x) or u8(x), between scalars
+    if (const BuiltinType *scalar = FindBuiltinType(callee); scalar && !scalar->lanes) {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      std::string type = TypeOf(*call.mArgs[0]);
+      if (type.empty())
+        return "";
+      const BuiltinType *from = FindBuiltinType(type);
+      if (!IsArithmeticType(callee) || !IsArithmeticType(type) || from->lanes) {
+        Error("cannot convert '" + type + "' to '" + callee + "' in '" + mProcName + "'");
+        return "";
+      }
+      return callee;
+    }
+
+    // Vector constructors: one value per lane, or one for all of them
+    if (const BuiltinType *vector = FindBuiltinType(callee)) {
+      if (call.mArgs.size() != 1 && call.mArgs.size() != vector->lanes) {
+        Error("'" + callee + "' takes 1 or " + std::to_string(vector->lanes) +
+              " argument(s), given " + std::to_string(call.mArgs.size()) + ", in '" +
+              mProcName + "'");
+        return "";
+      }
+      bool ok = true;
+      for (size_t i = 0; i < call.mArgs.size(); ++i) {
+        ok &= CheckArgument(call, i, vector->element);
+      }
+      return ok ? callee : "";
+    }
+
+    // shuffle(v, indices...) picks lanes of v; shuffle(a, b, indices...)
+    // picks lanes of a followed by b
+    if (callee == "shuffle") {
+      if (!CheckArgumentCount(call, 2, SIZE_MAX))
+        return "";
+      const BuiltinType *vector = VectorArgument(call, 0);
+      if (!vector)
+        return "";
+      size_t first = 1;
+      if (call.mArgs[1]->mExprKind != Expression::INT_LITERAL) {
+        std::string second = TypeOf(*call.mArgs[1]);
+        if (second.empty())
+          return "";
+        if (CanonicalTypeName(second) != vector->name) {
+          Error("cannot shuffle '" + std::string(vector->name) + "' with '" + second +
+                "' in '" + mProcName + "'");
+          return "";
+        }
+        first = 2;
+      }
+      unsigned num_lanes = vector->lanes * first;
+      for (size_t i = first; i < call.mArgs.size(); ++i) {
+        if (call.mArgs[i]->mExprKind != Expression::INT_LITERAL) {
+          Error("shuffle indices must be int literals in '" + mProcName + "'");
+          return "";
+        }
+        int64_t lane = static_cast<const IntegerLiteral &>(*call.mArgs[i]).mInt;
+        if (lane < 0 || lane >= num_lanes) {
+          Error("shuffle index " + std::to_string(lane) + " is out of bounds for " +
+                std::to_string(num_lanes) + " lanes in '" + mProcName + "'");
+          return "";
+        }
+      }
+      size_t lanes = call.mArgs.size() - first;
+      const BuiltinType *result = FindVectorType(vector->element, lanes);
+      if (!result) {
+        Error("there is no vector of " + std::to_string(lanes) + " '" + vector->element +
+              "' lanes for shuffle in '" + mProcName + "'");
+        return "";
+      }
+      return result->name;
+    }
+
+    // min(a, b) and max(a, b), lane by lane for vectors
+    if (callee == "min" || callee == "max") {
+      if (!CheckArgumentCount(call, 2, 2))
+        return "";
+      std::string lhs = TypeOf(*call.mArgs[0]);
+      std::string rhs = TypeOf(*call.mArgs[1]);
+      if (lhs.empty() || rhs.empty())
+        return "";
+      if (!IsArithmeticType(lhs) || !IsArithmeticType(rhs)) {
+        Error("'" + callee + "' needs numbers, not '" + lhs + "' and '" + rhs + "', in '" +
+              mProcName + "'");
+        return "";
+      }
+      if (Matches(*call.mArgs[1], rhs, lhs))
+        return lhs;
+      if (Matches(*call.mArgs[0], lhs, rhs))
+        return rhs;
+      Error("mismatched arguments '" + lhs + "' and '" + rhs + "' of '" + callee + "' in '" +
+            mProcName + "'");
+      return "";
+    }
+
+    auto atomic = std::find_if(std::begin(kAtomicBuiltins), std::end(kAtomicBuiltins),
+                               [&](const auto &spec) { return callee == spec.name; });
+    if (atomic != std::end(kAtomicBuiltins)) {
+      size_t num_values = atomic->num_values;
+      if (!CheckArgumentCount(call, 1 + num_values, 1 + num_values + atomic->num_orders))
+        return "";
+      std::string value = AtomicArgument(call);
+      bool is_load = callee == "atomic_load";
+      bool is_store = callee == "atomic_store";
+      bool is_cas = callee == "atomic_compare_exchange";
+      bool ok = !value.empty();
+      for (size_t i = 1; i <= num_values && ok; ++i) {
+        // compare_exchange writes the value it found to `expected`
+        if (is_cas && i == 1) {
+          if (!IsLvalue(*call.mArgs[i])) {
+            Error("argument 2 of '" + callee + "' must be a variable or element, in '" +
+                  mProcName + "'");
+            ok = false;
+            continue;
+          }
+          CheckNotLoopVariable(*call.mArgs[i]);
+          CheckNotConstant(*call.mArgs[i]);
+          CheckNotShared(*call.mArgs[i]);
+        }
+        ok &= CheckArgument(call, i, value);
+      }
+      if (ok && (callee == "atomic_fetch_add" || callee == "atomic_fetch_sub") &&
+          !IsArithmeticType(value)) {
+        Error("'" + callee + "' needs a number, not '" + value + "', in '" + mProcName + "'");
+        ok = false;
+      }
+      // Loads cannot release and stores cannot acquire. Neither can a failed
+      // compare_exchange, which only loads.
+      for (size_t i = 1 + num_values; i < call.mArgs.size(); ++i) {
+        bool is_failure = is_cas && i == call.mArgs.size() - 1 && i > 1 + num_values;
+        ok &= CheckMemoryOrder(call, i, !is_store, !is_load && !is_failure);
+      }
+      if (!ok)
+        return "";
+      if (is_store)
+        return "void";
+      return is_cas ? "bool" : value;
+    }
+
+    // atomic_fence(order) orders the memory accesses around it
+    if (callee == "atomic_fence") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      if (!CheckMemoryOrder(call, 0, true, true))
+        return "";
+      auto &order = static_cast<const Identifier &>(*call.mArgs[0]);
+      if (order.mName == "relaxed") {
+        Error("'atomic_fence' cannot be relaxed in '" + mProcName + "'");
+        return "";
+      }
+      return "void";
+    }
+
+    // Bit counts of ints, lane by lane for vectors. ctz() and clz() of 0 are
+    // the number of bits.
+    if (callee == "popcount" || callee == "ctz" || callee == "clz") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      return NumberArgument(call, 0, BuiltinType::INT);
+    }
+
+    // fma(a, b, c) is a * b + c rounded once
+    if (callee == "fma") {
+      if (!CheckArgumentCount(call, 3, 3))
+        return "";
+      // Constants take the type of the first argument that is not one
+      auto typed = std::find_if(call.mArgs.begin(), call.mArgs.end(),
+                                [](const auto &arg) { return !IsUntypedConstant(*arg); });
+      size_t first = typed == call.mArgs.end() ? 0 : typed - call.mArgs.begin();
+      std::string type = NumberArgument(call, first, BuiltinType::FLOAT);
+      if (type.empty())
+        return "";
+      bool ok = true;
+      for (size_t i = 0; i < call.mArgs.size(); ++i) {
+        if (i != first)
+          ok &= CheckArgument(call, i, type);
+      }
+      return ok ? type : "";
+    }
+
+    // expect(x, value) is x, which the optimizer lays out code for as if
+    // it were usually `value`. likely(c) and unlikely(c) do the same for
+    // bools.
+    if (callee == "expect") {
+      if (!CheckArgumentCount(call, 2, 2))
+        return "";
+      std::string type = TypeOf(*call.mArgs[0]);
+      if (type.empty())
+        return "";
+      const BuiltinType *builtin = FindBuiltinType(type);
+      if (!builtin || builtin->lanes ||
+          (builtin->kind != BuiltinType::INT && builtin->kind != BuiltinType::BOOL)) {
+        Error("argument 1 of 'expect' is '" + type + "', expected an int or bool, in '" +
+              mProcName + "'");
+        return "";
+      }
+      if (builtin->kind == BuiltinType::BOOL)
+        return CheckConstantArgument(call, 1, 0, 1) ? type : "";
+      if (call.mArgs[1]->mExprKind != Expression::INT_LITERAL) {
+        Error("argument 2 of 'expect' must be an int literal, in '" + mProcName + "'");
+        return "";
+      }
+      return CheckArgument(call, 1, type) ? type : "";
+    }
+    if (callee == "likely" || callee == "unlikely") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      return CheckArgument(call, 0, "bool") ? "bool" : "";
+    }
+
+    // prefetch(x[, rw[, locality]]) fetches the cache line holding x ahead
+    // of a read (rw 0, the default) or write (rw 1). Locality runs from 0,
+    // used once, to 3, the default, kept in every cache level.
+    if (callee == "prefetch") {
+      if (!CheckArgumentCount(call, 1, 3))
+        return "";
+      if (!IsLvalue(*call.mArgs[0])) {
+        Error("argument 1 of 'prefetch' must be a variable or element, in '" + mProcName +
+              "'");
+        return "";
+      }
+      bool ok = !TypeOf(*call.mArgs[0]).empty();
+      if (call.mArgs.size() > 1)
+        ok &= CheckConstantArgument(call, 1, 0, 1);
+      if (call.mArgs.size() > 2)
+        ok &= CheckConstantArgument(call, 2, 0, 3);
+      return ok ? "void" : "";
+    }
+
+    // assume_aligned(x, N) promises that x is at an address that is a
+    // multiple of N, a power of two
+    if (callee == "assume_aligned") {
+      if (!CheckArgumentCount(call, 2, 2))
+        return "";
+      if (!IsLvalue(*call.mArgs[0])) {
+        Error("argument 1 of 'assume_aligned' must be a variable or element, in '" +
+              mProcName + "'");
+        return "";
+      }
+      bool ok = !TypeOf(*call.mArgs[0]).empty();
+      if (!CheckConstantArgument(call, 1, 1, kMaxAlignment))
+        return "";
+      int64_t alignment = static_cast<const IntegerLiteral &>(*call.mArgs[1]).mInt;
+      if (alignment & (alignment - 1)) {
+        Error("'assume_aligned' to " + std::to_string(alignment) +
+              " is not a power of two in '" + mProcName + "'");
+        return "";
+      }
+      return ok ? "void" : "";
+    }
+
+    // unreachable() promises that it is never run
+    if (callee == "unreachable")
+      return CheckArgumentCount(call, 0, 0) ? "void" : "";
+
+    // resume(c) runs c until it yields or ends, and returns whether it
+    // yielded. done(c) is whether c has ended, yielded(c) the value it
+    // yielded last, zero before the first.
+    if (callee == "resume" || callee == "done" || callee == "yielded") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      std::string yield;
+      if (!CoroutineArgument(call, yield))
+        return "";
+      if (callee != "yielded")
+        return "bool";
+      if (yield.empty())
+        Error("coroutine passed to 'yielded' in '" + mProcName + "' yields no values");
+      return yield;
+    }
+
+    // spawn(p(args...)) hands a new coroutine to the executor, run() resumes
+    // the spawned coroutines in turn until all of them have ended
+    if (callee == "spawn") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      const Expression &arg = *call.mArgs[0];
+      if (arg.mExprKind != Expression::CALL ||
+          !mCoroutines.count(static_cast<const CallExpression &>(arg).mCallee) ||
+          static_cast<const CallExpression &>(arg).mAwait) {
+        Error("argument 1 of 'spawn' must be a call to a #coroutine procedure, in '" +
+              mProcName + "'");
+        return "";
+      }
+      return TypeOf(arg).empty() ? "" : "void";
+    }
+    if (callee == "run") {
+      if (!CheckArgumentCount(call, 0, 0))
+        return "";
+      if (mInCoroutine)
+        Error("cannot run() the executor from #coroutine '" + mProcName +
+              "', which it may be running");
+      if (mInPure)
+        Error("#pure procedure '" + mProcName + "' calls 'run', which is not #pure");
+      return "void";
+    }
+
+    if (callee == "reduce_add" || callee == "reduce_mul" || callee == "reduce_min" ||
+        callee == "reduce_max") {
+      if (!CheckArgumentCount(call, 1, 1))
+        return "";
+      const BuiltinType *vector = VectorArgument(call, 0);
+      return vector ? vector->element : "";
+    }
+
+    // masked_load(src[i], mask, passthru) returns passthru with the lanes
+    // whose mask is nonzero loaded from src[i], src[i + 1], ...
+    if (callee == "masked_load") {
+      if (!CheckArgumentCount(call, 3, 3))
+        return "";
+      const BuiltinType *vector = VectorArgument(call, 2);
+      if (!vector || !CheckMaskedAccess(call, 0, 1, *vector))
+        return "";
+      return vector->name;
+    }
+
+    // masked_store(dst[i], value, mask) stores the lanes of value whose mask
+    // is nonzero to dst[i], dst[i + 1], ...
+    if (callee == "masked_store") {
+      if (!CheckArgumentCount(call, 3, 3))
+        return "";
+      CheckNotLoopVariable(*call.mArgs[0]);
+      CheckNotConstant(*call.mArgs[0]);
+      const BuiltinType *vector = VectorArgument(call, 1);
+      if (!vector || !CheckMaskedAccess(call, 0, 2, *vector))
+        return "";
+      return "void";
+    }
+
+    return TypeOfProcedureCall(call);
+  }
+
+  // A call to a procedure rather than a builtin. Calling a #coroutine
+  // procedure gives a coroutine<T> that has not run yet.
+  std::string TypeOfProcedureCall(const CallExpression &call) {
+    const std::string &callee = call.mCallee;
+    auto it = mPrototypes.find(callee);
+    if (it == mPrototypes.end()) {
+      Error("unknown procedure '" + callee + "' in '" + mProcName + "'");
+      return "";
+    }
+    if (mInPure && !mPureProcedures.count(callee))
+      Error("#pure procedure '" + mProcName + "' calls '" + callee + "', which is not #pure");
+    const ProcedurePrototype *proto = it->second;
+    if (proto->IsGeneric()) {
+      proto = Instantiate(call, *mGenerics.at(callee));
+      if (!proto)
+        return "";
+    } else {
+      size_t num_args = proto->Args().size();
+      if (!CheckArgumentCount(call, num_args, num_args))
+        return "";
+      for (size_t i = 0; i < num_args; ++i) {
+        CheckArgument(call, i, proto->Args()[i].type);
+      }
+    }
+    if (mCoroutines.count(callee)) {
+      if (mInParallelLoop)
+        Error("cannot create coroutine '" + callee + "' in a parallel loop in '" + mProcName +
+              "'");
+      return proto->ReturnType().empty() ? "coroutine" : "coroutine<" + proto->ReturnType() + ">";
+    }
+    return proto->ReturnType().empty() ? "void" : proto->ReturnType();
+  }
+
+  // Infers the type arguments of a call to a generic procedure from the
+  // types of its arguments, and checks the call against the instance for
+  // them. Untyped constants only decide a type parameter no other argument
+  // does, so max(x, 1) takes the type of x. Returns the instance's
+  // prototype, or nullptr after reporting an error.
+  const ProcedurePrototype *Instantiate(const CallExpression &call,
+                                        const ProcedureDefinition &generic) {
+    const ProcedurePrototype &proto = *generic.Prototype();
+    size_t num_args = proto.Args().size();
+    if (!CheckArgumentCount(call, num_args, num_args))
+      return nullptr;
+    std::vector<std::string> types;
+    bool ok = true;
+    for (const auto &arg : call.mArgs) {
+      types.push_back(TypeOf(*arg));
+      ok &= !types.back().empty();
+    }
+    if (!ok)
+      return nullptr;
+
+    TypeBindings bindings;
+    for (bool constants : {false, true}) {
+      for (size_t i = 0; i < num_args; ++i) {
+        if (IsUntypedConstant(*call.mArgs[i]) != constants ||
+            BindTypeParameters(proto.Args()[i].type, types[i], proto.TypeParams(), bindings))
+          continue;
+        Error("argument " + std::to_string(i + 1) + " of '" + call.mCallee + "' is '" +
+              types[i] + "', expected '" + proto.Args()[i].type + "', in '" + mProcName + "'");
+        return nullptr;
+      }
+    }
+    std::vector<std::string> type_args;
+    for (const auto &param : proto.TypeParams()) {
+      auto it = bindings.find(param);
+      if (it == bindings.end()) {
+        Error("cannot infer type parameter '" + param + "' of '" + call.mCallee +
+              "' from its arguments in '" + mProcName + "'");
+        return nullptr;
+      }
+      if (it->second == "void") {
+        Error("type parameter '" + param + "' of '" + call.mCallee + "' cannot be void in '" +
+              mProcName + "'");
+        return nullptr;
+      }
+      type_args.push_back(it->second);
+    }
+    if (mInstanceDepth >= kMaxInstanceDepth) {
+      Error("instantiating '" + call.mCallee + "' in '" + mProcName + "' nests more than " +
+            std::to_string(kMaxInstanceDepth) + " generic instances deep");
+      return nullptr;
+    }
+
+    bool created;
+    ProcedureDefinition &instance = mInstances.Get(generic, type_args, created);
+    const std::string &name = instance.Prototype()->Name();
+    if (created) {
+      mOrigins.emplace(name, "this module");
+      mPrototypes.emplace(name, instance.Prototype().get());
+      if (instance.FindAnnotation("pure"))
+        mPureProcedures.insert(name);
+      if (instance.FindAnnotation("coroutine"))
+        mCoroutines.insert(name);
+      mPendingInstances.emplace_back(&instance, mInstanceDepth + 1);
+    }
+    mInstanceCallees[&call] = name;
+    for (size_t i = 0; i < num_args; ++i) {
+      CheckArgumentType(call, i, types[i], instance.Prototype()->Args()[i].type);
+    }
+    return instance.Prototype().get();
+  }
+
+  // The procedure `call` goes to, which for a generic one is an instance
+  const std::string &CalleeOf(const CallExpression &call) const {
+    auto it = mInstanceCallees.find(&call);
+    return it == mInstanceCallees.end() ? call.mCallee : it->second;
+  }
+
+  // A generic procedure's body is checked for each instance, see
+  // Instantiate(); on its own only its type parameters are
+  void CheckGeneric(const ProcedureDefinition &pdef) {
+    const ProcedurePrototype &proto = *pdef.Prototype();
+    if (proto.Name() == "main")
+      Error("'main' cannot be generic");
+    if (pdef.FindAnnotation("export"))
+      Error("generic procedure '" + proto.Name() +
+            "' cannot be #export, its instances are private to this module");
+    std::unordered_set<std::string> params;
+    for (const auto &param : proto.TypeParams()) {
+      if (!params.insert(param).second)
+        Error("duplicate type parameter '" + param + "' in '" + proto.Name() + "'");
+      if (FindBuiltinType(param) || mOrigins.count(param))
+        Error("type parameter '" + param + "' of '" + proto.Name() +
+              "' has the name of a type or procedure");
+      bool inferred = std::any_of(proto.Args().begin(), proto.Args().end(),
+                                  [&](const auto &arg) { return BaseTypeName(arg.type) == param; });
+      if (!inferred)
+        Error("type parameter '" + param + "' of '" + proto.Name() +
+              "' is not the type of a parameter, so calls cannot infer it");
+    }
+  }
+
+  // Hands the instances to the module, points the calls at them and drops
+  // the generic procedures, so later passes only see ordinary procedures
+  void ReplaceGenerics() {
+    for (auto &instance : mInstances.Take()) {
+      mModule.AddTopLevelDecl(std::move(instance));
+    }
+    CalleeRewriter rewriter(mInstanceCallees);
+    mModule.Accept(rewriter);
+    mModule.RemoveTopLevelDecls([](const TopLevelDeclaration &decl) {
+      return decl.mDeclKind == TopLevelDeclaration::PROC_DEF &&
+             static_cast<const ProcedureDefinition &>(decl).Prototype()->IsGeneric();
+    });
+  }
+
+  // `await p(args...)` is the value p yielded last
+  std::string TypeOfAwait(const CallExpression &call) {
+    if (!mInCoroutine) {
+      Error("cannot await in '" + mProcName + "', which is not a #coroutine");
+      return "";
+    }
+    if (!mCoroutines.count(call.mCallee)) {
+      Error("cannot await '" + call.mCallee + "' in '" + mProcName +
+            "', which is not a #coroutine procedure");
+      return "";
+    }
+    std::string type = TypeOfProcedureCall(call);
+    std::string yield;
+    if (!SplitCoroutineType(type, yield))
+      return "";
+    return yield.empty() ? "void" : yield;
+  }
+
+  void CheckPrototype(const ProcedurePrototype &proto) {
+    std::unordered_set<std::string> args;
+    // Arguments and results are copies, and copying an atomic is not atomic
+    std::string value;
+    for (const auto &arg : proto.Args()) {
+      if (!args.insert(arg.name).second)
+        Error("duplicate parameter '" + arg.name + "' in '" + proto.Name() + "'");
+      CheckType(arg.type, "parameter '" + arg.name + "' of '" + proto.Name() + "'");
+      if (SplitAtomicType(BaseTypeName(arg.type), value))
+        Error("parameter '" + arg.name + "' of '" + proto.Name() + "' cannot be atomic");
+      else if (ContainsAtomic(arg.type))
+        Error("parameter '" + arg.name + "' of '" + proto.Name() + "' cannot be '" +
+              arg.type + "', which contains atomics");
+      // Coroutines are not copied, see the LET case of CheckStatement()
+      if (SplitCoroutineType(BaseTypeName(arg.type), value))
+        Error("parameter '" + arg.name + "' of '" + proto.Name() + "' cannot be a coroutine");
+    }
+    // An empty return type means the procedure returns nothing
+    if (!proto.ReturnType().empty()) {
+      CheckType(proto.ReturnType(), "return type of '" + proto.Name() + "'");
+      if (SplitAtomicType(BaseTypeName(proto.ReturnType()), value))
+        Error("'" + proto.Name() + "' cannot return an atomic");
+      else if (ContainsAtomic(proto.ReturnType()))
+        Error("'" + proto.Name() + "' cannot return '" + proto.ReturnType() +
+              "', which contains atomics");
+      if (SplitCoroutineType(BaseTypeName(proto.ReturnType()), value))
+        Error("'" + proto.Name() + "' cannot return a coroutine");
+    }
+  }
+
+  // The initializer checks like a procedure named after the constant that
+  // returns its type
+  void CheckConstant(const ConstDefinition &cdef) {
+    std::string context = "constant '" + cdef.Name() + "'";
+    CheckType(cdef.Type(), context);
+    std::unordered_set<std::string> seen;
+    if (!IsConstantType(cdef.Type(), seen))
+      Error(context + " cannot be of type '" + cdef.Type() +
+            "', only ints, floats and bools, and vectors, arrays and structs of them");
+    CheckBody(*cdef.Initializer());
+  }
+
+  // Whether `type` can be laid out as read-only data. Unknown types and
+  // struct cycles are reported elsewhere.
+  bool IsConstantType(const std::string &type, std::unordered_set<std::string> &seen) {
+    std::string base = BaseTypeName(type);
+    if (std::string value; SplitAtomicType(base, value) || SplitCoroutineType(base, value))
+      return false;
+    if (const BuiltinType *builtin = FindBuiltinType(base))
+      return builtin->kind != BuiltinType::STRING;
+    auto it = mStructs.find(base);
+    if (it == mStructs.end() || !seen.insert(base).second)
+      return true;
+    for (const auto &member : it->second->Members()) {
+      if (!IsConstantType(member.type, seen))
+        return false;
+    }
+    return true;
+  }
+
+  // Whether `type` is an atomic, or an array or struct with one somewhere
+  // inside. Copying those is not atomic, so they are never copied. Struct
+  // cycles are reported elsewhere.
+  bool ContainsAtomic(const std::string &type, std::unordered_set<std::string> &seen) {
+    std::string base = BaseTypeName(type);
+    if (std::string value; SplitAtomicType(base, value))
+      return true;
+    auto it = mStructs.find(base);
+    if (it == mStructs.end() || !seen.insert(base).second)
+      return false;
+    for (const auto &member : it->second->Members()) {
+      if (ContainsAtomic(member.type, seen))
+        return true;
+    }
+    return false;
+  }
+
+  bool ContainsAtomic(const std::string &type) {
+    std::unordered_set<std::string> seen;
+    return ContainsAtomic(type, seen);
+  }
+
+  void CheckStruct(const StructDefinition &sdef) {
+    std::unordered_set<std::string> members;
+    for (const auto &member : sdef.Members()) {
+      if (!members.insert(member.name).second)
+        Error("duplicate member '" + member.name + "' in struct '" + sdef.Name() + "'");
+      CheckType(member.type, "member '" + sdef.Name() + "." + member.name + "'");
+      if (std::string yield; SplitCoroutineType(BaseTypeName(member.type), yield))
+        Error("member '" + sdef.Name() + "." + member.name + "' cannot be a coroutine");
+    }
+  }
+
+  // Depth-first search over by-value struct members; a back edge is a
+  // struct of infinite size.
+  void CheckStructCycles() {
+    std::unordered_map<std::string, int> state;  // 1 = on stack, 2 = done
+    std::function<void(const StructDefinition &)> visit =
+      [&](const StructDefinition &sdef) {
+        state[sdef.Name()] = 1;
+        for (const auto &member : sdef.Members()) {
+          std::string type = BaseTypeName(member.type);
+          auto it = mStructs.find(type);
+          if (it == mStructs.end())
+            continue;
+          int &s = state[type];
+          if (s == 1) {
+            Error("struct '" + type + "' contains itself through '" +
+                  sdef.Name() + "." + member.name + "'");
+          } else if (s == 0) {
+            visit(*it->second);
+          }
+        }
+        state[sdef.Name()] = 2;
+      };
+
+    for (const auto &decl : mModule.TopLevelDecls()) {
+      if (decl->mDeclKind != TopLevelDeclaration::STRUCT_DEF)
+        continue;
+      auto sdef = static_cast<const StructDefinition *>(decl.get());
+      if (!state[sdef->Name()])
+        visit(*sdef);
+    }
+  }
+};
+
+}  // namespace
+
+bool CheckModule(Module &mod,
+                 const std::vector<std::string> &extra_exports,
+                 std::ostream &diag) {
+  return ModuleChecker(mod, extra_exports, diag).Check();
+}
+
+bool CheckFile(const std::string &input,
+               const CompilerOptions &opts,
+               std::ostream &diag) {
+  if (!std::ifstream(input)) {
+    diag << "[Driver Error] Failed to read '" << input << "'\n";
+    return false;
+  }
+
+  Parser p(input, diag);
+  auto module = p.Parse();
+  if (!module)
+    return false;
+
+  ImportResolver resolver(ImportSearchPaths(input, opts.import_paths), opts, diag);
+  if (!resolver.Resolve(*module))
+    return false;
+
+  return CheckModule(*module, ExtraExports(*module, opts), diag);
+}
+
+}  // namespace charlie
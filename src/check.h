@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace charlie {
+
+// Semantic checks that need no code generation:
+//
+//   - top-level names, including imported ones, are declared once
+//   - struct member names are unique within their struct
+//   - every type named by a member, parameter or return type is a builtin or a struct
+//     declared in or imported into `mod`
+//   - structs do not contain themselves by value
+//   - procedure bodies only use declared variables, members and
+//     procedures, index arrays and vectors with ints, and assign, initialize,
+//     pass and return matching types
+//   - while conditions are bool, for loops count over an int type, and
+//     loop variables are not assigned
+//   - parallel loops do not return or assign variables declared outside
+//     them, except the scalars they reduce()
+//   - atomic<T> holds an int or float scalar, is not copied, and is only
+//     accessed through the atomic_* builtins with valid memory orders
+//   - builtin vector operations get vectors with matching lanes, and
+//     constant shuffle indices in range
+//   - bit counts get ints, fma() floats, and prefetch(), expect() and
+//     assume_aligned() constant hints in range
+//   - annotations are known, apply to the declaration they are on, have
+//     valid arguments, e.g. #align(N) takes a power of two, and do not
+//     contradict each other, like #inline and #noinline
+//   - #pure procedures only call other #pure procedures
+//   - only #coroutine procedures yield and await, yield values of the type
+//     they declare, and do not return; coroutine<T> variables are created
+//     by calling one and are not copied, assigned or used in parallel loops
+//   - calls to generic procedures determine every type parameter, and the
+//     instance for the types they pass checks like any other procedure
+//   - constants hold ints, floats, bools, or vectors, arrays and structs of
+//     them, their initializers return that type, and they are not assigned
+//
+// Generic procedures are instantiated here, once per distinct list of type
+// arguments. If `mod` has no problems, the instances are added to it, calls
+// are pointed at them and the generic procedures are removed. Constants
+// are then evaluated, see EvaluateConstants().
+//
+// `extra_exports` are the procedures code generation keeps external besides
+// ExportedProcedures(), see ExtraExports(). #tail calls between them and
+// internal procedures are rejected, as their calling conventions differ.
+//
+// Problems are reported to `diag`. Returns false if any were found.
+bool CheckModule(Module &mod,
+                 const std::vector<std::string> &extra_exports,
+                 std::ostream &diag);
+
+// Lexes, parses, resolves imports and runs CheckModule() on `input`,
+// without LLVM. Backs `charlie --check` and the charlie-check executable.
+//
+// Returns false if `input` has errors.
+bool CheckFile(const std::string &input,
+               const CompilerOptions &opts,
+               std::ostream &diag);
+
+}  // namespace charlie
@@ -0,0 +1,34 @@
+// charlie-check: `charlie --check` without LLVM.
+//
+// Links only the frontend, so start-up is just process creation, which is
+// what pre-commit hooks running it on every changed file want.
+
+#include "check.h"
+#include "options.h"
+
+#include <iostream>
+
+using namespace charlie;
+
+int main(int argc, char **argv) {
+  CompilerOptions opts;
+  ParseStatus parsed = ParseCommandLine(argc, argv, opts, std::cerr);
+  if (parsed == PARSE_HELP)
+    return 0;
+  if (parsed == PARSE_ERROR) {
+    PrintUsage(argv[0], std::cerr);
+    return 1;
+  }
+  if (opts.inputs.empty()) {
+    std::cerr << "[Driver Error] No inputs\n";
+    return 1;
+  }
+
+  // Code generation options are accepted so the same flags can be passed to
+  // charlie and charlie-check, but only -I affects checking.
+  bool success = true;
+  for (const auto &input : opts.inputs) {
+    success &= CheckFile(input, opts, std::cerr);
+  }
+  return success ? 0 : 1;
+}
@@ -0,0 +1,2029 @@
+#include "codegen.h"
+#include "memory.h"
+#include "reachability.h"
+#include "runtime.h"
+#include "timer.h"
+#include "types.h"
+
+#include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <algorithm>
+#include <numeric>
+
+namespace charlie {
+
+CodegenVisitor::CodegenVisitor() :
+    mOwnedLLVMContext(std::make_unique<llvm::LLVMContext>()),
+    mLLVMContext(*mOwnedLLVMContext), mLLVMIrBuilder(mLLVMContext) {}
+
+CodegenVisitor::CodegenVisitor(llvm::LLVMContext &context) :
+    mLLVMContext(context), mLLVMIrBuilder(mLLVMContext) {}
+
+void CodegenVisitor::SetTarget(std::string triple,
+                               std::string cpu,
+                               std::string features) {
+  mTargetTriple = std::move(triple);
+  mTargetCPU = std::move(cpu);
+  mTargetFeatures = std::move(features);
+}
+
+void CodegenVisitor::SetTargetMachine(llvm::TargetMachine *tm) {
+  mTargetMachine = tm;
+  SetTarget(tm->getTargetTriple().str(),
+            tm->getTargetCPU().str(),
+            tm->getTargetFeatureString().str());
+}
+
+void CodegenVisitor::Optimize(unsigned opt_level) {
+  assert(mLLVMModule);
+
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  // With the profiler on, every pass run shows up in the trace
+  llvm::PassInstrumentationCallbacks pic;
+  std::vector<std::pair<std::string, uint64_t>> pass_stack;
+  TimeProfiler &profiler = TimeProfiler::Get();
+  if (profiler.Enabled()) {
+    pic.registerBeforeNonSkippedPassCallback(
+      [&](llvm::StringRef pass, llvm::Any) {
+        pass_stack.emplace_back(pass.str(), profiler.Now());
+      });
+    auto after = [&](llvm::StringRef) {
+      if (pass_stack.empty())
+        return;
+      auto [name, start] = std::move(pass_stack.back());
+      pass_stack.pop_back();
+      profiler.Record({std::move(name), std::string(), TimeProfiler::PASS, start,
+                       profiler.Now() - start, TimeProfiler::ThreadId(), {}});
+    };
+    pic.registerAfterPassCallback(
+      [after](llvm::StringRef pass, llvm::Any, const llvm::PreservedAnalyses &) {
+        after(pass);
+      });
+    pic.registerAfterPassInvalidatedCallback(
+      [after](llvm::StringRef pass, const llvm::PreservedAnalyses &) {
+        after(pass);
+      });
+  }
+
+  TimeScope scope("optimize", mLLVMModule->getName().str());
+  MemoryPhaseScope mem_scope(MEM_OPTIMIZE);
+  llvm::PassBuilder pb(mTargetMachine, llvm::PipelineTuningOptions(), llvm::None,
+                       profiler.Enabled() ? &pic : nullptr);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  llvm::ModulePassManager mpm;
+  switch (opt_level) {
+  case 0: mpm = pb.buildO0DefaultPipeline(llvm::OptimizationLevel::O0); break;
+  case 1: mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O1); break;
+  case 2: mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2); break;
+  default: mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3); break;
+  }
+  mpm.run(*mLLVMModule, mam);
+}
+
+void CodegenVisitor::Print(llvm::raw_ostream &os) const {
+  assert(mLLVMModule);
+  mLLVMModule->print(os, nullptr);
+}
+
+void CodegenVisitor::EmitBitcode(std::string &out) const {
+  assert(mLLVMModule);
+  TimeScope scope("emit", mLLVMModule->getName().str());
+  MemoryPhaseScope mem_scope(MEM_EMIT);
+  llvm::raw_string_ostream os(out);
+  llvm::WriteBitcodeToFile(*mLLVMModule, os);
+  os.flush();
+}
+
+bool CodegenVisitor::EmitObject(std::string &out, std::string &error) const {
+  assert(mLLVMModule);
+  if (!mTargetMachine) {
+    error = "no target machine";
+    return false;
+  }
+
+  TimeScope scope("emit", mLLVMModule->getName().str());
+  MemoryPhaseScope mem_scope(MEM_EMIT);
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream os(buffer);
+  llvm::legacy::PassManager pm;
+  if (mTargetMachine->addPassesToEmitFile(pm, os, nullptr, llvm::CGFT_ObjectFile)) {
+    error = "target cannot emit object files";
+    return false;
+  }
+  pm.run(*mLLVMModule);
+
+  out.assign(buffer.begin(), buffer.end());
+  return true;
+}
+
+// Size of a struct whose fields have `sizes` and `alignments`, in that
+// order, under C layout rules
+static uint64_t LaidOutSize(const std::vector<uint64_t> &sizes,
+                            const std::vector<uint64_t> &alignments,
+                            uint64_t &alignment) {
+  uint64_t offset = 0;
+  alignment = 1;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    offset = llvm::alignTo(offset, alignments[i]) + sizes[i];
+    alignment = std::max(alignment, alignments[i]);
+  }
+  return llvm::alignTo(offset, alignment);
+}
+
+llvm::Type *CodegenVisitor::GetType(const std::string &name) {
+  if (auto it = mTypes.find(name); it != mTypes.end())
+    return it->second;
+
+  if (const BuiltinType *builtin = FindBuiltinType(name)) {
+    llvm::Type *type = nullptr;
+    if (builtin->lanes) {
+      type = llvm::FixedVectorType::get(GetType(builtin->element), builtin->lanes);
+    } else {
+      switch (builtin->kind) {
+      case BuiltinType::INT: type = llvm::Type::getIntNTy(mLLVMContext, builtin->bits); break;
+      case BuiltinType::FLOAT:
+        type = builtin->bits == 64 ? llvm::Type::getDoubleTy(mLLVMContext)
+                                   : llvm::Type::getFloatTy(mLLVMContext);
+        break;
+      case BuiltinType::BOOL: type = llvm::Type::getInt1Ty(mLLVMContext); break;
+      case BuiltinType::STRING: type = llvm::Type::getInt8PtrTy(mLLVMContext); break;
+      };
+    }
+    mTypes[name] = type;
+    return type;
+  }
+
+  // An atomic is laid out like the value it holds
+  if (std::string value; SplitAtomicType(name, value)) {
+    llvm::Type *type = GetType(value);
+    mTypes[name] = type;
+    return type;
+  }
+
+  // A coroutine is the address of its frame
+  if (std::string yield; SplitCoroutineType(name, yield)) {
+    llvm::Type *type = llvm::Type::getInt8PtrTy(mLLVMContext);
+    mTypes[name] = type;
+    return type;
+  }
+
+  std::string element;
+  uint64_t count;
+  if (!SplitArrayType(name, element, count)) {
+    const LoweredStruct *ls = GetStruct(name);
+    return ls ? ls->type : nullptr;
+  }
+
+  llvm::Type *type = nullptr;
+  if (const LoweredStruct *ls = GetSoaElement(name)) {
+    // One array per field, in the element's field order, so a loop over the
+    // elements touches each field with unit stride. Padding gets an empty one.
+    std::vector<llvm::Type *> streams;
+    for (unsigned field = 0; field < ls->type->getNumElements(); ++field) {
+      streams.push_back(ls->IsPadding(field)
+                          ? llvm::ArrayType::get(llvm::Type::getInt8Ty(mLLVMContext), 0)
+                          : llvm::ArrayType::get(ls->type->getElementType(field), count));
+    }
+    type = llvm::StructType::create(mLLVMContext, streams,
+                                    "soa." + element + "." + std::to_string(count));
+  } else if (llvm::Type *element_type = GetType(element)) {
+    type = llvm::ArrayType::get(element_type, count);
+  }
+  if (type)
+    mTypes[name] = type;
+  return type;
+}
+
+const CodegenVisitor::LoweredStruct *CodegenVisitor::GetSoaElement(const std::string &type) {
+  std::string element;
+  uint64_t count;
+  if (!SplitArrayType(type, element, count))
+    return nullptr;
+  const LoweredStruct *ls = GetStruct(element);
+  return ls && ls->def->FindAnnotation("soa") ? ls : nullptr;
+}
+
+uint64_t CodegenVisitor::GetAlignment(const std::string &type) {
+  uint64_t alignment = mLLVMModule->getDataLayout().getABITypeAlign(GetType(type)).value();
+  // #align(N) raises the alignment of the struct and of arrays of it
+  if (const LoweredStruct *ls = GetStruct(BaseTypeName(type)))
+    alignment = std::max(alignment, ls->alignment);
+  return alignment;
+}
+
+llvm::Constant *CodegenVisitor::GetConstant(const ConstValue &value) {
+  llvm::Type *type = GetType(value.type);
+  std::vector<llvm::Constant *> elements;
+  for (const auto &element : value.elements) {
+    elements.push_back(GetConstant(element));
+  }
+
+  if (const BuiltinType *builtin = FindBuiltinType(value.type)) {
+    if (builtin->lanes)
+      return llvm::ConstantVector::get(elements);
+    if (builtin->kind == BuiltinType::FLOAT)
+      return llvm::ConstantFP::get(type, value.f);
+    return llvm::ConstantInt::get(type, value.i, builtin->is_signed);
+  }
+
+  // A #soa array holds each field's stream, in the element's field order
+  if (GetSoaElement(value.type)) {
+    auto soa = llvm::cast<llvm::StructType>(type);
+    std::vector<llvm::Constant *> streams;
+    for (unsigned field = 0; field < soa->getNumElements(); ++field) {
+      auto stream_type = llvm::cast<llvm::ArrayType>(soa->getElementType(field));
+      if (stream_type->getNumElements() == 0) {
+        streams.push_back(llvm::Constant::getNullValue(stream_type));
+        continue;
+      }
+      std::vector<llvm::Constant *> stream;
+      for (llvm::Constant *element : elements) {
+        stream.push_back(element->getAggregateElement(field));
+      }
+      streams.push_back(llvm::ConstantArray::get(stream_type, stream));
+    }
+    return llvm::ConstantStruct::get(soa, streams);
+  }
+  if (auto array = llvm::dyn_cast<llvm::ArrayType>(type))
+    return llvm::ConstantArray::get(array, elements);
+
+  // Members go to their fields, and the padding #align may add is zero
+  const LoweredStruct *ls = GetStruct(value.type);
+  std::vector<llvm::Constant *> fields(ls->type->getNumElements());
+  for (size_t i = 0; i < elements.size(); ++i) {
+    fields[ls->field_index[i]] = elements[i];
+  }
+  for (unsigned field = 0; field < fields.size(); ++field) {
+    if (!fields[field])
+      fields[field] = llvm::Constant::getNullValue(ls->type->getElementType(field));
+  }
+  return llvm::ConstantStruct::get(ls->type, fields);
+}
+
+const CodegenVisitor::LoweredStruct *CodegenVisitor::GetStruct(const std::string &name) {
+  if (auto it = mStructs.find(name); it != mStructs.end())
+    return &it->second;
+  auto it = mStructDefs.find(name);
+  return it == mStructDefs.end() ? nullptr : LowerStruct(*it->second);
+}
+
+const CodegenVisitor::LoweredStruct *
+CodegenVisitor::LowerStruct(const StructDefinition &sdef) {
+  const llvm::DataLayout &dl = mLLVMModule->getDataLayout();
+  const auto &members = sdef.Members();
+
+  // Member structs are lowered first. CheckModule() has rejected unknown
+  // types and structs that contain themselves. A member's alignment is
+  // GetAlignment()'s, so one whose struct is #align(N) is N-aligned.
+  std::vector<llvm::Type *> member_types;
+  std::vector<uint64_t> member_sizes, member_alignments;
+  uint64_t member_bytes = 0;
+  for (const auto &member : members) {
+    llvm::Type *type = GetType(member.type);
+    if (!type)
+      return nullptr;
+    member_types.push_back(type);
+    member_sizes.push_back(dl.getTypeAllocSize(type));
+    member_alignments.push_back(GetAlignment(member.type));
+    member_bytes += member_sizes.back();
+  }
+
+  // With power-of-two alignments and sizes that are multiples of them,
+  // decreasing alignment order leaves no padding between fields. The sort is
+  // stable so equally aligned fields keep their declared order.
+  std::vector<unsigned> order(members.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (!sdef.FindAnnotation("packed_order")) {
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return member_alignments[a] > member_alignments[b];
+    });
+  }
+
+  // LLVM places a field by its type's ABI alignment, which does not know
+  // about #align. Where a member needs more, an i8 array field pads up to
+  // its offset, so field_index counts these too.
+  LoweredStruct ls;
+  ls.def = &sdef;
+  ls.field_index.resize(members.size());
+  ls.alignment = 1;
+  std::vector<llvm::Type *> fields;
+  uint64_t offset = 0, abi_alignment = 1;
+  auto pad = [&](uint64_t bytes) {
+    fields.push_back(llvm::ArrayType::get(llvm::Type::getInt8Ty(mLLVMContext), bytes));
+  };
+  for (unsigned member : order) {
+    uint64_t abi = dl.getABITypeAlign(member_types[member]).value();
+    uint64_t aligned = llvm::alignTo(offset, member_alignments[member]);
+    if (aligned > llvm::alignTo(offset, abi))
+      pad(aligned - offset);
+    ls.field_index[member] = fields.size();
+    fields.push_back(member_types[member]);
+    offset = aligned + member_sizes[member];
+    ls.alignment = std::max(ls.alignment, member_alignments[member]);
+    abi_alignment = std::max(abi_alignment, abi);
+  }
+
+  uint64_t declared_alignment;
+  ls.declared_order_size = LaidOutSize(member_sizes, member_alignments, declared_alignment);
+
+  // #align(N) rounds the size up to N as well, so neighbouring array
+  // elements never share an N-byte line
+  if (const Annotation *align = sdef.FindAnnotation("align"))
+    ls.alignment = std::max<uint64_t>(ls.alignment, align->args[0]);
+  ls.size = llvm::alignTo(offset, ls.alignment);
+  ls.declared_order_size = llvm::alignTo(ls.declared_order_size, ls.alignment);
+  // Tail padding LLVM would not add by itself
+  if (ls.alignment > abi_alignment && ls.size > offset)
+    pad(ls.size - offset);
+  ls.padding = ls.size - member_bytes;
+
+  ls.type = llvm::StructType::create(mLLVMContext, fields, "struct." + sdef.Name());
+  assert(dl.getTypeAllocSize(ls.type) == ls.size);
+
+  mTypes[sdef.Name()] = ls.type;
+  return &mStructs.emplace(sdef.Name(), std::move(ls)).first->second;
+}
+
+void CodegenVisitor::PrintLayoutReport(std::ostream &os) const {
+  assert(mLLVMModule);
+  const llvm::DataLayout &dl = mLLVMModule->getDataLayout();
+  for (const auto &name : mLocalStructs) {
+    auto it = mStructs.find(name);
+    if (it == mStructs.end())
+      continue;
+    const LoweredStruct &ls = it->second;
+    os << "[Layout] " << mLLVMModule->getName().str() << ": struct " << name
+       << ": " << ls.size << " bytes, align " << ls.alignment << ", "
+       << ls.padding << " bytes padding";
+    if (ls.declared_order_size != ls.size)
+      os << " (" << ls.declared_order_size << " bytes in declared order)";
+    os << '\n';
+
+    // Members in memory order
+    const auto &members = ls.def->Members();
+    const llvm::StructLayout *sl = dl.getStructLayout(ls.type);
+    std::vector<unsigned> by_offset(members.size());
+    std::iota(by_offset.begin(), by_offset.end(), 0);
+    std::sort(by_offset.begin(), by_offset.end(),
+              [&](unsigned a, unsigned b) { return ls.field_index[a] < ls.field_index[b]; });
+    for (unsigned i : by_offset) {
+      const auto &member = members[i];
+      unsigned field = ls.field_index[i];
+      os << "  +" << sl->getElementOffset(field) << '\t' << member.name << ": "
+         << member.type << " ("
+         << dl.getTypeAllocSize(ls.type->getElementType(field)) << " bytes)\n";
+    }
+  }
+}
+
+void CodegenVisitor::Visit(Module &mod) {
+  MemoryPhaseScope mem_scope(MEM_CODEGEN);
+  mLLVMModule = std::make_unique<llvm::Module>(mod.Name(), mLLVMContext);
+  mLLVMModule->setTargetTriple(mTargetTriple.empty()
+                                 ? llvm::sys::getDefaultTargetTriple()
+                                 : mTargetTriple);
+  if (mTargetMachine)
+    mLLVMModule->setDataLayout(mTargetMachine->createDataLayout());
+
+  mTypes.clear();
+  mStructs.clear();
+  mStructDefs.clear();
+  mLocalStructs.clear();
+  mPrototypes.clear();
+  mCoroutines.clear();
+  mConstants.clear();
+  mExports = ExportedProcedures(mod, {});
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind == TopLevelDeclaration::PROC_DEF) {
+      auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+      mPrototypes.emplace(pdef->Prototype()->Name(), pdef->Prototype().get());
+      if (pdef->FindAnnotation("coroutine"))
+        mCoroutines.insert(pdef->Prototype()->Name());
+    } else if (decl->mDeclKind == TopLevelDeclaration::STRUCT_DEF) {
+      auto sdef = static_cast<const StructDefinition *>(decl.get());
+      mStructDefs.emplace(sdef->Name(), sdef);
+      mLocalStructs.push_back(sdef->Name());
+    } else if (decl->mDeclKind == TopLevelDeclaration::USE_DECL) {
+      auto use = static_cast<const UseDeclaration *>(decl.get());
+      if (!use->Interface())
+        continue;
+      for (const auto &sdef : use->Interface()->structs) {
+        mStructDefs.emplace(sdef->Name(), sdef.get());
+      }
+      for (const auto &proto : use->Interface()->procedures) {
+        mPrototypes.emplace(proto->Name(), proto.get());
+      }
+    }
+  }
+
+  // Everything is declared before any body, so calls and constants may go
+  // forward. This walks the declarations rather than mPrototypes to keep the
+  // IR in source order.
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind == TopLevelDeclaration::PROC_DEF) {
+      auto pdef = static_cast<ProcedureDefinition *>(decl.get());
+      pdef->Prototype()->Accept(*this);
+      SetProcedureAttributes(*pdef, *mLLVMFunction);
+    } else if (decl->mDeclKind == TopLevelDeclaration::CONST_DEF) {
+      static_cast<ConstDefinition *>(decl.get())->Accept(*this);
+    } else if (decl->mDeclKind == TopLevelDeclaration::USE_DECL) {
+      auto use = static_cast<const UseDeclaration *>(decl.get());
+      if (!use->Interface())
+        continue;
+      for (const auto &proto : use->Interface()->procedures) {
+        proto->Accept(*this);
+      }
+    }
+  }
+
+  for (const auto &decl : mod.TopLevelDecls()) {
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF: {
+      auto pdef = static_cast<ProcedureDefinition *>(decl.get());
+      TimeScope scope("codegen", pdef->Prototype()->Name());
+      pdef->Accept(*this);
+      break;
+    }
+    case TopLevelDeclaration::STRUCT_DEF: {
+      auto sdef = static_cast<StructDefinition *>(decl.get());
+      TimeScope scope("codegen", sdef->Name());
+      sdef->Accept(*this);
+      break;
+    }
+    case TopLevelDeclaration::USE_DECL: {
+      auto use = static_cast<UseDeclaration *>(decl.get());
+      TimeScope scope("codegen", use->ModuleName());
+      use->Accept(*this);
+      break;
+    }
+    default: break;
+    };
+  }
+}
+
+void CodegenVisitor::Visit(ProcedurePrototype &proto) {
+  llvm::Function *f = mLLVMModule->getFunction(proto.Name());
+  if (!f) {
+    llvm::Type *return_type = mCoroutines.count(proto.Name())
+                                ? llvm::Type::getInt8PtrTy(mLLVMContext)
+                              : proto.ReturnType().empty()
+                                ? llvm::Type::getVoidTy(mLLVMContext)
+                                : GetType(proto.ReturnType());
+    std::vector<llvm::Type *> arg_types;
+    for (const auto &arg : proto.Args()) {
+      llvm::Type *type = GetType(arg.type);
+      arg_types.push_back(PassedByPointer(arg.type) ? type->getPointerTo() : type);
+    }
+    llvm::FunctionType *ft = llvm::FunctionType::get(return_type, arg_types, false);
+    f = llvm::Function::Create(
+      ft, llvm::Function::ExternalLinkage, proto.Name(), mLLVMModule.get());
+    if (!mTargetCPU.empty())
+      f->addFnAttr("target-cpu", mTargetCPU);
+    if (!mTargetFeatures.empty())
+      f->addFnAttr("target-features", mTargetFeatures);
+
+    unsigned i = 0;
+    for (auto &arg : f->args()) {
+      const std::string &type = proto.Args().at(i).type;
+      arg.setName(proto.Args().at(i).name);
+      if (PassedByPointer(type)) {
+        uint64_t size = mLLVMModule->getDataLayout().getTypeAllocSize(GetType(type));
+        arg.addAttr(llvm::Attribute::NoAlias);
+        arg.addAttr(llvm::Attribute::getWithAlignment(mLLVMContext,
+                                                      llvm::Align(GetAlignment(type))));
+        arg.addAttr(llvm::Attribute::getWithDereferenceableBytes(mLLVMContext, size));
+      }
+      i++;
+    }
+  }
+  mLLVMFunction = f;
+}
+
+// Procedures nothing outside the module calls are internal, so LLVM is free
+// to inline, clone or drop them and give them the fast calling convention.
+// Every external procedure, imported or kept, uses the C one, so callers
+// compiled separately agree with it.
+void CodegenVisitor::SetProcedureAttributes(const ProcedureDefinition &pdef,
+                                            llvm::Function &f) {
+  static constexpr struct {
+    const char *annotation;
+    llvm::Attribute::AttrKind attribute;
+  } kProcedureAttributes[] = {
+    {"inline", llvm::Attribute::AlwaysInline},
+    {"noinline", llvm::Attribute::NoInline},
+    {"hot", llvm::Attribute::Hot},
+    {"cold", llvm::Attribute::Cold},
+    // No effect beyond the result, so calls can be reused or dropped
+    {"pure", llvm::Attribute::NoUnwind},
+    {"pure", llvm::Attribute::WillReturn},
+  };
+  for (const auto &spec : kProcedureAttributes) {
+    if (pdef.FindAnnotation(spec.annotation))
+      f.addFnAttr(spec.attribute);
+  }
+  // A #pure procedure touches no memory, except that it reads the copies
+  // its arrays and structs come in, see PassedByPointer(). It keeps its own
+  // copy of those, so the incoming ones stay read-only.
+  if (pdef.FindAnnotation("pure")) {
+    bool reads_args = false;
+    for (auto &arg : f.args()) {
+      if (!arg.getType()->isPointerTy())
+        continue;
+      arg.addAttr(llvm::Attribute::ReadOnly);
+      reads_args = true;
+    }
+    if (reads_args) {
+      f.addFnAttr(llvm::Attribute::ReadOnly);
+      f.addFnAttr(llvm::Attribute::ArgMemOnly);
+    } else {
+      f.addFnAttr(llvm::Attribute::ReadNone);
+    }
+  }
+  const std::string &name = pdef.Prototype()->Name();
+  if (mExports.count(name) || mExtraExports.count(name))
+    return;
+  f.setLinkage(llvm::Function::InternalLinkage);
+  f.setCallingConv(llvm::CallingConv::Fast);
+}
+
+void CodegenVisitor::Visit(ProcedureDefinition &proc_def) {
+  proc_def.Prototype()->Accept(*this);
+
+  llvm::Function *f = mLLVMFunction;
+  if (!f) {
+    mLLVMFunction = nullptr;
+    return;
+  }
+
+  llvm::BasicBlock *bb = llvm::BasicBlock::Create(mLLVMContext, "entry", f);
+  mLLVMIrBuilder.SetInsertPoint(bb);
+  mLocals.clear();
+  mHandles.clear();
+  mCoroutine = Coroutine();
+  mReturnType = proc_def.Prototype()->ReturnType();
+  bool is_coroutine = mCoroutines.count(proc_def.Prototype()->Name());
+  if (is_coroutine && proc_def.BodyBlock())
+    EmitCoroutineBegin(proc_def);
+
+  // Parameters get stack slots like other locals, so they can be assigned
+  // and indexed; mem2reg promotes them back. The copy an aggregate comes in
+  // is the slot, except in a coroutine: its parameters are copied into its
+  // frame, as the caller's copy may not outlive the first suspend. A #pure
+  // procedure copies them too, as it promises not to write the caller's.
+  const auto &args = proc_def.Prototype()->Args();
+  bool copy_aggregates = is_coroutine || proc_def.FindAnnotation("pure");
+  for (unsigned i = 0; i < args.size(); ++i) {
+    bool by_pointer = PassedByPointer(args[i].type);
+    if (by_pointer && !copy_aggregates) {
+      mLocals[args[i].name] = {f->getArg(i), args[i].type};
+      continue;
+    }
+    llvm::AllocaInst *slot = CreateEntryAlloca(args[i].type, args[i].name);
+    if (by_pointer) {
+      mLLVMIrBuilder.CreateMemCpy(
+        slot, slot->getAlign(), f->getArg(i), slot->getAlign(),
+        mLLVMModule->getDataLayout().getTypeAllocSize(slot->getAllocatedType()));
+    } else {
+      mLLVMIrBuilder.CreateAlignedStore(f->getArg(i), slot, slot->getAlign());
+    }
+    mLocals[args[i].name] = {slot, args[i].type};
+  }
+
+  Block *body = proc_def.BodyBlock().get();
+  if (body) {
+    // The body waits for the first resume
+    if (is_coroutine)
+      mCoroutine.start = EmitSuspend(false);
+
+    body->Accept(*this);
+
+    if (is_coroutine) {
+      EmitCoroutineEnd();
+    } else if (!mLLVMIrBuilder.GetInsertBlock()->getTerminator()) {
+      // Falling off the end returns nothing, or zero
+      llvm::Type *return_type = f->getReturnType();
+      if (return_type->isVoidTy())
+        mLLVMIrBuilder.CreateRetVoid();
+      else
+        mLLVMIrBuilder.CreateRet(llvm::Constant::getNullValue(return_type));
+    }
+
+    llvm::verifyFunction(*f);
+
+    mLLVMFunction = f;
+    return;
+  }
+
+  f->eraseFromParent();
+  mLLVMFunction = nullptr;
+}
+
+void CodegenVisitor::Visit(StructDefinition &struct_def) {
+  GetStruct(struct_def.Name());
+}
+
+void CodegenVisitor::Visit(UseDeclaration &use_decl) {
+  const ModuleInterface *interface = use_decl.Interface();
+  if (!interface)
+    return;
+
+  // Imported procedures are declared, their definitions come from the
+  // imported module's object at link time
+  for (const auto &proto : interface->procedures) {
+    proto->Accept(*this);
+  }
+  for (const auto &sdef : interface->structs) {
+    sdef->Accept(*this);
+  }
+}
+
+void CodegenVisitor::Visit(ConstDefinition &const_def) {
+  // CheckModule() ran the initializer. The value is read-only data the
+  // optimizer folds loads of known elements from.
+  llvm::Type *type = GetType(const_def.Type());
+  auto global = new llvm::GlobalVariable(*mLLVMModule, type, /*isConstant=*/true,
+                                         llvm::GlobalValue::InternalLinkage,
+                                         GetConstant(*const_def.Value()), const_def.Name());
+  global->setAlignment(llvm::Align(GetAlignment(const_def.Type())));
+  global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  mConstants[const_def.Name()] = {global, const_def.Type()};
+}
+
+void CodegenVisitor::Visit(Block &block) {
+  auto outer = mLocals;
+  size_t outer_handles = mHandles.size();
+  for (auto &s : block.Statements()) {
+    // Code after a return is unreachable but still has to go somewhere
+    if (mLLVMIrBuilder.GetInsertBlock()->getTerminator()) {
+      llvm::Function *f = mLLVMIrBuilder.GetInsertBlock()->getParent();
+      mLLVMIrBuilder.SetInsertPoint(
+        llvm::BasicBlock::Create(mLLVMContext, "unreachable", f));
+    }
+    VisitStatement(*s);
+  }
+  if (!mLLVMIrBuilder.GetInsertBlock()->getTerminator())
+    EmitDestroyHandles(outer_handles);
+  mHandles.resize(outer_handles);
+  mLocals = std::move(outer);
+}
+
+// Literals are built at full width and narrowed by EmitConstantAs() once the
+// type they are used as is known, so an f64 keeps all of its digits.
+void CodegenVisitor::Visit(IntegerLiteral &intlit) {
+  mValueType = "int";
+  mLLVMValue = llvm::ConstantInt::get(
+    mLLVMContext, llvm::APInt(/*numBits=*/64, intlit.mInt, /*isSigned=*/true));
+}
+
+void CodegenVisitor::Visit(FloatLiteral &floatlit) {
+  mValueType = "float";
+  mLLVMValue =
+    llvm::ConstantFP::get(mLLVMContext, llvm::APFloat(floatlit.mFloat));
+}
+
+void CodegenVisitor::Visit(StringLiteral &strlit) {
+  mValueType = "string";
+  llvm::Type *i8_array_type =
+    llvm::ArrayType::get(llvm::IntegerType::get(mLLVMContext, /*numbits=*/8),
+                         strlit.mString.length());
+  if (!i8_array_type) {
+    mLLVMValue = nullptr;
+    return;
+  }
+
+  llvm::Module *mod = mLLVMModule.get();
+  assert(mod);
+
+  // FIXME: global_str will leak
+  llvm::GlobalVariable *global_str = new llvm::GlobalVariable(
+    /*Module=*/*mod,
+    /*Type=*/i8_array_type,
+    /*isConstant=*/true,
+    /*Linkage=*/llvm::GlobalVariable::PrivateLinkage,
+    /*Initializer=*/nullptr,
+    /*Name=*/".str");
+  if (!global_str) {
+    mLLVMValue = nullptr;
+    return;
+  }
+
+  global_str->setAlignment(llvm::MaybeAlign(1));
+
+  llvm::Constant *const_array = llvm::ConstantDataArray::getString(
+    mLLVMContext, strlit.mString.c_str(), /*AddNull=*/false);
+
+  global_str->setInitializer(const_array);
+
+  llvm::Constant *const_int64_0 = llvm::ConstantInt::get(
+    mLLVMContext, llvm::APInt(/*numbits=*/64, 0, /*issigned=*/true));
+
+  std::vector<llvm::Constant *> const_ptr_indices(2, const_int64_0);
+  llvm::Constant *const_ptr = llvm::ConstantExpr::getGetElementPtr(
+    i8_array_type, global_str, const_ptr_indices, /*inBounds=*/true);
+
+  mLLVMValue = const_ptr;
+}
+
+llvm::Value *CodegenVisitor::EmitValue(Expression &expr) {
+  if (IsUntypedConstant(expr))
+    return EmitConstantAs(expr, DefaultConstantType(expr));
+  bool want_address = std::exchange(mWantAddress, false);
+  VisitExpression(expr);
+  mWantAddress = want_address;
+  return mLLVMValue;
+}
+
+llvm::Value *CodegenVisitor::EmitConstantAs(Expression &expr, const std::string &type) {
+  if (expr.mExprKind == Expression::BINARY) {
+    auto &binary = static_cast<BinaryExpression &>(expr);
+    llvm::Value *lhs = EmitConstantAs(*binary.mLhs, type);
+    llvm::Value *rhs = EmitConstantAs(*binary.mRhs, type);
+    return EmitArithmetic(binary.mOp, lhs, rhs, type);
+  }
+  VisitExpression(expr);
+  mValueType = type;
+  return mLLVMValue = Coerce(mLLVMValue, GetType(type));
+}
+
+llvm::Value *CodegenVisitor::EmitValueAs(Expression &expr, const std::string &type) {
+  if (IsUntypedConstant(expr))
+    return EmitConstantAs(expr, type);
+  llvm::Value *value = Coerce(EmitValue(expr), GetType(type));
+  mValueType = type;
+  return value;
+}
+
+llvm::Value *CodegenVisitor::Coerce(llvm::Value *value, llvm::Type *type) {
+  if (value->getType() == type)
+    return value;
+  if (auto vector = llvm::dyn_cast<llvm::FixedVectorType>(type)) {
+    return mLLVMIrBuilder.CreateVectorSplat(vector->getNumElements(),
+                                            Coerce(value, vector->getElementType()));
+  }
+  // Only literals are converted, and CheckModule() made sure they fit
+  if (type->isIntegerTy())
+    return mLLVMIrBuilder.CreateSExtOrTrunc(value, type);
+  return mLLVMIrBuilder.CreateFPCast(value, type);
+}
+
+llvm::Value *CodegenVisitor::EmitAddress(Expression &expr) {
+  bool want_address = std::exchange(mWantAddress, true);
+  VisitExpression(expr);
+  mWantAddress = want_address;
+
+  switch (expr.mExprKind) {
+  case Expression::IDENTIFIER:
+  case Expression::INDEX:
+  case Expression::MEMBER: return mLLVMValue;
+  default: {
+    llvm::AllocaInst *slot = CreateEntryAlloca(mValueType, "tmp");
+    mLLVMIrBuilder.CreateAlignedStore(mLLVMValue, slot, slot->getAlign());
+    return slot;
+  }
+  };
+}
+
+bool CodegenVisitor::PassedByPointer(const std::string &type) {
+  return GetType(type)->isAggregateType();
+}
+
+llvm::Value *CodegenVisitor::EmitArgument(Expression &expr, const std::string &type) {
+  if (!PassedByPointer(type))
+    return EmitValueAs(expr, type);
+  llvm::AllocaInst *slot = CreateEntryAlloca(type, "arg");
+  if (llvm::Value *ptr = EmitAddress(expr)) {
+    mLLVMIrBuilder.CreateMemCpy(
+      slot, slot->getAlign(), ptr, slot->getAlign(),
+      mLLVMModule->getDataLayout().getTypeAllocSize(slot->getAllocatedType()));
+  } else {
+    // A #soa element has no address of its own
+    mLLVMIrBuilder.CreateAlignedStore(LoadSoaElement(), slot, slot->getAlign());
+  }
+  return slot;
+}
+
+llvm::AllocaInst *CodegenVisitor::CreateEntryAlloca(const std::string &type,
+                                                    const std::string &name) {
+  // Stack slots go in the entry block so they are allocated once
+  llvm::Function *f = mLLVMIrBuilder.GetInsertBlock()->getParent();
+  llvm::IRBuilder<> entry(&f->getEntryBlock(), f->getEntryBlock().begin());
+  llvm::AllocaInst *slot = entry.CreateAlloca(GetType(type), nullptr, name);
+  slot->setAlignment(llvm::Align(GetAlignment(type)));
+  return slot;
+}
+
+llvm::Value *CodegenVisitor::SoaFieldAddress(const SoaElement &soa, unsigned field) {
+  llvm::Value *indices[] = {
+    mLLVMIrBuilder.getInt64(0), mLLVMIrBuilder.getInt32(field), soa.index};
+  return mLLVMIrBuilder.CreateInBoundsGEP(soa.array_type, soa.array, indices);
+}
+
+llvm::Value *CodegenVisitor::LoadSoaElement() {
+  SoaElement soa = std::exchange(mSoaElement, SoaElement());
+  llvm::StructType *type = soa.element->type;
+  llvm::Value *value = llvm::Constant::getNullValue(type);
+  for (unsigned field : soa.element->field_index) {
+    llvm::Value *field_value = mLLVMIrBuilder.CreateLoad(
+      type->getElementType(field), SoaFieldAddress(soa, field));
+    value = mLLVMIrBuilder.CreateInsertValue(value, field_value, field);
+  }
+  return value;
+}
+
+void CodegenVisitor::StoreSoaElement(llvm::Value *value) {
+  SoaElement soa = std::exchange(mSoaElement, SoaElement());
+  for (unsigned field : soa.element->field_index) {
+    mLLVMIrBuilder.CreateStore(mLLVMIrBuilder.CreateExtractValue(value, field),
+                               SoaFieldAddress(soa, field));
+  }
+}
+
+void CodegenVisitor::Visit(Identifier &ident) {
+  auto it = mLocals.find(ident.mName);
+  const Local &local = it != mLocals.end() ? it->second : mConstants.at(ident.mName);
+  mValueType = local.type;
+  if (mWantAddress) {
+    mLLVMValue = local.slot;
+    return;
+  }
+  mLLVMValue = mLLVMIrBuilder.CreateLoad(GetType(local.type), local.slot,
+                                         ident.mName);
+}
+
+void CodegenVisitor::Visit(IndexExpression &index) {
+  bool want_address = mWantAddress;
+  llvm::Value *array = EmitAddress(*index.mBase);
+  std::string array_type = mValueType;
+  llvm::Value *i = EmitValue(*index.mIndex);
+  i = FindBuiltinType(mValueType)->is_signed
+        ? mLLVMIrBuilder.CreateSExt(i, mLLVMIrBuilder.getInt64Ty())
+        : mLLVMIrBuilder.CreateZExt(i, mLLVMIrBuilder.getInt64Ty());
+
+  // Vector lanes are addressed through a pointer to the first one
+  if (const BuiltinType *vector = FindBuiltinType(array_type)) {
+    mValueType = vector->element;
+    llvm::Type *lane_type = GetType(mValueType);
+    llvm::Value *lanes =
+      mLLVMIrBuilder.CreateBitCast(array, lane_type->getPointerTo());
+    llvm::Value *ptr = mLLVMIrBuilder.CreateInBoundsGEP(lane_type, lanes, i);
+    mLLVMValue = want_address ? ptr : mLLVMIrBuilder.CreateLoad(lane_type, ptr);
+    return;
+  }
+
+  std::string element;
+  uint64_t count;
+  SplitArrayType(array_type, element, count);
+  mValueType = element;
+
+  if (const LoweredStruct *ls = GetSoaElement(array_type)) {
+    mSoaElement = {array, GetType(array_type), i, ls};
+    mLLVMValue = want_address ? nullptr : LoadSoaElement();
+    return;
+  }
+
+  llvm::Value *indices[] = {mLLVMIrBuilder.getInt64(0), i};
+  llvm::Value *ptr =
+    mLLVMIrBuilder.CreateInBoundsGEP(GetType(array_type), array, indices);
+  mLLVMValue = want_address ? ptr : mLLVMIrBuilder.CreateLoad(GetType(element), ptr);
+}
+
+void CodegenVisitor::Visit(MemberExpression &member) {
+  bool want_address = mWantAddress;
+  llvm::Value *base = EmitAddress(*member.mBase);
+  const LoweredStruct *ls = GetStruct(mValueType);
+
+  const auto &members = ls->def->Members();
+  auto it = std::find_if(members.begin(), members.end(),
+                         [&](const auto &m) { return m.name == member.mMember; });
+  unsigned field = ls->field_index[it - members.begin()];
+  mValueType = it->type;
+
+  // A #soa element's field lives in that field's array
+  llvm::Value *ptr = base ? mLLVMIrBuilder.CreateStructGEP(ls->type, base, field)
+                          : SoaFieldAddress(std::exchange(mSoaElement, SoaElement()),
+                                            field);
+  mLLVMValue = want_address ? ptr
+                            : mLLVMIrBuilder.CreateLoad(GetType(mValueType), ptr,
+                                                        member.mMember);
+}
+
+void CodegenVisitor::Visit(BinaryExpression &binary) {
+  if (IsUntypedConstant(binary)) {
+    EmitConstantAs(binary, DefaultConstantType(binary));
+    return;
+  }
+
+  // A constant operand takes the type of the other one, see CheckModule().
+  // Constants have no side effects, so emitting the other operand first
+  // keeps the order of evaluation.
+  // The type is copied, as emitting the constant changes mValueType
+  llvm::Value *lhs, *rhs;
+  std::string type;
+  if (IsUntypedConstant(*binary.mLhs)) {
+    rhs = EmitValue(*binary.mRhs);
+    type = mValueType;
+    lhs = EmitConstantAs(*binary.mLhs, type);
+  } else {
+    lhs = EmitValue(*binary.mLhs);
+    type = mValueType;
+    rhs = EmitValueAs(*binary.mRhs, type);
+  }
+  EmitArithmetic(binary.mOp, lhs, rhs, type);
+}
+
+llvm::Value *CodegenVisitor::EmitArithmetic(BinaryExpression::Op op,
+                                            llvm::Value *lhs,
+                                            llvm::Value *rhs,
+                                            const std::string &type_name) {
+  const BuiltinType *type = FindBuiltinType(type_name);
+  bool is_float = type->kind == BuiltinType::FLOAT;
+  bool is_signed = type->is_signed;
+  mValueType = type_name;
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+
+  // Ordered float comparisons are false if either side is NaN. Vector
+  // comparisons give an i1 per lane, widened to the all-ones mask type.
+  if (IsComparison(op)) {
+    static constexpr struct {
+      llvm::CmpInst::Predicate f, s, u;
+    } kPredicates[] = {
+      {llvm::CmpInst::FCMP_OLT, llvm::CmpInst::ICMP_SLT, llvm::CmpInst::ICMP_ULT},
+      {llvm::CmpInst::FCMP_OLE, llvm::CmpInst::ICMP_SLE, llvm::CmpInst::ICMP_ULE},
+      {llvm::CmpInst::FCMP_OGT, llvm::CmpInst::ICMP_SGT, llvm::CmpInst::ICMP_UGT},
+      {llvm::CmpInst::FCMP_OGE, llvm::CmpInst::ICMP_SGE, llvm::CmpInst::ICMP_UGE},
+      {llvm::CmpInst::FCMP_OEQ, llvm::CmpInst::ICMP_EQ, llvm::CmpInst::ICMP_EQ},
+      {llvm::CmpInst::FCMP_ONE, llvm::CmpInst::ICMP_NE, llvm::CmpInst::ICMP_NE},
+    };
+    const auto &p = kPredicates[op - BinaryExpression::LT];
+    mLLVMValue = b.CreateCmp(is_float ? p.f : is_signed ? p.s : p.u, lhs, rhs);
+    mValueType = ComparisonResultType(*type)->name;
+    if (type->lanes)
+      mLLVMValue = b.CreateSExt(mLLVMValue, GetType(mValueType));
+    return mLLVMValue;
+  }
+
+  switch (op) {
+  case BinaryExpression::ADD:
+    mLLVMValue = is_float ? b.CreateFAdd(lhs, rhs) : b.CreateAdd(lhs, rhs);
+    break;
+  case BinaryExpression::SUB:
+    mLLVMValue = is_float ? b.CreateFSub(lhs, rhs) : b.CreateSub(lhs, rhs);
+    break;
+  case BinaryExpression::MUL:
+    mLLVMValue = is_float ? b.CreateFMul(lhs, rhs) : b.CreateMul(lhs, rhs);
+    break;
+  case BinaryExpression::DIV:
+    mLLVMValue = is_float    ? b.CreateFDiv(lhs, rhs)
+                 : is_signed ? b.CreateSDiv(lhs, rhs)
+                             : b.CreateUDiv(lhs, rhs);
+    break;
+  case BinaryExpression::MOD:
+    mLLVMValue = is_float    ? b.CreateFRem(lhs, rhs)
+                 : is_signed ? b.CreateSRem(lhs, rhs)
+                             : b.CreateURem(lhs, rhs);
+    break;
+  default: break;
+  };
+  return mLLVMValue;
+}
+
+void CodegenVisitor::Visit(CallExpression &call) {
+  if (call.mAwait)
+    EmitAwait(call);
+  else if (!EmitBuiltin(call))
+    EmitProcedureCall(call);
+}
+
+void CodegenVisitor::EmitProcedureCall(CallExpression &call) {
+  bool tail_call = std::exchange(mTailCall, false);
+  const ProcedurePrototype &proto = *mPrototypes.at(call.mCallee);
+  std::vector<llvm::Value *> args;
+  for (unsigned i = 0; i < call.mArgs.size(); ++i) {
+    args.push_back(EmitArgument(*call.mArgs[i], proto.Args()[i].type));
+  }
+  // A tail call's frame replaces this one, copies and all. The copies go
+  // where this procedure's own came in instead, which CheckModule() made
+  // sure are of the same types and are not needed after the call. That
+  // writes them, so a #pure caller no longer only reads its arguments.
+  if (tail_call) {
+    llvm::Function *caller = mLLVMIrBuilder.GetInsertBlock()->getParent();
+    for (unsigned i = 0; i < args.size(); ++i) {
+      if (!PassedByPointer(proto.Args()[i].type))
+        continue;
+      auto copy = llvm::cast<llvm::AllocaInst>(args[i]);
+      mLLVMIrBuilder.CreateMemCpy(
+        caller->getArg(i), copy->getAlign(), copy, copy->getAlign(),
+        mLLVMModule->getDataLayout().getTypeAllocSize(copy->getAllocatedType()));
+      caller->removeParamAttr(i, llvm::Attribute::ReadOnly);
+      caller->removeFnAttr(llvm::Attribute::ReadOnly);
+      args[i] = caller->getArg(i);
+    }
+  }
+  llvm::Function *callee = mLLVMModule->getFunction(call.mCallee);
+  llvm::CallInst *result = mLLVMIrBuilder.CreateCall(callee, args);
+  result->setCallingConv(callee->getCallingConv());
+  mLLVMValue = result;
+  if (mCoroutines.count(call.mCallee))
+    mValueType = proto.ReturnType().empty() ? "coroutine" : "coroutine<" + proto.ReturnType() + ">";
+  else
+    mValueType = proto.ReturnType().empty() ? "void" : proto.ReturnType();
+}
+
+bool CodegenVisitor::EmitBuiltin(CallExpression &call) {
+  const std::string &callee = call.mCallee;
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+
+  if (const BuiltinType *scalar = FindBuiltinType(callee); scalar && !scalar->lanes) {
+    llvm::Type *type = GetType(callee);
+    if (IsUntypedConstant(*call.mArgs[0])) {
+      mLLVMValue = EmitConstantAs(*call.mArgs[0], callee);
+      return true;
+    }
+    llvm::Value *value = EmitValue(*call.mArgs[0]);
+    const BuiltinType *from = FindBuiltinType(mValueType);
+    bool from_float = from->kind == BuiltinType::FLOAT;
+    bool to_float = scalar->kind == BuiltinType::FLOAT;
+    if (from_float && to_float)
+      mLLVMValue = b.CreateFPCast(value, type);
+    else if (from_float)
+      mLLVMValue = scalar->is_signed ? b.CreateFPToSI(value, type) : b.CreateFPToUI(value, type);
+    else if (to_float)
+      mLLVMValue = from->is_signed ? b.CreateSIToFP(value, type) : b.CreateUIToFP(value, type);
+    else
+      mLLVMValue = b.CreateIntCast(value, type, from->is_signed);
+    mValueType = callee;
+    return true;
+  }
+
+  if (const BuiltinType *vector = FindBuiltinType(callee)) {
+    auto type = llvm::cast<llvm::FixedVectorType>(GetType(callee));
+    if (call.mArgs.size() == 1) {
+      mLLVMValue = b.CreateVectorSplat(vector->lanes,
+                                       EmitValueAs(*call.mArgs[0], vector->element));
+    } else {
+      llvm::Value *value = llvm::PoisonValue::get(type);
+      for (unsigned lane = 0; lane < vector->lanes; ++lane) {
+        value = b.CreateInsertElement(value,
+                                      EmitValueAs(*call.mArgs[lane], vector->element),
+                                      lane);
+      }
+      mLLVMValue = value;
+    }
+    mValueType = callee;
+    return true;
+  }
+
+  if (callee == "shuffle") {
+    llvm::Value *a = EmitValue(*call.mArgs[0]);
+    const BuiltinType *vector = FindBuiltinType(mValueType);
+    llvm::Value *b_value = nullptr;
+    size_t first = 1;
+    if (call.mArgs[1]->mExprKind != Expression::INT_LITERAL) {
+      b_value = EmitValue(*call.mArgs[1]);
+      first = 2;
+    }
+    std::vector<int> mask;
+    for (size_t i = first; i < call.mArgs.size(); ++i) {
+      mask.push_back(static_cast<IntegerLiteral &>(*call.mArgs[i]).mInt);
+    }
+    mLLVMValue = b_value ? b.CreateShuffleVector(a, b_value, mask)
+                         : b.CreateShuffleVector(a, mask);
+    mValueType = FindVectorType(vector->element, mask.size())->name;
+    return true;
+  }
+
+  if (callee == "min" || callee == "max") {
+    // A constant argument takes the type of the other one, as for binary
+    // operators
+    llvm::Value *lhs, *rhs;
+    std::string type;
+    if (IsUntypedConstant(*call.mArgs[0])) {
+      rhs = EmitValue(*call.mArgs[1]);
+      type = mValueType;
+      lhs = EmitConstantAs(*call.mArgs[0], type);
+    } else {
+      lhs = EmitValue(*call.mArgs[0]);
+      type = mValueType;
+      rhs = EmitValueAs(*call.mArgs[1], type);
+    }
+    EmitReduce(callee == "min" ? Reduction::MIN : Reduction::MAX, lhs, rhs, type);
+    return true;
+  }
+
+  if (callee.compare(0, 7, "atomic_") == 0)
+    return EmitAtomic(call);
+
+  if (callee == "reduce_add" || callee == "reduce_mul" || callee == "reduce_min" ||
+      callee == "reduce_max") {
+    llvm::Value *v = EmitValue(*call.mArgs[0]);
+    const BuiltinType *vector = FindBuiltinType(mValueType);
+    mValueType = vector->element;
+    if (vector->kind == BuiltinType::INT) {
+      if (callee == "reduce_add")
+        mLLVMValue = b.CreateAddReduce(v);
+      else if (callee == "reduce_mul")
+        mLLVMValue = b.CreateMulReduce(v);
+      else if (callee == "reduce_min")
+        mLLVMValue = b.CreateIntMinReduce(v, vector->is_signed);
+      else
+        mLLVMValue = b.CreateIntMaxReduce(v, vector->is_signed);
+      return true;
+    }
+
+    llvm::Type *lane_type = GetType(vector->element);
+    llvm::CallInst *reduce;
+    if (callee == "reduce_add")
+      reduce = b.CreateFAddReduce(llvm::ConstantFP::getNegativeZero(lane_type), v);
+    else if (callee == "reduce_mul")
+      reduce = b.CreateFMulReduce(llvm::ConstantFP::get(lane_type, 1.0), v);
+    else if (callee == "reduce_min")
+      reduce = b.CreateFPMinReduce(v);
+    else
+      reduce = b.CreateFPMaxReduce(v);
+    // Without reassociation the sum would have to be taken lane by lane in
+    // order, which defeats the point of a vector reduction
+    reduce->setHasAllowReassoc(true);
+    mLLVMValue = reduce;
+    return true;
+  }
+
+  if (callee == "masked_load" || callee == "masked_store") {
+    bool load = callee == "masked_load";
+    llvm::Value *ptr = EmitAddress(*call.mArgs[0]);
+    llvm::Align alignment(GetAlignment(mValueType));
+    llvm::Value *mask = EmitValue(*call.mArgs[load ? 1 : 2]);
+    mask = b.CreateICmpNE(mask, llvm::Constant::getNullValue(mask->getType()));
+    llvm::Value *value = EmitValue(*call.mArgs[load ? 2 : 1]);
+    ptr = b.CreateBitCast(ptr, value->getType()->getPointerTo());
+    if (load) {
+      mLLVMValue = b.CreateMaskedLoad(value->getType(), ptr, alignment, mask, value);
+    } else {
+      mLLVMValue = b.CreateMaskedStore(value, ptr, alignment, mask);
+      mValueType = "void";
+    }
+    return true;
+  }
+
+  return EmitIntrinsic(call) || EmitCoroutineBuiltin(call);
+}
+
+void CodegenVisitor::Visit(ReturnStatement &retstmt) {
+  mTailCall = retstmt.FindAnnotation("tail") != nullptr;
+  llvm::Value *value = EmitValueAs(*retstmt.mReturnExpr, mReturnType);
+  // CheckModule() made sure the callee's frame can replace this one, and
+  // that the call's type is the return type, so nothing comes in between
+  if (retstmt.FindAnnotation("tail"))
+    llvm::cast<llvm::CallInst>(value)->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  EmitDestroyHandles(0);
+  mLLVMIrBuilder.CreateRet(value);
+}
+
+void CodegenVisitor::Visit(YieldStatement &yield) {
+  if (yield.mValue) {
+    llvm::Value *value = EmitValueAs(*yield.mValue, mReturnType);
+    mLLVMIrBuilder.CreateStore(value, mCoroutine.promise);
+  }
+  EmitSuspend(false);
+}
+
+void CodegenVisitor::Visit(LetStatement &let) {
+  llvm::AllocaInst *slot = CreateEntryAlloca(let.mType, let.mName);
+  llvm::Align alignment = slot->getAlign();
+
+  if (let.mInit) {
+    mLLVMIrBuilder.CreateAlignedStore(EmitValueAs(*let.mInit, let.mType), slot, alignment);
+  } else {
+    uint64_t size = mLLVMModule->getDataLayout().getTypeAllocSize(slot->getAllocatedType());
+    mLLVMIrBuilder.CreateMemSet(slot, mLLVMIrBuilder.getInt8(0), size, alignment);
+  }
+  mLocals[let.mName] = {slot, let.mType};
+  if (std::string yield; SplitCoroutineType(let.mType, yield))
+    AddHandle(slot);
+}
+
+void CodegenVisitor::Visit(AssignStatement &assign) {
+  llvm::Value *value = EmitValue(*assign.mValue);
+  llvm::Value *ptr = EmitAddress(*assign.mTarget);
+  if (!ptr) {
+    StoreSoaElement(value);
+    return;
+  }
+  mLLVMIrBuilder.CreateStore(Coerce(value, GetType(mValueType)), ptr);
+}
+
+void CodegenVisitor::Visit(ExpressionStatement &expr) {
+  EmitValue(*expr.mExpr);
+}
+
+// Loops are emitted in the form LLVM's loop passes expect: a header that
+// tests the condition, the body, and for `for` a latch that counts, with a
+// single backedge to the header. Exit blocks are only inserted into the
+// function once the body is done, so the loop's blocks stay contiguous for
+// EmitBackedge().
+void CodegenVisitor::Visit(WhileStatement &loop) {
+  llvm::Function *f = mLLVMIrBuilder.GetInsertBlock()->getParent();
+  llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(mLLVMContext, "while.cond", f);
+  llvm::BasicBlock *body_bb = llvm::BasicBlock::Create(mLLVMContext, "while.body", f);
+  llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create(mLLVMContext, "while.end");
+
+  mLLVMIrBuilder.CreateBr(cond_bb);
+  mLLVMIrBuilder.SetInsertPoint(cond_bb);
+  mLLVMIrBuilder.CreateCondBr(EmitValue(*loop.mCond), body_bb, exit_bb);
+
+  mLLVMIrBuilder.SetInsertPoint(body_bb);
+  loop.mBody->Accept(*this);
+  EmitBackedge(loop, cond_bb);
+
+  exit_bb->insertInto(f);
+  mLLVMIrBuilder.SetInsertPoint(exit_bb);
+}
+
+void CodegenVisitor::Visit(ForStatement &loop) {
+  // A constant begin takes the type of end, see CheckModule(). It has no
+  // side effects, so emitting end first keeps the order of evaluation.
+  std::string type = loop.mType;
+  llvm::Value *begin, *end;
+  if (type.empty() && IsUntypedConstant(*loop.mBegin)) {
+    end = EmitValue(*loop.mEnd);
+    type = mValueType;
+    begin = EmitConstantAs(*loop.mBegin, type);
+  } else if (type.empty()) {
+    begin = EmitValue(*loop.mBegin);
+    type = mValueType;
+    end = EmitValueAs(*loop.mEnd, type);
+  } else {
+    begin = EmitValueAs(*loop.mBegin, type);
+    end = EmitValueAs(*loop.mEnd, type);
+  }
+  if (loop.mParallel)
+    EmitParallelFor(loop, type, begin, end);
+  else
+    EmitForLoop(loop, type, begin, end);
+}
+
+void CodegenVisitor::EmitForLoop(ForStatement &loop,
+                                 const std::string &type,
+                                 llvm::Value *begin,
+                                 llvm::Value *end) {
+  bool is_signed = FindBuiltinType(type)->is_signed;
+
+  llvm::AllocaInst *slot = CreateEntryAlloca(type, loop.mVar);
+  llvm::Type *llvm_type = slot->getAllocatedType();
+  mLLVMIrBuilder.CreateAlignedStore(begin, slot, slot->getAlign());
+
+  llvm::Function *f = mLLVMIrBuilder.GetInsertBlock()->getParent();
+  llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(mLLVMContext, "for.cond", f);
+  llvm::BasicBlock *body_bb = llvm::BasicBlock::Create(mLLVMContext, "for.body", f);
+  llvm::BasicBlock *latch_bb = llvm::BasicBlock::Create(mLLVMContext, "for.inc");
+  llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create(mLLVMContext, "for.end");
+
+  mLLVMIrBuilder.CreateBr(cond_bb);
+  mLLVMIrBuilder.SetInsertPoint(cond_bb);
+  llvm::Value *i = mLLVMIrBuilder.CreateAlignedLoad(llvm_type, slot, slot->getAlign(), loop.mVar);
+  llvm::Value *more = is_signed ? mLLVMIrBuilder.CreateICmpSLT(i, end)
+                                : mLLVMIrBuilder.CreateICmpULT(i, end);
+  mLLVMIrBuilder.CreateCondBr(more, body_bb, exit_bb);
+
+  mLLVMIrBuilder.SetInsertPoint(body_bb);
+  auto outer = mLocals;
+  mLocals[loop.mVar] = {slot, type};
+  loop.mBody->Accept(*this);
+  mLocals = std::move(outer);
+  if (!mLLVMIrBuilder.GetInsertBlock()->getTerminator())
+    mLLVMIrBuilder.CreateBr(latch_bb);
+
+  // i < end on entry to the latch, so i + 1 cannot wrap
+  latch_bb->insertInto(f);
+  mLLVMIrBuilder.SetInsertPoint(latch_bb);
+  i = mLLVMIrBuilder.CreateAlignedLoad(llvm_type, slot, slot->getAlign(), loop.mVar);
+  llvm::Value *next = mLLVMIrBuilder.CreateAdd(i, llvm::ConstantInt::get(llvm_type, 1),
+                                               loop.mVar + ".next",
+                                               /*HasNUW=*/!is_signed, /*HasNSW=*/is_signed);
+  mLLVMIrBuilder.CreateAlignedStore(next, slot, slot->getAlign());
+  EmitBackedge(loop, cond_bb);
+
+  exit_bb->insertInto(f);
+  mLLVMIrBuilder.SetInsertPoint(exit_bb);
+}
+
+void CodegenVisitor::EmitBackedge(const LoopStatement &loop, llvm::BasicBlock *header) {
+  // A body that always returns does not loop
+  if (mLLVMIrBuilder.GetInsertBlock()->getTerminator())
+    return;
+  llvm::BranchInst *backedge = mLLVMIrBuilder.CreateBr(header);
+
+  // The first operand of a loop ID is the ID itself, so it is filled in
+  // once the node exists
+  llvm::SmallVector<llvm::Metadata *, 4> ops = {nullptr};
+  auto hint = [&](const char *name, llvm::Constant *value) {
+    ops.push_back(llvm::MDNode::get(
+      mLLVMContext,
+      {llvm::MDString::get(mLLVMContext, name), llvm::ConstantAsMetadata::get(value)}));
+  };
+
+  // #vectorize(1) turns vectorization off
+  if (const Annotation *vectorize = loop.FindAnnotation("vectorize")) {
+    int width = vectorize->args[0];
+    hint("llvm.loop.vectorize.enable", mLLVMIrBuilder.getInt1(width > 1));
+    hint("llvm.loop.vectorize.width", mLLVMIrBuilder.getInt32(width));
+  }
+  if (const Annotation *unroll = loop.FindAnnotation("unroll"))
+    hint("llvm.loop.unroll.count", mLLVMIrBuilder.getInt32(unroll->args[0]));
+
+  // #no_alias puts the loop's memory accesses in an access group and marks
+  // it parallel, so the vectorizer needs no runtime alias checks.
+  // llvm.loop.parallel_accesses asserts that accesses in the group carry no
+  // dependences between iterations, which is the promise the annotation
+  // makes; LLVM may reorder or interleave iterations that break it. Accesses
+  // in nested loops are in the groups of every loop around them. Scalar
+  // variables are left out: the induction variable and accumulators do
+  // carry values from one iteration to the next, in registers once mem2reg
+  // has run.
+  if (loop.FindAnnotation("no_alias")) {
+    llvm::MDNode *group = llvm::MDNode::getDistinct(mLLVMContext, {});
+    llvm::Function *f = header->getParent();
+    for (auto bb = header->getIterator(); bb != f->end(); ++bb) {
+      for (llvm::Instruction &inst : *bb) {
+        if (!inst.mayReadOrWriteMemory())
+          continue;
+        auto slot = llvm::dyn_cast_or_null<llvm::AllocaInst>(
+          llvm::getLoadStorePointerOperand(&inst));
+        if (slot && !slot->getAllocatedType()->isAggregateType())
+          continue;
+        llvm::SmallVector<llvm::Metadata *, 4> groups;
+        if (llvm::MDNode *outer = inst.getMetadata(llvm::LLVMContext::MD_access_group)) {
+          if (outer->getNumOperands() == 0)
+            groups.push_back(outer);
+          else
+            groups.append(outer->op_begin(), outer->op_end());
+        }
+        groups.push_back(group);
+        inst.setMetadata(llvm::LLVMContext::MD_access_group,
+                         groups.size() == 1 ? group : llvm::MDNode::get(mLLVMContext, groups));
+      }
+    }
+    ops.push_back(llvm::MDNode::get(
+      mLLVMContext, {llvm::MDString::get(mLLVMContext, "llvm.loop.parallel_accesses"), group}));
+  }
+
+  if (ops.size() == 1)
+    return;
+  llvm::MDNode *id = llvm::MDNode::getDistinct(mLLVMContext, ops);
+  id->replaceOperandWith(0, id);
+  backedge->setMetadata(llvm::LLVMContext::MD_loop, id);
+}
+
+// The value `op` leaves the other operand unchanged with
+static llvm::Constant *ReductionIdentity(Reduction::Op op,
+                                         const BuiltinType &type,
+                                         llvm::Type *llvm_type) {
+  bool is_float = type.kind == BuiltinType::FLOAT;
+  switch (op) {
+  case Reduction::ADD: return llvm::Constant::getNullValue(llvm_type);
+  case Reduction::MUL:
+    return is_float ? llvm::ConstantFP::get(llvm_type, 1.0) : llvm::ConstantInt::get(llvm_type, 1);
+  case Reduction::MIN:
+  case Reduction::MAX: {
+    // The identity of min is the largest value, and that of max the smallest
+    bool min = op == Reduction::MIN;
+    if (is_float)
+      return llvm::ConstantFP::getInfinity(llvm_type, /*Negative=*/!min);
+    llvm::APInt value = type.is_signed
+                          ? (min ? llvm::APInt::getSignedMaxValue(type.bits)
+                                 : llvm::APInt::getSignedMinValue(type.bits))
+                          : (min ? llvm::APInt::getMaxValue(type.bits)
+                                 : llvm::APInt::getMinValue(type.bits));
+    return llvm::ConstantInt::get(llvm_type, value);
+  }
+  };
+  return nullptr;
+}
+
+// The body of a parallel for is outlined into `void <proc>.parallel(i8 *context,
+// i64 first, i64 last)`, which runs iterations begin + first up to
+// begin + last as a serial loop. The context holds begin and pointers to the
+// variables visible at the loop, so the body works on the caller's variables
+// in place. Reduced variables are the exception: each chunk gets a private
+// copy, combined into the caller's when the chunk is done.
+void CodegenVisitor::EmitParallelFor(ForStatement &loop,
+                                     const std::string &type,
+                                     llvm::Value *begin,
+                                     llvm::Value *end) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Type *i64 = b.getInt64Ty();
+  bool is_signed = FindBuiltinType(type)->is_signed;
+
+  // end - begin wraps to the right unsigned count for any int type
+  llvm::Value *nonempty = is_signed ? b.CreateICmpSLT(begin, end) : b.CreateICmpULT(begin, end);
+  llvm::Value *count = b.CreateSelect(nonempty, b.CreateZExt(b.CreateSub(end, begin), i64),
+                                      b.getInt64(0), "count");
+
+  // Sorted so the context layout does not depend on hashing
+  std::vector<std::pair<std::string, Local>> captures(mLocals.begin(), mLocals.end());
+  std::sort(captures.begin(), captures.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  std::vector<llvm::Type *> fields;
+  for (const auto &capture : captures) {
+    fields.push_back(capture.second.slot->getType());
+  }
+  fields.push_back(begin->getType());
+  llvm::StructType *context_type = llvm::StructType::get(mLLVMContext, fields);
+
+  llvm::Function *f = b.GetInsertBlock()->getParent();
+  llvm::FunctionType *body_type =
+    llvm::FunctionType::get(b.getVoidTy(), {b.getInt8PtrTy(), i64, i64}, /*isVarArg=*/false);
+  llvm::Function *body = llvm::Function::Create(body_type, llvm::Function::InternalLinkage,
+                                                f->getName() + ".parallel", *mLLVMModule);
+  body->getArg(0)->setName("context");
+  body->getArg(1)->setName("first");
+  body->getArg(2)->setName("last");
+
+  llvm::AllocaInst *context;
+  {
+    llvm::IRBuilder<> entry(&f->getEntryBlock(), f->getEntryBlock().begin());
+    context = entry.CreateAlloca(context_type, nullptr, "context");
+  }
+  for (unsigned i = 0; i < fields.size(); ++i) {
+    llvm::Value *value = i < captures.size() ? captures[i].second.slot : begin;
+    b.CreateStore(value, b.CreateStructGEP(context_type, context, i));
+  }
+
+  static constexpr struct {
+    const char *name;
+    CharlieSchedule schedule;
+  } kSchedules[] = {
+    {"static", CHARLIE_SCHEDULE_STATIC},
+    {"dynamic", CHARLIE_SCHEDULE_DYNAMIC},
+    {"guided", CHARLIE_SCHEDULE_GUIDED},
+  };
+  CharlieSchedule schedule = CHARLIE_SCHEDULE_STATIC;
+  uint64_t chunk = 0;
+  for (const auto &s : kSchedules) {
+    if (const Annotation *annotation = loop.FindAnnotation(s.name)) {
+      schedule = s.schedule;
+      chunk = annotation->args.empty() ? 0 : annotation->args[0];
+    }
+  }
+  llvm::FunctionCallee parallel_for = mLLVMModule->getOrInsertFunction(
+    "charlie_parallel_for", b.getVoidTy(), i64, b.getInt32Ty(), i64,
+    body_type->getPointerTo(), b.getInt8PtrTy());
+  b.CreateCall(parallel_for, {count, b.getInt32(schedule), b.getInt64(chunk), body,
+                              b.CreateBitCast(context, b.getInt8PtrTy())});
+
+  // Now the body itself, with the caller's variables reached through the
+  // context
+  llvm::IRBuilderBase::InsertPoint caller = b.saveIP();
+  auto outer = std::move(mLocals);
+  mLocals.clear();
+  b.SetInsertPoint(llvm::BasicBlock::Create(mLLVMContext, "entry", body));
+
+  llvm::Value *ctx = b.CreateBitCast(body->getArg(0), context_type->getPointerTo());
+  for (unsigned i = 0; i < captures.size(); ++i) {
+    llvm::Value *slot = b.CreateLoad(fields[i], b.CreateStructGEP(context_type, ctx, i),
+                                     captures[i].first);
+    mLocals[captures[i].first] = {slot, captures[i].second.type};
+  }
+  llvm::Value *base =
+    b.CreateLoad(fields.back(), b.CreateStructGEP(context_type, ctx, captures.size()), "begin");
+
+  std::vector<llvm::Value *> shared;
+  for (const Reduction &reduction : loop.mReductions) {
+    Local &local = mLocals.at(reduction.var);
+    shared.push_back(local.slot);
+    llvm::AllocaInst *copy = CreateEntryAlloca(local.type, reduction.var);
+    b.CreateStore(ReductionIdentity(reduction.op, *FindBuiltinType(local.type),
+                                    copy->getAllocatedType()),
+                  copy);
+    local.slot = copy;
+  }
+
+  llvm::Value *first = b.CreateTrunc(body->getArg(1), base->getType());
+  llvm::Value *last = b.CreateTrunc(body->getArg(2), base->getType());
+  EmitForLoop(loop, type, b.CreateAdd(base, first), b.CreateAdd(base, last));
+
+  for (size_t i = 0; i < loop.mReductions.size(); ++i) {
+    const Local &local = mLocals.at(loop.mReductions[i].var);
+    llvm::Value *partial = b.CreateLoad(GetType(local.type), local.slot);
+    EmitAtomicReduce(loop.mReductions[i].op, shared[i], partial, local.type);
+  }
+  b.CreateRetVoid();
+  llvm::verifyFunction(*body);
+
+  b.restoreIP(caller);
+  mLocals = std::move(outer);
+}
+
+void CodegenVisitor::EmitAtomicReduce(Reduction::Op op,
+                                      llvm::Value *ptr,
+                                      llvm::Value *value,
+                                      const std::string &type) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Type *llvm_type = GetType(type);
+
+  // cmpxchg only takes ints, so floats are exchanged as their bits
+  llvm::IntegerType *bits = b.getIntNTy(llvm_type->getPrimitiveSizeInBits());
+  llvm::Value *bits_ptr = b.CreateBitCast(ptr, bits->getPointerTo());
+  llvm::LoadInst *initial = b.CreateLoad(bits, bits_ptr);
+  initial->setAtomic(llvm::AtomicOrdering::Monotonic);
+
+  llvm::BasicBlock *before = b.GetInsertBlock();
+  llvm::Function *f = before->getParent();
+  llvm::BasicBlock *retry_bb = llvm::BasicBlock::Create(mLLVMContext, "reduce", f);
+  llvm::BasicBlock *done_bb = llvm::BasicBlock::Create(mLLVMContext, "reduce.done", f);
+  b.CreateBr(retry_bb);
+
+  // The runtime waits for every chunk before returning to the caller, which
+  // orders these with what comes after the loop; they need no ordering of
+  // their own
+  b.SetInsertPoint(retry_bb);
+  llvm::PHINode *old = b.CreatePHI(bits, 2);
+  old->addIncoming(initial, before);
+  llvm::Value *combined = EmitReduce(op, b.CreateBitCast(old, llvm_type), value, type);
+  llvm::Value *result = b.CreateAtomicCmpXchg(bits_ptr, old, b.CreateBitCast(combined, bits),
+                                              llvm::MaybeAlign(),
+                                              llvm::AtomicOrdering::Monotonic,
+                                              llvm::AtomicOrdering::Monotonic);
+  old->addIncoming(b.CreateExtractValue(result, 0), retry_bb);
+  b.CreateCondBr(b.CreateExtractValue(result, 1), done_bb, retry_bb);
+  b.SetInsertPoint(done_bb);
+}
+
+llvm::Value *CodegenVisitor::EmitReduce(Reduction::Op op,
+                                        llvm::Value *lhs,
+                                        llvm::Value *rhs,
+                                        const std::string &type_name) {
+  switch (op) {
+  case Reduction::ADD: return EmitArithmetic(BinaryExpression::ADD, lhs, rhs, type_name);
+  case Reduction::MUL: return EmitArithmetic(BinaryExpression::MUL, lhs, rhs, type_name);
+  default: break;
+  };
+
+  // Lane by lane for vectors. If either operand is NaN the result is rhs.
+  const BuiltinType *type = FindBuiltinType(type_name);
+  bool min = op == Reduction::MIN;
+  llvm::CmpInst::Predicate predicate =
+    type->kind == BuiltinType::FLOAT ? (min ? llvm::CmpInst::FCMP_OLT : llvm::CmpInst::FCMP_OGT)
+    : type->is_signed                ? (min ? llvm::CmpInst::ICMP_SLT : llvm::CmpInst::ICMP_SGT)
+                                     : (min ? llvm::CmpInst::ICMP_ULT : llvm::CmpInst::ICMP_UGT);
+  mValueType = type_name;
+  return mLLVMValue = mLLVMIrBuilder.CreateSelect(
+           mLLVMIrBuilder.CreateCmp(predicate, lhs, rhs), lhs, rhs);
+}
+
+static llvm::AtomicOrdering GetMemoryOrder(const Expression &order) {
+  static constexpr struct {
+    const char *name;
+    llvm::AtomicOrdering ordering;
+  } kMemoryOrders[] = {
+    {"relaxed", llvm::AtomicOrdering::Monotonic},
+    {"acquire", llvm::AtomicOrdering::Acquire},
+    {"release", llvm::AtomicOrdering::Release},
+    {"acq_rel", llvm::AtomicOrdering::AcquireRelease},
+    {"seq_cst", llvm::AtomicOrdering::SequentiallyConsistent},
+  };
+  const std::string &name = static_cast<const Identifier &>(order).mName;
+  for (const auto &o : kMemoryOrders) {
+    if (name == o.name)
+      return o.ordering;
+  }
+  return llvm::AtomicOrdering::SequentiallyConsistent;
+}
+
+// Atomics are accessed at their natural alignment, which their slots, struct
+// fields and array elements have as ints and floats of the same size. cmpxchg
+// and xchg take floats as their bits.
+bool CodegenVisitor::EmitAtomic(CallExpression &call) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  const std::string &callee = call.mCallee;
+  auto &args = call.mArgs;
+
+  if (callee == "atomic_fence") {
+    b.CreateFence(GetMemoryOrder(*args[0]));
+    mValueType = "void";
+    return true;
+  }
+
+  static constexpr struct {
+    const char *name;
+    size_t num_values;
+  } kAtomicBuiltins[] = {
+    {"atomic_load", 0},
+    {"atomic_store", 1},
+    {"atomic_exchange", 1},
+    {"atomic_compare_exchange", 2},
+    {"atomic_fetch_add", 1},
+    {"atomic_fetch_sub", 1},
+  };
+  auto spec = std::find_if(std::begin(kAtomicBuiltins), std::end(kAtomicBuiltins),
+                           [&](const auto &spec) { return callee == spec.name; });
+  if (spec == std::end(kAtomicBuiltins))
+    return false;
+
+  llvm::Value *ptr = EmitAddress(*args[0]);
+  std::string value_type;
+  SplitAtomicType(mValueType, value_type);
+  llvm::Type *type = GetType(value_type);
+  llvm::Align alignment(mLLVMModule->getDataLayout().getTypeStoreSize(type));
+  size_t first_order = 1 + spec->num_values;
+  llvm::AtomicOrdering order = args.size() > first_order
+                                 ? GetMemoryOrder(*args[first_order])
+                                 : llvm::AtomicOrdering::SequentiallyConsistent;
+  bool is_float = type->isFloatingPointTy();
+  llvm::IntegerType *bits = b.getIntNTy(type->getPrimitiveSizeInBits());
+
+  if (callee == "atomic_load") {
+    llvm::LoadInst *load = b.CreateAlignedLoad(type, ptr, alignment);
+    load->setAtomic(order);
+    mLLVMValue = load;
+    mValueType = value_type;
+    return true;
+  }
+
+  if (callee == "atomic_store") {
+    llvm::StoreInst *store = b.CreateAlignedStore(EmitValueAs(*args[1], value_type), ptr,
+                                                  alignment);
+    store->setAtomic(order);
+    mValueType = "void";
+    return true;
+  }
+
+  if (callee == "atomic_compare_exchange") {
+    llvm::Value *expected_ptr = EmitAddress(*args[1]);
+    llvm::Value *desired = EmitValueAs(*args[2], value_type);
+    llvm::AtomicOrdering failure =
+      args.size() > first_order + 1
+        ? GetMemoryOrder(*args[first_order + 1])
+        : llvm::AtomicCmpXchgInst::getStrongestFailureOrdering(order);
+    llvm::Value *expected = b.CreateLoad(type, expected_ptr);
+    llvm::Value *result =
+      b.CreateAtomicCmpXchg(b.CreateBitCast(ptr, bits->getPointerTo()),
+                            b.CreateBitCast(expected, bits), b.CreateBitCast(desired, bits),
+                            alignment, order, failure);
+    // The value found replaces `expected`; on success it is the same value
+    b.CreateStore(b.CreateBitCast(b.CreateExtractValue(result, 0), type), expected_ptr);
+    mLLVMValue = b.CreateExtractValue(result, 1);
+    mValueType = "bool";
+    return true;
+  }
+
+  llvm::Value *value = EmitValueAs(*args[1], value_type);
+  llvm::AtomicRMWInst::BinOp op;
+  if (callee == "atomic_exchange")
+    op = llvm::AtomicRMWInst::Xchg;
+  else if (callee == "atomic_fetch_add")
+    op = is_float ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add;
+  else
+    op = is_float ? llvm::AtomicRMWInst::FSub : llvm::AtomicRMWInst::Sub;
+  if (op == llvm::AtomicRMWInst::Xchg && is_float) {
+    ptr = b.CreateBitCast(ptr, bits->getPointerTo());
+    value = b.CreateBitCast(value, bits);
+  }
+  mLLVMValue = b.CreateBitCast(b.CreateAtomicRMW(op, ptr, value, alignment, order), type);
+  mValueType = value_type;
+  return true;
+}
+
+bool CodegenVisitor::EmitIntrinsic(CallExpression &call) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  const std::string &callee = call.mCallee;
+  auto &args = call.mArgs;
+
+  static constexpr struct {
+    const char *name;
+    llvm::Intrinsic::ID id;
+  } kBitCounts[] = {
+    {"popcount", llvm::Intrinsic::ctpop},
+    {"ctz", llvm::Intrinsic::cttz},
+    {"clz", llvm::Intrinsic::ctlz},
+  };
+  for (const auto &count : kBitCounts) {
+    if (callee != count.name)
+      continue;
+    llvm::Value *x = EmitValue(*args[0]);
+    llvm::SmallVector<llvm::Value *, 2> ops = {x};
+    // ctz() and clz() of 0 are the number of bits rather than poison
+    if (count.id != llvm::Intrinsic::ctpop)
+      ops.push_back(b.getFalse());
+    mLLVMValue = b.CreateIntrinsic(count.id, {x->getType()}, ops);
+    return true;
+  }
+
+  if (callee == "fma") {
+    // Only constants come before the first typed argument, so emitting that
+    // one first does not reorder anything with side effects
+    auto typed = std::find_if(args.begin(), args.end(),
+                              [](const auto &arg) { return !IsUntypedConstant(*arg); });
+    std::string type = "float";
+    llvm::Value *ops[3];
+    if (typed != args.end()) {
+      ops[typed - args.begin()] = EmitValue(**typed);
+      type = mValueType;
+    }
+    for (size_t i = 0; i < 3; ++i) {
+      if (typed == args.end() || i != size_t(typed - args.begin()))
+        ops[i] = EmitValueAs(*args[i], type);
+    }
+    mLLVMValue = b.CreateIntrinsic(llvm::Intrinsic::fma, {GetType(type)}, ops);
+    mValueType = type;
+    return true;
+  }
+
+  if (callee == "expect" || callee == "likely" || callee == "unlikely") {
+    llvm::Value *x = EmitValue(*args[0]);
+    int64_t expected = callee == "expect" ? static_cast<IntegerLiteral &>(*args[1]).mInt
+                                          : callee == "likely";
+    mLLVMValue = b.CreateIntrinsic(llvm::Intrinsic::expect, {x->getType()},
+                                   {x, llvm::ConstantInt::get(x->getType(), expected)});
+    return true;
+  }
+
+  // An element of a #soa array has no single address to prefetch or assume
+  // anything about, so neither hint is emitted for one
+  if (callee == "prefetch") {
+    llvm::Value *ptr = EmitAddress(*args[0]);
+    auto constant = [&](size_t i, int64_t otherwise) {
+      return b.getInt32(args.size() > i ? static_cast<IntegerLiteral &>(*args[i]).mInt
+                                        : otherwise);
+    };
+    mLLVMValue = nullptr;
+    if (ptr) {
+      llvm::Type *i8_ptr = b.getInt8PtrTy();
+      // The last operand selects the data rather than the instruction cache
+      mLLVMValue = b.CreateIntrinsic(
+        llvm::Intrinsic::prefetch, {i8_ptr},
+        {b.CreateBitCast(ptr, i8_ptr), constant(1, 0), constant(2, 3), b.getInt32(1)});
+    }
+    mValueType = "void";
+    return true;
+  }
+
+  if (callee == "assume_aligned") {
+    llvm::Value *ptr = EmitAddress(*args[0]);
+    mLLVMValue = nullptr;
+    if (ptr) {
+      unsigned alignment = static_cast<IntegerLiteral &>(*args[1]).mInt;
+      mLLVMValue = b.CreateAlignmentAssumption(mLLVMModule->getDataLayout(), ptr, alignment);
+    }
+    mValueType = "void";
+    return true;
+  }
+
+  // Statements after it go to a new block, as after a return
+  if (callee == "unreachable") {
+    mLLVMValue = b.CreateUnreachable();
+    mValueType = "void";
+    return true;
+  }
+
+  return false;
+}
+
+// A #coroutine procedure is lowered with the switch-resumed llvm.coro.*
+// intrinsics, which the CoroSplit pass turns into a ramp that allocates the
+// frame and returns its address, plus resume and destroy functions the
+// frame points to. The frame is malloc()ed unless CoroElide finds that it
+// never outlives its creator, in which case it lives in the creator's stack
+// frame instead. The last value yielded is kept in the coroutine's promise,
+// which llvm.coro.promise finds from the frame's address.
+void CodegenVisitor::EmitCoroutineBegin(const ProcedureDefinition &pdef) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Function *f = b.GetInsertBlock()->getParent();
+  llvm::PointerType *i8_ptr = b.getInt8PtrTy();
+  // Marks the function for the coroutine passes
+  f->addFnAttr("coroutine.presplit", "0");
+
+  llvm::Value *promise = llvm::ConstantPointerNull::get(i8_ptr);
+  const std::string &yield = pdef.Prototype()->ReturnType();
+  if (!yield.empty()) {
+    mCoroutine.promise = CreateEntryAlloca(yield, "promise");
+    promise = b.CreateBitCast(mCoroutine.promise, i8_ptr);
+  }
+  mCoroutine.id = b.CreateIntrinsic(llvm::Intrinsic::coro_id, {},
+                                    {b.getInt32(0), promise,
+                                     llvm::ConstantPointerNull::get(i8_ptr),
+                                     llvm::ConstantPointerNull::get(i8_ptr)});
+
+  llvm::BasicBlock *entry_bb = b.GetInsertBlock();
+  llvm::BasicBlock *alloc_bb = llvm::BasicBlock::Create(mLLVMContext, "coro.alloc", f);
+  llvm::BasicBlock *begin_bb = llvm::BasicBlock::Create(mLLVMContext, "coro.begin", f);
+  b.CreateCondBr(b.CreateIntrinsic(llvm::Intrinsic::coro_alloc, {}, {mCoroutine.id}),
+                 alloc_bb, begin_bb);
+  b.SetInsertPoint(alloc_bb);
+  llvm::FunctionCallee malloc_fn =
+    mLLVMModule->getOrInsertFunction("malloc", i8_ptr, b.getInt64Ty());
+  llvm::Value *size = b.CreateIntrinsic(llvm::Intrinsic::coro_size, {b.getInt64Ty()}, {});
+  llvm::Value *memory = b.CreateCall(malloc_fn, {size});
+  b.CreateBr(begin_bb);
+
+  b.SetInsertPoint(begin_bb);
+  llvm::PHINode *frame = b.CreatePHI(i8_ptr, 2);
+  frame->addIncoming(llvm::ConstantPointerNull::get(i8_ptr), entry_bb);
+  frame->addIncoming(memory, alloc_bb);
+  mCoroutine.handle = b.CreateIntrinsic(llvm::Intrinsic::coro_begin, {},
+                                        {mCoroutine.id, frame});
+  // yielded() before the first yield is zero
+  if (mCoroutine.promise) {
+    llvm::Type *type = mCoroutine.promise->getType()->getPointerElementType();
+    b.CreateStore(llvm::Constant::getNullValue(type), mCoroutine.promise);
+  }
+  mCoroutine.cleanup = llvm::BasicBlock::Create(mLLVMContext, "coro.cleanup");
+  mCoroutine.suspend = llvm::BasicBlock::Create(mLLVMContext, "coro.suspend");
+}
+
+llvm::Instruction *CodegenVisitor::EmitSuspend(bool final) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Function *f = b.GetInsertBlock()->getParent();
+  llvm::Instruction *suspend = b.CreateIntrinsic(
+    llvm::Intrinsic::coro_suspend, {}, {llvm::ConstantTokenNone::get(mLLVMContext),
+                                        b.getInt1(final)});
+  // 0 when resumed, 1 when destroyed; anything else returns to the resumer
+  llvm::BasicBlock *resume_bb =
+    llvm::BasicBlock::Create(mLLVMContext, final ? "coro.final" : "coro.resume", f);
+  llvm::SwitchInst *sw = b.CreateSwitch(suspend, mCoroutine.suspend, 2);
+  sw->addCase(b.getInt8(0), resume_bb);
+  sw->addCase(b.getInt8(1), mCoroutine.cleanup);
+  b.SetInsertPoint(resume_bb);
+  // Resuming a coroutine at its final suspend is undefined
+  if (final)
+    b.CreateUnreachable();
+  return suspend;
+}
+
+void CodegenVisitor::EmitCoroutineEnd() {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Function *f = b.GetInsertBlock()->getParent();
+  if (!b.GetInsertBlock()->getTerminator())
+    EmitSuspend(true);
+
+  // Destroying a coroutine destroys those it still holds
+  mCoroutine.cleanup->insertInto(f);
+  b.SetInsertPoint(mCoroutine.cleanup);
+  for (llvm::Value *slot : mCoroutine.slots) {
+    llvm::Value *handle = b.CreateLoad(b.getInt8PtrTy(), slot);
+    llvm::BasicBlock *destroy_bb = llvm::BasicBlock::Create(mLLVMContext, "coro.destroy", f);
+    llvm::BasicBlock *next_bb = llvm::BasicBlock::Create(mLLVMContext, "coro.destroyed", f);
+    b.CreateCondBr(b.CreateIsNotNull(handle), destroy_bb, next_bb);
+    b.SetInsertPoint(destroy_bb);
+    b.CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, {handle});
+    b.CreateBr(next_bb);
+    b.SetInsertPoint(next_bb);
+  }
+  // coro.free is null when the frame was not allocated
+  llvm::Value *memory =
+    b.CreateIntrinsic(llvm::Intrinsic::coro_free, {}, {mCoroutine.id, mCoroutine.handle});
+  llvm::BasicBlock *free_bb = llvm::BasicBlock::Create(mLLVMContext, "coro.free", f);
+  b.CreateCondBr(b.CreateIsNotNull(memory), free_bb, mCoroutine.suspend);
+  b.SetInsertPoint(free_bb);
+  llvm::FunctionCallee free_fn =
+    mLLVMModule->getOrInsertFunction("free", b.getVoidTy(), b.getInt8PtrTy());
+  b.CreateCall(free_fn, {memory});
+  b.CreateBr(mCoroutine.suspend);
+
+  mCoroutine.suspend->insertInto(f);
+  b.SetInsertPoint(mCoroutine.suspend);
+  b.CreateIntrinsic(llvm::Intrinsic::coro_end, {}, {mCoroutine.handle, b.getFalse()});
+  b.CreateRet(mCoroutine.handle);
+}
+
+void CodegenVisitor::AddHandle(llvm::Value *slot) {
+  mHandles.push_back(slot);
+  if (!mCoroutine.handle)
+    return;
+  // Cleared before the body starts, for the cleanup
+  llvm::IRBuilder<> start(mCoroutine.start);
+  start.CreateStore(llvm::ConstantPointerNull::get(start.getInt8PtrTy()), slot);
+  mCoroutine.slots.push_back(slot);
+}
+
+void CodegenVisitor::EmitDestroyHandles(size_t first) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  for (size_t i = mHandles.size(); i-- > first;) {
+    llvm::Value *handle = b.CreateLoad(b.getInt8PtrTy(), mHandles[i]);
+    b.CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, {handle});
+    if (mCoroutine.handle)
+      b.CreateStore(llvm::ConstantPointerNull::get(b.getInt8PtrTy()), mHandles[i]);
+  }
+}
+
+// `await p(args...)` resumes the new coroutine until it is done, suspending
+// the awaiting one in between, so whoever resumes that one drives both
+void CodegenVisitor::EmitAwait(CallExpression &call) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  llvm::Function *f = b.GetInsertBlock()->getParent();
+  EmitProcedureCall(call);
+  std::string yield;
+  SplitCoroutineType(mValueType, yield);
+  llvm::Value *handle = mLLVMValue;
+  llvm::AllocaInst *slot = CreateEntryAlloca("coroutine", "await");
+  llvm::IRBuilder<>(mCoroutine.start).CreateStore(llvm::ConstantPointerNull::get(b.getInt8PtrTy()),
+                                                  slot);
+  mCoroutine.slots.push_back(slot);
+  b.CreateStore(handle, slot);
+
+  llvm::BasicBlock *loop_bb = llvm::BasicBlock::Create(mLLVMContext, "await", f);
+  llvm::BasicBlock *wait_bb = llvm::BasicBlock::Create(mLLVMContext, "await.wait", f);
+  llvm::BasicBlock *done_bb = llvm::BasicBlock::Create(mLLVMContext, "await.done", f);
+  b.CreateBr(loop_bb);
+  b.SetInsertPoint(loop_bb);
+  b.CreateIntrinsic(llvm::Intrinsic::coro_resume, {}, {handle});
+  b.CreateCondBr(b.CreateIntrinsic(llvm::Intrinsic::coro_done, {}, {handle}), done_bb, wait_bb);
+  b.SetInsertPoint(wait_bb);
+  EmitSuspend(false);
+  b.CreateBr(loop_bb);
+
+  b.SetInsertPoint(done_bb);
+  mLLVMValue = nullptr;
+  mValueType = "void";
+  if (!yield.empty()) {
+    llvm::Value *promise = b.CreateIntrinsic(
+      llvm::Intrinsic::coro_promise, {},
+      {handle, b.getInt32(GetAlignment(yield)), b.getFalse()});
+    llvm::Type *type = GetType(yield);
+    mLLVMValue = b.CreateLoad(type, b.CreateBitCast(promise, type->getPointerTo()));
+    mValueType = yield;
+  }
+  b.CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, {handle});
+  b.CreateStore(llvm::ConstantPointerNull::get(b.getInt8PtrTy()), slot);
+}
+
+bool CodegenVisitor::EmitCoroutineBuiltin(CallExpression &call) {
+  llvm::IRBuilder<> &b = mLLVMIrBuilder;
+  const std::string &callee = call.mCallee;
+  auto &args = call.mArgs;
+
+  // A coroutine at its final suspend cannot be resumed, so resume() checks
+  // first
+  if (callee == "resume") {
+    llvm::Value *handle = EmitValue(*args[0]);
+    llvm::Function *f = b.GetInsertBlock()->getParent();
+    llvm::BasicBlock *resume_bb = llvm::BasicBlock::Create(mLLVMContext, "resume", f);
+    llvm::BasicBlock *done_bb = llvm::BasicBlock::Create(mLLVMContext, "resume.done", f);
+    b.CreateCondBr(b.CreateIntrinsic(llvm::Intrinsic::coro_done, {}, {handle}), done_bb,
+                   resume_bb);
+    b.SetInsertPoint(resume_bb);
+    b.CreateIntrinsic(llvm::Intrinsic::coro_resume, {}, {handle});
+    b.CreateBr(done_bb);
+    b.SetInsertPoint(done_bb);
+    mLLVMValue = b.CreateNot(b.CreateIntrinsic(llvm::Intrinsic::coro_done, {}, {handle}));
+    mValueType = "bool";
+    return true;
+  }
+
+  if (callee == "done") {
+    mLLVMValue = b.CreateIntrinsic(llvm::Intrinsic::coro_done, {}, {EmitValue(*args[0])});
+    mValueType = "bool";
+    return true;
+  }
+
+  if (callee == "yielded") {
+    llvm::Value *handle = EmitValue(*args[0]);
+    std::string yield;
+    SplitCoroutineType(mValueType, yield);
+    llvm::Value *promise = b.CreateIntrinsic(
+      llvm::Intrinsic::coro_promise, {},
+      {handle, b.getInt32(GetAlignment(yield)), b.getFalse()});
+    llvm::Type *type = GetType(yield);
+    mLLVMValue = b.CreateLoad(type, b.CreateBitCast(promise, type->getPointerTo()));
+    mValueType = yield;
+    return true;
+  }
+
+  // The executor owns spawned coroutines and destroys them once done
+  if (callee == "spawn") {
+    llvm::Value *handle = EmitValue(*args[0]);
+    llvm::FunctionCallee spawn =
+      mLLVMModule->getOrInsertFunction("charlie_spawn", b.getVoidTy(), b.getInt8PtrTy());
+    mLLVMValue = b.CreateCall(spawn, {handle});
+    mValueType = "void";
+    return true;
+  }
+
+  if (callee == "run") {
+    llvm::FunctionCallee run = mLLVMModule->getOrInsertFunction("charlie_run", b.getVoidTy());
+    mLLVMValue = b.CreateCall(run);
+    mValueType = "void";
+    return true;
+  }
+
+  return false;
+}
+
+}  // namespace charlie
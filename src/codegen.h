@@ -0,0 +1,274 @@
+#pragma once
+
+#include "ast.h"
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace llvm {
+class TargetMachine;
+}
+
+namespace charlie {
+
+class CodegenVisitor : public AstVisitor {
+  // LLVM objects
+  std::unique_ptr<llvm::LLVMContext> mOwnedLLVMContext;
+  llvm::LLVMContext &mLLVMContext;
+  llvm::IRBuilder<> mLLVMIrBuilder;
+  std::unique_ptr<llvm::Module> mLLVMModule;
+  llvm::Value *mLLVMValue;        // Set after any AST node codegen
+  llvm::Function *mLLVMFunction;  // Set after ProcedureDefinition codegen
+
+  std::string mTargetTriple;
+  std::string mTargetCPU;
+  std::string mTargetFeatures;
+  llvm::TargetMachine *mTargetMachine = nullptr;
+
+public:
+  // A struct lowered to an llvm::StructType. Fields are laid out in
+  // decreasing alignment order to minimize padding unless the struct is
+  // #packed_order, so `field_index` maps declaration order to LLVM order.
+  struct LoweredStruct {
+    const StructDefinition *def;
+    llvm::StructType *type;
+    std::vector<unsigned> field_index;  // Of each member; other fields pad
+    uint64_t size;       // Including tail padding
+    uint64_t alignment;  // Raised by #align(N); apply it to allocas and globals
+    uint64_t padding;    // Bytes of `size` not covered by any field
+    uint64_t declared_order_size;  // `size` had the fields not been reordered
+
+    bool IsPadding(unsigned field) const {
+      return std::find(field_index.begin(), field_index.end(), field) == field_index.end();
+    }
+  };
+
+private:
+  // Type table. Builtins and structs are added on first use.
+  std::unordered_map<std::string, llvm::Type *> mTypes;
+  std::unordered_map<std::string, LoweredStruct> mStructs;
+  // Struct definitions visible in the module, local and imported
+  std::unordered_map<std::string, const StructDefinition *> mStructDefs;
+  // Structs defined by the module itself, in declaration order
+  std::vector<std::string> mLocalStructs;
+  // Procedure signatures visible in the module, local and imported
+  std::unordered_map<std::string, const ProcedurePrototype *> mPrototypes;
+  // Local procedures with external linkage and the C calling convention,
+  // see ExportedProcedures(), and more that are only kept external
+  std::unordered_set<std::string> mExports;
+  std::unordered_set<std::string> mExtraExports;
+  // Local #coroutine procedures. Calling one returns the handle of a new
+  // coroutine, an i8 * to its frame.
+  std::unordered_set<std::string> mCoroutines;
+
+  // Locals of the procedure being generated. In the body of a parallel
+  // loop, `slot` points into the procedure the loop is in.
+  struct Local {
+    llvm::Value *slot;
+    std::string type;
+  };
+  std::unordered_map<std::string, Local> mLocals;
+  // Constants of the module, each a read-only global. Locals hide them.
+  std::unordered_map<std::string, Local> mConstants;
+  std::string mReturnType;     // Of the procedure being generated
+
+  // The llvm.coro.* state of the #coroutine procedure being generated, see
+  // EmitCoroutineBegin()
+  struct Coroutine {
+    llvm::Value *id = nullptr;
+    llvm::Value *handle = nullptr;
+    llvm::Value *promise = nullptr;          // Null if it yields no values
+    llvm::Instruction *start = nullptr;      // The initial suspend
+    llvm::BasicBlock *cleanup = nullptr;     // Destroys the frame
+    llvm::BasicBlock *suspend = nullptr;     // Returns to the resumer
+    // Every coroutine slot of the procedure, nulled once destroyed, so the
+    // cleanup can destroy the ones still alive
+    std::vector<llvm::Value *> slots;
+  } mCoroutine;
+  // Slots of the coroutines in scope, innermost last. Each is destroyed at
+  // the end of the block that created it, or before a return.
+  std::vector<llvm::Value *> mHandles;
+
+  std::string mValueType;      // Charlie type of mLLVMValue
+  bool mWantAddress = false;   // Set to visit an lvalue to its address
+  bool mTailCall = false;      // Set to visit the call of a #tail return
+
+  // An element of a #soa array is spread over one array per field, so it
+  // has no address. Indexing one leaves it here, with a null mLLVMValue, for
+  // the member access or assignment that consumes it.
+  struct SoaElement {
+    llvm::Value *array = nullptr;
+    llvm::Type *array_type = nullptr;
+    llvm::Value *index = nullptr;
+    const LoweredStruct *element = nullptr;
+  } mSoaElement;
+
+  const LoweredStruct *LowerStruct(const StructDefinition &sdef);
+  // The element struct of `type` if it is an array of a #soa struct
+  const LoweredStruct *GetSoaElement(const std::string &type);
+  uint64_t GetAlignment(const std::string &type);
+  // The initializer of a global holding `value`, laid out like GetType()
+  llvm::Constant *GetConstant(const ConstValue &value);
+
+  llvm::Value *EmitValue(Expression &expr);
+  // Emits `expr` converted to `type`, which CheckModule() only allows for
+  // untyped constants: they are resized and splatted across vector lanes.
+  llvm::Value *EmitValueAs(Expression &expr, const std::string &type);
+  llvm::Value *EmitConstantAs(Expression &expr, const std::string &type);
+  // Emits `lhs op rhs` on two values of builtin type `type`
+  llvm::Value *EmitArithmetic(BinaryExpression::Op op,
+                              llvm::Value *lhs,
+                              llvm::Value *rhs,
+                              const std::string &type);
+  llvm::Value *Coerce(llvm::Value *value, llvm::Type *type);
+  // Returns nullptr for an element of a #soa array, see mSoaElement.
+  // Values that are not variables are spilled to a temporary.
+  llvm::Value *EmitAddress(Expression &expr);
+  llvm::AllocaInst *CreateEntryAlloca(const std::string &type, const std::string &name);
+  // Arrays and structs are passed as a pointer to a copy the caller makes
+  // and the callee owns, so the optimizer never handles a whole aggregate as
+  // one value.
+  bool PassedByPointer(const std::string &type);
+  // The argument for a parameter of `type`, see PassedByPointer()
+  llvm::Value *EmitArgument(Expression &expr, const std::string &type);
+  // Linkage, calling convention and the attributes of `pdef`'s annotations
+  void SetProcedureAttributes(const ProcedureDefinition &pdef, llvm::Function &f);
+  // A call to a procedure, or the creation of a coroutine
+  void EmitProcedureCall(CallExpression &call);
+  // Numeric conversions and vector operations; returns false if `call` is
+  // not one
+  bool EmitBuiltin(CallExpression &call);
+  // The atomic_* builtins; returns false if `call` is not one
+  bool EmitAtomic(CallExpression &call);
+  // Bit counts, fma() and the hints to the optimizer, which map to llvm.*
+  // intrinsics; returns false if `call` is not one
+  bool EmitIntrinsic(CallExpression &call);
+  // resume(), done(), yielded(), spawn() and run(); returns false if `call`
+  // is not one
+  bool EmitCoroutineBuiltin(CallExpression &call);
+  // Starts a #coroutine procedure: the frame is allocated, and the body
+  // waits at an initial suspend for the first resume
+  void EmitCoroutineBegin(const ProcedureDefinition &pdef);
+  // The final suspend, then the cleanup that frees the frame
+  void EmitCoroutineEnd();
+  // Suspends the coroutine being generated and continues where it resumes
+  llvm::Instruction *EmitSuspend(bool final);
+  // Runs a coroutine to its end, suspending this one in between
+  void EmitAwait(CallExpression &call);
+  // Registers the coroutine `slot` of a let, destroyed with its block
+  void AddHandle(llvm::Value *slot);
+  // Destroys the coroutines of mHandles from index `first` on
+  void EmitDestroyHandles(size_t first);
+  // Ends the body of `loop` with a branch back to `header`, carrying the
+  // llvm.loop metadata for its annotations. The loop's blocks are those from
+  // `header` to the end of the function.
+  void EmitBackedge(const LoopStatement &loop, llvm::BasicBlock *header);
+  // Emits `for` over [begin, end), values of int type `type`
+  void EmitForLoop(ForStatement &loop,
+                   const std::string &type,
+                   llvm::Value *begin,
+                   llvm::Value *end);
+  // Outlines the body of `loop` and runs it through charlie_parallel_for()
+  void EmitParallelFor(ForStatement &loop,
+                       const std::string &type,
+                       llvm::Value *begin,
+                       llvm::Value *end);
+  // Combines `value` into the variable at `ptr` with a compare-exchange loop
+  void EmitAtomicReduce(Reduction::Op op,
+                        llvm::Value *ptr,
+                        llvm::Value *value,
+                        const std::string &type);
+  llvm::Value *EmitReduce(Reduction::Op op,
+                          llvm::Value *lhs,
+                          llvm::Value *rhs,
+                          const std::string &type);
+  llvm::Value *SoaFieldAddress(const SoaElement &soa, unsigned field);
+  llvm::Value *LoadSoaElement();
+  void StoreSoaElement(llvm::Value *value);
+
+public:
+  CodegenVisitor();
+
+  // Generates code into a caller-owned `context`, which lets long-running
+  // hosts reuse one across compilations. The context must outlive the visitor
+  // and must not be used by another thread at the same time.
+  explicit CodegenVisitor(llvm::LLVMContext &context);
+
+  // Must be called before visiting a Module. Empty strings select the host
+  // triple and generic CPU respectively.
+  void SetTarget(std::string triple, std::string cpu, std::string features);
+
+  // Like SetTarget(), but also takes the data layout from `tm` and enables
+  // EmitObject(). `tm` must outlive the visitor.
+  void SetTargetMachine(llvm::TargetMachine *tm);
+
+  // Procedures to keep external besides `main` and #export ones, e.g. the
+  // --keep roots. Like them they use the C calling convention. Must be
+  // called before visiting a Module.
+  void SetExtraExports(const std::vector<std::string> &names) {
+    mExtraExports = {names.begin(), names.end()};
+  }
+
+  // Runs the default LLVM pass pipeline for -O`opt_level` over the module.
+  void Optimize(unsigned opt_level);
+
+  void Print(llvm::raw_ostream &os) const;
+
+  // Returns the LLVM type for a builtin or struct type name, or nullptr if
+  // there is no such type.
+  llvm::Type *GetType(const std::string &name);
+
+  // Returns the layout of struct `name`, lowering it if needed, or nullptr
+  // if there is no such struct.
+  const LoweredStruct *GetStruct(const std::string &name);
+
+  // Prints size, alignment, padding and field offsets of the structs the
+  // module defines.
+  void PrintLayoutReport(std::ostream &os) const;
+
+  // Hands the generated module to the caller. The visitor cannot emit
+  // anything afterwards.
+  std::unique_ptr<llvm::Module> TakeModule() {
+    return std::move(mLLVMModule);
+  }
+
+  // Serializes the module as LLVM bitcode into `out`.
+  void EmitBitcode(std::string &out) const;
+
+  // Emits a native object file into `out`. Requires SetTargetMachine().
+  bool EmitObject(std::string &out, std::string &error) const;
+
+  void Visit(Module &mod) override;
+  void Visit(Block &block) override;
+  void Visit(ProcedurePrototype &proto) override;
+  void Visit(ProcedureDefinition &func_def) override;
+  void Visit(StructDefinition &struct_def) override;
+  void Visit(UseDeclaration &use_decl) override;
+  void Visit(ConstDefinition &const_def) override;
+  void Visit(IntegerLiteral &intlit) override;
+  void Visit(FloatLiteral &floatlit) override;
+  void Visit(StringLiteral &StringLiteral) override;
+  void Visit(Identifier &ident) override;
+  void Visit(IndexExpression &index) override;
+  void Visit(MemberExpression &member) override;
+  void Visit(BinaryExpression &binary) override;
+  void Visit(CallExpression &call) override;
+  void Visit(ReturnStatement &retstmt) override;
+  void Visit(YieldStatement &yield) override;
+  void Visit(LetStatement &let) override;
+  void Visit(AssignStatement &assign) override;
+  void Visit(ExpressionStatement &expr) override;
+  void Visit(WhileStatement &loop) override;
+  void Visit(ForStatement &loop) override;
+};
+
+}  // namespace charlie
@@ -0,0 +1,326 @@
+#include "compiler.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "check.h"
+#include "codegen.h"
+#include "interface.h"
+#include "interpreter.h"
+#include "memory.h"
+#include "parser.h"
+#include "reachability.h"
+#include "timer.h"
+
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace charlie {
+
+void InitializeLLVMTargets() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+    llvm::InitializeAllAsmPrinters();
+  });
+}
+
+static llvm::CodeGenOpt::Level GetCodeGenOptLevel(unsigned opt_level) {
+  switch (opt_level) {
+  case 0: return llvm::CodeGenOpt::None;
+  case 1: return llvm::CodeGenOpt::Less;
+  case 2: return llvm::CodeGenOpt::Default;
+  default: return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
+TargetSpec ResolveTarget(const CompilerOptions &opts) {
+  TargetSpec spec;
+  spec.triple = opts.target_triple.empty() ? llvm::sys::getDefaultTargetTriple()
+                                           : opts.target_triple;
+  spec.cpu = opts.target_cpu.empty() ? "generic" : opts.target_cpu;
+  spec.features = opts.target_features;
+  return spec;
+}
+
+llvm::TargetMachine *CompileContext::GetTargetMachine(const CompilerOptions &opts,
+                                                      std::string &error) {
+  TargetSpec spec = ResolveTarget(opts);
+  const std::string &triple = spec.triple;
+
+  std::string key = triple + '\0' + spec.cpu + '\0' + spec.features + '\0' +
+                    std::to_string(opts.opt_level);
+  auto it = mTargetMachines.find(key);
+  if (it != mTargetMachines.end())
+    return it->second.get();
+
+  InitializeLLVMTargets();
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target)
+    return nullptr;
+
+  llvm::TargetOptions target_opts;
+  llvm::TargetMachine *tm =
+    target->createTargetMachine(triple,
+                                spec.cpu,
+                                spec.features,
+                                target_opts,
+                                llvm::Reloc::PIC_,
+                                llvm::None,
+                                GetCodeGenOptLevel(opts.opt_level));
+  if (!tm) {
+    error = "failed to create target machine for '" + triple + "'";
+    return nullptr;
+  }
+  mTargetMachines.emplace(std::move(key), tm);
+  return tm;
+}
+
+static bool ReadFile(const std::string &path, std::string &contents) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  contents = ss.str();
+  return true;
+}
+
+// Resolves imports, drops dead declarations and generates optimized code
+// for a parsed module. With `ast_out`, the checked AST is printed there
+// before any declaration is dropped. Returns nullptr after reporting to
+// `diag` on failure.
+static std::unique_ptr<CodegenVisitor> GenerateCode(Module &module,
+                                                    ImportResolver &resolver,
+                                                    const CompilerOptions &opts,
+                                                    CompileContext &cc,
+                                                    std::ostream &diag,
+                                                    std::ostream *ast_out = nullptr) {
+  if (TimeScope scope("imports", module.Name()); !resolver.Resolve(module))
+    return nullptr;
+  if (!CheckModule(module, ExtraExports(module, opts), diag))
+    return nullptr;
+
+  if (ast_out) {
+    TimeScope scope("display", module.Name());
+    *ast_out << "; AST for " << module.Name() << '\n';
+    AstDisplayVisitor adv(*ast_out);
+    module.Accept(adv);
+    *ast_out << '\n';
+  }
+
+  if (opts.dead_decl_elim) {
+    TimeScope scope("dce", module.Name());
+    auto report = EliminateDeadDeclarations(module, opts.keep);
+    if (opts.dead_decl_report)
+      report.Print(diag);
+  }
+
+  std::string error;
+  llvm::TargetMachine *tm = cc.GetTargetMachine(opts, error);
+  if (!tm) {
+    diag << "[Driver Error] " << error << '\n';
+    return nullptr;
+  }
+
+  auto cv = std::make_unique<CodegenVisitor>(cc.NewContext());
+  cv->SetTargetMachine(tm);
+  cv->SetExtraExports(ExtraExports(module, opts));
+  module.Accept(*cv);
+  if (opts.layout_report)
+    cv->PrintLayoutReport(diag);
+  cv->Optimize(opts.opt_level);
+  return cv;
+}
+
+// Compiles `source` to the output kind selected in `opts`
+static bool CompileBuffer(const SourceBuffer &source,
+                          const std::string &module_name,
+                          ImportResolver &resolver,
+                          const CompilerOptions &opts,
+                          CompileContext &cc,
+                          std::ostream &diag,
+                          std::string &output) {
+  Parser p(source, diag);
+  auto module = p.Parse();
+  if (!module)
+    return false;
+  if (MemoryTracker::Get().Enabled())
+    MemoryTracker::Get().CountAstNodes(*module);
+
+  if (opts.emit == CompilerOptions::EMIT_INTERFACE) {
+    WriteInterface(*ExtractInterface(*module, module_name, source.text,
+                                     ExtraExports(*module, opts)),
+                   output);
+    return true;
+  }
+
+  auto cv = GenerateCode(*module, resolver, opts, cc, diag);
+  if (!cv)
+    return false;
+
+  output.clear();
+  std::string error;
+  switch (opts.emit) {
+  case CompilerOptions::EMIT_BITCODE:
+    cv->EmitBitcode(output);
+    break;
+  case CompilerOptions::EMIT_OBJECT:
+    if (!cv->EmitObject(output, error)) {
+      diag << "[Codegen Error] " << error << '\n';
+      return false;
+    }
+    break;
+  case CompilerOptions::EMIT_LLVM_IR: {
+    llvm::raw_string_ostream os(output);
+    cv->Print(os);
+    os.flush();
+    break;
+  }
+  case CompilerOptions::EMIT_INTERFACE:
+    break;
+  }
+  return true;
+}
+
+bool CompileFile(const std::string &input,
+                 const CompilerOptions &opts,
+                 CompileContext &cc,
+                 CompilationCache *cache,
+                 std::ostream &diag,
+                 std::string &output) {
+  TimeScope scope("compile", input);
+
+  // Read once; the cache key and the lexer both work from this buffer
+  std::string source;
+  if (!ReadFile(input, source)) {
+    diag << "[Driver Error] Failed to read '" << input << "'\n";
+    return false;
+  }
+
+  std::string cache_key;
+  if (cache) {
+    cache_key = CompilationCache::ComputeKey(source, input, opts);
+    TimeScope lookup_scope("cache", input);
+    if (cache->Lookup(cache_key, output))
+      return true;
+  }
+
+  ImportResolver resolver(ImportSearchPaths(input, opts.import_paths), opts, diag);
+  if (!CompileBuffer({input, source}, DefaultModuleName(input), resolver, opts,
+                     cc, diag, output))
+    return false;
+
+  if (cache)
+    cache->Store(cache_key, output, resolver.Dependencies());
+  return true;
+}
+
+bool CompileSource(std::string_view source,
+                   const std::string &name,
+                   const CompilerOptions &opts,
+                   CompileContext &cc,
+                   std::ostream &diag,
+                   std::string &output) {
+  TimeScope scope("compile", name);
+  ImportResolver resolver(opts.import_paths, opts, diag);
+  return CompileBuffer({name, source}, DefaultModuleName(name), resolver, opts,
+                       cc, diag, output);
+}
+
+std::unique_ptr<llvm::Module> CompileSourceToModule(std::string_view source,
+                                                    const std::string &name,
+                                                    const CompilerOptions &opts,
+                                                    CompileContext &cc,
+                                                    std::ostream &diag) {
+  TimeScope scope("compile", name);
+  Parser p(SourceBuffer{name, source}, diag);
+  auto module = p.Parse();
+  if (!module)
+    return nullptr;
+  if (MemoryTracker::Get().Enabled())
+    MemoryTracker::Get().CountAstNodes(*module);
+
+  ImportResolver resolver(opts.import_paths, opts, diag);
+  auto cv = GenerateCode(*module, resolver, opts, cc, diag);
+  if (!cv)
+    return nullptr;
+  return cv->TakeModule();
+}
+
+bool DumpFile(const std::string &input,
+              const CompilerOptions &opts,
+              CompileContext &cc,
+              std::ostream &out,
+              std::ostream &diag) {
+  TimeScope scope("compile", input);
+  Parser p(input, diag);
+  auto module = p.Parse();
+  if (!module)
+    return false;
+  if (MemoryTracker::Get().Enabled())
+    MemoryTracker::Get().CountAstNodes(*module);
+
+  ImportResolver resolver(ImportSearchPaths(input, opts.import_paths), opts, diag);
+  auto cv = GenerateCode(*module, resolver, opts, cc, diag, &out);
+  if (!cv)
+    return false;
+
+  llvm::raw_os_ostream os(out);
+  cv->Print(os);
+  return true;
+}
+
+bool InterpretFile(const std::string &input,
+                   const CompilerOptions &opts,
+                   std::ostream &out,
+                   std::ostream &diag,
+                   int &exit_code) {
+  Parser p(input, diag);
+  auto module = p.Parse();
+  if (!module)
+    return false;
+  if (MemoryTracker::Get().Enabled())
+    MemoryTracker::Get().CountAstNodes(*module);
+
+  ImportResolver resolver(ImportSearchPaths(input, opts.import_paths), opts, diag);
+  if (TimeScope scope("imports", input); !resolver.Resolve(*module))
+    return false;
+  if (!CheckModule(*module, ExtraExports(*module, opts), diag))
+    return false;
+
+  if (opts.dead_decl_elim) {
+    TimeScope scope("dce", input);
+    EliminateDeadDeclarations(*module, opts.keep);
+  }
+
+  BytecodeModule bytecode;
+  BytecodeLowering lowering(bytecode, diag);
+  if (TimeScope scope("lower", input); !lowering.Lower(*module))
+    return false;
+  if (opts.dump)
+    bytecode.Print(out);
+
+  Interpreter interp(bytecode, diag);
+  Value result;
+  if (TimeScope scope("interp", input); !interp.Call("main", result))
+    return false;
+
+  exit_code = 0;
+  if (result.kind == Value::INT) {
+    exit_code = static_cast<int>(result.i);
+  } else if (result.kind != Value::NONE) {
+    out << result << '\n';
+  }
+  return true;
+}
+
+}  // namespace charlie
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "cache.h"
+#include "options.h"
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace charlie {
+
+// Registers all LLVM targets. Safe to call from multiple threads.
+void InitializeLLVMTargets();
+
+// The target `opts` selects, with the host triple and the generic CPU in
+// place of empty options.
+struct TargetSpec {
+  std::string triple;
+  std::string cpu;
+  std::string features;
+};
+
+TargetSpec ResolveTarget(const CompilerOptions &opts);
+
+// State that is expensive to create and can be reused across compilations:
+// one TargetMachine per distinct target configuration. Each compilation gets
+// a fresh LLVMContext, as types created in one, such as named structs, live
+// as long as it does and would rename the next compilation's.
+// A CompileContext must only be used by one thread at a time.
+class CompileContext {
+public:
+  // Replaces the LLVMContext of the previous compilation, and whatever it
+  // still holds, with an empty one
+  llvm::LLVMContext &NewContext() {
+    mContext = std::make_unique<llvm::LLVMContext>();
+    return *mContext;
+  }
+
+  // The LLVMContext of the latest compilation
+  llvm::LLVMContext &Context() {
+    return *mContext;
+  }
+
+  // Returns the TargetMachine for the target in `opts`, creating it on first
+  // use. Sets `error` and returns nullptr if the target is unknown.
+  llvm::TargetMachine *GetTargetMachine(const CompilerOptions &opts,
+                                        std::string &error);
+
+private:
+  std::unique_ptr<llvm::LLVMContext> mContext = std::make_unique<llvm::LLVMContext>();
+  std::map<std::string, std::unique_ptr<llvm::TargetMachine>> mTargetMachines;
+};
+
+// Compiles `input` to the output kind selected in `opts` and sets `output` to
+// the emitted bytes. Diagnostics are written to `diag`. If `cache` is non-null
+// it is consulted before, and updated after, compiling.
+//
+// Returns false if compilation failed.
+bool CompileFile(const std::string &input,
+                 const CompilerOptions &opts,
+                 CompileContext &cc,
+                 CompilationCache *cache,
+                 std::ostream &diag,
+                 std::string &output);
+
+// Compiles `source` from memory like CompileFile(), without the cache.
+// `name` names the module in diagnostics and output. Nothing is read from
+// the file system unless `source` `use`s other modules, which are looked up
+// in `opts.import_paths`.
+//
+// Returns false if compilation failed.
+bool CompileSource(std::string_view source,
+                   const std::string &name,
+                   const CompilerOptions &opts,
+                   CompileContext &cc,
+                   std::ostream &diag,
+                   std::string &output);
+
+// Like CompileSource(), but stops after optimization and returns the LLVM
+// module for the caller to JIT, link or emit. The module belongs to
+// `cc.Context()`, so it must be destroyed before `cc` compiles again.
+// Returns nullptr if compilation failed.
+std::unique_ptr<llvm::Module> CompileSourceToModule(std::string_view source,
+                                                    const std::string &name,
+                                                    const CompilerOptions &opts,
+                                                    CompileContext &cc,
+                                                    std::ostream &diag);
+
+// Parses and generates code for `input` like CompileFile(), but writes the AST
+// and the optimized LLVM IR to `out` instead of emitting an output.
+//
+// Returns false if compilation failed.
+bool DumpFile(const std::string &input,
+              const CompilerOptions &opts,
+              CompileContext &cc,
+              std::ostream &out,
+              std::ostream &diag);
+
+// Runs `main` from `input` on the bytecode interpreter without touching
+// LLVM. Integer results become `exit_code`, anything else is printed to
+// `out`.
+//
+// Returns false if the program could not be run.
+bool InterpretFile(const std::string &input,
+                   const CompilerOptions &opts,
+                   std::ostream &out,
+                   std::ostream &diag,
+                   int &exit_code);
+
+}  // namespace charlie
@@ -0,0 +1,703 @@
+#include "consteval.h"
+#include "types.h"
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace charlie {
+
+// Statements and loop iterations the initializer of one constant may run,
+// counting the constants it evaluates first, so an endless loop fails in
+// seconds rather than hanging the compiler
+static constexpr uint64_t kMaxSteps = 10000000;
+
+// How deeply initializers may nest calls. The interpreter recurses on the
+// compiler's own stack.
+static constexpr int kMaxCallDepth = 256;
+
+namespace {
+
+// What running a statement did
+enum class Flow {
+  NEXT,    // Go on with the next statement
+  RETURN,  // The procedure returned, with its frame's result
+  FAILED,  // An error was reported
+};
+
+ConstValue MakeInt(const BuiltinType &type, uint64_t bits) {
+  if (type.bits < 64) {
+    uint64_t sign = uint64_t(1) << (type.bits - 1);
+    bits &= (sign << 1) - 1;
+    if (type.is_signed && (bits & sign))
+      bits |= ~((sign << 1) - 1);
+  }
+  ConstValue value{type.name};
+  value.i = static_cast<int64_t>(bits);
+  return value;
+}
+
+ConstValue MakeFloat(const BuiltinType &type, double f) {
+  ConstValue value{type.name};
+  value.f = type.bits == 32 ? static_cast<float>(f) : f;
+  return value;
+}
+
+std::string ToString(const ConstValue &value) {
+  const BuiltinType *type = FindBuiltinType(value.type);
+  if (type->kind == BuiltinType::FLOAT) {
+    std::ostringstream os;
+    os << value.f;
+    return os.str();
+  }
+  return type->is_signed ? std::to_string(value.i)
+                         : std::to_string(static_cast<uint64_t>(value.i));
+}
+
+template <typename T>
+bool Compare(BinaryExpression::Op op, T a, T b) {
+  switch (op) {
+  case BinaryExpression::LT: return a < b;
+  case BinaryExpression::LE: return a <= b;
+  case BinaryExpression::GT: return a > b;
+  case BinaryExpression::GE: return a >= b;
+  case BinaryExpression::EQ: return a == b;
+  default: return a != b;
+  };
+}
+
+class ConstantEvaluator {
+public:
+  ConstantEvaluator(Module &mod, std::ostream &diag) : mModule(mod), mDiag(diag) {}
+
+  bool Run() {
+    CollectNames();
+    bool ok = true;
+    for (const auto &[name, cdef] : mConstantOrder) {
+      mSteps = 0;
+      ok &= Evaluate(*cdef) != nullptr;
+    }
+    if (!ok)
+      return false;
+    for (const auto &[name, cdef] : mConstantOrder) {
+      cdef->SetValue(std::make_unique<ConstValue>(std::move(mValues.at(name))));
+    }
+    return true;
+  }
+
+private:
+  // The variables of one running procedure
+  struct Frame {
+    const ProcedureDefinition &proc;
+    std::unordered_map<std::string, ConstValue> locals;
+    // Names in the order they were declared, so blocks can drop theirs
+    std::vector<std::string> declared;
+    ConstValue result;
+  };
+
+  Module &mModule;
+  std::ostream &mDiag;
+
+  std::unordered_map<std::string, const ProcedureDefinition *> mProcedures;
+  std::unordered_map<std::string, const StructDefinition *> mStructs;
+  std::unordered_set<std::string> mImported;
+  std::unordered_map<std::string, ConstDefinition *> mConstants;
+  std::vector<std::pair<std::string, ConstDefinition *>> mConstantOrder;
+
+  // Values of the constants evaluated so far. References into the map stay
+  // valid as it grows, so reads do not copy whole arrays.
+  std::unordered_map<std::string, ConstValue> mValues;
+  // Constants being evaluated, to catch cycles, and ones that failed
+  std::unordered_set<std::string> mEvaluating;
+  std::unordered_set<std::string> mFailed;
+  std::string mConstName;
+
+  Frame *mFrame = nullptr;
+  int mDepth = 0;
+  uint64_t mSteps = 0;
+
+  // FindBuiltinType() scans the whole table of builtins, and nearly every
+  // value computed asks for its type
+  std::unordered_map<std::string, const BuiltinType *> mBuiltins;
+
+  const BuiltinType *Builtin(const std::string &type) {
+    if (auto it = mBuiltins.find(type); it != mBuiltins.end())
+      return it->second;
+    return mBuiltins[type] = FindBuiltinType(type);
+  }
+
+  void Error(const std::string &message) {
+    mDiag << "[Comptime Error] " << mModule.Name() << ": " << message << '\n';
+  }
+
+  // Where an error happened, e.g. " in 'f', evaluating 'TABLE'"
+  std::string Where() const {
+    const std::string &proc = mFrame->proc.Prototype()->Name();
+    std::string where = " in '" + proc + "'";
+    if (proc != mConstName)
+      where += ", evaluating '" + mConstName + "'";
+    return where;
+  }
+
+  bool Step() {
+    if (++mSteps <= kMaxSteps)
+      return true;
+    if (mSteps == kMaxSteps + 1)
+      Error("evaluation takes more than " + std::to_string(kMaxSteps) + " steps" + Where());
+    return false;
+  }
+
+  void CollectNames() {
+    for (const auto &decl : mModule.TopLevelDecls()) {
+      switch (decl->mDeclKind) {
+      case TopLevelDeclaration::PROC_DEF: {
+        auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+        mProcedures.emplace(pdef->Prototype()->Name(), pdef);
+        break;
+      }
+      case TopLevelDeclaration::STRUCT_DEF: {
+        auto sdef = static_cast<const StructDefinition *>(decl.get());
+        mStructs.emplace(sdef->Name(), sdef);
+        break;
+      }
+      case TopLevelDeclaration::USE_DECL: {
+        const ModuleInterface *interface = static_cast<const UseDeclaration &>(*decl).Interface();
+        if (!interface)
+          break;
+        for (const auto &proto : interface->procedures) {
+          mImported.insert(proto->Name());
+        }
+        for (const auto &sdef : interface->structs) {
+          mStructs.emplace(sdef->Name(), sdef.get());
+        }
+        break;
+      }
+      case TopLevelDeclaration::CONST_DEF: {
+        auto cdef = static_cast<ConstDefinition *>(decl.get());
+        mConstants.emplace(cdef->Name(), cdef);
+        mConstantOrder.emplace_back(cdef->Name(), cdef);
+        break;
+      }
+      default: break;
+      };
+    }
+  }
+
+  // Returns the value of `cdef`, or nullptr after reporting an error
+  ConstValue *Evaluate(const ConstDefinition &cdef) {
+    const std::string &name = cdef.Name();
+    if (auto it = mValues.find(name); it != mValues.end())
+      return &it->second;
+    if (mFailed.count(name))
+      return nullptr;
+    if (!mEvaluating.insert(name).second) {
+      Error("constant '" + name + "' depends on its own value" + Where());
+      return nullptr;
+    }
+    std::string outer = std::exchange(mConstName, name);
+    ConstValue value;
+    bool ok = Call(*cdef.Initializer(), {}, value);
+    mConstName = std::move(outer);
+    mEvaluating.erase(name);
+    if (!ok) {
+      mFailed.insert(name);
+      return nullptr;
+    }
+    return &mValues.emplace(name, std::move(value)).first->second;
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Procedures and statements
+  //===--------------------------------------------------------------------===//
+
+  bool Call(const ProcedureDefinition &pdef, std::vector<ConstValue> args, ConstValue &result) {
+    const ProcedurePrototype &proto = *pdef.Prototype();
+    if (mDepth == kMaxCallDepth) {
+      Error("calls nest more than " + std::to_string(kMaxCallDepth) + " deep" + Where());
+      return false;
+    }
+    Frame frame{pdef, {}, {}, {}};
+    for (size_t i = 0; i < args.size(); ++i) {
+      frame.locals.emplace(proto.Args()[i].name, std::move(args[i]));
+    }
+    Frame *caller = std::exchange(mFrame, &frame);
+    ++mDepth;
+    Flow flow = Run(*pdef.BodyBlock());
+    --mDepth;
+    mFrame = caller;
+
+    if (flow == Flow::FAILED)
+      return false;
+    if (flow == Flow::NEXT && !proto.ReturnType().empty()) {
+      Error("'" + proto.Name() + "' ends without returning a value, evaluating '" + mConstName +
+            "'");
+      return false;
+    }
+    result = std::move(frame.result);
+    return true;
+  }
+
+  Flow Run(const Block &block) {
+    size_t declared = mFrame->declared.size();
+    Flow flow = Flow::NEXT;
+    for (const auto &stmt : block.Statements()) {
+      flow = Run(*stmt);
+      if (flow != Flow::NEXT)
+        break;
+    }
+    EndScope(declared);
+    return flow;
+  }
+
+  void Declare(const std::string &name, ConstValue value) {
+    mFrame->locals[name] = std::move(value);
+    mFrame->declared.push_back(name);
+  }
+
+  // Drops the variables declared after the first `declared`
+  void EndScope(size_t declared) {
+    while (mFrame->declared.size() > declared) {
+      mFrame->locals.erase(mFrame->declared.back());
+      mFrame->declared.pop_back();
+    }
+  }
+
+  Flow Run(const Statement &stmt) {
+    if (!Step())
+      return Flow::FAILED;
+    switch (stmt.mStmtKind) {
+    case Statement::RETURN: {
+      auto &ret = static_cast<const ReturnStatement &>(stmt);
+      std::string type = CanonicalTypeName(mFrame->proc.Prototype()->ReturnType());
+      return EvaluateAs(*ret.mReturnExpr, type, mFrame->result) ? Flow::RETURN : Flow::FAILED;
+    }
+    case Statement::LET: {
+      auto &let = static_cast<const LetStatement &>(stmt);
+      std::string type = CanonicalTypeName(let.mType);
+      if (std::string value; SplitAtomicType(BaseTypeName(type), value)) {
+        Error("atomic '" + let.mName + "' cannot be used at compile time" + Where());
+        return Flow::FAILED;
+      }
+      ConstValue value;
+      if (!let.mInit)
+        value = Zero(type);
+      else if (!EvaluateAs(*let.mInit, type, value))
+        return Flow::FAILED;
+      Declare(let.mName, std::move(value));
+      return Flow::NEXT;
+    }
+    case Statement::ASSIGN: {
+      // Like generated code, the value takes the target's type after it is
+      // evaluated on its own
+      auto &assign = static_cast<const AssignStatement &>(stmt);
+      ConstValue value, temp;
+      if (!Evaluate(*assign.mValue, value))
+        return Flow::FAILED;
+      ConstValue *target = Locate(*assign.mTarget, temp);
+      if (!target)
+        return Flow::FAILED;
+      *target = Coerce(std::move(value), target->type);
+      return Flow::NEXT;
+    }
+    case Statement::EXPR: {
+      ConstValue value;
+      auto &expr = static_cast<const ExpressionStatement &>(stmt);
+      return Evaluate(*expr.mExpr, value) ? Flow::NEXT : Flow::FAILED;
+    }
+    case Statement::WHILE: {
+      auto &loop = static_cast<const WhileStatement &>(stmt);
+      for (;;) {
+        ConstValue cond;
+        if (!Evaluate(*loop.mCond, cond))
+          return Flow::FAILED;
+        if (!cond.i)
+          return Flow::NEXT;
+        if (Flow flow = Run(*loop.mBody); flow != Flow::NEXT)
+          return flow;
+        if (!Step())
+          return Flow::FAILED;
+      }
+    }
+    case Statement::FOR: return Run(static_cast<const ForStatement &>(stmt));
+    case Statement::YIELD:
+      Error("cannot yield at compile time" + Where());
+      return Flow::FAILED;
+    default: return Flow::NEXT;
+    };
+  }
+
+  // Parallel loops run their iterations in order, which is one of the
+  // orders they may run in
+  Flow Run(const ForStatement &loop) {
+    // A constant begin takes the type of end, see CheckModule()
+    std::string type = CanonicalTypeName(loop.mType);
+    ConstValue begin, end;
+    if (type.empty() && IsUntypedConstant(*loop.mBegin)) {
+      if (!Evaluate(*loop.mEnd, end))
+        return Flow::FAILED;
+      type = end.type;
+      if (!EvaluateAs(*loop.mBegin, type, begin))
+        return Flow::FAILED;
+    } else if (type.empty()) {
+      if (!Evaluate(*loop.mBegin, begin))
+        return Flow::FAILED;
+      type = begin.type;
+      if (!EvaluateAs(*loop.mEnd, type, end))
+        return Flow::FAILED;
+    } else if (!EvaluateAs(*loop.mBegin, type, begin) || !EvaluateAs(*loop.mEnd, type, end)) {
+      return Flow::FAILED;
+    }
+
+    const BuiltinType &counter = *Builtin(type);
+    for (ConstValue i = begin; Less(i, end, counter);
+         i = MakeInt(counter, static_cast<uint64_t>(i.i) + 1)) {
+      size_t declared = mFrame->declared.size();
+      Declare(loop.mVar, i);
+      Flow flow = Run(*loop.mBody);
+      EndScope(declared);
+      if (flow != Flow::NEXT)
+        return flow;
+      if (!Step())
+        return Flow::FAILED;
+    }
+    return Flow::NEXT;
+  }
+
+  static bool Less(const ConstValue &a, const ConstValue &b, const BuiltinType &type) {
+    return type.is_signed ? a.i < b.i : static_cast<uint64_t>(a.i) < static_cast<uint64_t>(b.i);
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Expressions
+  //===--------------------------------------------------------------------===//
+
+  // The zero value of `type`, what a let without an initializer holds
+  ConstValue Zero(const std::string &type) {
+    ConstValue value{type};
+    std::string element;
+    uint64_t count;
+    if (const BuiltinType *builtin = Builtin(type)) {
+      if (builtin->lanes)
+        value.elements.assign(builtin->lanes, Zero(builtin->element));
+    } else if (SplitArrayType(type, element, count)) {
+      value.elements.assign(count, Zero(element));
+    } else if (SplitAtomicType(type, element)) {
+      value = Zero(element);
+    } else if (auto it = mStructs.find(type); it != mStructs.end()) {
+      for (const auto &member : it->second->Members()) {
+        value.elements.push_back(Zero(CanonicalTypeName(member.type)));
+      }
+    }
+    return value;
+  }
+
+  // `value` as `type`, the way generated code widens and narrows literals
+  // and splats scalars across vectors. Other values already have `type`.
+  ConstValue Coerce(ConstValue value, const std::string &type) {
+    const BuiltinType *to = Builtin(type);
+    if (value.type == type || !to)
+      return value;
+    if (to->lanes) {
+      ConstValue vector{type};
+      vector.elements.assign(to->lanes, Coerce(std::move(value), to->element));
+      return vector;
+    }
+    bool from_float = Builtin(value.type)->kind == BuiltinType::FLOAT;
+    if (to->kind == BuiltinType::FLOAT)
+      return MakeFloat(*to, from_float ? value.f : static_cast<double>(value.i));
+    return MakeInt(*to, from_float ? static_cast<int64_t>(value.f) : value.i);
+  }
+
+  bool Evaluate(const Expression &expr, ConstValue &out) {
+    if (IsUntypedConstant(expr))
+      return EvaluateConstantAs(expr, CanonicalTypeName(DefaultConstantType(expr)), out);
+
+    switch (expr.mExprKind) {
+    case Expression::STRING_LITERAL:
+      Error("strings cannot be evaluated at compile time" + Where());
+      return false;
+    case Expression::IDENTIFIER:
+    case Expression::INDEX:
+    case Expression::MEMBER: {
+      ConstValue temp;
+      ConstValue *value = Locate(expr, temp);
+      if (!value)
+        return false;
+      out = *value;
+      return true;
+    }
+    case Expression::BINARY: {
+      // A literal on either side takes the type of the other
+      auto &binary = static_cast<const BinaryExpression &>(expr);
+      ConstValue lhs, rhs;
+      if (IsUntypedConstant(*binary.mLhs)) {
+        if (!Evaluate(*binary.mRhs, rhs) || !EvaluateAs(*binary.mLhs, rhs.type, lhs))
+          return false;
+      } else if (!Evaluate(*binary.mLhs, lhs) || !EvaluateAs(*binary.mRhs, lhs.type, rhs)) {
+        return false;
+      }
+      return Arithmetic(binary.mOp, lhs, rhs, out);
+    }
+    case Expression::CALL: return Evaluate(static_cast<const CallExpression &>(expr), out);
+    default: return false;
+    };
+  }
+
+  bool EvaluateAs(const Expression &expr, const std::string &type, ConstValue &out) {
+    if (IsUntypedConstant(expr))
+      return EvaluateConstantAs(expr, type, out);
+    if (!Evaluate(expr, out))
+      return false;
+    out = Coerce(std::move(out), type);
+    return true;
+  }
+
+  // Untyped constants are evaluated in the type they are used as, like
+  // CodegenVisitor::EmitConstantAs()
+  bool EvaluateConstantAs(const Expression &expr, const std::string &type, ConstValue &out) {
+    switch (expr.mExprKind) {
+    case Expression::INT_LITERAL: {
+      auto &intlit = static_cast<const IntegerLiteral &>(expr);
+      out = Coerce(MakeInt(*Builtin("i64"), intlit.mInt), type);
+      return true;
+    }
+    case Expression::FLOAT_LITERAL: {
+      auto &floatlit = static_cast<const FloatLiteral &>(expr);
+      out = Coerce(MakeFloat(*Builtin("f64"), floatlit.mFloat), type);
+      return true;
+    }
+    default: {
+      auto &binary = static_cast<const BinaryExpression &>(expr);
+      ConstValue lhs, rhs;
+      return EvaluateConstantAs(*binary.mLhs, type, lhs) &&
+             EvaluateConstantAs(*binary.mRhs, type, rhs) &&
+             Arithmetic(binary.mOp, lhs, rhs, out);
+    }
+    };
+  }
+
+  // The value `expr` names if it is a variable, constant, element or
+  // member, so that reading one element of an array does not copy all of
+  // it. Other values are evaluated into `temp`. Returns nullptr after
+  // reporting an error.
+  ConstValue *Locate(const Expression &expr, ConstValue &temp) {
+    switch (expr.mExprKind) {
+    case Expression::IDENTIFIER: {
+      auto &ident = static_cast<const Identifier &>(expr);
+      if (auto it = mFrame->locals.find(ident.mName); it != mFrame->locals.end())
+        return &it->second;
+      return Evaluate(*mConstants.at(ident.mName));
+    }
+    case Expression::INDEX: {
+      auto &index = static_cast<const IndexExpression &>(expr);
+      ConstValue *base = Locate(*index.mBase, temp);
+      ConstValue i;
+      if (!base || !Evaluate(*index.mIndex, i))
+        return nullptr;
+      // Generated code would access memory outside the array or vector
+      bool negative = Builtin(i.type)->is_signed && i.i < 0;
+      if (negative || static_cast<uint64_t>(i.i) >= base->elements.size()) {
+        Error("index " + ToString(i) + " is out of bounds of '" + base->type + "'" + Where());
+        return nullptr;
+      }
+      return &base->elements[i.i];
+    }
+    case Expression::MEMBER: {
+      auto &member = static_cast<const MemberExpression &>(expr);
+      ConstValue *base = Locate(*member.mBase, temp);
+      if (!base)
+        return nullptr;
+      const auto &members = mStructs.at(base->type)->Members();
+      for (size_t i = 0; i < members.size(); ++i) {
+        if (members[i].name == member.mMember)
+          return &base->elements[i];
+      }
+      return nullptr;
+    }
+    default: return Evaluate(expr, temp) ? &temp : nullptr;
+    };
+  }
+
+  bool Arithmetic(BinaryExpression::Op op,
+                  const ConstValue &lhs,
+                  const ConstValue &rhs,
+                  ConstValue &out) {
+    const BuiltinType &type = *Builtin(lhs.type);
+    bool comparison = IsComparison(op);
+
+    // Vectors lane by lane. Comparisons give a mask, all ones where they
+    // hold.
+    if (type.lanes) {
+      const BuiltinType &result = comparison ? *ComparisonResultType(type) : type;
+      const BuiltinType &lane_type = *Builtin(result.element);
+      out = ConstValue{result.name};
+      for (unsigned lane = 0; lane < type.lanes; ++lane) {
+        ConstValue value;
+        if (!Arithmetic(op, lhs.elements[lane], rhs.elements[lane], value))
+          return false;
+        if (comparison)
+          value = MakeInt(lane_type, value.i ? ~uint64_t(0) : 0);
+        out.elements.push_back(std::move(value));
+      }
+      return true;
+    }
+
+    if (type.kind == BuiltinType::FLOAT) {
+      // Ordered comparisons are false if either side is NaN
+      double a = lhs.f, b = rhs.f;
+      if (comparison) {
+        bool holds = !std::isnan(a) && !std::isnan(b) && Compare(op, a, b);
+        out = MakeInt(*Builtin("bool"), holds);
+      } else if (type.bits == 32) {
+        out = MakeFloat(type, FloatArithmetic<float>(op, lhs.f, rhs.f));
+      } else {
+        out = MakeFloat(type, FloatArithmetic<double>(op, lhs.f, rhs.f));
+      }
+      return true;
+    }
+
+    if (comparison) {
+      bool holds = type.is_signed ? Compare(op, lhs.i, rhs.i)
+                                  : Compare(op, static_cast<uint64_t>(lhs.i),
+                                            static_cast<uint64_t>(rhs.i));
+      out = MakeInt(*Builtin("bool"), holds);
+      return true;
+    }
+
+    // Values are extended from their width, so the low bits of 64-bit
+    // arithmetic are the result
+    uint64_t a = lhs.i, b = rhs.i;
+    switch (op) {
+    case BinaryExpression::ADD: out = MakeInt(type, a + b); return true;
+    case BinaryExpression::SUB: out = MakeInt(type, a - b); return true;
+    case BinaryExpression::MUL: out = MakeInt(type, a * b); return true;
+    default: break;
+    };
+    if (b == 0) {
+      Error("division by zero" + Where());
+      return false;
+    }
+    bool div = op == BinaryExpression::DIV;
+    if (!type.is_signed) {
+      out = MakeInt(type, div ? a / b : a % b);
+      return true;
+    }
+    int64_t min = type.bits == 64 ? INT64_MIN : -(int64_t(1) << (type.bits - 1));
+    if (lhs.i == min && rhs.i == -1) {
+      Error("'" + ToString(lhs) + (div ? " / " : " % ") + "-1' overflows '" + type.name + "'" +
+            Where());
+      return false;
+    }
+    out = MakeInt(type, div ? lhs.i / rhs.i : lhs.i % rhs.i);
+    return true;
+  }
+
+  template <typename T>
+  static T FloatArithmetic(BinaryExpression::Op op, T a, T b) {
+    switch (op) {
+    case BinaryExpression::ADD: return a + b;
+    case BinaryExpression::SUB: return a - b;
+    case BinaryExpression::MUL: return a * b;
+    case BinaryExpression::DIV: return a / b;
+    default: return std::fmod(a, b);
+    };
+  }
+
+  bool Evaluate(const CallExpression &call, ConstValue &out) {
+    const std::string &callee = call.mCallee;
+    if (call.mAwait) {
+      Error("cannot await '" + callee + "' at compile time" + Where());
+      return false;
+    }
+
+    if (auto it = mProcedures.find(callee); it != mProcedures.end()) {
+      const ProcedureDefinition &pdef = *it->second;
+      if (pdef.FindAnnotation("coroutine")) {
+        Error("cannot run #coroutine '" + callee + "' at compile time" + Where());
+        return false;
+      }
+      if (!pdef.BodyBlock()) {
+        Error("cannot call '" + callee + "', which has no body, at compile time" + Where());
+        return false;
+      }
+      std::vector<ConstValue> args(call.mArgs.size());
+      for (size_t i = 0; i < args.size(); ++i) {
+        std::string type = CanonicalTypeName(pdef.Prototype()->Args()[i].type);
+        if (!EvaluateAs(*call.mArgs[i], type, args[i]))
+          return false;
+      }
+      return Call(pdef, std::move(args), out);
+    }
+    if (mImported.count(callee)) {
+      Error("cannot call '" + callee + "' of another module at compile time" + Where());
+      return false;
+    }
+
+    const BuiltinType *type = Builtin(callee);
+    if (type && !type->lanes) {
+      if (IsUntypedConstant(*call.mArgs[0]))
+        return EvaluateConstantAs(*call.mArgs[0], type->name, out);
+      ConstValue value;
+      return Evaluate(*call.mArgs[0], value) && Convert(value, *type, out);
+    }
+    if (type) {
+      out = ConstValue{type->name};
+      for (const auto &arg : call.mArgs) {
+        ConstValue lane;
+        if (!EvaluateAs(*arg, type->element, lane))
+          return false;
+        out.elements.push_back(std::move(lane));
+      }
+      // One value is splat across every lane
+      if (out.elements.size() == 1)
+        out.elements.assign(type->lanes, out.elements[0]);
+      return true;
+    }
+
+    Error("'" + callee + "' cannot be evaluated at compile time" + Where());
+    return false;
+  }
+
+  // `value` converted to the scalar `to` like CodegenVisitor::EmitBuiltin()
+  // does at run time
+  bool Convert(const ConstValue &value, const BuiltinType &to, ConstValue &out) {
+    const BuiltinType &from = *Builtin(value.type);
+    bool from_float = from.kind == BuiltinType::FLOAT;
+    if (from_float && to.kind == BuiltinType::FLOAT) {
+      out = MakeFloat(to, value.f);
+    } else if (from_float) {
+      // fptosi and fptoui give poison for values outside the int's range
+      double t = std::trunc(value.f);
+      bool fits = to.is_signed ? t >= -std::ldexp(1.0, to.bits - 1) && t < std::ldexp(1.0, to.bits - 1)
+                               : t >= 0 && t < std::ldexp(1.0, to.bits);
+      if (!fits) {
+        Error("'" + ToString(value) + "' does not fit in '" + to.name + "'" + Where());
+        return false;
+      }
+      out = MakeInt(to, to.is_signed ? static_cast<uint64_t>(static_cast<int64_t>(t))
+                                     : static_cast<uint64_t>(t));
+    } else if (to.kind == BuiltinType::FLOAT) {
+      uint64_t bits = value.i;
+      if (to.bits == 32)
+        out = MakeFloat(to, from.is_signed ? static_cast<float>(value.i) : static_cast<float>(bits));
+      else
+        out = MakeFloat(to, from.is_signed ? static_cast<double>(value.i) : static_cast<double>(bits));
+    } else {
+      out = MakeInt(to, value.i);
+    }
+    return true;
+  }
+};
+
+}  // namespace
+
+bool EvaluateConstants(Module &mod, std::ostream &diag) {
+  return ConstantEvaluator(mod, diag).Run();
+}
+
+}  // namespace charlie
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ast.h"
+
+#include <iostream>
+
+namespace charlie {
+
+// Runs the initializers of the constants `mod` defines, and the procedures
+// they call, and stores the values, see ConstDefinition::Value(). Constants
+// are evaluated on first use, so they may refer to each other in any order.
+//
+// The interpreter follows generated code: ints wrap at their width, f32
+// arithmetic is done in single precision, and conversions round like the
+// instructions they lower to. What generated code leaves undefined, such as
+// division by zero, an index out of bounds or a float that does not fit the
+// int it is converted to, is reported instead. So is anything the compiler
+// cannot run: calls to procedures whose body is in another module,
+// coroutines, builtins other than conversions and vector constructors, and
+// initializers that run for too long. Parallel loops run serially.
+//
+// `mod` must have passed the other checks of CheckModule(), which calls
+// this. Problems are reported to `diag`. Returns false if any were found.
+bool EvaluateConstants(Module &mod, std::ostream &diag);
+
+}  // namespace charlie
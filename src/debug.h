@@ -0,0 +1,17 @@
+#pragma once
+
+#include <iostream>
+
+// Token-level tracing of the lexer and parser. Configure with
+// `-Ddebug_trace=true` to enable it; it is compiled out otherwise since it
+// writes to stdout from every compile job.
+#ifdef CHARLIE_DEBUG_TRACE
+#define DEBUG_TRACE(stream_expr) \
+  do {                           \
+    std::cout << stream_expr;    \
+  } while (0)
+#else
+#define DEBUG_TRACE(stream_expr) \
+  do {                           \
+  } while (0)
+#endif
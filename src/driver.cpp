@@ -0,0 +1,173 @@
+#include "driver.h"
+#include "check.h"
+#include "compiler.h"
+#include "memory.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+namespace charlie {
+
+std::string DefaultOutputPath(const std::string &input,
+                              CompilerOptions::EmitKind emit) {
+  const char *ext = "";
+  switch (emit) {
+  case CompilerOptions::EMIT_BITCODE: ext = ".bc"; break;
+  case CompilerOptions::EMIT_OBJECT: ext = ".o"; break;
+  case CompilerOptions::EMIT_LLVM_IR: ext = ".ll"; break;
+  case CompilerOptions::EMIT_INTERFACE: ext = ".chi"; break;
+  }
+
+  size_t slash = input.find_last_of('/');
+  size_t dot = input.find_last_of('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return input + ext;
+  return input.substr(0, dot) + ext;
+}
+
+static bool WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(contents.data(), contents.size());
+  return static_cast<bool>(out);
+}
+
+namespace {
+
+struct JobResult {
+  std::string out;
+  std::string diag;
+  bool success = false;
+  bool done = false;
+};
+
+}  // namespace
+
+static int CompileInputs(const CompilerOptions &opts) {
+  if (!opts.output.empty() && opts.inputs.size() > 1) {
+    std::cerr << "[Driver Error] '-o' cannot be used with multiple inputs\n";
+    return 1;
+  }
+
+  if (opts.interp) {
+    if (opts.inputs.size() > 1) {
+      std::cerr << "[Driver Error] '--interp' runs a single input\n";
+      return 1;
+    }
+    int exit_code;
+    if (!InterpretFile(opts.inputs.front(), opts, std::cout, std::cerr, exit_code))
+      return 1;
+    return exit_code;
+  }
+
+  std::optional<CompilationCache> cache;
+  if (!opts.cache_dir.empty() && !opts.dump && !opts.check) {
+    cache.emplace(opts.cache_dir, opts.cache_max_bytes);
+  }
+
+  const size_t num_inputs = opts.inputs.size();
+  size_t num_jobs = opts.jobs ? opts.jobs : std::thread::hardware_concurrency();
+  num_jobs = std::max<size_t>(1, std::min(num_jobs, num_inputs));
+
+  ThreadPool pool(num_jobs);
+  // A CompileContext is for one thread at a time, so each worker gets its
+  // own and keeps its TargetMachines for every input it compiles.
+  std::vector<std::unique_ptr<CompileContext>> contexts(pool.NumThreads());
+
+  std::vector<JobResult> results(num_inputs);
+  std::mutex flush_mutex;
+  size_t next_to_flush = 0;
+
+  for (size_t i = 0; i < num_inputs; ++i) {
+    pool.Submit([&, i] {
+      const std::string &input = opts.inputs[i];
+      // Created on first use so --check never touches LLVM
+      auto context = [&]() -> CompileContext & {
+        auto &cc = contexts[pool.CurrentWorker()];
+        if (!cc)
+          cc = std::make_unique<CompileContext>();
+        return *cc;
+      };
+
+      std::stringstream out, diag;
+      bool success;
+      if (opts.check) {
+        success = CheckFile(input, opts, diag);
+      } else if (opts.dump) {
+        success = DumpFile(input, opts, context(), out, diag);
+      } else {
+        std::string output;
+        success = CompileFile(
+          input, opts, context(), cache ? &*cache : nullptr, diag, output);
+        if (success) {
+          std::string path = opts.output.empty()
+                               ? DefaultOutputPath(input, opts.emit)
+                               : opts.output;
+          if (!WriteFile(path, output)) {
+            diag << "[Driver Error] Failed to write '" << path << "'\n";
+            success = false;
+          }
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(flush_mutex);
+      results[i] = {out.str(), diag.str(), success, true};
+      while (next_to_flush < num_inputs && results[next_to_flush].done) {
+        JobResult &r = results[next_to_flush++];
+        std::cout << r.out;
+        std::cerr << r.diag;
+        std::cout.flush();
+        // Release the buffers of results that have been printed
+        r.out = std::string();
+        r.diag = std::string();
+      }
+    });
+  }
+  pool.Wait();
+
+  if (cache && opts.cache_stats)
+    cache->ReportStats(std::cerr);
+
+  bool success = std::all_of(results.begin(), results.end(),
+                             [](const JobResult &r) { return r.success; });
+  return success ? 0 : 1;
+}
+
+int RunDriver(const CompilerOptions &driver_opts) {
+  CompilerOptions opts = driver_opts;
+  if (opts.inputs.empty()) {
+    opts.inputs.emplace_back("examples.ch");
+    opts.dump = true;
+  }
+
+  bool profile = opts.time_report || !opts.time_trace.empty();
+  if (profile)
+    TimeProfiler::Get().Enable(opts.time_report_hw);
+  if (opts.mem_report)
+    MemoryTracker::Get().Enable();
+
+  int status = CompileInputs(opts);
+
+  if (profile) {
+    TimeProfiler &profiler = TimeProfiler::Get();
+    if (opts.time_report)
+      profiler.PrintReport(std::cerr);
+    std::string error;
+    if (!opts.time_trace.empty() && !profiler.WriteTrace(opts.time_trace, error)) {
+      std::cerr << "[Driver Error] " << error << '\n';
+      status = 1;
+    }
+  }
+  if (opts.mem_report)
+    MemoryTracker::Get().PrintReport(std::cerr);
+  return status;
+}
+
+}  // namespace charlie
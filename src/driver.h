@@ -0,0 +1,22 @@
+#pragma once
+
+#include "options.h"
+
+#include <string>
+
+namespace charlie {
+
+// Compiles every input in `opts` concurrently on a work-stealing ThreadPool
+// with `opts.jobs` workers. Each input's diagnostics (and --dump output) are
+// buffered and printed in input order as soon as every earlier input is done,
+// so the console output is the same as a serial build.
+//
+// Returns the process exit status.
+int RunDriver(const CompilerOptions &opts);
+
+// The output path for `input` when -o was not given: `input` with its
+// extension replaced by the one for `emit`.
+std::string DefaultOutputPath(const std::string &input,
+                              CompilerOptions::EmitKind emit);
+
+}  // namespace charlie
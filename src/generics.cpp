@@ -0,0 +1,211 @@
+#include "generics.h"
+#include "types.h"
+
+#include <algorithm>
+
+namespace charlie {
+
+namespace {
+
+// Copies procedure bodies, replacing the type parameters in every type they
+// name: let and for types, and the callee of conversions such as T(x)
+class Instantiator {
+public:
+  explicit Instantiator(const TypeBindings &bindings) : mBindings(bindings) {}
+
+  std::unique_ptr<Block> Clone(const Block &block) {
+    std::vector<std::unique_ptr<Statement>> stmts;
+    for (const auto &stmt : block.Statements()) {
+      stmts.push_back(Clone(*stmt));
+    }
+    return std::make_unique<Block>(std::move(stmts));
+  }
+
+  std::unique_ptr<Statement> Clone(const Statement &stmt) {
+    switch (stmt.mStmtKind) {
+    case Statement::RETURN: {
+      auto &ret = static_cast<const ReturnStatement &>(stmt);
+      auto copy = std::make_unique<ReturnStatement>(Clone(*ret.mReturnExpr));
+      copy->mAnnotations = ret.mAnnotations;
+      return copy;
+    }
+    case Statement::LET: {
+      auto &let = static_cast<const LetStatement &>(stmt);
+      return std::make_unique<LetStatement>(let.mName, Substitute(let.mType),
+                                            CloneOrNull(let.mInit.get()));
+    }
+    case Statement::ASSIGN: {
+      auto &assign = static_cast<const AssignStatement &>(stmt);
+      return std::make_unique<AssignStatement>(Clone(*assign.mTarget), Clone(*assign.mValue));
+    }
+    case Statement::EXPR: {
+      auto &expr = static_cast<const ExpressionStatement &>(stmt);
+      return std::make_unique<ExpressionStatement>(Clone(*expr.mExpr));
+    }
+    case Statement::WHILE: {
+      auto &loop = static_cast<const WhileStatement &>(stmt);
+      auto copy = std::make_unique<WhileStatement>(Clone(*loop.mCond), Clone(*loop.mBody));
+      copy->mAnnotations = loop.mAnnotations;
+      return copy;
+    }
+    case Statement::FOR: {
+      auto &loop = static_cast<const ForStatement &>(stmt);
+      auto copy = std::make_unique<ForStatement>(loop.mVar,
+                                                 Substitute(loop.mType),
+                                                 Clone(*loop.mBegin),
+                                                 Clone(*loop.mEnd),
+                                                 Clone(*loop.mBody));
+      copy->mAnnotations = loop.mAnnotations;
+      copy->mParallel = loop.mParallel;
+      copy->mReductions = loop.mReductions;
+      return copy;
+    }
+    case Statement::YIELD: {
+      auto &yield = static_cast<const YieldStatement &>(stmt);
+      return std::make_unique<YieldStatement>(CloneOrNull(yield.mValue.get()));
+    }
+    default: return nullptr;
+    };
+  }
+
+  std::unique_ptr<Expression> Clone(const Expression &expr) {
+    switch (expr.mExprKind) {
+    case Expression::INT_LITERAL: {
+      auto &intlit = static_cast<const IntegerLiteral &>(expr);
+      auto clone = std::make_unique<IntegerLiteral>(intlit.mInt);
+      clone->mUnsigned = intlit.mUnsigned;
+      return clone;
+    }
+    case Expression::FLOAT_LITERAL:
+      return std::make_unique<FloatLiteral>(static_cast<const FloatLiteral &>(expr).mFloat);
+    case Expression::STRING_LITERAL:
+      return std::make_unique<StringLiteral>(static_cast<const StringLiteral &>(expr).mString);
+    case Expression::IDENTIFIER:
+      return std::make_unique<Identifier>(static_cast<const Identifier &>(expr).mName);
+    case Expression::INDEX: {
+      auto &index = static_cast<const IndexExpression &>(expr);
+      return std::make_unique<IndexExpression>(Clone(*index.mBase), Clone(*index.mIndex));
+    }
+    case Expression::MEMBER: {
+      auto &member = static_cast<const MemberExpression &>(expr);
+      return std::make_unique<MemberExpression>(Clone(*member.mBase), member.mMember);
+    }
+    case Expression::BINARY: {
+      auto &binary = static_cast<const BinaryExpression &>(expr);
+      return std::make_unique<BinaryExpression>(binary.mOp, Clone(*binary.mLhs),
+                                                Clone(*binary.mRhs));
+    }
+    case Expression::CALL: {
+      auto &call = static_cast<const CallExpression &>(expr);
+      std::vector<std::unique_ptr<Expression>> args;
+      for (const auto &arg : call.mArgs) {
+        args.push_back(Clone(*arg));
+      }
+      auto copy = std::make_unique<CallExpression>(Substitute(call.mCallee), std::move(args));
+      copy->mAwait = call.mAwait;
+      return copy;
+    }
+    default: return nullptr;
+    };
+  }
+
+private:
+  const TypeBindings &mBindings;
+
+  std::unique_ptr<Expression> CloneOrNull(const Expression *expr) {
+    return expr ? Clone(*expr) : nullptr;
+  }
+
+  std::string Substitute(const std::string &type) {
+    return type.empty() ? type : SubstituteType(type, mBindings);
+  }
+};
+
+}  // namespace
+
+std::string SubstituteType(const std::string &type, const TypeBindings &bindings) {
+  std::string base = BaseTypeName(type);
+  std::string dims = type.substr(base.size());
+  if (std::string value; SplitAtomicType(base, value))
+    return "atomic<" + SubstituteType(value, bindings) + ">" + dims;
+  if (std::string yield; SplitCoroutineType(base, yield) && !yield.empty())
+    return "coroutine<" + SubstituteType(yield, bindings) + ">" + dims;
+  auto it = bindings.find(base);
+  return it == bindings.end() ? type : it->second + dims;
+}
+
+bool BindTypeParameters(const std::string &param,
+                        const std::string &arg,
+                        const std::vector<std::string> &type_params,
+                        TypeBindings &bindings) {
+  // Peel matching dimensions off both until `param` is a bare name
+  std::string param_element = param, arg_element = CanonicalTypeName(arg);
+  std::string element;
+  uint64_t param_count, arg_count;
+  while (SplitArrayType(param_element, element, param_count)) {
+    param_element = element;
+    if (!SplitArrayType(arg_element, element, arg_count) || arg_count != param_count)
+      return false;
+    arg_element = element;
+  }
+  if (std::find(type_params.begin(), type_params.end(), param_element) != type_params.end())
+    bindings.emplace(param_element, arg_element);
+  return true;
+}
+
+std::string InstanceName(const std::string &generic, const std::vector<std::string> &type_args) {
+  std::string name = generic + "<";
+  for (size_t i = 0; i < type_args.size(); ++i) {
+    name += (i ? ", " : "") + type_args[i];
+  }
+  return name + ">";
+}
+
+ProcedureDefinition &GenericInstances::Get(const ProcedureDefinition &generic,
+                                           const std::vector<std::string> &type_args,
+                                           bool &created) {
+  std::vector<uint32_t> key;
+  for (const auto &type : type_args) {
+    key.push_back(Intern(type));
+  }
+  auto [it, inserted] = mInstances.emplace(std::make_pair(&generic, std::move(key)), nullptr);
+  created = inserted;
+  if (!inserted)
+    return *it->second;
+
+  const ProcedurePrototype &proto = *generic.Prototype();
+  TypeBindings bindings;
+  for (size_t i = 0; i < type_args.size(); ++i) {
+    bindings.emplace(proto.TypeParams()[i], type_args[i]);
+  }
+  std::vector<ProcedurePrototype::Parameter> args;
+  for (const auto &arg : proto.Args()) {
+    args.push_back({arg.name, SubstituteType(arg.type, bindings)});
+  }
+  std::string return_type =
+    proto.ReturnType().empty() ? "" : SubstituteType(proto.ReturnType(), bindings);
+
+  Instantiator instantiator(bindings);
+  auto instance = std::make_unique<ProcedureDefinition>(
+    std::make_unique<ProcedurePrototype>(InstanceName(proto.Name(), type_args),
+                                         std::move(return_type),
+                                         std::move(args)),
+    instantiator.Clone(*generic.BodyBlock()));
+  instance->SetAnnotations(generic.Annotations());
+  instance->SetTypeArgs(type_args);
+  it->second = instance.get();
+  mCreated.push_back(std::move(instance));
+  return *it->second;
+}
+
+std::vector<std::unique_ptr<TopLevelDeclaration>> GenericInstances::Take() {
+  std::vector<std::unique_ptr<TopLevelDeclaration>> created;
+  created.swap(mCreated);
+  return created;
+}
+
+uint32_t GenericInstances::Intern(const std::string &type) {
+  return mTypeIds.emplace(type, static_cast<uint32_t>(mTypeIds.size())).first->second;
+}
+
+}  // namespace charlie
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ast.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace charlie {
+
+// Types bound to the type parameters of a generic procedure, by name
+using TypeBindings = std::unordered_map<std::string, std::string>;
+
+// `type` with its type parameters replaced by the types bound to them, e.g.
+// "f32[4]" for "T[4]" with T bound to f32, or "i64[8][4]" with T bound to
+// i64[8]. Types inside atomic<T> and coroutine<T> are replaced as well.
+std::string SubstituteType(const std::string &type, const TypeBindings &bindings);
+
+// Binds the type parameters `param` refers to so that it becomes `arg`,
+// e.g. T to i32 for "T[4]" and "i32[4]". Parameters that are already bound
+// keep their types. Returns false if `arg` does not have the shape of
+// `param`, like an int for "T[4]".
+bool BindTypeParameters(const std::string &param,
+                        const std::string &arg,
+                        const std::vector<std::string> &type_params,
+                        TypeBindings &bindings);
+
+// The name of the instance of `generic` for `type_args`, e.g. "max<i64>".
+// It cannot clash with a name written in the source.
+std::string InstanceName(const std::string &generic, const std::vector<std::string> &type_args);
+
+// The instances of one module's generic procedures. A generic is
+// instantiated once for each distinct list of type arguments, by the first
+// call that needs it; every later call with the same types shares that
+// instance, so no specialization is generated twice.
+//
+// CheckModule() owns the cache of the module it checks, and the instances
+// it hands over are ordinary procedures to every later pass. Each module is
+// checked and compiled by one thread, and instances are internal to their
+// module, so parallel codegen never needs to share or lock it.
+class GenericInstances {
+public:
+  // Returns the instance of `generic` for `type_args`, which are canonical
+  // type names bound to its type parameters in order. Sets `created` if this
+  // call made it, in which case the caller still has to check it.
+  ProcedureDefinition &Get(const ProcedureDefinition &generic,
+                           const std::vector<std::string> &type_args,
+                           bool &created);
+
+  // Hands over the instances made so far, in the order they were made
+  std::vector<std::unique_ptr<TopLevelDeclaration>> Take();
+
+private:
+  // Canonical type names are interned, so a key is a short list of ints
+  // rather than of strings
+  uint32_t Intern(const std::string &type);
+
+  std::unordered_map<std::string, uint32_t> mTypeIds;
+  std::map<std::pair<const ProcedureDefinition *, std::vector<uint32_t>>,
+           ProcedureDefinition *> mInstances;
+  std::vector<std::unique_ptr<TopLevelDeclaration>> mCreated;
+};
+
+}  // namespace charlie
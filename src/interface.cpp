@@ -0,0 +1,386 @@
+#include "interface.h"
+#include "memory.h"
+#include "options.h"
+#include "parser.h"
+#include "reachability.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace charlie {
+
+static constexpr char kInterfaceMagic[4] = {'C', 'H', 'I', '6'};
+
+uint64_t SourceHash(std::string_view source) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : source) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::unique_ptr<ModuleInterface> ExtractInterface(const Module &mod,
+                                                  std::string name,
+                                                  std::string_view source,
+                                                  const std::vector<std::string> &extra_roots) {
+  auto interface = std::make_unique<ModuleInterface>();
+  interface->name = std::move(name);
+  interface->source_hash = SourceHash(source);
+  interface->source_size = source.size();
+
+  // Other procedures are internal to the module's object
+  auto exported = ExportedProcedures(mod, extra_roots);
+  for (const auto &decl : mod.TopLevelDecls()) {
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF: {
+      auto pdef = static_cast<ProcedureDefinition *>(decl.get());
+      const ProcedurePrototype &proto = *pdef->Prototype();
+      if (!exported.count(proto.Name()))
+        break;
+      interface->procedures.push_back(std::make_unique<ProcedurePrototype>(
+        proto.Name(), proto.ReturnType(), proto.Args()));
+      break;
+    }
+    case TopLevelDeclaration::STRUCT_DEF: {
+      auto sdef = static_cast<StructDefinition *>(decl.get());
+      auto copy = std::make_unique<StructDefinition>(sdef->Name(), sdef->Members());
+      // Annotations decide the layout, which importers must agree on
+      copy->SetAnnotations(sdef->Annotations());
+      interface->structs.push_back(std::move(copy));
+      break;
+    }
+    // Imports are not re-exported, and constants are private to the module
+    // that defines them
+    default: break;
+    };
+  }
+  return interface;
+}
+
+//===----------------------------------------------------------------------===//
+// Encoding
+//===----------------------------------------------------------------------===//
+
+static void WriteULEB(std::string &bytes, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value)
+      byte |= 0x80;
+    bytes.push_back(static_cast<char>(byte));
+  } while (value);
+}
+
+static void WriteString(std::string &bytes, const std::string &s) {
+  WriteULEB(bytes, s.size());
+  bytes += s;
+}
+
+static void WriteAnnotations(std::string &bytes,
+                             const std::vector<Annotation> &annotations) {
+  WriteULEB(bytes, annotations.size());
+  for (const auto &annotation : annotations) {
+    WriteString(bytes, annotation.name);
+    WriteULEB(bytes, annotation.args.size());
+    for (int arg : annotation.args) {
+      WriteULEB(bytes, static_cast<uint32_t>(arg));
+    }
+  }
+}
+
+void WriteInterface(const ModuleInterface &interface, std::string &bytes) {
+  bytes.assign(kInterfaceMagic, sizeof(kInterfaceMagic));
+  WriteString(bytes, CHARLIE_VERSION);
+  WriteString(bytes, interface.name);
+  WriteULEB(bytes, interface.source_hash);
+  WriteULEB(bytes, interface.source_size);
+  WriteULEB(bytes, interface.source_mtime);
+
+  WriteULEB(bytes, interface.structs.size());
+  for (const auto &sdef : interface.structs) {
+    WriteString(bytes, sdef->Name());
+    WriteAnnotations(bytes, sdef->Annotations());
+    WriteULEB(bytes, sdef->Members().size());
+    for (const auto &member : sdef->Members()) {
+      WriteString(bytes, member.name);
+      WriteString(bytes, member.type);
+    }
+  }
+
+  WriteULEB(bytes, interface.procedures.size());
+  for (const auto &proto : interface.procedures) {
+    WriteString(bytes, proto->Name());
+    WriteString(bytes, proto->ReturnType());
+    WriteULEB(bytes, proto->Args().size());
+    for (const auto &arg : proto->Args()) {
+      WriteString(bytes, arg.name);
+      WriteString(bytes, arg.type);
+    }
+  }
+}
+
+namespace {
+
+class InterfaceReader {
+public:
+  InterfaceReader(std::string_view bytes) : mBytes(bytes), mPos(0) {}
+
+  bool ReadULEB(uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (mPos >= mBytes.size())
+        return false;
+      uint8_t byte = mBytes[mPos++];
+      value |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  bool ReadString(std::string &s) {
+    uint64_t len;
+    if (!ReadULEB(len) || len > mBytes.size() - mPos)
+      return false;
+    s.assign(mBytes.data() + mPos, len);
+    mPos += len;
+    return true;
+  }
+
+  bool ReadAnnotations(std::vector<Annotation> &annotations) {
+    uint64_t num_annotations;
+    if (!ReadULEB(num_annotations))
+      return false;
+    for (uint64_t i = 0; i < num_annotations; ++i) {
+      Annotation annotation;
+      uint64_t num_args;
+      if (!ReadString(annotation.name) || !ReadULEB(num_args))
+        return false;
+      for (uint64_t j = 0; j < num_args; ++j) {
+        uint64_t arg;
+        if (!ReadULEB(arg))
+          return false;
+        annotation.args.push_back(static_cast<int>(arg));
+      }
+      annotations.push_back(std::move(annotation));
+    }
+    return true;
+  }
+
+  bool ReadMagic() {
+    if (mBytes.size() < sizeof(kInterfaceMagic) ||
+        mBytes.compare(0, sizeof(kInterfaceMagic),
+                       std::string_view(kInterfaceMagic, sizeof(kInterfaceMagic))))
+      return false;
+    mPos = sizeof(kInterfaceMagic);
+    return true;
+  }
+
+  bool AtEnd() const {
+    return mPos == mBytes.size();
+  }
+
+private:
+  std::string_view mBytes;
+  size_t mPos;
+};
+
+}  // namespace
+
+bool ReadInterface(std::string_view bytes, ModuleInterface &interface) {
+  InterfaceReader r(bytes);
+
+  std::string version;
+  if (!r.ReadMagic() || !r.ReadString(version) || version != CHARLIE_VERSION)
+    return false;
+  if (!r.ReadString(interface.name) || !r.ReadULEB(interface.source_hash) ||
+      !r.ReadULEB(interface.source_size) || !r.ReadULEB(interface.source_mtime))
+    return false;
+
+  uint64_t num_structs;
+  if (!r.ReadULEB(num_structs))
+    return false;
+  for (uint64_t i = 0; i < num_structs; ++i) {
+    std::string name;
+    std::vector<Annotation> annotations;
+    uint64_t num_members;
+    if (!r.ReadString(name) || !r.ReadAnnotations(annotations) ||
+        !r.ReadULEB(num_members))
+      return false;
+    std::vector<StructDefinition::StructMember> members;
+    for (uint64_t j = 0; j < num_members; ++j) {
+      StructDefinition::StructMember member;
+      if (!r.ReadString(member.name) || !r.ReadString(member.type))
+        return false;
+      members.push_back(std::move(member));
+    }
+    auto sdef = std::make_unique<StructDefinition>(std::move(name), std::move(members));
+    sdef->SetAnnotations(std::move(annotations));
+    interface.structs.push_back(std::move(sdef));
+  }
+
+  uint64_t num_procs;
+  if (!r.ReadULEB(num_procs))
+    return false;
+  for (uint64_t i = 0; i < num_procs; ++i) {
+    std::string name, return_type;
+    uint64_t num_args;
+    if (!r.ReadString(name) || !r.ReadString(return_type) ||
+        !r.ReadULEB(num_args))
+      return false;
+    std::vector<ProcedurePrototype::Parameter> args(num_args);
+    for (auto &arg : args) {
+      if (!r.ReadString(arg.name) || !r.ReadString(arg.type))
+        return false;
+    }
+    interface.procedures.push_back(std::make_unique<ProcedurePrototype>(
+      std::move(name), std::move(return_type), std::move(args)));
+  }
+
+  return r.AtEnd();
+}
+
+//===----------------------------------------------------------------------===//
+// ImportResolver
+//===----------------------------------------------------------------------===//
+
+std::string DefaultModuleName(const std::string &path) {
+  size_t start = path.find_last_of('/');
+  start = start == std::string::npos ? 0 : start + 1;
+  size_t end = path.find_last_of('.');
+  if (end == std::string::npos || end < start)
+    end = path.size();
+  return path.substr(start, end - start);
+}
+
+std::vector<std::string> ImportSearchPaths(const std::string &input,
+                                           const std::vector<std::string> &import_paths) {
+  size_t slash = input.find_last_of('/');
+  std::vector<std::string> paths;
+  paths.push_back(slash == std::string::npos ? "." : input.substr(0, slash));
+  paths.insert(paths.end(), import_paths.begin(), import_paths.end());
+  return paths;
+}
+
+ImportResolver::ImportResolver(std::vector<std::string> search_paths,
+                               const CompilerOptions &opts,
+                               std::ostream &diag) :
+    mSearchPaths(std::move(search_paths)), mOptions(opts), mDiag(diag) {}
+
+bool ImportResolver::Resolve(Module &mod) {
+  MemoryPhaseScope mem_scope(MEM_IMPORTS);
+  bool success = true;
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind != TopLevelDeclaration::USE_DECL)
+      continue;
+
+    auto use = static_cast<UseDeclaration *>(decl.get());
+    auto interface = Load(use->ModuleName());
+    if (!interface) {
+      mDiag << "[Import Error] " << mod.Name() << ": Cannot find module '"
+            << use->ModuleName() << "'\n";
+      success = false;
+      continue;
+    }
+    use->SetInterface(std::move(interface));
+  }
+  return success;
+}
+
+static bool ReadWholeFile(const fs::path &path, std::string &text) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  text = ss.str();
+  return static_cast<bool>(in);
+}
+
+// Publishes `interface` at `path` atomically; concurrent importers may be
+// writing the same file.
+static void PublishInterface(const ModuleInterface &interface, const fs::path &path) {
+  std::string bytes;
+  WriteInterface(interface, bytes);
+  fs::path tmp_path = path;
+  tmp_path += ".tmp." + std::to_string(getpid()) + "." +
+              std::to_string(reinterpret_cast<uintptr_t>(&interface));
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+  }
+  std::error_code ec;
+  if (rename(tmp_path.c_str(), path.c_str()) != 0)
+    fs::remove(tmp_path, ec);
+}
+
+std::unique_ptr<ModuleInterface>
+ImportResolver::Load(const std::string &module_name) {
+  for (const auto &dir : mSearchPaths) {
+    fs::path source_path = fs::path(dir) / (module_name + ".ch");
+    fs::path interface_path = fs::path(dir) / (module_name + ".chi");
+
+    std::error_code ec;
+    bool have_source = fs::exists(source_path, ec);
+    bool have_interface = fs::exists(interface_path, ec);
+    if (!have_source && !have_interface)
+      continue;
+
+    // Taken before the source is read, so an edit in between shows up as a
+    // different stamp next time
+    uint64_t size = 0, mtime = 0;
+    if (have_source) {
+      size = fs::file_size(source_path, ec);
+      mtime = fs::last_write_time(source_path, ec).time_since_epoch().count();
+    }
+
+    std::string source;
+    bool read_source = false;
+    if (have_interface) {
+      std::string bytes;
+      auto interface = std::make_unique<ModuleInterface>();
+      if (ReadWholeFile(interface_path, bytes) && ReadInterface(bytes, *interface)) {
+        bool unchanged = !have_source || (interface->source_size == size &&
+                                          interface->source_mtime == mtime);
+        // Touched, but perhaps not changed
+        if (!unchanged && ReadWholeFile(source_path, source)) {
+          read_source = true;
+          if (interface->source_hash == SourceHash(source)) {
+            interface->source_size = size;
+            interface->source_mtime = mtime;
+            PublishInterface(*interface, interface_path);
+            unchanged = true;
+          }
+        }
+        if (unchanged) {
+          mDependencies.push_back(have_source ? source_path.string()
+                                              : interface_path.string());
+          return interface;
+        }
+      }
+      // Stale source, format or version: rebuild it from source below
+    }
+
+    if (!have_source || (!read_source && !ReadWholeFile(source_path, source)))
+      return nullptr;
+
+    Parser p(SourceBuffer{source_path.string(), source}, mDiag);
+    auto mod = p.Parse();
+    if (!mod)
+      return nullptr;
+    auto interface = ExtractInterface(*mod, module_name, source, ExtraExports(*mod, mOptions));
+    interface->source_size = size;
+    interface->source_mtime = mtime;
+    PublishInterface(*interface, interface_path);
+    mDependencies.push_back(source_path.string());
+    return interface;
+  }
+  return nullptr;
+}
+
+}  // namespace charlie
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace charlie {
+
+// Precompiled module interfaces (.chi files)
+//
+// A .chi file holds the procedure prototypes and struct layouts a module
+// exports, so importers can load them without lexing or parsing the module's
+// source. The encoding is a magic number and compiler version followed by
+// length-prefixed strings and LEB128 counts:
+//
+//   "CHI6" version name source_hash source_size source_mtime
+//   #structs { name #annotations { name #args { arg } } #members { name type } }
+//   #procs   { name return_type #args { name type } }
+
+// Copies the declarations `mod` exports into a new interface: its structs
+// and ExportedProcedures(mod, extra_roots), the same procedures its object
+// keeps external. `source` is the text `mod` was parsed from.
+std::unique_ptr<ModuleInterface> ExtractInterface(const Module &mod,
+                                                  std::string name,
+                                                  std::string_view source,
+                                                  const std::vector<std::string> &extra_roots);
+
+// 64-bit FNV-1a hash of a module's source, which tells whether an interface
+// is still up to date
+uint64_t SourceHash(std::string_view source);
+
+void WriteInterface(const ModuleInterface &interface, std::string &bytes);
+
+// Returns false if `bytes` is malformed or was written by another compiler
+// version.
+bool ReadInterface(std::string_view bytes, ModuleInterface &interface);
+
+// The name importers `use` for the module in `path`: the file name without
+// directory or extension.
+std::string DefaultModuleName(const std::string &path);
+
+// Where `use` declarations in `input` are looked up: the directory holding
+// `input` first, then `import_paths` (-I) in order.
+std::vector<std::string> ImportSearchPaths(const std::string &input,
+                                           const std::vector<std::string> &import_paths);
+
+// Resolves `use` declarations to module interfaces.
+//
+// `use foo;` is looked up as foo.chi and foo.ch in each search path in order.
+// A .chi file is used as long as it was extracted from the current contents
+// of the matching .ch file, whatever their modification times say. The
+// source is only read and hashed to find out when its size or modification
+// time differ from the ones the .chi recorded. If the hash still matches,
+// the .chi is rewritten with the new ones; otherwise the source is parsed
+// once and a fresh .chi is written next to it for later importers. It
+// exports what the module's object does when compiled with `opts`, the
+// extra roots of --keep included.
+class ImportResolver {
+public:
+  ImportResolver(std::vector<std::string> search_paths,
+                 const CompilerOptions &opts,
+                 std::ostream &diag);
+
+  // Attaches an interface to every UseDeclaration in `mod`.
+  //
+  // Returns false if any import could not be resolved.
+  bool Resolve(Module &mod);
+
+  // Files the resolved interfaces were derived from: each module's source,
+  // or its .chi where there is no source. A compilation's output is only
+  // valid while these are unchanged. The source decides rather than a .chi
+  // next to it, as the cache is consulted before imports are resolved again,
+  // which is what brings a stale .chi up to date.
+  const std::vector<std::string> &Dependencies() const {
+    return mDependencies;
+  }
+
+private:
+  std::vector<std::string> mSearchPaths;
+  const CompilerOptions &mOptions;
+  std::ostream &mDiag;
+  std::vector<std::string> mDependencies;
+
+  std::unique_ptr<ModuleInterface> Load(const std::string &module_name);
+};
+
+}  // namespace charlie
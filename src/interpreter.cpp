@@ -0,0 +1,331 @@
+#include "interpreter.h"
+#include "memory.h"
+
+#include <cmath>
+#include <iterator>
+#include <sstream>
+
+namespace charlie {
+
+Interpreter::Interpreter(const BytecodeModule &module, std::ostream &diag) :
+    mModule(module), mDiag(diag) {}
+
+bool Interpreter::Call(const std::string &name, Value &result) {
+  MemoryPhaseScope mem_scope(MEM_INTERP);
+  const BytecodeFunction *fn = mModule.GetFunction(name);
+  if (!fn) {
+    mDiag << "[Interp Error] No procedure named '" << name << "'\n";
+    return false;
+  }
+  mDepth = 0;
+  bool ok = Execute(*fn, 0, result);
+  mRegisters.clear();
+  return ok;
+}
+
+bool Interpreter::Error(const BytecodeFunction &fn, const std::string &message) {
+  mDiag << "[Interp Error] " << fn.name << ": " << message << '\n';
+  return false;
+}
+
+// Whether the float `f` truncated fits in an int of `bits`, what fptosi and
+// fptoui need to not give poison
+static bool FitsInt(double f, unsigned bits, bool is_signed) {
+  double t = std::trunc(f);
+  return is_signed ? t >= -std::ldexp(1.0, bits - 1) && t < std::ldexp(1.0, bits - 1)
+                   : t >= 0 && t < std::ldexp(1.0, bits);
+}
+
+#if defined(__GNUC__)
+// Computed goto is a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define CHARLIE_THREADED_DISPATCH 1
+#endif
+
+bool Interpreter::Execute(const BytecodeFunction &fn, size_t base, Value &result) {
+  // Windows overlap, so they only grow until the outermost call returns
+  if (mRegisters.size() < base + fn.num_registers)
+    mRegisters.resize(base + fn.num_registers);
+  Value *R = mRegisters.data() + base;
+  const Value *K = fn.constants.data();
+  const uint32_t *code = fn.code.data();
+  const uint32_t *pc = code;
+  uint32_t insn;
+
+#define A() ((insn >> 8) & 0xff)
+#define B() ((insn >> 16) & 0xff)
+#define C() (insn >> 24)
+#define BX() (insn >> 16)
+
+#if CHARLIE_THREADED_DISPATCH
+  static void *const kDispatch[] = {
+    &&op_load_const,
+    &&op_move,
+    &&op_add_i,
+    &&op_sub_i,
+    &&op_mul_i,
+    &&op_div_i,
+    &&op_mod_i,
+    &&op_div_u,
+    &&op_mod_u,
+    &&op_add_f,
+    &&op_sub_f,
+    &&op_mul_f,
+    &&op_div_f,
+    &&op_mod_f,
+    &&op_eq_i,
+    &&op_ne_i,
+    &&op_lt_i,
+    &&op_le_i,
+    &&op_lt_u,
+    &&op_le_u,
+    &&op_eq_f,
+    &&op_ne_f,
+    &&op_lt_f,
+    &&op_le_f,
+    &&op_sext,
+    &&op_zext,
+    &&op_sitof,
+    &&op_uitof,
+    &&op_ftosi,
+    &&op_ftoui,
+    &&op_round_f32,
+    &&op_jump,
+    &&op_jump_if_not,
+    &&op_call,
+    &&op_return,
+  };
+  static_assert(std::size(kDispatch) == OP_NUM_OPCODES, "every opcode needs a handler");
+#define CASE(label) label:
+#define DISPATCH()                     \
+  do {                                 \
+    insn = *pc++;                      \
+    goto *kDispatch[insn & 0xff];      \
+  } while (0)
+
+  DISPATCH();
+#else
+#define CASE(label) case label##_opcode:
+#define DISPATCH() break
+  enum {
+    op_load_const_opcode = OP_LOAD_CONST,
+    op_move_opcode = OP_MOVE,
+    op_add_i_opcode = OP_ADD_I,
+    op_sub_i_opcode = OP_SUB_I,
+    op_mul_i_opcode = OP_MUL_I,
+    op_div_i_opcode = OP_DIV_I,
+    op_mod_i_opcode = OP_MOD_I,
+    op_div_u_opcode = OP_DIV_U,
+    op_mod_u_opcode = OP_MOD_U,
+    op_add_f_opcode = OP_ADD_F,
+    op_sub_f_opcode = OP_SUB_F,
+    op_mul_f_opcode = OP_MUL_F,
+    op_div_f_opcode = OP_DIV_F,
+    op_mod_f_opcode = OP_MOD_F,
+    op_eq_i_opcode = OP_EQ_I,
+    op_ne_i_opcode = OP_NE_I,
+    op_lt_i_opcode = OP_LT_I,
+    op_le_i_opcode = OP_LE_I,
+    op_lt_u_opcode = OP_LT_U,
+    op_le_u_opcode = OP_LE_U,
+    op_eq_f_opcode = OP_EQ_F,
+    op_ne_f_opcode = OP_NE_F,
+    op_lt_f_opcode = OP_LT_F,
+    op_le_f_opcode = OP_LE_F,
+    op_sext_opcode = OP_SEXT,
+    op_zext_opcode = OP_ZEXT,
+    op_sitof_opcode = OP_SITOF,
+    op_uitof_opcode = OP_UITOF,
+    op_ftosi_opcode = OP_FTOSI,
+    op_ftoui_opcode = OP_FTOUI,
+    op_round_f32_opcode = OP_ROUND_F32,
+    op_jump_opcode = OP_JUMP,
+    op_jump_if_not_opcode = OP_JUMP_IF_NOT,
+    op_call_opcode = OP_CALL,
+    op_return_opcode = OP_RETURN,
+  };
+  for (;;) {
+    insn = *pc++;
+    switch (insn & 0xff) {
+#endif
+
+// R[a] = R[b] op R[c], with the operands as `x` and `y`
+#define BINARY(label, T, field, make, expr) \
+  CASE(label) {                             \
+    T x = R[B()].field;                     \
+    T y = R[C()].field;                     \
+    R[A()] = Value::make(expr);             \
+    DISPATCH();                             \
+  }
+
+  CASE(op_load_const) {
+    R[A()] = K[BX()];
+    DISPATCH();
+  }
+
+  CASE(op_move) {
+    R[A()] = R[B()];
+    DISPATCH();
+  }
+
+  // Unsigned, so overflow wraps
+  BINARY(op_add_i, uint64_t, i, Int, static_cast<int64_t>(x + y))
+  BINARY(op_sub_i, uint64_t, i, Int, static_cast<int64_t>(x - y))
+  BINARY(op_mul_i, uint64_t, i, Int, static_cast<int64_t>(x * y))
+
+  CASE(op_div_i) {
+    int64_t x = R[B()].i, y = R[C()].i;
+    if (y == 0)
+      return Error(fn, "division by zero");
+    // INT64_MIN / -1 wraps rather than trapping like the hardware would
+    R[A()] = Value::Int(y == -1 ? static_cast<int64_t>(0 - static_cast<uint64_t>(x)) : x / y);
+    DISPATCH();
+  }
+
+  CASE(op_mod_i) {
+    int64_t x = R[B()].i, y = R[C()].i;
+    if (y == 0)
+      return Error(fn, "division by zero");
+    R[A()] = Value::Int(y == -1 ? 0 : x % y);
+    DISPATCH();
+  }
+
+  CASE(op_div_u) {
+    uint64_t x = R[B()].i, y = R[C()].i;
+    if (y == 0)
+      return Error(fn, "division by zero");
+    R[A()] = Value::Int(static_cast<int64_t>(x / y));
+    DISPATCH();
+  }
+
+  CASE(op_mod_u) {
+    uint64_t x = R[B()].i, y = R[C()].i;
+    if (y == 0)
+      return Error(fn, "division by zero");
+    R[A()] = Value::Int(static_cast<int64_t>(x % y));
+    DISPATCH();
+  }
+
+  BINARY(op_add_f, double, f, Float, x + y)
+  BINARY(op_sub_f, double, f, Float, x - y)
+  BINARY(op_mul_f, double, f, Float, x * y)
+  BINARY(op_div_f, double, f, Float, x / y)
+  BINARY(op_mod_f, double, f, Float, std::fmod(x, y))
+
+  BINARY(op_eq_i, int64_t, i, Int, x == y)
+  BINARY(op_ne_i, int64_t, i, Int, x != y)
+  BINARY(op_lt_i, int64_t, i, Int, x < y)
+  BINARY(op_le_i, int64_t, i, Int, x <= y)
+  BINARY(op_lt_u, uint64_t, i, Int, x < y)
+  BINARY(op_le_u, uint64_t, i, Int, x <= y)
+  // Ordered, like fcmp oeq and fcmp one
+  BINARY(op_eq_f, double, f, Int, x == y)
+  BINARY(op_ne_f, double, f, Int, x < y || x > y)
+  BINARY(op_lt_f, double, f, Int, x < y)
+  BINARY(op_le_f, double, f, Int, x <= y)
+
+  CASE(op_sext) {
+    unsigned shift = 64 - C();
+    R[A()] = Value::Int(static_cast<int64_t>(static_cast<uint64_t>(R[B()].i) << shift) >> shift);
+    DISPATCH();
+  }
+
+  CASE(op_zext) {
+    uint64_t mask = (uint64_t(1) << C()) - 1;
+    R[A()] = Value::Int(static_cast<int64_t>(static_cast<uint64_t>(R[B()].i) & mask));
+    DISPATCH();
+  }
+
+  CASE(op_sitof) {
+    int64_t x = R[B()].i;
+    R[A()] = Value::Float(C() == 32 ? static_cast<float>(x) : static_cast<double>(x));
+    DISPATCH();
+  }
+
+  CASE(op_uitof) {
+    uint64_t x = R[B()].i;
+    R[A()] = Value::Float(C() == 32 ? static_cast<float>(x) : static_cast<double>(x));
+    DISPATCH();
+  }
+
+  CASE(op_ftosi) {
+    double x = R[B()].f;
+    if (!FitsInt(x, C(), true)) {
+      std::ostringstream message;
+      message << "'" << x << "' does not fit in 'i" << C() << "'";
+      return Error(fn, message.str());
+    }
+    R[A()] = Value::Int(static_cast<int64_t>(x));
+    DISPATCH();
+  }
+
+  CASE(op_ftoui) {
+    double x = R[B()].f;
+    if (!FitsInt(x, C(), false)) {
+      std::ostringstream message;
+      message << "'" << x << "' does not fit in 'u" << C() << "'";
+      return Error(fn, message.str());
+    }
+    R[A()] = Value::Int(static_cast<int64_t>(static_cast<uint64_t>(x)));
+    DISPATCH();
+  }
+
+  CASE(op_round_f32) {
+    R[A()] = Value::Float(static_cast<float>(R[B()].f));
+    DISPATCH();
+  }
+
+  CASE(op_jump) {
+    pc = code + BX();
+    DISPATCH();
+  }
+
+  CASE(op_jump_if_not) {
+    if (!R[A()].i)
+      pc = code + BX();
+    DISPATCH();
+  }
+
+  CASE(op_call) {
+    if (mDepth == kMaxCallDepth)
+      return Error(fn, "calls nest more than " + std::to_string(kMaxCallDepth) + " deep");
+    Value value;
+    ++mDepth;
+    bool ok = Execute(mModule.functions[BX()], base + A(), value);
+    --mDepth;
+    if (!ok)
+      return false;
+    // The callee may have grown the registers
+    R = mRegisters.data() + base;
+    R[A()] = value;
+    DISPATCH();
+  }
+
+  CASE(op_return) {
+    result = R[A()];
+    return true;
+  }
+
+#if !CHARLIE_THREADED_DISPATCH
+    default:
+      mDiag << "[Interp Error] Bad opcode " << (insn & 0xff) << '\n';
+      return false;
+    }
+  }
+#endif
+
+#undef A
+#undef B
+#undef C
+#undef BX
+#undef CASE
+#undef DISPATCH
+#undef BINARY
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+}  // namespace charlie
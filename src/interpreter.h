@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace charlie {
+
+// Executes BytecodeModules.
+//
+// The dispatch loop is threaded: every handler jumps straight to the next
+// instruction's handler through a table of label addresses (GCC/Clang
+// computed goto), which gives the branch predictor one indirect branch per
+// opcode instead of a single shared one. Other compilers fall back to a
+// switch.
+class Interpreter {
+public:
+  Interpreter(const BytecodeModule &module, std::ostream &diag);
+
+  // Calls the procedure `name` and sets `result` to its return value.
+  //
+  // Returns false if `name` does not exist or a runtime error occurred, such
+  // as an int division by zero, a float converted to an int it does not fit
+  // or calls nesting too deeply.
+  bool Call(const std::string &name, Value &result);
+
+private:
+  // How deeply calls may nest. Each one recurses on the interpreter's own
+  // stack.
+  static constexpr int kMaxCallDepth = 10000;
+
+  const BytecodeModule &mModule;
+  std::ostream &mDiag;
+  // Register windows of all active frames. A callee's window starts at the
+  // caller's register holding its first argument, so arguments are passed
+  // without copying.
+  std::vector<Value> mRegisters;
+  int mDepth = 0;
+
+  bool Execute(const BytecodeFunction &fn, size_t base, Value &result);
+  bool Error(const BytecodeFunction &fn, const std::string &message);
+};
+
+}  // namespace charlie
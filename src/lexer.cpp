@@ -1,6 +1,9 @@
 #include "lexer.h"
+#include "debug.h"
+#include "memory.h"
 
 #include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -42,6 +45,13 @@ const char *GetTokenName(TokenKind kind) {
   case TOK_KEYWORD_STRUCT: name = "struct"; break;
   case TOK_KEYWORD_ENUM: name = "enum"; break;
   case TOK_KEYWORD_RETURN: name = "return"; break;
+  case TOK_KEYWORD_IN: name = "in"; break;
+  case TOK_KEYWORD_PARALLEL: name = "parallel"; break;
+  case TOK_KEYWORD_REDUCE: name = "reduce"; break;
+  case TOK_KEYWORD_YIELD: name = "yield"; break;
+  case TOK_KEYWORD_AWAIT: name = "await"; break;
+  case TOK_KEYWORD_CONST: name = "const"; break;
+  case TOK_KEYWORD_COMPTIME: name = "comptime"; break;
 
   case TOK_STRING: name = "string"; break;
   case TOK_RAW_STRING: name = "raw string"; break;
@@ -56,7 +66,10 @@ const char *GetTokenName(TokenKind kind) {
   case TOK_OP_MODULO: name = "%"; break;
   case TOK_OP_GT: name = ">"; break;
   case TOK_OP_LT: name = "<"; break;
-  case TOK_OP_EQ: name = "="; break;
+  case TOK_OP_EQ: name = "=="; break;
+  case TOK_OP_LE: name = "<="; break;
+  case TOK_OP_GE: name = ">="; break;
+  case TOK_OP_NE: name = "!="; break;
 
   case TOK_COMMA: name = ","; break;
   case TOK_EQUAL: name = "="; break;
@@ -70,38 +83,87 @@ const char *GetTokenName(TokenKind kind) {
   case TOK_BRACE_LEFT: name = "{"; break;
   case TOK_BRACE_RIGHT: name = "}"; break;
   case TOK_DASH: name = "-"; break;
+  case TOK_HASH: name = "#"; break;
+  case TOK_DOT_DOT: name = ".."; break;
 
   default: break;
   }
   return name;
 }
 
-Lexer::Lexer(const std::string &file) :
-    mFileStream(std::ifstream(file)), mLine(1), mPos(0),
+MemoryStreamBuf::MemoryStreamBuf(std::string_view buffer) {
+  // The get area is never written through
+  char *begin = const_cast<char *>(buffer.data());
+  setg(begin, begin, begin + buffer.size());
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type off,
+                                                   std::ios_base::seekdir dir,
+                                                   std::ios_base::openmode which) {
+  if (!(which & std::ios_base::in))
+    return pos_type(off_type(-1));
+
+  char *base = dir == std::ios_base::beg   ? eback()
+               : dir == std::ios_base::cur ? gptr()
+                                           : egptr();
+  if (off < eback() - base || off > egptr() - base)
+    return pos_type(off_type(-1));
+  setg(eback(), base + off, egptr());
+  return pos_type(gptr() - eback());
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos,
+                                                   std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+static std::unique_ptr<std::streambuf> OpenFile(const std::string &file) {
+  auto buffer = std::make_unique<std::filebuf>();
+  buffer->open(file, std::ios::in | std::ios::binary);
+  return buffer;
+}
+
+Lexer::Lexer(const std::string &file, std::ostream &diag) :
+    mBuffer(OpenFile(file)), mStream(mBuffer.get()), mFileName(file), mDiag(diag), mLine(1),
+    mPos(0), mLastToken(DefaultToken()) {}
+
+Lexer::Lexer(const SourceBuffer &source, std::ostream &diag) :
+    mBuffer(std::make_unique<MemoryStreamBuf>(source.text)),
+    mStream(mBuffer.get()), mFileName(source.name), mDiag(diag), mLine(1), mPos(0),
     mLastToken(DefaultToken()) {}
 
 Lexer::~Lexer() {}
 
+void Lexer::ReportError(const Token &tok) {
+  if (mNumErrors && tok.span.line_start == mErrorLine && tok.span.pos_start == mErrorPos)
+    return;
+  mDiag << "[Lexer Error] " << mFileName << ":<" << tok.span.line_start << ':'
+        << tok.span.pos_start << ">: Failed to lex!\n";
+  mErrorLine = tok.span.line_start;
+  mErrorPos = tok.span.pos_start;
+  mNumErrors++;
+}
+
 void Lexer::GetNextToken(Token &tok) {
-  if (bool success = Advance(tok, mLine, mPos); !success && tok.kind != TOK_EOF) {
-    fprintf(stderr, "[Lexer Error] <%d,%d>: Failed to lex! \n", tok.span.line_start, tok.span.pos_start);
-  }
+  MemoryPhaseScope mem_scope(MEM_LEX);
+  if (bool success = Advance(tok, mLine, mPos); !success && tok.kind != TOK_EOF)
+    ReportError(tok);
   mLine = tok.span.line_end;
   mPos = tok.span.pos_end;
   mLastToken = tok;
 }
 
 void Lexer::PeekNextToken(Token &tok) {
-  int file_pos_start = mFileStream.tellg();
-  if (bool success = Advance(tok, mLine, mPos); !success && tok.kind != TOK_EOF) {
-    fprintf(stderr, "[Lexer Error] <%d,%d>: Failed to lex! \n", tok.span.line_start, tok.span.pos_start);
-  }
-  mFileStream.seekg(file_pos_start);
+  MemoryPhaseScope mem_scope(MEM_LEX);
+  int file_pos_start = mStream.tellg();
+  if (bool success = Advance(tok, mLine, mPos); !success && tok.kind != TOK_EOF)
+    ReportError(tok);
+  mStream.seekg(file_pos_start);
 }
 
 void Lexer::SkipWhitespace(uint32_t *line, uint32_t *pos) {
   char c;
-  while ((c = mFileStream.get()) && isspace(c)) {
+  while ((c = mStream.get()) && isspace(c)) {
     if (c == '\n') {
       (*line)++;
       *pos = 0;
@@ -110,10 +172,10 @@ void Lexer::SkipWhitespace(uint32_t *line, uint32_t *pos) {
     }
   }
 
-  if (mFileStream.eof())
+  if (mStream.eof())
     return;
 
-  mFileStream.unget();
+  mStream.unget();
 }
 
 bool Lexer::Expect(TokenKind kind, Token &tok) {
@@ -127,13 +189,13 @@ bool Lexer::Advance(Token &tok, uint32_t line, uint32_t pos) {
   bool success = false;
   char c;
 
-  if (mFileStream.eof()) {
+  if (mStream.eof()) {
     tok = MakeToken(line, line, pos, pos, TOK_EOF, TokenValue());
     success = false;
     goto done;
   }
 
-  c = mFileStream.peek();
+  c = mStream.peek();
   if (isalpha(c)) {
     success = HandleIdentifier(tok, line, pos);
   } else if (isdigit(c)) {
@@ -152,6 +214,9 @@ bool Lexer::Advance(Token &tok, uint32_t line, uint32_t pos) {
       success = HandleString(tok, line, pos);
     } else {
       // consume operator or punctuation
+      if (success = HandleDigraph(tok, line, pos); success) {
+        goto done;
+      }
       if (success = HandlePunctuation(tok, line, pos); success) {
         goto done;
       }
@@ -202,9 +267,9 @@ bool Lexer::HandleIdentifier(Token &tok, uint32_t line, uint32_t pos) {
   TokenValue value;
   std::string &s = value.emplace<std::string>();
 
-  while ((c = mFileStream.get())) {
+  while ((c = mStream.get())) {
     if (isspace(c) || !(isalnum(c) || c == '_')) {
-      mFileStream.unget();
+      mStream.unget();
       break;
     }
     s += c;
@@ -224,27 +289,34 @@ bool Lexer::HandleIdentifier(Token &tok, uint32_t line, uint32_t pos) {
 }
 
 bool Lexer::HandleInt(Token &tok, uint32_t line, uint32_t pos) {
-  int file_pos_start = mFileStream.tellg();
-  char c = mFileStream.get();
+  int file_pos_start = mStream.tellg();
+  char c = mStream.get();
   uint32_t pos_start = ++pos;
 
-  if (c == '0' && isdigit(mFileStream.peek())) {
+  if (c == '0' && isdigit(mStream.peek())) {
     tok = ErrorToken(line, line, pos_start, pos_start);
-    mFileStream.seekg(file_pos_start);
+    mStream.seekg(file_pos_start);
     return false;
   } else if (c == '0') {
-    tok = MakeToken(line, line, pos_start, pos_start, TOK_INT_LITERAL, TokenValue(0));
+    tok = MakeToken(line, line, pos_start, pos_start, TOK_INT_LITERAL, TokenValue(uint64_t(0)));
     return true;
   }
 
   TokenValue value;
-  int &i = value.emplace<int>();
+  uint64_t &i = value.emplace<uint64_t>();
   i = c - '0';
-  while ((c = mFileStream.get()) && isdigit(c)) {
+  while ((c = mStream.get()) && isdigit(c)) {
+    // Up to the largest u64; the checker decides whether a literal fits the
+    // type it is used as
+    if (i > (UINT64_MAX - (c - '0')) / 10) {
+      tok = ErrorToken(line, line, pos_start, pos + 1);
+      mStream.seekg(file_pos_start);
+      return false;
+    }
     i = (i * 10) + (c - '0');
     pos++;
   }
-  mFileStream.unget();
+  mStream.unget();
 
   tok = MakeToken(line, line, pos_start, pos, TOK_INT_LITERAL, value);
 
@@ -252,39 +324,41 @@ bool Lexer::HandleInt(Token &tok, uint32_t line, uint32_t pos) {
 }
 
 bool Lexer::HandleFloat(Token &tok, uint32_t line, uint32_t pos) {
-  int file_pos_start = mFileStream.tellg();
+  int file_pos_start = mStream.tellg();
   uint32_t pos_start = ++pos;
 
-  char c = mFileStream.get();
-  if (c == '0' && mFileStream.peek() != '.') {
-    mFileStream.seekg(file_pos_start);
+  char c = mStream.get();
+  if (c == '0' && mStream.peek() != '.') {
+    mStream.seekg(file_pos_start);
     return false;
   }
 
   std::string s {c};
 
-  while ((c = mFileStream.get()) && isdigit(c)) {
+  while ((c = mStream.get()) && isdigit(c)) {
     s += c;
   }
 
-  if (c != '.') {
+  // `1..n` is a range, not the float `1.` followed by `.n`
+  if (c != '.' || mStream.peek() == '.') {
     uint32_t pos_end = pos_start + (s.length() - 1);
     tok = ErrorToken(line, line, pos_start, pos_end);
-    mFileStream.seekg(file_pos_start);
+    mStream.seekg(file_pos_start);
     return false;
   }
 
   s += c;
 
-  while ((c = mFileStream.get()) && isdigit(c)) {
+  while ((c = mStream.get()) && isdigit(c)) {
     s += c;
   }
-  mFileStream.unget();
+  mStream.unget();
 
   TokenValue value;
-  float &f = value.emplace<float>();
-  f = atof(s.c_str());
-  std::cout << "DEBUG: parsed float " << f << " from string " << s << '\n';
+  // Kept in double precision until the type it is used as is known
+  double &f = value.emplace<double>();
+  f = strtod(s.c_str(), nullptr);
+  DEBUG_TRACE("DEBUG: parsed float " << f << " from string " << s << '\n');
 
    pos += (s.length() - 1);
 
@@ -294,20 +368,20 @@ bool Lexer::HandleFloat(Token &tok, uint32_t line, uint32_t pos) {
 }
 
 bool Lexer::HandleString(Token &tok, uint32_t line, uint32_t pos) {
-  int file_pos_start = mFileStream.tellg();
+  int file_pos_start = mStream.tellg();
   uint32_t pos_start = ++pos;
 
   TokenValue value;
   std::string &str = value.emplace<std::string>();
-  mFileStream.ignore();
+  mStream.ignore();
   char c;
-  while ((c = mFileStream.get()) && isprint(c) && c != '"') {
+  while ((c = mStream.get()) && isprint(c) && c != '"') {
     str += c;
   }
 
   if (c != '"') {
     tok = ErrorToken(line, line, pos_start, pos_start);
-    mFileStream.seekg(file_pos_start);
+    mStream.seekg(file_pos_start);
     return false;
   }
 
@@ -319,7 +393,7 @@ bool Lexer::HandleString(Token &tok, uint32_t line, uint32_t pos) {
 }
 
 bool Lexer::HandleOperator(Token &tok, uint32_t line, uint32_t pos) {
-  char c = mFileStream.peek();
+  char c = mStream.peek();
 
   TokenKind kind = IsOperator(c);
   if (kind == TOK_ERROR) {
@@ -329,7 +403,7 @@ bool Lexer::HandleOperator(Token &tok, uint32_t line, uint32_t pos) {
 
   TokenValue value;
   char &punc = value.emplace<char>();
-  punc = mFileStream.get();
+  punc = mStream.get();
   pos++;
 
   tok = MakeToken(line, line, pos, pos, kind, value);
@@ -337,8 +411,23 @@ bool Lexer::HandleOperator(Token &tok, uint32_t line, uint32_t pos) {
   return true;
 }
 
+bool Lexer::HandleDigraph(Token &tok, uint32_t line, uint32_t pos) {
+  char first = mStream.get();
+  char second = mStream.peek();
+  for (int i = 0; i < kNumDigraphs; ++i) {
+    if (first == mDigraphMap[i].chars[0] && second == mDigraphMap[i].chars[1]) {
+      mStream.get();
+      tok = MakeToken(line, line, pos + 1, pos + 2, mDigraphMap[i].tok,
+                      TokenValue(std::string(mDigraphMap[i].chars)));
+      return true;
+    }
+  }
+  mStream.unget();
+  return false;
+}
+
 bool Lexer::HandlePunctuation(Token &tok, uint32_t line, uint32_t pos) {
-  char c = mFileStream.peek();
+  char c = mStream.peek();
 
   TokenKind kind = IsPunctuation(c);
   if (kind == TOK_ERROR) {
@@ -348,7 +437,7 @@ bool Lexer::HandlePunctuation(Token &tok, uint32_t line, uint32_t pos) {
 
   TokenValue value;
   char &punc = value.emplace<char>();
-  punc = mFileStream.get();
+  punc = mStream.get();
   pos++;
 
   tok = MakeToken(line, line, pos, pos, kind, value);
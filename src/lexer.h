@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
 #include <variant>
 
 namespace charlie {
@@ -21,8 +27,15 @@ enum TokenKind : uint32_t {
   TOK_KEYWORD_STRUCT = 107,
   TOK_KEYWORD_ENUM = 108,
   TOK_KEYWORD_RETURN = 109,
+  TOK_KEYWORD_IN = 110,
+  TOK_KEYWORD_PARALLEL = 111,
+  TOK_KEYWORD_REDUCE = 112,
+  TOK_KEYWORD_YIELD = 113,
+  TOK_KEYWORD_AWAIT = 114,
+  TOK_KEYWORD_CONST = 115,
+  TOK_KEYWORD_COMPTIME = 116,
   // Add keywords as they come and update TOK_KEYWORD_END
-  TOK_KEYWORD_END = 110,
+  TOK_KEYWORD_END = 117,
 
   TOK_STRING = 400,
   TOK_RAW_STRING = 401,
@@ -40,8 +53,11 @@ enum TokenKind : uint32_t {
   TOK_OP_GT = 505,
   TOK_OP_LT = 506,
   TOK_OP_EQ = 507,
+  TOK_OP_LE = 508,
+  TOK_OP_GE = 509,
+  TOK_OP_NE = 510,
   // Add operators as they come and update TOK_OP_END
-  TOK_OP_END = 508,
+  TOK_OP_END = 511,
 
   // PUNCTUATION
   TOK_PUNC_START = 800,
@@ -57,8 +73,10 @@ enum TokenKind : uint32_t {
   TOK_BRACE_LEFT = 809,
   TOK_BRACE_RIGHT = 810,
   TOK_DASH = 811,
+  TOK_HASH = 812,
+  TOK_DOT_DOT = 813,
   // Add punctuation as they come and update TOK_PUNC_END
-  TOK_PUNC_END = 812,
+  TOK_PUNC_END = 814,
 
   TOK_EOF = (0x0E0F'E0F0),
 
@@ -72,7 +90,7 @@ struct Span {
   uint32_t pos_end;
 };
 
-using TokenValue = std::variant<int, float, char, std::string>;
+using TokenValue = std::variant<uint64_t, double, char, std::string>;
 struct Token {
   Span span;
   TokenKind kind;
@@ -81,9 +99,31 @@ struct Token {
 
 const char *GetTokenName(TokenKind kind);
 
+// Source text that is already in memory. `text` is not copied and must
+// outlive the Lexer or Parser reading it.
+struct SourceBuffer {
+  std::string name;  // Shown in diagnostics and used as the module name
+  std::string_view text;
+};
+
+// Read-only streambuf over a caller-owned buffer, so in-memory sources are
+// lexed in place without copying them.
+class MemoryStreamBuf : public std::streambuf {
+public:
+  explicit MemoryStreamBuf(std::string_view buffer);
+
+protected:
+  pos_type seekoff(off_type off,
+                   std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
 class Lexer {
 public:
-  Lexer(const std::string &file);
+  // Lexing errors are written to `diag`.
+  Lexer(const std::string &file, std::ostream &diag = std::cerr);
+  Lexer(const SourceBuffer &source, std::ostream &diag = std::cerr);
   ~Lexer();
 
   // Sets `tok` to the next token and advances the lexer.
@@ -105,6 +145,10 @@ public:
   // Returns the last successfully lexed token
   Token GetToken() { return mLastToken; }
 
+  // Number of tokens that failed to lex so far. Each is reported once, even
+  // if it is peeked before it is consumed.
+  unsigned NumErrors() const { return mNumErrors; }
+
   // Gets the next token and compares its kind with |kind|.
   // |tok| is set to the next token.
   bool Expect(TokenKind kind, Token &tok);
@@ -125,13 +169,33 @@ private:
     {"while", TOK_KEYWORD_WHILE},
     {"struct", TOK_KEYWORD_STRUCT},
     {"return", TOK_KEYWORD_RETURN},
+    {"in", TOK_KEYWORD_IN},
+    {"parallel", TOK_KEYWORD_PARALLEL},
+    {"reduce", TOK_KEYWORD_REDUCE},
+    {"yield", TOK_KEYWORD_YIELD},
+    {"await", TOK_KEYWORD_AWAIT},
+    {"const", TOK_KEYWORD_CONST},
+    {"comptime", TOK_KEYWORD_COMPTIME},
+  };
+
+  // Two-character tokens, matched before the one-character ones
+  constexpr static struct {
+    const char *chars;
+    TokenKind tok;
+  } mDigraphMap[] = {
+    {"==", TOK_OP_EQ},
+    {"!=", TOK_OP_NE},
+    {"<=", TOK_OP_LE},
+    {">=", TOK_OP_GE},
+    {"..", TOK_DOT_DOT},
   };
+  constexpr static int kNumDigraphs = sizeof(mDigraphMap) / sizeof(mDigraphMap[0]);
 
-  constexpr static int kNumPunc = TOK_PUNC_END - TOK_PUNC_START;
+  // Digraphs have no entry below, so the maps are sized by their contents
   constexpr static struct {
     const char punc;
     TokenKind tok;
-  } mPuncMap[kNumPunc] = {
+  } mPuncMap[] = {
     {',', TOK_COMMA},
     {'=', TOK_EQUAL},
     {';', TOK_SEMICOLON},
@@ -144,13 +208,14 @@ private:
     {'{', TOK_BRACE_LEFT},
     {'}', TOK_BRACE_RIGHT},
     {'-', TOK_DASH},
+    {'#', TOK_HASH},
   };
+  constexpr static int kNumPunc = sizeof(mPuncMap) / sizeof(mPuncMap[0]);
 
-  constexpr static int kNumOps = TOK_OP_END - TOK_OP_START;
   constexpr static struct {
     const char op;
     TokenKind tok;
-  } mOpMap[kNumOps] = {
+  } mOpMap[] = {
     {'+', TOK_OP_PLUS},
     {'-', TOK_OP_MINUS},
     {'*', TOK_OP_MUL},
@@ -158,16 +223,26 @@ private:
     {'%', TOK_OP_MODULO},
     {'>', TOK_OP_GT},
     {'<', TOK_OP_LT},
-    {'=', TOK_OP_EQ},
   };
+  constexpr static int kNumOps = sizeof(mOpMap) / sizeof(mOpMap[0]);
 
-  std::ifstream mFileStream;
+  std::unique_ptr<std::streambuf> mBuffer;
+  std::istream mStream;
+  std::string mFileName;  // For diagnostics
+  std::ostream &mDiag;
+  unsigned mNumErrors = 0;
+  // Where the last error was, so peeking and then consuming the same bad
+  // token reports it once
+  uint32_t mErrorLine = 0;
+  uint32_t mErrorPos = 0;
 
   uint32_t mLine;
   uint32_t mPos;
 
   Token mLastToken;
 
+  void ReportError(const Token &tok);
+
   // Advances the lexer forward one token and assigns it to `tok`
   bool Advance(Token &tok, uint32_t line, uint32_t pos);
 
@@ -187,6 +262,8 @@ private:
   bool HandleString(Token &tok, uint32_t line, uint32_t pos);
   bool HandleOperator(Token &tok, uint32_t line, uint32_t pos);
   bool HandlePunctuation(Token &tok, uint32_t line, uint32_t pos);
+  // Consumes nothing unless the next two characters are a digraph
+  bool HandleDigraph(Token &tok, uint32_t line, uint32_t pos);
 
 };  // class Lexer
 
@@ -1,32 +1,27 @@
-#include "ast.h"
-#include "parser.h"
+#include "driver.h"
+#include "options.h"
+#include "server.h"
 
 #include <iostream>
 
 using namespace charlie;
 
-int main() {
-  std::cout << "Welcome to Charlie!" << '\n';
-
-  Parser p("examples.ch");
-
-  std::cout << "Parsing...\n";
-  auto module = p.Parse();
-  if (!module) {
-    std::cerr << "Parse failed!" << '\n';
+int main(int argc, char **argv) {
+  CompilerOptions opts;
+  ParseStatus parsed = ParseCommandLine(argc, argv, opts, std::cerr);
+  if (parsed == PARSE_HELP)
+    return 0;
+  if (parsed == PARSE_ERROR) {
+    PrintUsage(argv[0], std::cerr);
     return 1;
   }
-  std::cout << "Parse done\n\n";
-
-  std::cout << "Printing AST...\n";
-  AstDisplayVisitor adv;
-  module->Accept(adv);
-  std::cout << "Print done\n\n";
 
-  std::cout << "Codegen from AST...\n";
-  CodegenVisitor cv;
-  module->Accept(cv);
-  std::cout << "Codegen done\n\n";
+  if (!opts.server.empty()) {
+    return RunServer(opts);
+  }
+  if (!opts.connect.empty()) {
+    return RunClient(opts, argc, argv);
+  }
 
-  return 0;
+  return RunDriver(opts);
 }
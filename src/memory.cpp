@@ -0,0 +1,295 @@
+#include "memory.h"
+#include "ast.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <iomanip>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace charlie {
+
+//===----------------------------------------------------------------------===//
+// Counters
+//
+// Plain globals with constant initialization so they are usable from
+// operator new before any constructor has run.
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+struct AtomicPhaseStats {
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> allocated_bytes;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> freed_bytes;
+};
+
+std::atomic<bool> gEnabled{false};
+AtomicPhaseStats gPhaseStats[MEM_NUM_PHASES];
+std::atomic<int64_t> gLiveBytes{0};
+std::atomic<int64_t> gPeakLiveBytes{0};
+thread_local MemoryPhase tCurrentPhase = MEM_OTHER;
+
+size_t AllocationSize(void *p) {
+#ifdef __GLIBC__
+  return malloc_usable_size(p);
+#else
+  (void) p;
+  return 0;
+#endif
+}
+
+// Counts AST nodes by kind
+class AstNodeCounter : public RecursiveAstVisitor {
+public:
+  explicit AstNodeCounter(std::map<std::string, uint64_t> &counts) :
+      mCounts(counts) {}
+
+  void Visit(Module &mod) override {
+    mCounts["Module"]++;
+    RecursiveAstVisitor::Visit(mod);
+  }
+  void Visit(Block &block) override {
+    mCounts["Block"]++;
+    RecursiveAstVisitor::Visit(block);
+  }
+  void Visit(ProcedurePrototype &proto) override {
+    mCounts["ProcedurePrototype"]++;
+    RecursiveAstVisitor::Visit(proto);
+  }
+  void Visit(ProcedureDefinition &proc_def) override {
+    mCounts["ProcedureDefinition"]++;
+    RecursiveAstVisitor::Visit(proc_def);
+  }
+  void Visit(StructDefinition &struct_def) override {
+    mCounts["StructDefinition"]++;
+    RecursiveAstVisitor::Visit(struct_def);
+  }
+  void Visit(UseDeclaration &use_decl) override {
+    mCounts["UseDeclaration"]++;
+    RecursiveAstVisitor::Visit(use_decl);
+  }
+  void Visit(ConstDefinition &const_def) override {
+    mCounts["ConstDefinition"]++;
+    RecursiveAstVisitor::Visit(const_def);
+  }
+  void Visit(IntegerLiteral &intlit) override {
+    mCounts["IntegerLiteral"]++;
+    RecursiveAstVisitor::Visit(intlit);
+  }
+  void Visit(FloatLiteral &floatlit) override {
+    mCounts["FloatLiteral"]++;
+    RecursiveAstVisitor::Visit(floatlit);
+  }
+  void Visit(StringLiteral &strlit) override {
+    mCounts["StringLiteral"]++;
+    RecursiveAstVisitor::Visit(strlit);
+  }
+  void Visit(Identifier &ident) override {
+    mCounts["Identifier"]++;
+    RecursiveAstVisitor::Visit(ident);
+  }
+  void Visit(IndexExpression &index) override {
+    mCounts["IndexExpression"]++;
+    RecursiveAstVisitor::Visit(index);
+  }
+  void Visit(MemberExpression &member) override {
+    mCounts["MemberExpression"]++;
+    RecursiveAstVisitor::Visit(member);
+  }
+  void Visit(BinaryExpression &binary) override {
+    mCounts["BinaryExpression"]++;
+    RecursiveAstVisitor::Visit(binary);
+  }
+  void Visit(CallExpression &call) override {
+    mCounts["CallExpression"]++;
+    RecursiveAstVisitor::Visit(call);
+  }
+  void Visit(ReturnStatement &retstmt) override {
+    mCounts["ReturnStatement"]++;
+    RecursiveAstVisitor::Visit(retstmt);
+  }
+  void Visit(YieldStatement &yield) override {
+    mCounts["YieldStatement"]++;
+    RecursiveAstVisitor::Visit(yield);
+  }
+  void Visit(LetStatement &let) override {
+    mCounts["LetStatement"]++;
+    RecursiveAstVisitor::Visit(let);
+  }
+  void Visit(AssignStatement &assign) override {
+    mCounts["AssignStatement"]++;
+    RecursiveAstVisitor::Visit(assign);
+  }
+  void Visit(ExpressionStatement &expr) override {
+    mCounts["ExpressionStatement"]++;
+    RecursiveAstVisitor::Visit(expr);
+  }
+  void Visit(WhileStatement &loop) override {
+    mCounts["WhileStatement"]++;
+    RecursiveAstVisitor::Visit(loop);
+  }
+  void Visit(ForStatement &loop) override {
+    mCounts["ForStatement"]++;
+    RecursiveAstVisitor::Visit(loop);
+  }
+
+private:
+  std::map<std::string, uint64_t> &mCounts;
+};
+
+}  // namespace
+
+void RecordAllocation(void *p) {
+  if (!p || !gEnabled.load(std::memory_order_relaxed))
+    return;
+  int64_t bytes = AllocationSize(p);
+  AtomicPhaseStats &stats = gPhaseStats[tCurrentPhase];
+  stats.allocations.fetch_add(1, std::memory_order_relaxed);
+  stats.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+  int64_t live = gLiveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = gPeakLiveBytes.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !gPeakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void RecordFree(void *p) {
+  if (!p || !gEnabled.load(std::memory_order_relaxed))
+    return;
+  int64_t bytes = AllocationSize(p);
+  AtomicPhaseStats &stats = gPhaseStats[tCurrentPhase];
+  stats.frees.fetch_add(1, std::memory_order_relaxed);
+  stats.freed_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  gLiveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+const char *GetMemoryPhaseName(MemoryPhase phase) {
+  const char *name = "";
+  switch (phase) {
+  case MEM_OTHER: name = "other"; break;
+  case MEM_LEX: name = "lex"; break;
+  case MEM_PARSE: name = "parse"; break;
+  case MEM_IMPORTS: name = "imports"; break;
+  case MEM_DCE: name = "dce"; break;
+  case MEM_CODEGEN: name = "codegen"; break;
+  case MEM_OPTIMIZE: name = "optimize"; break;
+  case MEM_EMIT: name = "emit"; break;
+  case MEM_INTERP: name = "interp"; break;
+  default: break;
+  }
+  return name;
+}
+
+//===----------------------------------------------------------------------===//
+// MemoryTracker
+//===----------------------------------------------------------------------===//
+
+MemoryTracker &MemoryTracker::Get() {
+  static MemoryTracker tracker;
+  return tracker;
+}
+
+void MemoryTracker::Enable() {
+  gEnabled.store(true, std::memory_order_relaxed);
+}
+
+bool MemoryTracker::Enabled() const {
+  return gEnabled.load(std::memory_order_relaxed);
+}
+
+MemoryTracker::PhaseStats MemoryTracker::Stats(MemoryPhase phase) const {
+  const AtomicPhaseStats &s = gPhaseStats[phase];
+  PhaseStats stats;
+  stats.allocations = s.allocations.load(std::memory_order_relaxed);
+  stats.allocated_bytes = s.allocated_bytes.load(std::memory_order_relaxed);
+  stats.frees = s.frees.load(std::memory_order_relaxed);
+  stats.freed_bytes = s.freed_bytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+int64_t MemoryTracker::PeakLiveBytes() const {
+  return gPeakLiveBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryTracker::PeakRSS() {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+  // ru_maxrss is in kilobytes on Linux
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+void MemoryTracker::CountAstNodes(Module &mod) {
+  std::map<std::string, uint64_t> counts;
+  AstNodeCounter counter(counts);
+  mod.Accept(counter);
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (const auto &[kind, count] : counts) {
+    mAstNodes[kind] += count;
+  }
+}
+
+void MemoryTracker::PrintReport(std::ostream &os) const {
+  auto flags = os.flags();
+  os << std::fixed << std::setprecision(1);
+  os << "===-------------------------------------------------------------===\n"
+     << "  Charlie memory report (peak RSS " << PeakRSS() / 1048576.0
+     << " MiB, peak heap " << PeakLiveBytes() / 1048576.0 << " MiB)\n"
+     << "===-------------------------------------------------------------===\n";
+  os << std::left << std::setw(12) << "Phase" << std::right << std::setw(12)
+     << "Allocs" << std::setw(14) << "Alloc KiB" << std::setw(12) << "Frees"
+     << std::setw(14) << "Freed KiB" << std::setw(14) << "Net KiB" << '\n';
+
+  PhaseStats total;
+  auto print_row = [&](const char *name, const PhaseStats &s) {
+    double net = (int64_t(s.allocated_bytes) - int64_t(s.freed_bytes)) / 1024.0;
+    os << std::left << std::setw(12) << name << std::right << std::setw(12)
+       << s.allocations << std::setw(14) << s.allocated_bytes / 1024.0
+       << std::setw(12) << s.frees << std::setw(14) << s.freed_bytes / 1024.0
+       << std::setw(14) << net << '\n';
+  };
+  for (int i = 0; i < MEM_NUM_PHASES; ++i) {
+    MemoryPhase phase = static_cast<MemoryPhase>(i);
+    PhaseStats s = Stats(phase);
+    if (!s.allocations && !s.frees)
+      continue;
+    print_row(GetMemoryPhaseName(phase), s);
+    total.allocations += s.allocations;
+    total.allocated_bytes += s.allocated_bytes;
+    total.frees += s.frees;
+    total.freed_bytes += s.freed_bytes;
+  }
+  print_row("total", total);
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mAstNodes.empty()) {
+    os << "\nAST nodes\n";
+    for (const auto &[kind, count] : mAstNodes) {
+      os << "  " << std::left << std::setw(22) << kind << std::right
+         << std::setw(10) << count << '\n';
+    }
+  }
+  os.flags(flags);
+}
+
+//===----------------------------------------------------------------------===//
+// MemoryPhaseScope
+//===----------------------------------------------------------------------===//
+
+MemoryPhaseScope::MemoryPhaseScope(MemoryPhase phase) :
+    mPrevious(tCurrentPhase) {
+  tCurrentPhase = phase;
+}
+
+MemoryPhaseScope::~MemoryPhaseScope() {
+  tCurrentPhase = mPrevious;
+}
+
+}  // namespace charlie
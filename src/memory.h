@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace charlie {
+
+class Module;
+
+// Compiler phases that heap allocations are attributed to. The phase is per
+// thread and set by MemoryPhaseScope; anything outside a scope is MEM_OTHER.
+enum MemoryPhase : uint8_t {
+  MEM_OTHER,
+  MEM_LEX,
+  MEM_PARSE,
+  MEM_IMPORTS,
+  MEM_DCE,
+  MEM_CODEGEN,
+  MEM_OPTIMIZE,
+  MEM_EMIT,
+  MEM_INTERP,
+  MEM_NUM_PHASES,
+};
+
+const char *GetMemoryPhaseName(MemoryPhase phase);
+
+// Called by the global operator new and delete in memory_hooks.cpp
+void RecordAllocation(void *p);
+void RecordFree(void *p);
+
+// Process-wide collector behind --mem-report.
+//
+// The global operator new and delete in memory_hooks.cpp count every
+// allocation and deallocation against the calling thread's phase while
+// accounting is enabled. Frees are attributed to the phase that frees, so
+// a phase's net bytes can be negative when it releases memory another phase
+// allocated.
+class MemoryTracker {
+public:
+  struct PhaseStats {
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    uint64_t frees = 0;
+    uint64_t freed_bytes = 0;
+  };
+
+  static MemoryTracker &Get();
+
+  void Enable();
+  bool Enabled() const;
+
+  PhaseStats Stats(MemoryPhase phase) const;
+
+  // Highest number of live heap bytes seen since Enable()
+  int64_t PeakLiveBytes() const;
+
+  // Peak resident set size of the process, in bytes
+  static uint64_t PeakRSS();
+
+  // Adds the nodes of `mod` to the AST node counts, by kind.
+  void CountAstNodes(Module &mod);
+
+  void PrintReport(std::ostream &os) const;
+
+private:
+  mutable std::mutex mMutex;
+  std::map<std::string, uint64_t> mAstNodes;
+};
+
+// Attributes allocations on this thread to `phase` for the enclosing scope.
+class MemoryPhaseScope {
+public:
+  explicit MemoryPhaseScope(MemoryPhase phase);
+  ~MemoryPhaseScope();
+
+  MemoryPhaseScope(const MemoryPhaseScope &) = delete;
+  MemoryPhaseScope &operator=(const MemoryPhaseScope &) = delete;
+
+private:
+  MemoryPhase mPrevious;
+};
+
+}  // namespace charlie
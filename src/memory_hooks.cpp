@@ -0,0 +1,50 @@
+// Global operator new and delete feeding MemoryTracker. Only linked into
+// executables; libcharlie leaves the host's allocation functions alone, so
+// embedders that want --mem-report style numbers add this file themselves.
+
+#include "memory.h"
+
+#include <cstdlib>
+#include <new>
+
+// The remaining forms (array, nothrow and sized) forward to these in the
+// standard library.
+
+void *operator new(std::size_t size) {
+  void *p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  charlie::RecordAllocation(p);
+  return p;
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  size_t alignment = static_cast<size_t>(align);
+  // aligned_alloc needs the size to be a multiple of the alignment
+  size_t rounded = ((size ? size : 1) + alignment - 1) & ~(alignment - 1);
+  void *p = std::aligned_alloc(alignment, rounded);
+  if (!p)
+    throw std::bad_alloc();
+  charlie::RecordAllocation(p);
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  charlie::RecordFree(p);
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  charlie::RecordFree(p);
+  std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+  charlie::RecordFree(p);
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  charlie::RecordFree(p);
+  std::free(p);
+}
@@ -0,0 +1,187 @@
+#include "options.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+
+#include <unistd.h>
+
+namespace charlie {
+
+// Matches `--name=value` and points `value` past the '='.
+static bool MatchValue(const char *arg, const char *name, const char **value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) || arg[len] != '=')
+    return false;
+  *value = arg + len + 1;
+  return true;
+}
+
+static bool ParseSize(const char *s, uint64_t *size) {
+  char *end = nullptr;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (end == s)
+    return false;
+  switch (*end) {
+  case 'k': case 'K': n <<= 10; end++; break;
+  case 'm': case 'M': n <<= 20; end++; break;
+  case 'g': case 'G': n <<= 30; end++; break;
+  default: break;
+  }
+  if (*end != '\0')
+    return false;
+  *size = n;
+  return true;
+}
+
+std::string DefaultServerSocketPath() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && *runtime_dir)
+    return std::string(runtime_dir) + "/charlie.sock";
+  return "/tmp/charlie-" + std::to_string(getuid()) + ".sock";
+}
+
+void PrintUsage(const char *argv0, std::ostream &out) {
+  out << "Usage: " << argv0 << " [options] <file>...\n"
+         "\n"
+         "Options:\n"
+         "  -o <file>                Write output to <file>\n"
+         "  --emit=<kind>            Output kind: bc (default), obj, ll,\n"
+         "                           chi (module interface)\n"
+         "  -I <dir>                 Add <dir> to the module search path\n"
+         "  --dump                   Print the AST and LLVM IR instead\n"
+         "  --check                  Only check the inputs for errors\n"
+         "  --interp                 Run main on the bytecode interpreter\n"
+         "                           (with --dump, print the bytecode too)\n"
+         "  -j <n>                   Compile <n> inputs in parallel\n"
+         "                           (default: one per hardware thread)\n"
+         "  -O<n>                    Optimization level (0-3)\n"
+         "  --keep=<proc>            Keep <proc> and what it uses even if\n"
+         "                           unreachable from main, and keep it external\n"
+         "  --no-dead-decl-elim      Generate code for every declaration\n"
+         "  --dead-decl-report       Print the declarations that were dropped\n"
+         "  --layout-report          Print struct sizes, alignment and padding\n"
+         "  --target=<triple>        Target triple (default: host)\n"
+         "  --mcpu=<cpu>             Target CPU (default: generic)\n"
+         "  --mattr=<features>       Target features, e.g. +avx2,+fma\n"
+         "  --cache-dir=<dir>        Reuse outputs from an on-disk cache\n"
+         "  --cache-size=<n>[K|M|G]  Cache size cap (default: 512M)\n"
+         "  --cache-stats            Print cache hit/miss statistics\n"
+         "  --time-report            Print time spent in each compiler phase\n"
+         "  --time-report-hw         Add cycles, instructions and cache misses\n"
+         "                           to the time report (Linux perf events)\n"
+         "  --time-trace=<file>      Write a Chrome trace of phases and passes\n"
+         "  --mem-report             Print allocations per compiler phase,\n"
+         "                           AST node counts and peak memory\n"
+         "  --server[=<socket>]      Run as a compile server\n"
+         "  --connect[=<socket>]     Compile using a running server\n"
+         "  -h, --help               Print this info\n";
+}
+
+ParseStatus ParseCommandLine(int argc, char **argv, CompilerOptions &opts,
+                             std::ostream &diag) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = nullptr;
+
+    if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+      PrintUsage(argv[0], diag);
+      return PARSE_HELP;
+    } else if (!strcmp(arg, "-o")) {
+      if (++i == argc) {
+        diag << "[Driver Error] Missing argument to '-o'\n";
+        return PARSE_ERROR;
+      }
+      opts.output = argv[i];
+    } else if (!strncmp(arg, "-I", 2)) {
+      const char *dir = arg[2] ? arg + 2 : (i + 1 < argc ? argv[++i] : nullptr);
+      if (!dir) {
+        diag << "[Driver Error] Missing argument to '-I'\n";
+        return PARSE_ERROR;
+      }
+      opts.import_paths.emplace_back(dir);
+    } else if (!strcmp(arg, "--dump")) {
+      opts.dump = true;
+    } else if (!strcmp(arg, "--check")) {
+      opts.check = true;
+    } else if (!strcmp(arg, "--interp")) {
+      opts.interp = true;
+    } else if (!strncmp(arg, "-j", 2)) {
+      const char *n = arg[2] ? arg + 2 : (i + 1 < argc ? argv[++i] : nullptr);
+      char *end = nullptr;
+      long jobs = n ? strtol(n, &end, 10) : 0;
+      if (!n || *end != '\0' || jobs < 1) {
+        diag << "[Driver Error] Invalid job count for '-j'\n";
+        return PARSE_ERROR;
+      }
+      opts.jobs = static_cast<unsigned>(jobs);
+    } else if (!strncmp(arg, "-O", 2)) {
+      if (arg[2] < '0' || arg[2] > '3' || arg[3] != '\0') {
+        diag << "[Driver Error] Invalid optimization level '" << arg << "'\n";
+        return PARSE_ERROR;
+      }
+      opts.opt_level = arg[2] - '0';
+    } else if (MatchValue(arg, "--emit", &value)) {
+      if (!strcmp(value, "bc")) {
+        opts.emit = CompilerOptions::EMIT_BITCODE;
+      } else if (!strcmp(value, "obj")) {
+        opts.emit = CompilerOptions::EMIT_OBJECT;
+      } else if (!strcmp(value, "ll")) {
+        opts.emit = CompilerOptions::EMIT_LLVM_IR;
+      } else if (!strcmp(value, "chi")) {
+        opts.emit = CompilerOptions::EMIT_INTERFACE;
+      } else {
+        diag << "[Driver Error] Unknown output kind '" << value << "'\n";
+        return PARSE_ERROR;
+      }
+    } else if (MatchValue(arg, "--keep", &value)) {
+      opts.keep.emplace_back(value);
+    } else if (!strcmp(arg, "--no-dead-decl-elim")) {
+      opts.dead_decl_elim = false;
+    } else if (!strcmp(arg, "--dead-decl-report")) {
+      opts.dead_decl_report = true;
+    } else if (!strcmp(arg, "--layout-report")) {
+      opts.layout_report = true;
+    } else if (MatchValue(arg, "--target", &value)) {
+      opts.target_triple = value;
+    } else if (MatchValue(arg, "--mcpu", &value)) {
+      opts.target_cpu = value;
+    } else if (MatchValue(arg, "--mattr", &value)) {
+      opts.target_features = value;
+    } else if (MatchValue(arg, "--cache-dir", &value)) {
+      opts.cache_dir = value;
+    } else if (MatchValue(arg, "--cache-size", &value)) {
+      if (!ParseSize(value, &opts.cache_max_bytes)) {
+        diag << "[Driver Error] Invalid cache size '" << value << "'\n";
+        return PARSE_ERROR;
+      }
+    } else if (!strcmp(arg, "--cache-stats")) {
+      opts.cache_stats = true;
+    } else if (!strcmp(arg, "--time-report")) {
+      opts.time_report = true;
+    } else if (!strcmp(arg, "--time-report-hw")) {
+      opts.time_report = true;
+      opts.time_report_hw = true;
+    } else if (MatchValue(arg, "--time-trace", &value)) {
+      opts.time_trace = value;
+    } else if (!strcmp(arg, "--mem-report")) {
+      opts.mem_report = true;
+    } else if (!strcmp(arg, "--server")) {
+      opts.server = DefaultServerSocketPath();
+    } else if (MatchValue(arg, "--server", &value)) {
+      opts.server = value;
+    } else if (!strcmp(arg, "--connect")) {
+      opts.connect = DefaultServerSocketPath();
+    } else if (MatchValue(arg, "--connect", &value)) {
+      opts.connect = value;
+    } else if (arg[0] == '-') {
+      diag << "[Driver Error] Unknown option '" << arg << "'\n";
+      return PARSE_ERROR;
+    } else {
+      opts.inputs.emplace_back(arg);
+    }
+  }
+  return PARSE_OK;
+}
+
+}  // namespace charlie
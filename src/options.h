@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace charlie {
+
+#ifndef CHARLIE_VERSION
+#define CHARLIE_VERSION "unknown"
+#endif
+
+struct CompilerOptions {
+  std::vector<std::string> inputs;
+
+  // Output path. Only valid with a single input; otherwise each output is
+  // written next to its input with the extension for `emit`.
+  std::string output;
+
+  // Print the AST and LLVM IR of each input instead of writing outputs.
+  bool dump = false;
+
+  // Only lex, parse, resolve imports and run semantic checks. Never touches
+  // LLVM.
+  bool check = false;
+
+  // Run `main` on the bytecode interpreter instead of compiling with LLVM.
+  bool interp = false;
+
+  // Number of inputs compiled concurrently. 0 means one per hardware thread.
+  unsigned jobs = 0;
+
+  enum EmitKind {
+    EMIT_BITCODE,
+    EMIT_OBJECT,
+    EMIT_LLVM_IR,
+    EMIT_INTERFACE,
+  } emit = EMIT_BITCODE;
+
+  // Directories searched for `use`d modules after the importer's own
+  std::vector<std::string> import_paths;
+
+  // -O<n>
+  unsigned opt_level = 0;
+
+  // Dead declaration elimination. `keep` adds roots beyond `main` and #export
+  // procedures, and like them they keep external linkage, as every procedure
+  // does without elimination.
+  bool dead_decl_elim = true;
+  bool dead_decl_report = false;
+  std::vector<std::string> keep;
+
+  // Print the size, alignment, padding and field offsets of each struct that
+  // reaches code generation.
+  bool layout_report = false;
+
+  // Target selection. Empty means the host defaults.
+  std::string target_triple;
+  std::string target_cpu;
+  std::string target_features;
+
+  // On-disk compilation cache. Disabled when `cache_dir` is empty.
+  std::string cache_dir;
+  uint64_t cache_max_bytes = kDefaultCacheMaxBytes;
+  bool cache_stats = false;
+
+  // Compiler server. `server` runs the daemon, `connect` forwards this
+  // invocation to one. Both name the Unix domain socket path.
+  std::string server;
+  std::string connect;
+
+  // Compile-time profiling. `time_report` prints a per-phase table to
+  // stderr, `time_trace` writes a Chrome trace, and `time_report_hw` adds
+  // hardware counters to both.
+  bool time_report = false;
+  std::string time_trace;
+  bool time_report_hw = false;
+
+  // Print allocations per compiler phase, AST node counts and peak memory
+  // to stderr.
+  bool mem_report = false;
+
+  static constexpr uint64_t kDefaultCacheMaxBytes = 512ull * 1024 * 1024;
+};
+
+enum ParseStatus {
+  PARSE_OK,
+  PARSE_HELP,   // -h or --help; the usage has been written
+  PARSE_ERROR,  // Malformed arguments; a diagnostic has been written
+};
+
+// Parses the command line into `opts`. Diagnostics and the usage go to
+// `diag`. Never exits, so the server can parse the arguments of a client.
+ParseStatus ParseCommandLine(int argc, char **argv, CompilerOptions &opts,
+                             std::ostream &diag);
+
+void PrintUsage(const char *argv0, std::ostream &out);
+
+// Per-user socket path used by --server and --connect without a value.
+std::string DefaultServerSocketPath();
+
+}  // namespace charlie
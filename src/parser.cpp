@@ -1,52 +1,95 @@
 #include "parser.h"
+#include "debug.h"
+#include "memory.h"
+#include "timer.h"
 
 #include <cstdarg>
+#include <climits>
 #include <iostream>
 #include <variant>
 
 namespace charlie {
 
-static void warn(const char *format_msg, ...) {
+void Parser::Warn(const char *format_msg, ...) {
+  char buf[512];
   va_list args;
   va_start(args, format_msg);
-  vfprintf(stderr, format_msg, args);
+  vsnprintf(buf, sizeof(buf), format_msg, args);
   va_end(args);
+  mDiag << buf;
+  mNumErrors++;
 }
 
 static void print_tok(const Token &tok) {
-  std::cout << "Token: Kind " << tok.kind
-            << " Span(Line:  " << tok.span.line_start << " -> "
-            << tok.span.line_end << ", Pos: " << tok.span.pos_start << " -> "
-            << tok.span.pos_end << ") \"" << GetTokenName(tok.kind) << "\"\n";
+  DEBUG_TRACE("Token: Kind " << tok.kind
+              << " Span(Line:  " << tok.span.line_start << " -> "
+              << tok.span.line_end << ", Pos: " << tok.span.pos_start << " -> "
+              << tok.span.pos_end << ") \"" << GetTokenName(tok.kind) << "\"\n");
+  (void) tok;
 }
 
-Parser::Parser(std::string file) :
-    mFileName(std::move(file)), mLexer(mFileName) {}
+Parser::Parser(std::string file, std::ostream &diag) :
+    mFileName(std::move(file)), mDiag(diag), mLexer(mFileName, diag) {}
+
+Parser::Parser(const SourceBuffer &source, std::ostream &diag) :
+    mFileName(source.name), mDiag(diag), mLexer(source, diag) {}
 
 Parser::~Parser() {}
 
 std::unique_ptr<Module> Parser::Parse() {
+  TimeScope scope("parse", mFileName);
+  MemoryPhaseScope mem_scope(MEM_PARSE);
   std::vector<std::unique_ptr<TopLevelDeclaration>> decls;
   for (auto decl = ParseTopLevelDeclaration(); decl != nullptr;
        decl = ParseTopLevelDeclaration()) {
     decls.push_back(std::move(decl));
   }
+  // A token that fails to lex ends the declaration it is in, and with it
+  // the parse
+  if (mNumErrors || mLexer.NumErrors())
+    return nullptr;
   return std::make_unique<Module>(std::string(mFileName), std::move(decls));
 }
 
 /*
- * TopLevelDeclaration ::= ProcedureDefinition | StructDefinition
+ * TopLevelDeclaration ::= { Annotation } ( UseDeclaration | ProcedureDefinition | StructDefinition
+ *                                          | ConstDefinition )
  */
 std::unique_ptr<TopLevelDeclaration> Parser::ParseTopLevelDeclaration() {
   Token tok;
 
+  std::vector<Annotation> annotations;
+  while (mLexer.PeekNextToken(tok), tok.kind == TOK_HASH) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    Annotation annotation;
+    if (!ParseAnnotation(annotation))
+      return nullptr;
+    annotations.push_back(std::move(annotation));
+  }
+  auto annotate = [&](std::unique_ptr<TopLevelDeclaration> decl) {
+    if (decl)
+      decl->SetAnnotations(std::move(annotations));
+    return decl;
+  };
+
   if (mLexer.PeekNextToken(tok); tok.kind == TOK_EOF) {
+    if (!annotations.empty()) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected declaration after annotation\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+    }
     return nullptr;
+  } else if (tok.kind == TOK_KEYWORD_USE) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    return annotate(ParseUseDeclaration());
   }
 
   bool res = mLexer.Expect(TOK_IDENTIFIER, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected identifier\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected identifier\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -54,12 +97,12 @@ std::unique_ptr<TopLevelDeclaration> Parser::ParseTopLevelDeclaration() {
   }
 
   std::string ident = std::get<std::string>(tok.value);
-  std::cout << "DEBUG: Lexer consumed identifier: " << ident << '\n';
+  DEBUG_TRACE("DEBUG: Lexer consumed identifier: " << ident << '\n');
   print_tok(tok);
 
   res = mLexer.Expect(TOK_COLON, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -68,7 +111,7 @@ std::unique_ptr<TopLevelDeclaration> Parser::ParseTopLevelDeclaration() {
 
   res = mLexer.Expect(TOK_COLON, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -78,26 +121,128 @@ std::unique_ptr<TopLevelDeclaration> Parser::ParseTopLevelDeclaration() {
   switch (mLexer.GetNextToken(tok); tok.kind) {
   case TOK_KEYWORD_PROC:
     print_tok(tok);
-    return ParseProcedureDefintion(std::move(ident));
+    return annotate(ParseProcedureDefintion(std::move(ident)));
   case TOK_KEYWORD_STRUCT:
     print_tok(tok);
-    return ParseStructDefinition(std::move(ident));
+    return annotate(ParseStructDefinition(std::move(ident)));
+  case TOK_KEYWORD_CONST:
+    print_tok(tok);
+    return annotate(ParseConstDefinition(std::move(ident)));
   default:
-    // TODO: report some approriate warning/error
+    Warn("[Parse Error] %s:<%d:%d>: Expected \"proc\", \"struct\" or \"const\"\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
     return nullptr;
   }
 }
 
 /*
-* ProcedurePrototype ::= IDENTIFIER "::" "proc" "(" { ProcdeureParameters } ")" [ "->" IDENTIFIER ]
+ * Annotation ::= "#" IDENTIFIER [ "(" INT_LITERAL { "," INT_LITERAL } ")" ]
+ */
+bool Parser::ParseAnnotation(Annotation &annotation) {
+  Token tok;
+
+  bool res = mLexer.Expect(TOK_IDENTIFIER, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected annotation name\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return false;
+  }
+  annotation.name = std::get<std::string>(tok.value);
+  print_tok(tok);
+
+  if (mLexer.PeekNextToken(tok); tok.kind != TOK_PAREN_LEFT)
+    return true;
+  mLexer.GetNextToken(tok);
+  print_tok(tok);
+
+  for (;;) {
+    res = mLexer.Expect(TOK_INT_LITERAL, tok);
+    if (!res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected integer annotation argument\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    if (std::get<uint64_t>(tok.value) > INT_MAX) {
+      Warn("[Parse Error] %s:<%d:%d>: Annotation argument is too large\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    annotation.args.push_back(std::get<uint64_t>(tok.value));
+    print_tok(tok);
+
+    tok = mLexer.GetNextToken();
+    if (tok.kind == TOK_PAREN_RIGHT)
+      break;
+    if (tok.kind != TOK_COMMA) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ',' or ')'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+  }
+  print_tok(tok);
+  return true;
+}
+
+/*
+ * UseDeclaration ::= "use" IDENTIFIER ";"
+ */
+std::unique_ptr<UseDeclaration> Parser::ParseUseDeclaration() {
+  Token tok;
+
+  bool res = mLexer.Expect(TOK_IDENTIFIER, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected module name\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  std::string module_name = std::get<std::string>(tok.value);
+  print_tok(tok);
+
+  res = mLexer.Expect(TOK_SEMICOLON, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected ';'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+
+  return std::make_unique<UseDeclaration>(std::move(module_name));
+}
+
+/*
+* ProcedurePrototype ::= IDENTIFIER "::" "proc" [ "<" TypeParameters ">" ]
+*                        "(" { ProcdeureParameters } ")" [ "->" Type ]
 */
 std::unique_ptr<ProcedurePrototype> Parser::ParseProcedurePrototype(std::string proc_name) {
   Token tok;
 
+  // '<' TypeParameters '>'
+  std::vector<std::string> type_params;
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_OP_LT) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    if (!ParseTypeParameters(type_params))
+      return nullptr;
+  }
+
   // '('
   bool res = mLexer.Expect(TOK_PAREN_LEFT, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected '('\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected '('\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -105,13 +250,16 @@ std::unique_ptr<ProcedurePrototype> Parser::ParseProcedurePrototype(std::string
   }
   print_tok(tok);
 
-  std::vector<std::string> args;
-  // ParseProcedureParameters();
+  std::vector<ProcedurePrototype::Parameter> args;
+  if (mLexer.PeekNextToken(tok); tok.kind != TOK_PAREN_RIGHT) {
+    if (!ParseProcedureParameters(args))
+      return nullptr;
+  }
 
   // ')'
   res = mLexer.Expect(TOK_PAREN_RIGHT, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected ')'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected ')'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -120,49 +268,99 @@ std::unique_ptr<ProcedurePrototype> Parser::ParseProcedurePrototype(std::string
   print_tok(tok);
 
   // "->"
-  // TODO: We should really peek here instead of expecting since ParseBlock will be expecting an
-  // open left brace
-  res = mLexer.Expect(TOK_DASH, tok);
-  if (!res && tok.kind == TOK_BRACE_LEFT) {
+  if (mLexer.PeekNextToken(tok); tok.kind != TOK_DASH) {
     // We dont have a return type so we're done
     return std::make_unique<ProcedurePrototype>(
-      std::move(proc_name), "", std::move(args));
-  } else if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected \"->\"\n",
-         mFileName.c_str(),
-         tok.span.line_start,
-         tok.span.pos_start);
-    return nullptr;
+      std::move(proc_name), "", std::move(args), std::move(type_params));
   }
+  mLexer.GetNextToken(tok);
   res = mLexer.Expect(TOK_OP_GT, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected \"->\"\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected \"->\"\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
     return nullptr;
   }
 
-  // IDENTIFIER (return type)
-  res = mLexer.Expect(TOK_IDENTIFIER, tok);
-  if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected identifier\n",
-         mFileName.c_str(),
-         tok.span.line_start,
-         tok.span.pos_start);
+  // Type (return type)
+  std::string return_type;
+  if (!ParseType(return_type))
     return nullptr;
-  }
-
-  std::string return_type = std::get<std::string>(tok.value);
-  std::cout << "DEBUG: Lexer consumed identifier: " << return_type << '\n';
-  print_tok(tok);
 
   if (proc_name.empty() || return_type.empty()) {
     return nullptr;
   }
 
   return std::make_unique<ProcedurePrototype>(
-    std::move(proc_name), std::move(return_type), std::move(args));
+    std::move(proc_name), std::move(return_type), std::move(args), std::move(type_params));
+}
+
+/*
+ * TypeParameters ::= IDENTIFIER { "," IDENTIFIER }
+ */
+bool Parser::ParseTypeParameters(std::vector<std::string> &type_params) {
+  Token tok;
+  for (;;) {
+    if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected type parameter name\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+    type_params.push_back(std::get<std::string>(tok.value));
+
+    tok = mLexer.GetNextToken();
+    if (tok.kind == TOK_OP_GT)
+      break;
+    if (tok.kind != TOK_COMMA) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ',' or '>'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+  }
+  print_tok(tok);
+  return true;
+}
+
+/*
+ * ProcedureParameters ::= IDENTIFIER ":" Type { "," IDENTIFIER ":" Type }
+ */
+bool Parser::ParseProcedureParameters(std::vector<ProcedurePrototype::Parameter> &args) {
+  Token tok;
+  for (;;) {
+    if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected parameter name\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+    ProcedurePrototype::Parameter arg;
+    arg.name = std::get<std::string>(tok.value);
+
+    if (bool res = mLexer.Expect(TOK_COLON, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    if (!ParseType(arg.type))
+      return false;
+    args.push_back(std::move(arg));
+
+    if (mLexer.PeekNextToken(tok); tok.kind != TOK_COMMA)
+      return true;
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+  }
 }
 
 /*
@@ -191,7 +389,7 @@ std::unique_ptr<StructDefinition> Parser::ParseStructDefinition(std::string stru
   // '{'
   bool res = mLexer.Expect(TOK_BRACE_LEFT, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected '{'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected '{'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -204,7 +402,7 @@ std::unique_ptr<StructDefinition> Parser::ParseStructDefinition(std::string stru
 
   tok = mLexer.GetNextToken();
   if (tok.kind != TOK_BRACE_RIGHT) {
-    warn("[Parse Error] %s:<%d:%d>: Expected '}'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected '}'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -216,13 +414,13 @@ std::unique_ptr<StructDefinition> Parser::ParseStructDefinition(std::string stru
 }
 
 /*
- * StructMemberList ::= IDENTIFIER ':' IDENTIFIER | { IDENTIFIER ':' IDENFITIER "," }
+ * StructMemberList ::= IDENTIFIER ':' Type | { IDENTIFIER ':' Type "," }
  */
 void Parser::ParseStructMembers(std::vector<StructDefinition::StructMember> &members) {
     // TODO: Handle non-comma-terminated case
     for(;;) if(Token tok = mLexer.PeekNextToken(); tok.kind != TOK_BRACE_RIGHT) {
       if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
-        warn("[Parse Error] %s:<%d:%d>: Expected struct member identifier\n",
+        Warn("[Parse Error] %s:<%d:%d>: Expected struct member identifier\n",
              mFileName.c_str(),
              tok.span.line_start,
              tok.span.pos_start);
@@ -231,35 +429,86 @@ void Parser::ParseStructMembers(std::vector<StructDefinition::StructMember> &mem
       auto member_name = std::get<std::string>(tok.value);
 
       if (bool res = mLexer.Expect(TOK_COLON, tok); !res) {
-        warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+        Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
              mFileName.c_str(),
              tok.span.line_start,
              tok.span.pos_start);
         break;
       }
 
-      if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
-        warn("[Parse Error] %s:<%d:%d>: Expected struct member type\n",
-             mFileName.c_str(),
-             tok.span.line_start,
-             tok.span.pos_start);
+      std::string type;
+      if (!ParseType(type))
         break;
-      }
-      auto type = std::get<std::string>(tok.value);
 
       if (bool res = mLexer.Expect(TOK_COMMA, tok); !res) {
-        warn("[Parse Error] %s:<%d:%d>: Expected ','\n",
+        Warn("[Parse Error] %s:<%d:%d>: Expected ','\n",
              mFileName.c_str(),
              tok.span.line_start,
              tok.span.pos_start);
         break;
       }
 
-      std::cout << "DEBUG: Parsed struct member: " << member_name << " " << type << '\n';
+      DEBUG_TRACE("DEBUG: Parsed struct member: " << member_name << " " << type << '\n');
       members.emplace_back(member_name, type);
     } else break;
 }
 
+/*
+ * ConstDefinition ::= IDENTIFIER "::" "const" Type "=" ( Expression ";" | "comptime" Block )
+ */
+std::unique_ptr<ConstDefinition> Parser::ParseConstDefinition(std::string const_name) {
+  Token tok;
+
+  std::string type;
+  if (!ParseType(type))
+    return nullptr;
+
+  bool res = mLexer.Expect(TOK_EQUAL, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected '='\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+
+  std::unique_ptr<Block> block;
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_KEYWORD_COMPTIME) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    block = ParseBlock();
+    if (!block)
+      return nullptr;
+  } else {
+    // `= value;` runs as `= comptime { return value; }`
+    std::unique_ptr<Expression> value = ParseExpression();
+    if (!value)
+      return nullptr;
+    res = mLexer.Expect(TOK_SEMICOLON, tok);
+    if (!res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ';'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return nullptr;
+    }
+    print_tok(tok);
+    std::vector<std::unique_ptr<Statement>> stmts;
+    stmts.push_back(std::make_unique<ReturnStatement>(std::move(value)));
+    block = std::make_unique<Block>(std::move(stmts));
+  }
+
+  // The initializer is a procedure named after the constant, see
+  // ConstDefinition
+  auto initializer = std::make_unique<ProcedureDefinition>(
+    std::make_unique<ProcedurePrototype>(const_name, type,
+                                         std::vector<ProcedurePrototype::Parameter>()),
+    std::move(block));
+  return std::make_unique<ConstDefinition>(std::move(const_name), std::move(type),
+                                           std::move(initializer));
+}
+
 /*
 * Block ::= "{" { Statement } "}"
 */
@@ -268,7 +517,7 @@ std::unique_ptr<Block> Parser::ParseBlock() {
   Token tok;
   bool res = mLexer.Expect(TOK_BRACE_LEFT, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected '{'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected '{'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -276,40 +525,48 @@ std::unique_ptr<Block> Parser::ParseBlock() {
   }
   print_tok(tok);
 
-  // TODO: Blocks need to parse multiple statements
   std::vector<std::unique_ptr<Statement>> stmts;
-  for (auto stmt = ParseStatement(); stmt != nullptr; stmt = ParseStatement()) {
+  while (mLexer.PeekNextToken(tok), tok.kind != TOK_BRACE_RIGHT) {
+    if (tok.kind == TOK_EOF) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected '}'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return nullptr;
+    }
+    auto stmt = ParseStatement();
+    if (!stmt)
+      return nullptr;
     stmts.push_back(std::move(stmt));
   }
 
   // '}'
-  tok = mLexer.GetToken();
-  if (tok.kind != TOK_BRACE_RIGHT) {
-    warn("[Parse Error] %s:<%d:%d>: Expected '}'\n",
-         mFileName.c_str(),
-         tok.span.line_start,
-         tok.span.pos_start);
-    return nullptr;
-  }
+  mLexer.GetNextToken(tok);
   print_tok(tok);
 
   return std::make_unique<Block>(std::move(stmts));
 }
 
 /*
- * Statement ::= BasicStatement ";"
+ * Statement ::= AnnotatedStatement | BasicStatement ";" | LoopStatement
  */
 std::unique_ptr<Statement> Parser::ParseStatement() {
+  Token tok = mLexer.PeekNextToken();
+  if (tok.kind == TOK_HASH)
+    return ParseAnnotatedStatement();
+  if (tok.kind == TOK_KEYWORD_WHILE || tok.kind == TOK_KEYWORD_FOR ||
+      tok.kind == TOK_KEYWORD_PARALLEL)
+    return ParseLoopStatement();
+
   // BasicStatement
   std::unique_ptr<Statement> stmt = ParseBasicStatement();
   if (!stmt)
     return nullptr;
 
   // ';'
-  Token tok;
   bool res = mLexer.Expect(TOK_SEMICOLON, tok);
   if (!res) {
-    warn("[Parse Error] %s:<%d:%d>: Expected ';'\n",
+    Warn("[Parse Error] %s:<%d:%d>: Expected ';'\n",
          mFileName.c_str(),
          tok.span.line_start,
          tok.span.pos_start);
@@ -320,16 +577,247 @@ std::unique_ptr<Statement> Parser::ParseStatement() {
 }
 
 /*
- * BasicStatement ::= ReturnStatement
+ * AnnotatedStatement ::= Annotation { Annotation } ( LoopStatement | ReturnStatement ";" )
  */
-std::unique_ptr<Statement> Parser::ParseBasicStatement() {
+std::unique_ptr<Statement> Parser::ParseAnnotatedStatement() {
+  Token tok;
+  std::vector<Annotation> annotations;
+  while (mLexer.PeekNextToken(tok), tok.kind == TOK_HASH) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    Annotation annotation;
+    if (!ParseAnnotation(annotation))
+      return nullptr;
+    annotations.push_back(std::move(annotation));
+  }
+
+  if (tok.kind != TOK_KEYWORD_RETURN) {
+    std::unique_ptr<LoopStatement> loop = ParseLoopStatement();
+    if (loop)
+      loop->mAnnotations = std::move(annotations);
+    return loop;
+  }
+
+  mLexer.GetNextToken(tok);
+  print_tok(tok);
+  std::unique_ptr<ReturnStatement> ret = ParseReturnStatement();
+  if (!ret)
+    return nullptr;
+  if (bool res = mLexer.Expect(TOK_SEMICOLON, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected ';'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+  ret->mAnnotations = std::move(annotations);
+  return ret;
+}
+
+/*
+ * LoopStatement ::= WhileStatement | [ "parallel" ] ForStatement
+ */
+std::unique_ptr<LoopStatement> Parser::ParseLoopStatement() {
+  std::unique_ptr<LoopStatement> loop;
   Token tok = mLexer.GetNextToken();
+  if (tok.kind == TOK_KEYWORD_WHILE) {
+    print_tok(tok);
+    loop = ParseWhileStatement();
+  } else if (tok.kind == TOK_KEYWORD_FOR) {
+    print_tok(tok);
+    loop = ParseForStatement();
+  } else if (tok.kind == TOK_KEYWORD_PARALLEL) {
+    print_tok(tok);
+    if (bool res = mLexer.Expect(TOK_KEYWORD_FOR, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected 'for' after 'parallel'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return nullptr;
+    }
+    print_tok(tok);
+    std::unique_ptr<ForStatement> for_stmt = ParseForStatement();
+    if (for_stmt)
+      for_stmt->mParallel = true;
+    loop = std::move(for_stmt);
+  } else {
+    Warn("[Parse Error] %s:<%d:%d>: Expected loop or return after annotation\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  return loop;
+}
+
+/*
+ * WhileStatement ::= "while" Expression Block
+ */
+std::unique_ptr<WhileStatement> Parser::ParseWhileStatement() {
+  std::unique_ptr<Expression> cond = ParseExpression();
+  if (!cond)
+    return nullptr;
+  std::unique_ptr<Block> body = ParseBlock();
+  if (!body)
+    return nullptr;
+  return std::make_unique<WhileStatement>(std::move(cond), std::move(body));
+}
+
+/*
+ * ForStatement ::= "for" IDENTIFIER [ ":" Type ] "in" Expression ".." Expression
+ *                  [ ReduceClause ] Block
+ */
+std::unique_ptr<ForStatement> Parser::ParseForStatement() {
+  Token tok;
+  if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected loop variable\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+  std::string var = std::get<std::string>(tok.value);
+
+  std::string type;
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_COLON) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    if (!ParseType(type))
+      return nullptr;
+  }
+
+  if (bool res = mLexer.Expect(TOK_KEYWORD_IN, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected 'in'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+
+  std::unique_ptr<Expression> begin = ParseExpression();
+  if (!begin)
+    return nullptr;
+  if (bool res = mLexer.Expect(TOK_DOT_DOT, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected '..'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+  std::unique_ptr<Expression> end = ParseExpression();
+  if (!end)
+    return nullptr;
+
+  std::vector<Reduction> reductions;
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_KEYWORD_REDUCE) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    if (!ParseReduceClause(reductions))
+      return nullptr;
+  }
+
+  std::unique_ptr<Block> body = ParseBlock();
+  if (!body)
+    return nullptr;
+  auto for_stmt = std::make_unique<ForStatement>(std::move(var), std::move(type),
+                                                 std::move(begin), std::move(end),
+                                                 std::move(body));
+  for_stmt->mReductions = std::move(reductions);
+  return for_stmt;
+}
+
+/*
+ * ReduceClause ::= "reduce" "(" Reduction { "," Reduction } ")"
+ * Reduction ::= ( "+" | "*" | "min" | "max" ) ":" IDENTIFIER
+ */
+bool Parser::ParseReduceClause(std::vector<Reduction> &reductions) {
+  Token tok;
+  if (bool res = mLexer.Expect(TOK_PAREN_LEFT, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected '(' after 'reduce'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return false;
+  }
+  print_tok(tok);
+
+  for (;;) {
+    Reduction reduction;
+    mLexer.GetNextToken(tok);
+    if (tok.kind == TOK_OP_PLUS) {
+      reduction.op = Reduction::ADD;
+    } else if (tok.kind == TOK_OP_MUL) {
+      reduction.op = Reduction::MUL;
+    } else if (tok.kind == TOK_IDENTIFIER && std::get<std::string>(tok.value) == "min") {
+      reduction.op = Reduction::MIN;
+    } else if (tok.kind == TOK_IDENTIFIER && std::get<std::string>(tok.value) == "max") {
+      reduction.op = Reduction::MAX;
+    } else {
+      Warn("[Parse Error] %s:<%d:%d>: Expected one of '+', '*', 'min' or 'max'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+
+    if (bool res = mLexer.Expect(TOK_COLON, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+    if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected reduction variable\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+    reduction.var = std::get<std::string>(tok.value);
+    reductions.push_back(std::move(reduction));
+
+    if (mLexer.PeekNextToken(tok); tok.kind != TOK_COMMA)
+      break;
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+  }
+
+  if (bool res = mLexer.Expect(TOK_PAREN_RIGHT, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected ')'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return false;
+  }
+  print_tok(tok);
+  return true;
+}
+
+/*
+ * BasicStatement ::= ReturnStatement | YieldStatement | LetStatement | AssignStatement
+ *                  | ExpressionStatement
+ */
+std::unique_ptr<Statement> Parser::ParseBasicStatement() {
+  Token tok = mLexer.PeekNextToken();
   if (tok.kind == TOK_ERROR) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected statement\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
     return nullptr;
   }
 
   switch (tok.kind) {
   case TOK_KEYWORD_RETURN: {
+    mLexer.GetNextToken(tok);
     print_tok(tok);
     auto return_stmt = ParseReturnStatement();
     if (!return_stmt)
@@ -337,7 +825,19 @@ std::unique_ptr<Statement> Parser::ParseBasicStatement() {
     return return_stmt;
   }
 
-  default: return nullptr;
+  case TOK_KEYWORD_YIELD: {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    return ParseYieldStatement();
+  }
+
+  case TOK_KEYWORD_LET: {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    return ParseLetStatement();
+  }
+
+  default: return ParseAssignOrExpressionStatement();
   }
 }
 
@@ -352,40 +852,423 @@ std::unique_ptr<ReturnStatement> Parser::ParseReturnStatement() {
 }
 
 /*
-* Expression ::= IntegerLiteral | FloatLiteral | StringLiteral
-*/
+ * YieldStatement ::= "yield" [ Expression ]
+ */
+std::unique_ptr<YieldStatement> Parser::ParseYieldStatement() {
+  std::unique_ptr<Expression> expr;
+  if (Token tok; mLexer.PeekNextToken(tok), tok.kind != TOK_SEMICOLON) {
+    expr = ParseExpression();
+    if (!expr)
+      return nullptr;
+  }
+  return std::make_unique<YieldStatement>(std::move(expr));
+}
+
+/*
+ * LetStatement ::= "let" IDENTIFIER ":" Type [ "=" Expression ]
+ */
+std::unique_ptr<LetStatement> Parser::ParseLetStatement() {
+  Token tok;
+
+  bool res = mLexer.Expect(TOK_IDENTIFIER, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected variable name\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  std::string name = std::get<std::string>(tok.value);
+  print_tok(tok);
+
+  res = mLexer.Expect(TOK_COLON, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected ':'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+
+  std::string type;
+  if (!ParseType(type))
+    return nullptr;
+
+  std::unique_ptr<Expression> init;
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_EQUAL) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    init = ParseExpression();
+    if (!init)
+      return nullptr;
+  }
+
+  return std::make_unique<LetStatement>(std::move(name), std::move(type),
+                                        std::move(init));
+}
+
+/*
+ * AssignStatement ::= Expression "=" Expression
+ * ExpressionStatement ::= Expression
+ */
+std::unique_ptr<Statement> Parser::ParseAssignOrExpressionStatement() {
+  std::unique_ptr<Expression> expr = ParseExpression();
+  if (!expr)
+    return nullptr;
+
+  Token tok;
+  if (mLexer.PeekNextToken(tok); tok.kind != TOK_EQUAL)
+    return std::make_unique<ExpressionStatement>(std::move(expr));
+  mLexer.GetNextToken(tok);
+  print_tok(tok);
+
+  std::unique_ptr<Expression> value = ParseExpression();
+  if (!value)
+    return nullptr;
+  return std::make_unique<AssignStatement>(std::move(expr), std::move(value));
+}
+
+/*
+ * Type ::= IDENTIFIER [ "<" Type ">" ] { "[" INT_LITERAL "]" }
+ */
+bool Parser::ParseType(std::string &type) {
+  Token tok;
+
+  bool res = mLexer.Expect(TOK_IDENTIFIER, tok);
+  if (!res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected type\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return false;
+  }
+  type = std::get<std::string>(tok.value);
+  print_tok(tok);
+
+  if (mLexer.PeekNextToken(tok); tok.kind == TOK_OP_LT) {
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+    std::string argument;
+    if (!ParseType(argument))
+      return false;
+    res = mLexer.Expect(TOK_OP_GT, tok);
+    if (!res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected '>'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    print_tok(tok);
+    type += "<" + argument + ">";
+  }
+
+  while (mLexer.PeekNextToken(tok), tok.kind == TOK_BRACKET_LEFT) {
+    mLexer.GetNextToken(tok);
+    res = mLexer.Expect(TOK_INT_LITERAL, tok);
+    if (!res || std::get<uint64_t>(tok.value) == 0) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected positive array length\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    uint64_t length = std::get<uint64_t>(tok.value);
+    res = mLexer.Expect(TOK_BRACKET_RIGHT, tok);
+    if (!res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ']'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return false;
+    }
+    type += "[" + std::to_string(length) + "]";
+  }
+  return true;
+}
+
+/*
+ * Expression ::= ComparisonExpression
+ */
 std::unique_ptr<Expression> Parser::ParseExpression() {
+  return ParseComparisonExpression();
+}
+
+/*
+ * ComparisonExpression ::= AdditiveExpression
+ *                          [ ( "<" | "<=" | ">" | ">=" | "==" | "!=" ) AdditiveExpression ]
+ */
+std::unique_ptr<Expression> Parser::ParseComparisonExpression() {
+  std::unique_ptr<Expression> lhs = ParseAdditiveExpression();
+  if (!lhs)
+    return nullptr;
+
+  Token tok = mLexer.PeekNextToken();
+  BinaryExpression::Op op;
+  switch (tok.kind) {
+  case TOK_OP_LT: op = BinaryExpression::LT; break;
+  case TOK_OP_LE: op = BinaryExpression::LE; break;
+  case TOK_OP_GT: op = BinaryExpression::GT; break;
+  case TOK_OP_GE: op = BinaryExpression::GE; break;
+  case TOK_OP_EQ: op = BinaryExpression::EQ; break;
+  case TOK_OP_NE: op = BinaryExpression::NE; break;
+  default: return lhs;
+  }
+  mLexer.GetNextToken(tok);
+  print_tok(tok);
+
+  std::unique_ptr<Expression> rhs = ParseAdditiveExpression();
+  if (!rhs)
+    return nullptr;
+  return std::make_unique<BinaryExpression>(op, std::move(lhs), std::move(rhs));
+}
+
+/*
+ * AdditiveExpression ::= MultiplicativeExpression { ( "+" | "-" ) MultiplicativeExpression }
+ */
+std::unique_ptr<Expression> Parser::ParseAdditiveExpression() {
+  std::unique_ptr<Expression> lhs = ParseMultiplicativeExpression();
+  if (!lhs)
+    return nullptr;
+
+  for (;;) {
+    Token tok = mLexer.PeekNextToken();
+    BinaryExpression::Op op;
+    switch (tok.kind) {
+    case TOK_OP_PLUS: op = BinaryExpression::ADD; break;
+    // The lexer prefers punctuation, so '-' arrives as a dash
+    case TOK_DASH: op = BinaryExpression::SUB; break;
+    default: return lhs;
+    }
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+
+    std::unique_ptr<Expression> rhs = ParseMultiplicativeExpression();
+    if (!rhs)
+      return nullptr;
+    lhs = std::make_unique<BinaryExpression>(op, std::move(lhs), std::move(rhs));
+  }
+}
+
+/*
+ * MultiplicativeExpression ::= PostfixExpression { ( "*" | "/" | "%" ) PostfixExpression }
+ */
+std::unique_ptr<Expression> Parser::ParseMultiplicativeExpression() {
+  std::unique_ptr<Expression> lhs = ParsePostfixExpression();
+  if (!lhs)
+    return nullptr;
+
+  for (;;) {
+    Token tok = mLexer.PeekNextToken();
+    BinaryExpression::Op op;
+    switch (tok.kind) {
+    case TOK_OP_MUL: op = BinaryExpression::MUL; break;
+    case TOK_OP_DIV: op = BinaryExpression::DIV; break;
+    case TOK_OP_MODULO: op = BinaryExpression::MOD; break;
+    default: return lhs;
+    }
+    mLexer.GetNextToken(tok);
+    print_tok(tok);
+
+    std::unique_ptr<Expression> rhs = ParsePostfixExpression();
+    if (!rhs)
+      return nullptr;
+    lhs = std::make_unique<BinaryExpression>(op, std::move(lhs), std::move(rhs));
+  }
+}
+
+/*
+ * PostfixExpression ::= PrimaryExpression { "[" Expression "]" | "." IDENTIFIER }
+ */
+std::unique_ptr<Expression> Parser::ParsePostfixExpression() {
+  std::unique_ptr<Expression> expr = ParsePrimaryExpression();
+  if (!expr)
+    return nullptr;
+
+  for (;;) {
+    Token tok = mLexer.PeekNextToken();
+    if (tok.kind == TOK_BRACKET_LEFT) {
+      mLexer.GetNextToken(tok);
+      print_tok(tok);
+      std::unique_ptr<Expression> index = ParseExpression();
+      if (!index)
+        return nullptr;
+      if (bool res = mLexer.Expect(TOK_BRACKET_RIGHT, tok); !res) {
+        Warn("[Parse Error] %s:<%d:%d>: Expected ']'\n",
+             mFileName.c_str(),
+             tok.span.line_start,
+             tok.span.pos_start);
+        return nullptr;
+      }
+      print_tok(tok);
+      expr = std::make_unique<IndexExpression>(std::move(expr), std::move(index));
+    } else if (tok.kind == TOK_DOT) {
+      mLexer.GetNextToken(tok);
+      print_tok(tok);
+      if (bool res = mLexer.Expect(TOK_IDENTIFIER, tok); !res) {
+        Warn("[Parse Error] %s:<%d:%d>: Expected member name\n",
+             mFileName.c_str(),
+             tok.span.line_start,
+             tok.span.pos_start);
+        return nullptr;
+      }
+      print_tok(tok);
+      expr = std::make_unique<MemberExpression>(
+        std::move(expr), std::get<std::string>(tok.value));
+    } else {
+      return expr;
+    }
+  }
+}
+
+/*
+ * PrimaryExpression ::= [ "-" ] IntegerLiteral | [ "-" ] FloatLiteral | StringLiteral
+ *                     | IDENTIFIER | CallExpression | "await" CallExpression
+ *                     | "(" Expression ")"
+ */
+std::unique_ptr<Expression> Parser::ParsePrimaryExpression() {
   Token tok = mLexer.GetNextToken();
   if (tok.kind == TOK_ERROR) {
     return nullptr;
   }
 
+  // Negative literals
+  if (tok.kind == TOK_DASH) {
+    print_tok(tok);
+    tok = mLexer.GetNextToken();
+    if (tok.kind == TOK_INT_LITERAL) {
+      // Down to the smallest i64, the most negative value any type holds
+      uint64_t magnitude = std::get<uint64_t>(tok.value);
+      if (magnitude > uint64_t(INT64_MAX) + 1) {
+        Warn("[Parse Error] %s:<%d:%d>: -%llu is below the range of every integer type\n",
+             mFileName.c_str(),
+             tok.span.line_start,
+             tok.span.pos_start,
+             static_cast<unsigned long long>(magnitude));
+        return nullptr;
+      }
+      print_tok(tok);
+      return std::make_unique<IntegerLiteral>(static_cast<int64_t>(0 - magnitude));
+    } else if (tok.kind == TOK_FLOAT_LITERAL) {
+      print_tok(tok);
+      return std::make_unique<FloatLiteral>(-std::get<double>(tok.value));
+    }
+    Warn("[Parse Error] %s:<%d:%d>: Expected number after '-'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+
   switch (tok.kind) {
   case TOK_INT_LITERAL: {
-    auto i = std::get<int>(tok.value);
-    std::cout << "DEBUG: Lexer consumed int: " << i << '\n';
+    auto i = std::get<uint64_t>(tok.value);
+    DEBUG_TRACE("DEBUG: Lexer consumed int: " << i << '\n');
     print_tok(tok);
-    return std::make_unique<IntegerLiteral>(i);
+    auto intlit = std::make_unique<IntegerLiteral>(static_cast<int64_t>(i));
+    intlit->mUnsigned = i > uint64_t(INT64_MAX);
+    return intlit;
   }
 
   case TOK_FLOAT_LITERAL: {
-    auto f = std::get<float>(tok.value);
-    std::cout << "DEBUG: Lexer consumed float: " << f << '\n';
+    auto f = std::get<double>(tok.value);
+    DEBUG_TRACE("DEBUG: Lexer consumed float: " << f << '\n');
     print_tok(tok);
     return std::make_unique<FloatLiteral>(f);
   }
 
   case TOK_STRING: {
     auto s = std::get<std::string>(tok.value);
-    std::cout << "DEBUG: Lexer consumed string: \"" << s << "\"\n";
+    DEBUG_TRACE("DEBUG: Lexer consumed string: \"" << s << "\"\n");
     print_tok(tok);
     return std::make_unique<StringLiteral>(std::move(s));
   }
 
+  case TOK_IDENTIFIER: {
+    auto name = std::get<std::string>(tok.value);
+    DEBUG_TRACE("DEBUG: Lexer consumed identifier: " << name << '\n');
+    print_tok(tok);
+    if (mLexer.PeekNextToken(tok); tok.kind == TOK_PAREN_LEFT)
+      return ParseCallExpression(std::move(name));
+    return std::make_unique<Identifier>(std::move(name));
+  }
+
+  case TOK_KEYWORD_AWAIT: {
+    print_tok(tok);
+    Token callee;
+    if (bool res = mLexer.Expect(TOK_IDENTIFIER, callee); !res ||
+        (mLexer.PeekNextToken(tok), tok.kind != TOK_PAREN_LEFT)) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected call after 'await'\n",
+           mFileName.c_str(),
+           callee.span.line_start,
+           callee.span.pos_start);
+      return nullptr;
+    }
+    print_tok(callee);
+    std::unique_ptr<CallExpression> call =
+      ParseCallExpression(std::get<std::string>(callee.value));
+    if (call)
+      call->mAwait = true;
+    return call;
+  }
+
+  case TOK_PAREN_LEFT: {
+    print_tok(tok);
+    std::unique_ptr<Expression> expr = ParseExpression();
+    if (!expr)
+      return nullptr;
+    if (bool res = mLexer.Expect(TOK_PAREN_RIGHT, tok); !res) {
+      Warn("[Parse Error] %s:<%d:%d>: Expected ')'\n",
+           mFileName.c_str(),
+           tok.span.line_start,
+           tok.span.pos_start);
+      return nullptr;
+    }
+    print_tok(tok);
+    return expr;
+  }
+
   default: {
+    Warn("[Parse Error] %s:<%d:%d>: Expected expression\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
     return nullptr;
   }
   }
 }
 
+/*
+ * CallExpression ::= IDENTIFIER "(" [ Expression { "," Expression } ] ")"
+ */
+std::unique_ptr<CallExpression> Parser::ParseCallExpression(std::string callee) {
+  // '('
+  Token tok = mLexer.GetNextToken();
+  print_tok(tok);
+
+  std::vector<std::unique_ptr<Expression>> args;
+  if (mLexer.PeekNextToken(tok); tok.kind != TOK_PAREN_RIGHT) {
+    for (;;) {
+      std::unique_ptr<Expression> arg = ParseExpression();
+      if (!arg)
+        return nullptr;
+      args.push_back(std::move(arg));
+      if (mLexer.PeekNextToken(tok); tok.kind != TOK_COMMA)
+        break;
+      mLexer.GetNextToken(tok);
+      print_tok(tok);
+    }
+  }
+
+  if (bool res = mLexer.Expect(TOK_PAREN_RIGHT, tok); !res) {
+    Warn("[Parse Error] %s:<%d:%d>: Expected ')'\n",
+         mFileName.c_str(),
+         tok.span.line_start,
+         tok.span.pos_start);
+    return nullptr;
+  }
+  print_tok(tok);
+  return std::make_unique<CallExpression>(std::move(callee), std::move(args));
+}
+
 }  // namespace charlie
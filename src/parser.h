@@ -3,27 +3,54 @@
 #include "ast.h"
 #include "lexer.h"
 
+#include <iostream>
 #include <memory>
 
 namespace charlie {
 
 class Parser {
 public:
-  Parser(std::string file);
+  // Diagnostics are written to `diag`.
+  Parser(std::string file, std::ostream &diag = std::cerr);
+  // Parses `source` from memory without touching the file system.
+  Parser(const SourceBuffer &source, std::ostream &diag = std::cerr);
   ~Parser();
 
+  // Returns nullptr if any errors were reported.
   std::unique_ptr<Module> Parse();
 
   /*
-   * TopLevelDeclaration ::= ProcedureDefinition | StructDefinition
+   * TopLevelDeclaration ::= { Annotation } ( UseDeclaration | ProcedureDefinition | StructDefinition
+   *                                          | ConstDefinition )
    */
   std::unique_ptr<TopLevelDeclaration> ParseTopLevelDeclaration();
 
   /*
-   * ProcedurePrototype ::= IDENTIFIER "::" "proc" "(" { ProcdeureParameters } ")" [ "->" IDENTIFIER ]
+   * Annotation ::= "#" IDENTIFIER [ "(" INT_LITERAL { "," INT_LITERAL } ")" ]
+   */
+  bool ParseAnnotation(Annotation &annotation);
+
+  /*
+   * UseDeclaration ::= "use" IDENTIFIER ";"
+   */
+  std::unique_ptr<UseDeclaration> ParseUseDeclaration();
+
+  /*
+   * ProcedurePrototype ::= IDENTIFIER "::" "proc" [ "<" TypeParameters ">" ]
+   *                        "(" { ProcdeureParameters } ")" [ "->" Type ]
    */
   std::unique_ptr<ProcedurePrototype> ParseProcedurePrototype(std::string proc_name);
 
+  /*
+   * TypeParameters ::= IDENTIFIER { "," IDENTIFIER }
+   */
+  bool ParseTypeParameters(std::vector<std::string> &type_params);
+
+  /*
+   * ProcedureParameters ::= IDENTIFIER ":" Type { "," IDENTIFIER ":" Type }
+   */
+  bool ParseProcedureParameters(std::vector<ProcedurePrototype::Parameter> &args);
+
   /*
    * ProcedureDefinition ::= ProcedurePrototype Block
    */
@@ -35,22 +62,55 @@ public:
   std::unique_ptr<StructDefinition> ParseStructDefinition(std::string struct_name);
 
   /*
-   * StructMemberList ::= IDENTIFIER ':' IDENTIFIER | { IDENTIFIER ':' IDENFITIER "," }
+   * StructMemberList ::= IDENTIFIER ':' Type | { IDENTIFIER ':' Type "," }
    */
   void ParseStructMembers(std::vector<StructDefinition::StructMember> &members);
 
+  /*
+   * ConstDefinition ::= IDENTIFIER "::" "const" Type "=" ( Expression ";" | "comptime" Block )
+   */
+  std::unique_ptr<ConstDefinition> ParseConstDefinition(std::string const_name);
+
   /*
    * Block ::= "{" { Statement } "}"
    */
   std::unique_ptr<Block> ParseBlock();
 
   /*
-   * Statement ::= BasicStatement ";"
+   * Statement ::= AnnotatedStatement | BasicStatement ";" | LoopStatement
    */
   std::unique_ptr<Statement> ParseStatement();
 
   /*
-   * BasicStatement ::= ReturnStatement
+   * AnnotatedStatement ::= Annotation { Annotation } ( LoopStatement | ReturnStatement ";" )
+   */
+  std::unique_ptr<Statement> ParseAnnotatedStatement();
+
+  /*
+   * LoopStatement ::= WhileStatement | [ "parallel" ] ForStatement
+   */
+  std::unique_ptr<LoopStatement> ParseLoopStatement();
+
+  /*
+   * WhileStatement ::= "while" Expression Block
+   */
+  std::unique_ptr<WhileStatement> ParseWhileStatement();
+
+  /*
+   * ForStatement ::= "for" IDENTIFIER [ ":" Type ] "in" Expression ".." Expression
+   *                  [ ReduceClause ] Block
+   */
+  std::unique_ptr<ForStatement> ParseForStatement();
+
+  /*
+   * ReduceClause ::= "reduce" "(" Reduction { "," Reduction } ")"
+   * Reduction ::= ( "+" | "*" | "min" | "max" ) ":" IDENTIFIER
+   */
+  bool ParseReduceClause(std::vector<Reduction> &reductions);
+
+  /*
+   * BasicStatement ::= ReturnStatement | YieldStatement | LetStatement | AssignStatement
+   *                  | ExpressionStatement
    */
   std::unique_ptr<Statement> ParseBasicStatement();
 
@@ -60,13 +120,71 @@ public:
   std::unique_ptr<ReturnStatement> ParseReturnStatement();
 
   /*
-   * Expression ::= IntegerLiteral | FloatLiteral | StringLiteral
+   * YieldStatement ::= "yield" [ Expression ]
+   */
+  std::unique_ptr<YieldStatement> ParseYieldStatement();
+
+  /*
+   * LetStatement ::= "let" IDENTIFIER ":" Type [ "=" Expression ]
+   */
+  std::unique_ptr<LetStatement> ParseLetStatement();
+
+  /*
+   * AssignStatement ::= Expression "=" Expression
+   * ExpressionStatement ::= Expression
+   */
+  std::unique_ptr<Statement> ParseAssignOrExpressionStatement();
+
+  /*
+   * Type ::= IDENTIFIER [ "<" Type ">" ] { "[" INT_LITERAL "]" }
+   */
+  bool ParseType(std::string &type);
+
+  /*
+   * Expression ::= ComparisonExpression
    */
   std::unique_ptr<Expression> ParseExpression();
 
+  /*
+   * ComparisonExpression ::= AdditiveExpression
+   *                          [ ( "<" | "<=" | ">" | ">=" | "==" | "!=" ) AdditiveExpression ]
+   */
+  std::unique_ptr<Expression> ParseComparisonExpression();
+
+  /*
+   * AdditiveExpression ::= MultiplicativeExpression { ( "+" | "-" ) MultiplicativeExpression }
+   */
+  std::unique_ptr<Expression> ParseAdditiveExpression();
+
+  /*
+   * MultiplicativeExpression ::= PostfixExpression { ( "*" | "/" | "%" ) PostfixExpression }
+   */
+  std::unique_ptr<Expression> ParseMultiplicativeExpression();
+
+  /*
+   * PostfixExpression ::= PrimaryExpression { "[" Expression "]" | "." IDENTIFIER }
+   */
+  std::unique_ptr<Expression> ParsePostfixExpression();
+
+  /*
+   * PrimaryExpression ::= [ "-" ] IntegerLiteral | [ "-" ] FloatLiteral | StringLiteral
+   *                     | IDENTIFIER | CallExpression | "await" CallExpression
+   *                     | "(" Expression ")"
+   */
+  std::unique_ptr<Expression> ParsePrimaryExpression();
+
+  /*
+   * CallExpression ::= IDENTIFIER "(" [ Expression { "," Expression } ] ")"
+   */
+  std::unique_ptr<CallExpression> ParseCallExpression(std::string callee);
+
 private:
   std::string mFileName;
+  std::ostream &mDiag;
   Lexer mLexer;
+  unsigned mNumErrors = 0;
+
+  void Warn(const char *format_msg, ...);
 };  // class Parser
 
 }  // namespace charlie
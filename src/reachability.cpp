@@ -0,0 +1,208 @@
+#include "reachability.h"
+#include "memory.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace charlie {
+
+namespace {
+
+// Collects the names of procedures and types a declaration refers to, and
+// of the variables it reads, some of which may be constants
+class ReferenceCollector : public RecursiveAstVisitor {
+public:
+  std::vector<std::string> mReferences;
+  std::vector<std::string> mVariables;
+
+  using RecursiveAstVisitor::Visit;
+
+  void Visit(ProcedurePrototype &proto) override {
+    if (!proto.ReturnType().empty())
+      mReferences.push_back(BaseTypeName(proto.ReturnType()));
+    for (const auto &arg : proto.Args()) {
+      mReferences.push_back(BaseTypeName(arg.type));
+    }
+  }
+
+  void Visit(StructDefinition &struct_def) override {
+    for (const auto &member : struct_def.Members()) {
+      mReferences.push_back(BaseTypeName(member.type));
+    }
+  }
+
+  // The initializer already ran in CheckModule(), so what it calls is not
+  // needed at run time
+  void Visit(ConstDefinition &const_def) override {
+    mReferences.push_back(BaseTypeName(const_def.Type()));
+  }
+
+  void Visit(Identifier &ident) override {
+    mVariables.push_back(ident.mName);
+  }
+
+  void Visit(LetStatement &let) override {
+    mReferences.push_back(BaseTypeName(let.mType));
+    RecursiveAstVisitor::Visit(let);
+  }
+
+  void Visit(ForStatement &loop) override {
+    if (!loop.mType.empty())
+      mReferences.push_back(BaseTypeName(loop.mType));
+    RecursiveAstVisitor::Visit(loop);
+  }
+
+  void Visit(CallExpression &call) override {
+    mReferences.push_back(call.mCallee);
+    RecursiveAstVisitor::Visit(call);
+  }
+};
+
+}  // namespace
+
+void DeadDeclarationReport::Print(std::ostream &os) const {
+  os << "[DCE] " << module_name << ": dropped "
+     << procedures.size() + structs.size() + constants.size() << " of " << num_declarations
+     << " declarations\n";
+  for (const auto &name : procedures) {
+    os << "  proc   " << name << '\n';
+  }
+  for (const auto &name : structs) {
+    os << "  struct " << name << '\n';
+  }
+  for (const auto &name : constants) {
+    os << "  const  " << name << '\n';
+  }
+}
+
+std::unordered_set<std::string> ExportedProcedures(const Module &mod,
+                                                   const std::vector<std::string> &extra_roots) {
+  std::unordered_set<std::string> exported, all;
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind != TopLevelDeclaration::PROC_DEF)
+      continue;
+    // A coroutine's frame layout is private to the module that builds it
+    if (decl->FindAnnotation("coroutine"))
+      continue;
+    // Generic procedures have no code of their own, and their instances
+    // belong to the module that made them
+    auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+    if (pdef->Prototype()->IsGeneric() || !pdef->TypeArgs().empty())
+      continue;
+    const std::string &name = pdef->Prototype()->Name();
+    all.insert(name);
+    if (name == "main" || decl->FindAnnotation("export"))
+      exported.insert(name);
+  }
+  // A library exports every procedure, extra roots included. They do not
+  // make a module less of a library.
+  if (exported.empty())
+    return all;
+  for (const auto &name : extra_roots) {
+    if (all.count(name))
+      exported.insert(name);
+  }
+  return exported;
+}
+
+std::vector<std::string> ExtraExports(const Module &mod, const CompilerOptions &opts) {
+  if (opts.dead_decl_elim)
+    return opts.keep;
+  std::vector<std::string> names;
+  for (const auto &decl : mod.TopLevelDecls()) {
+    if (decl->mDeclKind != TopLevelDeclaration::PROC_DEF)
+      continue;
+    auto pdef = static_cast<const ProcedureDefinition *>(decl.get());
+    if (pdef->TypeArgs().empty())
+      names.push_back(pdef->Prototype()->Name());
+  }
+  return names;
+}
+
+DeadDeclarationReport EliminateDeadDeclarations(
+  Module &mod, const std::vector<std::string> &extra_roots) {
+  MemoryPhaseScope mem_scope(MEM_DCE);
+  std::unordered_map<std::string, TopLevelDeclaration *> decls_by_name;
+  for (const auto &decl : mod.TopLevelDecls()) {
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF: {
+      auto pdef = static_cast<ProcedureDefinition *>(decl.get());
+      decls_by_name.emplace(pdef->Prototype()->Name(), decl.get());
+      break;
+    }
+    case TopLevelDeclaration::STRUCT_DEF: {
+      auto sdef = static_cast<StructDefinition *>(decl.get());
+      decls_by_name.emplace(sdef->Name(), decl.get());
+      break;
+    }
+    case TopLevelDeclaration::CONST_DEF: {
+      auto cdef = static_cast<ConstDefinition *>(decl.get());
+      decls_by_name.emplace(cdef->Name(), decl.get());
+      break;
+    }
+    default: break;
+    };
+  }
+
+  std::unordered_set<const TopLevelDeclaration *> live;
+  std::vector<TopLevelDeclaration *> worklist;
+  auto mark = [&](const std::string &name) {
+    auto it = decls_by_name.find(name);
+    if (it != decls_by_name.end() && live.insert(it->second).second)
+      worklist.push_back(it->second);
+  };
+
+  for (const auto &name : ExportedProcedures(mod, extra_roots)) {
+    mark(name);
+  }
+
+  while (!worklist.empty()) {
+    TopLevelDeclaration *decl = worklist.back();
+    worklist.pop_back();
+
+    ReferenceCollector collector;
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF:
+      static_cast<ProcedureDefinition *>(decl)->Accept(collector);
+      break;
+    case TopLevelDeclaration::STRUCT_DEF:
+      static_cast<StructDefinition *>(decl)->Accept(collector);
+      break;
+    default: static_cast<ConstDefinition *>(decl)->Accept(collector); break;
+    };
+    for (const auto &name : collector.mReferences) {
+      mark(name);
+    }
+    // Variables are marked only if they name a constant, not a procedure
+    // that a local happens to share its name with
+    for (const auto &name : collector.mVariables) {
+      auto it = decls_by_name.find(name);
+      if (it != decls_by_name.end() && it->second->mDeclKind == TopLevelDeclaration::CONST_DEF)
+        mark(name);
+    }
+  }
+
+  DeadDeclarationReport report;
+  report.module_name = mod.Name();
+  report.num_declarations = decls_by_name.size();
+
+  auto dropped = mod.RemoveTopLevelDecls([&](const TopLevelDeclaration &decl) {
+    // Imports are only declarations and cost next to nothing to keep
+    return decl.mDeclKind != TopLevelDeclaration::USE_DECL && !live.count(&decl);
+  });
+  for (const auto &decl : dropped) {
+    switch (decl->mDeclKind) {
+    case TopLevelDeclaration::PROC_DEF:
+      report.procedures.push_back(
+        static_cast<ProcedureDefinition *>(decl.get())->Prototype()->Name());
+      break;
+    case TopLevelDeclaration::STRUCT_DEF:
+      report.structs.push_back(static_cast<StructDefinition *>(decl.get())->Name());
+      break;
+    default: report.constants.push_back(static_cast<ConstDefinition *>(decl.get())->Name()); break;
+    };
+  }
+  return report;
+}
+
+}  // namespace charlie
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace charlie {
+
+struct DeadDeclarationReport {
+  std::string module_name;
+  size_t num_declarations = 0;
+  std::vector<std::string> procedures;
+  std::vector<std::string> structs;
+  std::vector<std::string> constants;
+
+  void Print(std::ostream &os) const;
+};
+
+// The procedures of `mod` that code outside it may call: the entry procedure
+// `main`, those marked #export and those named in `extra_roots`. A module
+// without `main` or #export is treated as a library whose procedures are all
+// exported, whatever `extra_roots` holds. #coroutine and generic procedures,
+// and instances of the latter, are never exported.
+std::unordered_set<std::string> ExportedProcedures(const Module &mod,
+                                                   const std::vector<std::string> &extra_roots);
+
+// Procedures `opts` keeps external besides `main` and #export ones: the
+// --keep roots, or without dead declaration elimination all of them, as LLVM
+// would drop the unused ones anyway. Instances of generic procedures stay
+// internal, as every module that uses one makes its own.
+std::vector<std::string> ExtraExports(const Module &mod, const CompilerOptions &opts);
+
+// Removes procedure, struct and constant definitions that nothing reachable
+// refers to, so no IR is ever built for them.
+//
+// The roots are ExportedProcedures(mod, extra_roots), so in a library only
+// unreferenced structs and constants are dropped. From the roots the
+// analysis follows procedure calls, constants read and type references in
+// prototypes, bodies and struct members. Procedures only constant initializers call
+// are dropped, as the initializers ran in CheckModule().
+DeadDeclarationReport EliminateDeadDeclarations(
+  Module &mod, const std::vector<std::string> &extra_roots);
+
+}  // namespace charlie
@@ -0,0 +1,140 @@
+#include "runtime.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+
+namespace charlie {
+
+namespace {
+
+ThreadPool &Pool() {
+  static ThreadPool pool([] {
+    const char *env = std::getenv("CHARLIE_NUM_THREADS");
+    long n = env ? std::strtol(env, nullptr, 10) : 0;
+    return n > 0 ? static_cast<size_t>(n) : 0;
+  }());
+  return pool;
+}
+
+// Counts down the tasks of one loop. ThreadPool::Wait() would also wait for
+// loops other threads started.
+class Latch {
+public:
+  explicit Latch(uint64_t count) : mCount(count) {}
+
+  void CountDown() {
+    // Notify under the lock: the waiter owns the latch and may destroy it
+    // as soon as it sees zero.
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (--mCount == 0)
+      mDone.notify_all();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mCount == 0; });
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mDone;
+  uint64_t mCount;
+};
+
+// The start of every coroutine frame, see charlie_spawn(). LLVM gives the
+// functions fastcc, which for a single pointer is the C convention.
+struct CoroutineFrame {
+  void (*resume)(void *frame);
+  void (*destroy)(void *frame);
+};
+
+// Coroutines waiting for their turn on this thread, in the order they run
+thread_local std::deque<CoroutineFrame *> tReadyCoroutines;
+
+}  // namespace
+
+}  // namespace charlie
+
+using charlie::Latch;
+using charlie::ThreadPool;
+
+void charlie_parallel_for(uint64_t count,
+                          int32_t schedule,
+                          uint64_t chunk,
+                          CharlieLoopBody body,
+                          void *context) {
+  if (count == 0)
+    return;
+
+  // A worker waiting for a nested loop could hold up the tasks of that very
+  // loop, and the outer loop keeps the other workers busy anyway
+  ThreadPool &pool = charlie::Pool();
+  uint64_t workers = pool.NumThreads();
+  if (pool.CurrentWorker() >= 0 || workers == 1 || count == 1) {
+    body(context, 0, count);
+    return;
+  }
+
+  // Fixed chunks, each its own task; idle workers steal whole chunks
+  if (schedule == CHARLIE_SCHEDULE_STATIC) {
+    if (chunk == 0)
+      chunk = count / workers + (count % workers != 0);
+    Latch latch(count / chunk + (count % chunk != 0));
+    for (uint64_t first = 0, last; first < count; first = last) {
+      last = count - first > chunk ? first + chunk : count;
+      pool.Submit([=, &latch] {
+        body(context, first, last);
+        latch.CountDown();
+      });
+    }
+    latch.Wait();
+    return;
+  }
+
+  // Every worker claims chunks until there are no iterations left
+  bool guided = schedule == CHARLIE_SCHEDULE_GUIDED;
+  uint64_t min_chunk = std::max<uint64_t>(chunk, 1);
+  std::atomic<uint64_t> next{0};
+  Latch latch(workers);
+  for (uint64_t i = 0; i < workers; ++i) {
+    pool.Submit([&] {
+      uint64_t first = next.load(std::memory_order_relaxed);
+      for (;;) {
+        if (first >= count)
+          break;
+        uint64_t left = count - first;
+        uint64_t size = guided ? std::max(min_chunk, left / (2 * workers)) : min_chunk;
+        size = std::min(size, left);
+        if (!next.compare_exchange_weak(first, first + size, std::memory_order_relaxed))
+          continue;
+        body(context, first, first + size);
+        first = next.load(std::memory_order_relaxed);
+      }
+      latch.CountDown();
+    });
+  }
+  latch.Wait();
+}
+
+void charlie_spawn(void *frame) {
+  charlie::tReadyCoroutines.push_back(static_cast<charlie::CoroutineFrame *>(frame));
+}
+
+void charlie_run(void) {
+  auto &ready = charlie::tReadyCoroutines;
+  while (!ready.empty()) {
+    charlie::CoroutineFrame *frame = ready.front();
+    ready.pop_front();
+    if (frame->resume)
+      frame->resume(frame);
+    if (frame->resume)
+      ready.push_back(frame);
+    else
+      frame->destroy(frame);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// libcharlie_rt: support code linked into Charlie programs.
+//
+// Code generated for `parallel for`, spawn() and run() calls into it, so
+// programs that use them are linked with -lcharlie_rt (plus -lstdc++
+// -lpthread when the linker driver is a C one). The interface is plain C so
+// it does not depend on the C++ ABI of the compiler that built the runtime.
+
+extern "C" {
+
+// How a parallel loop's iterations are split into chunks. The chunk size
+// is the annotation's argument, or 0 for the default noted below.
+enum CharlieSchedule : int32_t {
+  // #static(n): chunks of n, by default one per worker, each a task on the
+  // work-stealing pool
+  CHARLIE_SCHEDULE_STATIC = 0,
+  // #dynamic(n): workers claim the next n iterations, 1 by default, until
+  // none are left
+  CHARLIE_SCHEDULE_DYNAMIC = 1,
+  // #guided(n): like dynamic, but chunks start large and shrink toward n as
+  // iterations run out
+  CHARLIE_SCHEDULE_GUIDED = 2,
+};
+
+// Runs iterations [first, last) of a loop with the context it was given
+typedef void (*CharlieLoopBody)(void *context, uint64_t first, uint64_t last);
+
+// Runs iterations [0, count) of `body` on the thread pool and returns once
+// all of them are done. The pool has one worker per hardware thread, or
+// $CHARLIE_NUM_THREADS. Loops started from inside a parallel loop run on
+// the worker that started them.
+void charlie_parallel_for(uint64_t count,
+                          int32_t schedule,
+                          uint64_t chunk,
+                          CharlieLoopBody body,
+                          void *context);
+
+// Hands the coroutine at `frame`, created by calling a #coroutine procedure,
+// to the calling thread's executor, which destroys it once it is done.
+//
+// Frames are laid out by LLVM's switch-resumed coroutine lowering: they start
+// with pointers to the coroutine's resume and destroy functions, and the
+// resume pointer is null once the coroutine is done.
+void charlie_spawn(void *frame);
+
+// Resumes the coroutines spawned on the calling thread in turn, each until
+// its next yield, and returns once all of them are done. Coroutines may
+// spawn more while it runs.
+void charlie_run(void);
+
+}  // extern "C"
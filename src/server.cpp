@@ -0,0 +1,340 @@
+#include "server.h"
+#include "check.h"
+#include "compiler.h"
+#include "driver.h"
+#include "thread_pool.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace charlie {
+
+//===----------------------------------------------------------------------===//
+// Wire protocol
+//
+// Every message is a sequence of frames, each a native-endian uint32_t length
+// followed by that many bytes.
+//
+//   request:  <cwd> <argc> <arg>...
+//   response: <exit status> <diagnostics> <output>
+//===----------------------------------------------------------------------===//
+
+static bool WriteAll(int fd, const char *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, char *data, size_t len) {
+  while (len) {
+    ssize_t n = read(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool WriteFrame(int fd, const std::string &s) {
+  uint32_t len = s.size();
+  return WriteAll(fd, reinterpret_cast<const char *>(&len), sizeof(len)) &&
+         WriteAll(fd, s.data(), s.size());
+}
+
+static bool ReadFrame(int fd, std::string &s) {
+  uint32_t len;
+  if (!ReadAll(fd, reinterpret_cast<char *>(&len), sizeof(len)))
+    return false;
+  s.resize(len);
+  return ReadAll(fd, s.data(), len);
+}
+
+static bool MakeAddress(const std::string &path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "[Server Error] Socket path too long: '%s'\n", path.c_str());
+    return false;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Server
+//===----------------------------------------------------------------------===//
+
+// How long a connection may go without sending or reading anything
+static constexpr int kClientTimeoutSeconds = 60;
+
+// Whether a server accepts connections at `addr`. The socket file of one
+// that exited without cleaning up refuses them.
+static bool Answers(const sockaddr_un &addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  bool answers = connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0;
+  close(fd);
+  return answers;
+}
+
+static std::string ResolvePath(const std::string &cwd, const std::string &path) {
+  if (path.empty() || path[0] == '/')
+    return path;
+  return cwd + '/' + path;
+}
+
+// Rejects options that only make sense for a process of its own. Profiling
+// state is global to the server, and -j, --server and --connect configure
+// the driver rather than a single compilation.
+static bool CheckServerOptions(const CompilerOptions &opts, std::ostream &diag) {
+  const char *option = nullptr;
+  if (opts.jobs)
+    option = "-j";
+  else if (!opts.server.empty())
+    option = "--server";
+  else if (!opts.connect.empty())
+    option = "--connect";
+  else if (opts.time_report)
+    option = "--time-report";
+  else if (!opts.time_trace.empty())
+    option = "--time-trace";
+  else if (opts.mem_report)
+    option = "--mem-report";
+  if (option)
+    diag << "[Server Error] '" << option << "' is not supported by the server\n";
+  return !option;
+}
+
+static void HandleConnection(int fd, CompileContext &cc) {
+  std::string cwd, argc_str;
+  if (!ReadFrame(fd, cwd) || !ReadFrame(fd, argc_str)) {
+    close(fd);
+    return;
+  }
+
+  std::vector<std::string> args(1, "charlie");
+  for (int i = 0, n = atoi(argc_str.c_str()); i < n; ++i) {
+    std::string arg;
+    if (!ReadFrame(fd, arg)) {
+      close(fd);
+      return;
+    }
+    args.push_back(std::move(arg));
+  }
+  std::vector<char *> argv;
+  for (auto &arg : args)
+    argv.push_back(arg.data());
+
+  int status = 1;
+  std::stringstream diag;
+  std::string output;
+
+  CompilerOptions opts;
+  ParseStatus parsed = ParseCommandLine(argv.size(), argv.data(), opts, diag);
+  if (parsed == PARSE_HELP) {
+    status = 0;
+  } else if (parsed == PARSE_ERROR || !CheckServerOptions(opts, diag)) {
+    // Diagnosed above
+  } else if (opts.inputs.size() != 1) {
+    diag << "[Server Error] Expected exactly one input file\n";
+  } else {
+    std::string input = ResolvePath(cwd, opts.inputs.front());
+    for (auto &dir : opts.import_paths)
+      dir = ResolvePath(cwd, dir);
+
+    // Same precedence as the driver
+    if (opts.interp) {
+      std::stringstream out;
+      int exit_code;
+      bool ok = InterpretFile(input, opts, out, diag, exit_code);
+      output = out.str();
+      status = ok ? exit_code : 1;
+    } else if (opts.check) {
+      status = CheckFile(input, opts, diag) ? 0 : 1;
+    } else if (opts.dump) {
+      std::stringstream out;
+      bool ok = DumpFile(input, opts, cc, out, diag);
+      output = out.str();
+      status = ok ? 0 : 1;
+    } else {
+      std::unique_ptr<CompilationCache> cache;
+      if (!opts.cache_dir.empty()) {
+        cache = std::make_unique<CompilationCache>(
+          ResolvePath(cwd, opts.cache_dir), opts.cache_max_bytes);
+      }
+
+      bool ok = CompileFile(input, opts, cc, cache.get(), diag, output);
+
+      if (cache && opts.cache_stats)
+        cache->ReportStats(diag);
+      status = ok ? 0 : 1;
+    }
+  }
+
+  WriteFrame(fd, std::to_string(status)) && WriteFrame(fd, diag.str()) &&
+    WriteFrame(fd, output);
+  close(fd);
+}
+
+int RunServer(const CompilerOptions &opts) {
+  // A client hanging up mid-response must not take the server down
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un addr;
+  if (!MakeAddress(opts.server, addr))
+    return 1;
+  if (Answers(addr)) {
+    fprintf(stderr, "[Server Error] A server is already listening on '%s'\n",
+            opts.server.c_str());
+    return 1;
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("[Server Error] socket");
+    return 1;
+  }
+
+  // Remove a stale socket left behind by a previous server
+  unlink(opts.server.c_str());
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    perror("[Server Error] bind");
+    close(listen_fd);
+    return 1;
+  }
+  if (listen(listen_fd, SOMAXCONN) < 0) {
+    perror("[Server Error] listen");
+    close(listen_fd);
+    return 1;
+  }
+
+  InitializeLLVMTargets();
+  ThreadPool pool;
+  // Each worker compiles with its own CompileContext. The default
+  // TargetMachine is created up front so the first request for the common
+  // configuration does not pay for it.
+  std::vector<CompileContext> contexts(pool.NumThreads());
+  for (auto &cc : contexts) {
+    std::string error;
+    cc.GetTargetMachine(opts, error);
+  }
+
+  fprintf(stderr, "charlie server listening on %s (%zu workers)\n",
+          opts.server.c_str(), pool.NumThreads());
+
+  for (;;) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("[Server Error] accept");
+      break;
+    }
+    // Connections wait in the pool's queues while every worker is busy. A
+    // client that stops sending or reading is dropped after a while, so it
+    // cannot hold a worker.
+    timeval timeout = {kClientTimeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    pool.Submit([fd, &pool, &contexts] { HandleConnection(fd, contexts[pool.CurrentWorker()]); });
+  }
+
+  close(listen_fd);
+  unlink(opts.server.c_str());
+  return 1;
+}
+
+//===----------------------------------------------------------------------===//
+// Client
+//===----------------------------------------------------------------------===//
+
+int RunClient(const CompilerOptions &opts, int argc, char **argv) {
+  sockaddr_un addr;
+  if (!MakeAddress(opts.connect, addr))
+    return 1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("[Client Error] socket");
+    return 1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    fprintf(stderr, "[Client Error] Failed to connect to '%s': %s\n",
+            opts.connect.c_str(), strerror(errno));
+    close(fd);
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    perror("[Client Error] getcwd");
+    close(fd);
+    return 1;
+  }
+
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--connect", strlen("--connect")))
+      args.emplace_back(argv[i]);
+  }
+
+  bool sent = WriteFrame(fd, cwd) && WriteFrame(fd, std::to_string(args.size()));
+  for (size_t i = 0; sent && i < args.size(); ++i)
+    sent = WriteFrame(fd, args[i]);
+
+  std::string status, diag, output;
+  if (!sent || !ReadFrame(fd, status) || !ReadFrame(fd, diag) ||
+      !ReadFrame(fd, output)) {
+    fprintf(stderr, "[Client Error] Lost connection to server\n");
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  fputs(diag.c_str(), stderr);
+
+  // Like the driver, compiled outputs go to -o or next to the input, and
+  // everything else to stdout. What --interp prints is shown whatever the
+  // program returns.
+  int exit_status = atoi(status.c_str());
+  if (opts.check || opts.dump || opts.interp) {
+    fwrite(output.data(), 1, output.size(), stdout);
+  } else if (exit_status == 0 && !opts.inputs.empty()) {
+    std::string path = opts.output.empty()
+                         ? DefaultOutputPath(opts.inputs.front(), opts.emit)
+                         : opts.output;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(output.data(), output.size());
+    if (!out) {
+      fprintf(stderr, "[Client Error] Failed to write '%s'\n", path.c_str());
+      return 1;
+    }
+  }
+  return exit_status;
+}
+
+}  // namespace charlie
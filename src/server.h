@@ -0,0 +1,23 @@
+#pragma once
+
+#include "options.h"
+
+namespace charlie {
+
+// Runs a compile server listening on the Unix domain socket `opts.server`.
+//
+// The server initializes LLVM once and serves connections on a ThreadPool
+// with one worker per hardware thread. Each worker keeps a CompileContext
+// with warm TargetMachines, so a request only pays for the compilation
+// itself. Only returns on a setup error.
+int RunServer(const CompilerOptions &opts);
+
+// Forwards this invocation to the server at `opts.connect`, writes the
+// returned output where the driver would, to `opts.output` or
+// DefaultOutputPath(), and prints the returned diagnostics.
+// `argv` is forwarded verbatim apart from the --connect option.
+//
+// Returns the process exit status.
+int RunClient(const CompilerOptions &opts, int argc, char **argv);
+
+}  // namespace charlie
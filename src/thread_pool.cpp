@@ -0,0 +1,132 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace charlie {
+
+// The pool the calling thread works for, and its index there. Keyed by pool
+// so that a worker of one pool is an outside thread to every other pool.
+static thread_local struct {
+  const ThreadPool *pool = nullptr;
+  int index = -1;
+} tCurrentWorker;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i = 0; i < num_threads; ++i)
+    mQueues.push_back(std::make_unique<WorkerQueue>());
+  for (size_t i = 0; i < num_threads; ++i)
+    mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mWorkAvailable.notify_all();
+  for (auto &worker : mWorkers)
+    worker.join();
+}
+
+int ThreadPool::CurrentWorker() const {
+  return tCurrentWorker.pool == this ? tCurrentWorker.index : -1;
+}
+
+void ThreadPool::Submit(Task task) {
+  int worker = CurrentWorker();
+  size_t index = worker >= 0
+                   ? static_cast<size_t>(worker)
+                   : mNextQueue.fetch_add(1, std::memory_order_relaxed) %
+                       mQueues.size();
+  mPending++;
+  {
+    std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+    mQueues[index]->tasks.push_back(std::move(task));
+  }
+  // Counted only once it is in a queue, so a claimed task can always be found
+  mQueued++;
+
+  // A worker going to sleep bumps mSleeping before it checks mQueued, so
+  // either it sees the new task or we see it sleeping. Taking mMutex makes
+  // sure it is waiting by the time we notify.
+  if (mSleeping > 0) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mWorkAvailable.notify_one();
+  }
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mAllDone.wait(lock, [this] { return mPending == 0; });
+}
+
+bool ThreadPool::TryClaim() {
+  size_t queued = mQueued.load();
+  while (queued > 0) {
+    if (mQueued.compare_exchange_weak(queued, queued - 1))
+      return true;
+  }
+  return false;
+}
+
+bool ThreadPool::PopOrSteal(size_t index, Task &task) {
+  {
+    WorkerQueue &own = *mQueues[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < mQueues.size(); ++i) {
+    WorkerQueue &victim = *mQueues[(index + i) % mQueues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+  tCurrentWorker.pool = this;
+  tCurrentWorker.index = static_cast<int>(index);
+
+  for (;;) {
+    // Claim a task before looking for it so that sleeping workers are not
+    // woken for work another worker has already claimed.
+    if (!TryClaim()) {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mSleeping++;
+      mWorkAvailable.wait(lock, [this] { return mStopping || mQueued > 0; });
+      mSleeping--;
+      if (mQueued == 0 && mStopping)
+        return;
+      continue;
+    }
+
+    Task task;
+    // The claimed task is in some queue, but another worker may be moving it
+    // between our scan positions; keep scanning until we find it.
+    while (!PopOrSteal(index, task))
+      std::this_thread::yield();
+
+    task();
+
+    // Wait() checks mPending under mMutex, so taking it here means the
+    // waiter is either still to check or already waiting
+    if (--mPending == 0) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mAllDone.notify_all();
+    }
+  }
+}
+
+}  // namespace charlie
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace charlie {
+
+// Fixed-size pool of worker threads with per-worker task queues.
+//
+// A worker pops its own queue from the back (most recently pushed first, which
+// keeps recently touched data in cache) and, when that runs dry, steals from
+// the front of the other workers' queues. Tasks submitted from outside the
+// pool are spread round-robin; tasks submitted from a worker go to that
+// worker's own queue.
+//
+// Each queue has its own lock, and the counts of queued and unfinished tasks
+// are atomics, so submitting and running tasks never contend on a pool-wide
+// lock. mMutex is only taken to put idle workers to sleep, wake them, and
+// wake Wait().
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  // `num_threads` == 0 means one worker per hardware thread.
+  explicit ThreadPool(size_t num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void Submit(Task task);
+
+  // Blocks until every submitted task has finished.
+  void Wait();
+
+  size_t NumThreads() const {
+    return mWorkers.size();
+  }
+
+  // Index of the calling worker in [0, NumThreads()), or -1 when called from
+  // a thread that is not one of this pool's workers.
+  int CurrentWorker() const;
+
+private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+  std::vector<std::thread> mWorkers;
+
+  std::mutex mMutex;
+  std::condition_variable mWorkAvailable;
+  std::condition_variable mAllDone;
+  bool mStopping = false;  // Guarded by mMutex
+
+  std::atomic<size_t> mQueued{0};    // Tasks sitting in queues, not claimed
+  std::atomic<size_t> mPending{0};   // Tasks submitted but not finished
+  std::atomic<size_t> mSleeping{0};  // Workers waiting on mWorkAvailable
+  std::atomic<size_t> mNextQueue{0};
+
+  void WorkerLoop(size_t index);
+  bool TryClaim();
+  bool PopOrSteal(size_t index, Task &task);
+};
+
+}  // namespace charlie
@@ -0,0 +1,302 @@
+#include "timer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace charlie {
+
+//===----------------------------------------------------------------------===//
+// Hardware counters
+//===----------------------------------------------------------------------===//
+
+#ifdef __linux__
+namespace {
+
+// Cycles, instructions and cache misses for the calling thread, read
+// together as one perf event group.
+class PerfCounterGroup {
+public:
+  PerfCounterGroup() {
+    static const uint64_t kConfigs[kNumCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+    };
+
+    for (int i = 0; i < kNumCounters; ++i) {
+      perf_event_attr attr = {};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = kConfigs[i];
+      attr.disabled = i == 0;  // The leader starts the whole group
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      mFds[i] = syscall(__NR_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1,
+                        /*group_fd=*/i == 0 ? -1 : mFds[0], /*flags=*/0);
+      if (mFds[i] < 0) {
+        Close();
+        return;
+      }
+    }
+    ioctl(mFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  ~PerfCounterGroup() {
+    Close();
+  }
+
+  bool Read(HardwareCounters &counters) const {
+    if (mFds[0] < 0)
+      return false;
+    struct {
+      uint64_t nr;
+      uint64_t values[kNumCounters];
+    } data;
+    if (read(mFds[0], &data, sizeof(data)) != sizeof(data))
+      return false;
+    counters.cycles = data.values[0];
+    counters.instructions = data.values[1];
+    counters.cache_misses = data.values[2];
+    counters.valid = true;
+    return true;
+  }
+
+private:
+  static constexpr int kNumCounters = 3;
+  int mFds[kNumCounters] = {-1, -1, -1};
+
+  void Close() {
+    for (int &fd : mFds) {
+      if (fd >= 0)
+        close(fd);
+      fd = -1;
+    }
+  }
+};
+
+}  // namespace
+#endif
+
+static bool ReadHardwareCounters(HardwareCounters &counters) {
+#ifdef __linux__
+  static thread_local PerfCounterGroup group;
+  if (group.Read(counters))
+    return true;
+
+  static std::atomic<bool> warned{false};
+  if (!warned.exchange(true)) {
+    fprintf(stderr,
+            "[Profiler Warning] perf_event_open failed; hardware counters "
+            "are unavailable (check /proc/sys/kernel/perf_event_paranoid)\n");
+  }
+#endif
+  (void) counters;
+  return false;
+}
+
+//===----------------------------------------------------------------------===//
+// TimeProfiler
+//===----------------------------------------------------------------------===//
+
+TimeProfiler &TimeProfiler::Get() {
+  static TimeProfiler profiler;
+  return profiler;
+}
+
+void TimeProfiler::Enable(bool hardware_counters) {
+  mStart = std::chrono::steady_clock::now();
+  mHardwareCounters = hardware_counters;
+  mEnabled.store(true, std::memory_order_relaxed);
+}
+
+uint64_t TimeProfiler::Now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - mStart)
+    .count();
+}
+
+uint32_t TimeProfiler::ThreadId() {
+  static std::atomic<uint32_t> next_id{0};
+  static thread_local uint32_t id = next_id.fetch_add(1);
+  return id;
+}
+
+void TimeProfiler::Record(Event event) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEvents.push_back(std::move(event));
+}
+
+void TimeProfiler::PrintReport(std::ostream &os) const {
+  struct Totals {
+    uint64_t count = 0;
+    uint64_t total_us = 0;
+    HardwareCounters counters;
+  };
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  std::map<std::string, Totals> phases;
+  uint64_t first = UINT64_MAX, last = 0;
+  for (const auto &e : mEvents) {
+    first = std::min(first, e.start_us);
+    last = std::max(last, e.start_us + e.duration_us);
+    if (e.category != PHASE)
+      continue;
+    Totals &t = phases[e.name];
+    t.count++;
+    t.total_us += e.duration_us;
+    if (e.counters.valid) {
+      t.counters.cycles += e.counters.cycles;
+      t.counters.instructions += e.counters.instructions;
+      t.counters.cache_misses += e.counters.cache_misses;
+      t.counters.valid = true;
+    }
+  }
+  double wall_ms = mEvents.empty() ? 0.0 : (last - first) / 1000.0;
+
+  std::vector<std::pair<std::string, Totals>> rows(phases.begin(), phases.end());
+  std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+    return a.second.total_us > b.second.total_us;
+  });
+
+  auto flags = os.flags();
+  os << std::fixed << std::setprecision(3);
+  os << "===-------------------------------------------------------------===\n"
+     << "  Charlie time report (wall " << wall_ms << " ms)\n"
+     << "===-------------------------------------------------------------===\n";
+  os << std::left << std::setw(14) << "Phase" << std::right << std::setw(8)
+     << "Count" << std::setw(12) << "Total ms" << std::setw(9) << "% wall"
+     << std::setw(11) << "Avg ms";
+  if (mHardwareCounters) {
+    os << std::setw(12) << "Mcycles" << std::setw(12) << "Minstrs"
+       << std::setw(7) << "IPC" << std::setw(14) << "Cache misses";
+  }
+  os << '\n';
+
+  for (const auto &[name, t] : rows) {
+    double total_ms = t.total_us / 1000.0;
+    os << std::left << std::setw(14) << name << std::right << std::setw(8)
+       << t.count << std::setw(12) << total_ms << std::setw(8)
+       << std::setprecision(1) << (wall_ms > 0 ? 100.0 * total_ms / wall_ms : 0.0)
+       << '%' << std::setprecision(3) << std::setw(11) << total_ms / t.count;
+    if (mHardwareCounters && t.counters.valid) {
+      double ipc = t.counters.cycles
+                     ? double(t.counters.instructions) / t.counters.cycles
+                     : 0.0;
+      os << std::setw(12) << t.counters.cycles / 1e6 << std::setw(12)
+         << t.counters.instructions / 1e6 << std::setw(7) << std::setprecision(2)
+         << ipc << std::setprecision(3) << std::setw(14)
+         << t.counters.cache_misses;
+    }
+    os << '\n';
+  }
+  os.flags(flags);
+}
+
+static void WriteJsonString(std::ostream &os, const std::string &s) {
+  os << '"';
+  for (char c : s) {
+    switch (c) {
+    case '"': os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\n': os << "\\n"; break;
+    case '\t': os << "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        os << buf;
+      } else {
+        os << c;
+      }
+    }
+  }
+  os << '"';
+}
+
+bool TimeProfiler::WriteTrace(const std::string &path, std::string &error) const {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    error = "failed to open '" + path + "'";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for (const auto &e : mEvents) {
+    if (!first)
+      out << ",\n";
+    first = false;
+
+    out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid << ",\"ts\":" << e.start_us
+        << ",\"dur\":" << e.duration_us << ",\"cat\":"
+        << (e.category == PHASE ? "\"phase\"" : "\"pass\"") << ",\"name\":";
+    WriteJsonString(out, e.name);
+    out << ",\"args\":{\"detail\":";
+    WriteJsonString(out, e.detail);
+    if (e.counters.valid) {
+      out << ",\"cycles\":" << e.counters.cycles
+          << ",\"instructions\":" << e.counters.instructions
+          << ",\"cache_misses\":" << e.counters.cache_misses;
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+
+  if (!out) {
+    error = "failed to write '" + path + "'";
+    return false;
+  }
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// TimeScope
+//===----------------------------------------------------------------------===//
+
+TimeScope::TimeScope(const char *name,
+                     std::string detail,
+                     TimeProfiler::Category category) :
+    mName(name), mCategory(category),
+    mActive(TimeProfiler::Get().Enabled()) {
+  if (!mActive)
+    return;
+  TimeProfiler &profiler = TimeProfiler::Get();
+  mDetail = std::move(detail);
+  if (profiler.HardwareCountersEnabled())
+    ReadHardwareCounters(mStartCounters);
+  mStart = profiler.Now();
+}
+
+TimeScope::~TimeScope() {
+  if (!mActive)
+    return;
+  TimeProfiler &profiler = TimeProfiler::Get();
+  uint64_t end = profiler.Now();
+
+  HardwareCounters counters;
+  if (mStartCounters.valid && ReadHardwareCounters(counters)) {
+    counters.cycles -= mStartCounters.cycles;
+    counters.instructions -= mStartCounters.instructions;
+    counters.cache_misses -= mStartCounters.cache_misses;
+  } else {
+    counters.valid = false;
+  }
+
+  profiler.Record({mName, std::move(mDetail), mCategory, mStart, end - mStart,
+                   TimeProfiler::ThreadId(), counters});
+}
+
+}  // namespace charlie
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace charlie {
+
+// Hardware counter deltas for one scope. Only filled in when the profiler
+// was enabled with hardware counters and perf_event_open is available.
+struct HardwareCounters {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cache_misses = 0;
+  bool valid = false;
+};
+
+// Process-wide collector behind --time-report and --time-trace.
+//
+// Events are recorded by TimeScope from any thread. Phase events are summed
+// into the report table; every event, including the individual LLVM passes,
+// goes into the Chrome trace, which chrome://tracing and ui.perfetto.dev
+// can open.
+class TimeProfiler {
+public:
+  enum Category {
+    PHASE,
+    PASS,
+  };
+
+  struct Event {
+    std::string name;
+    std::string detail;
+    Category category;
+    uint64_t start_us;
+    uint64_t duration_us;
+    uint32_t tid;
+    HardwareCounters counters;
+  };
+
+  static TimeProfiler &Get();
+
+  // `hardware_counters` additionally samples cycles, instructions and cache
+  // misses per scope on Linux.
+  void Enable(bool hardware_counters);
+
+  bool Enabled() const {
+    return mEnabled.load(std::memory_order_relaxed);
+  }
+  bool HardwareCountersEnabled() const {
+    return mHardwareCounters;
+  }
+
+  void Record(Event event);
+
+  // Microseconds since the profiler was enabled
+  uint64_t Now() const;
+
+  // Small stable id for the calling thread
+  static uint32_t ThreadId();
+
+  void PrintReport(std::ostream &os) const;
+  bool WriteTrace(const std::string &path, std::string &error) const;
+
+private:
+  std::atomic<bool> mEnabled{false};
+  bool mHardwareCounters = false;
+  std::chrono::steady_clock::time_point mStart;
+
+  mutable std::mutex mMutex;
+  std::vector<Event> mEvents;
+};
+
+// Times the enclosing scope as `name`. Does nothing unless the profiler is
+// enabled, so scopes can stay in hot code. `name` must be a string literal.
+class TimeScope {
+public:
+  explicit TimeScope(const char *name,
+                     std::string detail = std::string(),
+                     TimeProfiler::Category category = TimeProfiler::PHASE);
+  ~TimeScope();
+
+  TimeScope(const TimeScope &) = delete;
+  TimeScope &operator=(const TimeScope &) = delete;
+
+private:
+  const char *mName;
+  std::string mDetail;
+  TimeProfiler::Category mCategory;
+  bool mActive;
+  uint64_t mStart = 0;
+  HardwareCounters mStartCounters;
+};
+
+}  // namespace charlie
@@ -0,0 +1,139 @@
+#include "types.h"
+
+#include <cstring>
+
+namespace charlie {
+
+static constexpr BuiltinType kBuiltinTypes[] = {
+  {BuiltinType::INT, "i8", 8, 0, nullptr, true},
+  {BuiltinType::INT, "i16", 16, 0, nullptr, true},
+  {BuiltinType::INT, "i32", 32, 0, nullptr, true},
+  {BuiltinType::INT, "i64", 64, 0, nullptr, true},
+  {BuiltinType::INT, "u8", 8, 0, nullptr, false},
+  {BuiltinType::INT, "u16", 16, 0, nullptr, false},
+  {BuiltinType::INT, "u32", 32, 0, nullptr, false},
+  {BuiltinType::INT, "u64", 64, 0, nullptr, false},
+  {BuiltinType::FLOAT, "f32", 32, 0, nullptr, true},
+  {BuiltinType::FLOAT, "f64", 64, 0, nullptr, true},
+  {BuiltinType::BOOL, "bool", 1, 0, nullptr, false},
+  {BuiltinType::STRING, "string", 64, 0, nullptr, false},
+
+  // Narrower lanes fit more of them in a register
+  {BuiltinType::FLOAT, "f32x4", 32, 4, "f32", true},
+  {BuiltinType::FLOAT, "f32x8", 32, 8, "f32", true},
+  {BuiltinType::FLOAT, "f64x2", 64, 2, "f64", true},
+  {BuiltinType::FLOAT, "f64x4", 64, 4, "f64", true},
+  {BuiltinType::INT, "i8x16", 8, 16, "i8", true},
+  {BuiltinType::INT, "i8x32", 8, 32, "i8", true},
+  {BuiltinType::INT, "u8x16", 8, 16, "u8", false},
+  {BuiltinType::INT, "u8x32", 8, 32, "u8", false},
+  {BuiltinType::INT, "i16x8", 16, 8, "i16", true},
+  {BuiltinType::INT, "i16x16", 16, 16, "i16", true},
+  {BuiltinType::INT, "u16x8", 16, 8, "u16", false},
+  {BuiltinType::INT, "u16x16", 16, 16, "u16", false},
+  {BuiltinType::INT, "i32x4", 32, 4, "i32", true},
+  {BuiltinType::INT, "i32x8", 32, 8, "i32", true},
+  {BuiltinType::INT, "u32x4", 32, 4, "u32", false},
+  {BuiltinType::INT, "u32x8", 32, 8, "u32", false},
+  {BuiltinType::INT, "i64x2", 64, 2, "i64", true},
+  {BuiltinType::INT, "i64x4", 64, 4, "i64", true},
+};
+
+static constexpr struct {
+  const char *alias;
+  const char *name;
+} kTypeAliases[] = {
+  {"int", "i32"},
+  {"float", "f32"},
+};
+
+static const char *ResolveAlias(const std::string &name) {
+  for (const auto &alias : kTypeAliases) {
+    if (name == alias.alias)
+      return alias.name;
+  }
+  return nullptr;
+}
+
+const BuiltinType *FindBuiltinType(const std::string &name) {
+  const char *resolved = ResolveAlias(name);
+  for (const auto &type : kBuiltinTypes) {
+    if (resolved ? !strcmp(resolved, type.name) : name == type.name)
+      return &type;
+  }
+  return nullptr;
+}
+
+const BuiltinType *FindVectorType(const std::string &element, unsigned lanes) {
+  const BuiltinType *scalar = FindBuiltinType(element);
+  if (!scalar)
+    return nullptr;
+  for (const auto &type : kBuiltinTypes) {
+    if (type.lanes == lanes && type.element && !strcmp(scalar->name, type.element))
+      return &type;
+  }
+  return nullptr;
+}
+
+bool IsArithmeticType(const std::string &name) {
+  const BuiltinType *type = FindBuiltinType(name);
+  return type && (type->kind == BuiltinType::INT || type->kind == BuiltinType::FLOAT);
+}
+
+const BuiltinType *ComparisonResultType(const BuiltinType &operand) {
+  if (!operand.lanes)
+    return FindBuiltinType("bool");
+  return FindVectorType("i" + std::to_string(operand.bits), operand.lanes);
+}
+
+std::string CanonicalTypeName(const std::string &name) {
+  size_t dims = name.find('[');
+  if (std::string value; SplitAtomicType(name.substr(0, dims), value)) {
+    std::string atomic = "atomic<" + CanonicalTypeName(value) + ">";
+    return dims == std::string::npos ? atomic : atomic + name.substr(dims);
+  }
+  if (std::string yield; SplitCoroutineType(name.substr(0, dims), yield) && !yield.empty()) {
+    std::string coroutine = "coroutine<" + CanonicalTypeName(yield) + ">";
+    return dims == std::string::npos ? coroutine : coroutine + name.substr(dims);
+  }
+  const char *resolved = ResolveAlias(name.substr(0, dims));
+  if (!resolved)
+    return name;
+  return dims == std::string::npos ? resolved : resolved + name.substr(dims);
+}
+
+bool SplitAtomicType(const std::string &type, std::string &value) {
+  static constexpr char kPrefix[] = "atomic<";
+  constexpr size_t kPrefixLength = sizeof(kPrefix) - 1;
+  if (type.size() <= kPrefixLength + 1 || type.compare(0, kPrefixLength, kPrefix) ||
+      type.back() != '>')
+    return false;
+  value = type.substr(kPrefixLength, type.size() - kPrefixLength - 1);
+  return true;
+}
+
+bool SplitCoroutineType(const std::string &type, std::string &yield) {
+  static constexpr char kPrefix[] = "coroutine";
+  constexpr size_t kPrefixLength = sizeof(kPrefix) - 1;
+  if (type.compare(0, kPrefixLength, kPrefix))
+    return false;
+  if (type.size() == kPrefixLength) {
+    yield.clear();
+    return true;
+  }
+  if (type.size() <= kPrefixLength + 2 || type[kPrefixLength] != '<' || type.back() != '>')
+    return false;
+  yield = type.substr(kPrefixLength + 1, type.size() - kPrefixLength - 2);
+  return true;
+}
+
+bool IntFits(const BuiltinType &type, int64_t value) {
+  if (type.bits == 64)
+    return type.is_signed || value >= 0;
+  int64_t range = int64_t(1) << type.bits;
+  if (type.is_signed)
+    return value >= -range / 2 && value < range / 2;
+  return value >= 0 && value < range;
+}
+
+}  // namespace charlie
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace charlie {
+
+// Builtin types. Scalars have no lanes; SIMD vectors name the scalar type of
+// their lanes and lower to llvm::FixedVectorType.
+struct BuiltinType {
+  enum Kind {
+    INT,
+    FLOAT,
+    BOOL,
+    STRING,
+  } kind;
+  const char *name;
+  unsigned bits;        // Of the scalar, or of one lane
+  unsigned lanes;       // 0 for scalars
+  const char *element;  // Scalar type of one lane, for vectors
+  bool is_signed;       // For ints
+};
+
+// Returns nullptr if `name` is not a builtin type. `int` and `float` are
+// aliases of i32 and f32.
+const BuiltinType *FindBuiltinType(const std::string &name);
+
+// Returns the builtin vector type with `lanes` lanes of `element`, or
+// nullptr if there is none.
+const BuiltinType *FindVectorType(const std::string &element, unsigned lanes);
+
+// True for int and float scalars and vectors, the operands of arithmetic
+bool IsArithmeticType(const std::string &name);
+
+// The type of comparing two `operand`s: bool for scalars, and for vectors a
+// mask of signed ints as wide as the lanes, all ones where the comparison
+// holds, e.g. i32x4 for f32x4.
+const BuiltinType *ComparisonResultType(const BuiltinType &operand);
+
+// `name` with builtin aliases in its element type resolved, e.g. "i32[4]"
+// for "int[4]". Types are the same if their canonical names are.
+std::string CanonicalTypeName(const std::string &name);
+
+// Sets `value` to T if `type` is `atomic<T>`. Atomics are laid out like
+// their int or float scalar, and are only read and written through the
+// atomic_* builtins.
+bool SplitAtomicType(const std::string &type, std::string &value);
+
+// Sets `yield` to T if `type` is `coroutine<T>`, or to an empty string if it
+// is `coroutine`. Both are handles to a coroutine created by calling a
+// #coroutine procedure that yields T, or nothing.
+bool SplitCoroutineType(const std::string &type, std::string &yield);
+
+// Whether `value` is representable in the int scalar `type`
+bool IntFits(const BuiltinType &type, int64_t value);
+
+}  // namespace charlie
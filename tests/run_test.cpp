@@ -0,0 +1,619 @@
+// Runs one case of the test suite, see the test() list in meson.build.
+//
+//   run_test [expectations] -- <charlie options> <input>
+//
+// Compiles the input as the driver would with the given options, verifies
+// the IR, and checks each expectation:
+//
+//   --exit=<n>        main() returns n, JIT-linked from the object file
+//   --interp=<n>      main() returns n on the bytecode interpreter
+//   --ir=<text>       the LLVM IR contains <text>
+//   --ir-once=<text>  the LLVM IR contains <text> exactly once
+//   --no-ir=<text>    the LLVM IR does not contain <text>
+//   --diag=<text>     the diagnostics contain <text>
+//   --fail            compilation fails
+//   --repeatable      compiling again with the same CompileContext gives the
+//                     same IR
+//
+// Some cases are scenarios of their own, which run in a scratch directory:
+//
+//   run_test --cache  the cache hits, and misses after each kind of change
+//   run_test --chi    interfaces survive a write and read of their encoding
+//   run_test --driver inputs compiled on several workers all come out the
+//                     same as when compiled alone
+//   run_test --server a client gets what the driver would have written
+//   run_test --time-trace
+//                     --time-trace writes every phase and pass of a compile
+//   run_test --mem-report
+//                     --mem-report counts allocations in every phase
+
+#include "../src/cache.h"
+#include "../src/compiler.h"
+#include "../src/driver.h"
+#include "../src/interface.h"
+#include "../src/memory.h"
+#include "../src/parser.h"
+#include "../src/runtime.h"
+#include "../src/server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using namespace charlie;
+
+namespace {
+
+int gFailures = 0;
+
+void Fail(const std::string &what) {
+  fprintf(stderr, "[Test Error] %s\n", what.c_str());
+  gFailures++;
+}
+
+bool ExitOnError(llvm::Error err) {
+  if (!err)
+    return false;
+  std::string message;
+  llvm::raw_string_ostream os(message);
+  llvm::logAllUnhandledErrors(std::move(err), os);
+  Fail("JIT: " + os.str());
+  return true;
+}
+
+// Links `object` in memory and returns what its main() returns. Programs
+// call into the runtime, which is linked into this executable.
+bool RunObject(const std::string &object, int &exit_code) {
+  auto jit = llvm::orc::LLJITBuilder().create();
+  if (ExitOnError(jit.takeError()))
+    return false;
+  llvm::orc::JITDylib &lib = (*jit)->getMainJITDylib();
+
+  auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+    (*jit)->getDataLayout().getGlobalPrefix());
+  if (ExitOnError(process.takeError()))
+    return false;
+  lib.addGenerator(std::move(*process));
+
+  const struct {
+    const char *name;
+    void *address;
+  } kRuntime[] = {
+    {"charlie_parallel_for", reinterpret_cast<void *>(&charlie_parallel_for)},
+    {"charlie_spawn", reinterpret_cast<void *>(&charlie_spawn)},
+    {"charlie_run", reinterpret_cast<void *>(&charlie_run)},
+  };
+  llvm::orc::SymbolMap runtime;
+  for (const auto &symbol : kRuntime) {
+    runtime[(*jit)->mangleAndIntern(symbol.name)] =
+      llvm::JITEvaluatedSymbol::fromPointer(symbol.address);
+  }
+  if (ExitOnError(lib.define(llvm::orc::absoluteSymbols(std::move(runtime)))))
+    return false;
+
+  if (ExitOnError((*jit)->addObjectFile(llvm::MemoryBuffer::getMemBufferCopy(object))))
+    return false;
+  auto main_sym = (*jit)->lookup("main");
+  if (ExitOnError(main_sym.takeError()))
+    return false;
+  exit_code = reinterpret_cast<int (*)()>(main_sym->getAddress())();
+  return true;
+}
+
+bool Compile(const std::string &input,
+             const CompilerOptions &opts,
+             CompilerOptions::EmitKind emit,
+             CompileContext &cc,
+             std::string &output,
+             std::string &diag) {
+  CompilerOptions emit_opts = opts;
+  emit_opts.emit = emit;
+  std::stringstream diag_stream;
+  bool success = CompileFile(input, emit_opts, cc, nullptr, diag_stream, output);
+  diag = diag_stream.str();
+  return success;
+}
+
+// The printer writes out malformed IR as readily as any other, so each
+// module a case compiles is read back and verified
+void Verify(const std::string &ir) {
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic error;
+  std::unique_ptr<llvm::Module> module = llvm::parseAssemblyString(ir, error, context);
+  std::string message;
+  llvm::raw_string_ostream os(message);
+  if (!module)
+    error.print("run_test", os);
+  else
+    llvm::verifyModule(*module, &os);
+  if (!os.str().empty())
+    Fail("the IR is malformed:\n" + os.str());
+}
+
+size_t Count(const std::string &text, const std::string &pattern) {
+  size_t count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + pattern.size()))
+    count++;
+  return count;
+}
+
+//===----------------------------------------------------------------------===//
+// Scenarios
+//===----------------------------------------------------------------------===//
+
+void WriteFile(const fs::path &path, const std::string &text) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << text;
+}
+
+const char *kLibrary = "a :: proc() -> int {\n"
+                       "  return 1;\n"
+                       "}\n";
+
+const char *kApplication = "use lib;\n"
+                           "\n"
+                           "main :: proc() -> int {\n"
+                           "  return a();\n"
+                           "}\n";
+
+void CacheScenario(const fs::path &dir) {
+  fs::path lib = dir / "lib.ch", app = dir / "app.ch";
+  WriteFile(lib, kLibrary);
+  WriteFile(app, kApplication);
+  fs::create_directories(dir / "include");
+
+  CompilationCache cache((dir / "cache").string(), 1 << 20);
+  auto compile = [&](const fs::path &input, const CompilerOptions &opts, std::string &diag) {
+    CompileContext cc;
+    std::stringstream diag_stream;
+    std::string output;
+    bool success = CompileFile(input.string(), opts, cc, &cache, diag_stream, output);
+    diag = diag_stream.str();
+    return success;
+  };
+  auto expect = [&](const char *step, const CompilerOptions &opts, bool hit) {
+    uint64_t hits = cache.Stats().hits;
+    std::string diag;
+    if (!compile(app, opts, diag)) {
+      Fail(std::string(step) + ": compilation failed: " + diag);
+      return;
+    }
+    if ((cache.Stats().hits > hits) != hit)
+      Fail(std::string(step) + ": expected a cache " + (hit ? "hit" : "miss"));
+  };
+
+  CompilerOptions opts;
+  opts.emit = CompilerOptions::EMIT_OBJECT;
+  expect("first compile", opts, false);
+  expect("unchanged", opts, true);
+
+  CompilerOptions o2 = opts;
+  o2.opt_level = 2;
+  expect("-O2", o2, false);
+  expect("back to -O0", opts, true);
+
+  CompilerOptions include = opts;
+  include.import_paths.push_back((dir / "include").string());
+  expect("-I", include, false);
+
+  CompilerOptions keep = opts;
+  keep.keep.push_back("main");
+  expect("--keep", keep, false);
+
+  // An edit that leaves the modification time as it was
+  auto mtime = fs::last_write_time(lib);
+  WriteFile(lib, std::string(kLibrary) + "\nb :: proc() -> int {\n  return 2;\n}\n");
+  fs::last_write_time(lib, mtime);
+  expect("imported module edited", opts, false);
+  expect("unchanged after the edit", opts, true);
+
+  WriteFile(app, std::string(kApplication) + "\n");
+  expect("input edited", opts, false);
+
+  // The same input in another directory imports that directory's lib.ch,
+  // where it calls `a` wrong
+  fs::path other = dir / "other";
+  fs::create_directories(other);
+  fs::copy_file(app, other / "app.ch");
+  WriteFile(other / "lib.ch", "a :: proc(x: int) -> int {\n  return x;\n}\n");
+  std::string diag;
+  if (compile(other / "app.ch", opts, diag))
+    Fail("input moved: hit the entry of the same source in another directory");
+}
+
+void ChiScenario(const fs::path &dir) {
+  // Enough of everything that counts and values take several LEB128 bytes
+  std::ostringstream source;
+  source << "#align(4096)\nBig :: struct {\n";
+  for (int i = 0; i < 200; ++i)
+    source << "  m" << i << ": i32,\n";
+  source << "}\n\n";
+  for (int i = 0; i < 300; ++i)
+    source << "p" << i << " :: proc(x: i32, big: Big) -> i32 {\n  return x;\n}\n\n";
+  std::string text = source.str();
+
+  std::stringstream diag;
+  Parser parser(SourceBuffer{(dir / "big.ch").string(), text}, diag);
+  auto mod = parser.Parse();
+  if (!mod) {
+    Fail("parse failed: " + diag.str());
+    return;
+  }
+  auto interface = ExtractInterface(*mod, "big", text, {});
+  std::string bytes;
+  WriteInterface(*interface, bytes);
+
+  ModuleInterface read;
+  if (!ReadInterface(bytes, read)) {
+    Fail("the encoded interface does not read back");
+    return;
+  }
+  std::string again;
+  WriteInterface(read, again);
+  if (again != bytes)
+    Fail("the interface reads back different from what was written");
+  if (read.source_hash != SourceHash(text))
+    Fail("the source hash does not read back");
+  if (read.procedures.size() != 300 || read.structs.size() != 1 ||
+      read.structs[0]->Members().size() != 200)
+    Fail("the interface reads back with missing declarations");
+  else if (read.structs[0]->Annotations().at(0).args.at(0) != 4096)
+    Fail("the #align argument does not read back");
+
+  ModuleInterface truncated, extended;
+  if (ReadInterface(std::string_view(bytes).substr(0, bytes.size() - 1), truncated))
+    Fail("a truncated interface is accepted");
+  if (ReadInterface(bytes + '\0', extended))
+    Fail("an interface with trailing bytes is accepted");
+
+  // Resolving `use lib;` regenerates lib.chi only when lib.ch changed
+  fs::path lib = dir / "lib.ch";
+  std::string lib_text = kLibrary;
+  WriteFile(lib, lib_text);
+  CompilerOptions opts;
+  auto resolve = [&](const char *step) {
+    Parser app_parser(SourceBuffer{(dir / "app.ch").string(), kApplication}, diag);
+    auto app = app_parser.Parse();
+    ImportResolver resolver({dir.string()}, opts, diag);
+    if (!app || !resolver.Resolve(*app)) {
+      Fail(std::string(step) + ": resolution failed: " + diag.str());
+      return ModuleInterface();
+    }
+    std::ifstream in(dir / "lib.chi", std::ios::binary);
+    std::string chi((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ModuleInterface stamped;
+    if (!ReadInterface(chi, stamped) || stamped.source_size != lib_text.size() ||
+        stamped.source_mtime != uint64_t(fs::last_write_time(lib).time_since_epoch().count()))
+      Fail(std::string(step) + ": lib.chi does not record the source's stamp");
+    return stamped;
+  };
+  resolve("first import");
+
+  // Touched without a change: lib.chi stays, with the new stamp
+  auto mtime = fs::last_write_time(lib);
+  fs::last_write_time(lib, mtime + std::chrono::seconds(1));
+  auto touched = resolve("touched");
+  if (touched.procedures.empty() || touched.procedures[0]->Name() != "a")
+    Fail("touched: lib.chi lost `a`");
+
+  // An edit that leaves the size as it was
+  lib_text[0] = 'c';
+  WriteFile(lib, lib_text);
+  fs::last_write_time(lib, mtime + std::chrono::seconds(2));
+  auto edited = resolve("edited");
+  if (edited.procedures.empty() || edited.procedures[0]->Name() != "c")
+    Fail("edited to the same size: the stale lib.chi was used");
+
+  // A module that picks its exports with #export also exports its --keep
+  // roots, as its object does
+  fs::path tool = dir / "tool.ch";
+  WriteFile(tool, "helper :: proc() -> int {\n  return 2;\n}\n\n"
+                  "#export\nrun :: proc() -> int {\n  return 0;\n}\n");
+  WriteFile(dir / "user.ch", "use tool;\n\nmain :: proc() -> int {\n  return helper();\n}\n");
+  opts.keep.push_back("helper");
+  opts.emit = CompilerOptions::EMIT_LLVM_IR;
+  CompileContext cc;
+  std::stringstream tool_diag;
+  std::string output;
+  if (!CompileFile((dir / "user.ch").string(), opts, cc, nullptr, tool_diag, output))
+    Fail("--keep: the kept procedure is not exported: " + tool_diag.str());
+}
+
+void DriverScenario(const fs::path &dir) {
+  const int kInputs = 16;
+  CompilerOptions opts;
+  opts.emit = CompilerOptions::EMIT_LLVM_IR;
+  opts.jobs = 4;
+  for (int i = 0; i < kInputs; ++i) {
+    fs::path input = dir / ("input" + std::to_string(i) + ".ch");
+    WriteFile(input, "Pair :: struct {\n  a: i8,\n  b: f64,\n}\n\n"
+                     "main :: proc() -> int {\n  let p: Pair;\n  p.a = 1;\n"
+                     "  return i32(p.a);\n}\n");
+    opts.inputs.push_back(input.string());
+  }
+  if (RunDriver(opts) != 0) {
+    Fail("the driver failed");
+    return;
+  }
+
+  // Apart from the module name in the first lines
+  auto body = [&](int i) {
+    std::ifstream in(dir / ("input" + std::to_string(i) + ".ll"));
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t start = text.find("\n\n");
+    return start == std::string::npos ? text : text.substr(start);
+  };
+  std::string expected = body(0);
+  if (expected.find("%struct.Pair = type") == std::string::npos)
+    Fail("input0.ll lacks the struct:\n" + expected);
+  for (int i = 1; i < kInputs; ++i) {
+    if (body(i) != expected)
+      Fail("input" + std::to_string(i) + ".ll differs from input0.ll:\n" + body(i));
+  }
+}
+
+// Whether a server accepts connections on `socket_path`
+bool Answers(const fs::path &socket_path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  bool connected = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+  close(fd);
+  return connected;
+}
+
+void ServerScenario(const fs::path &dir) {
+  fs::path socket_path = dir / "socket", app = dir / "app.ch";
+  WriteFile(app, "main :: proc() -> int {\n  return 3;\n}\n");
+
+  // The server never returns; it goes away with this process
+  CompilerOptions server_opts;
+  server_opts.server = socket_path.string();
+  std::thread(RunServer, server_opts).detach();
+  for (int i = 0; i < 1000 && !Answers(socket_path); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  auto client = [&](std::vector<std::string> args) {
+    args.insert(args.begin(), {"charlie", "--connect=" + socket_path.string()});
+    std::vector<char *> argv;
+    for (auto &arg : args)
+      argv.push_back(arg.data());
+    CompilerOptions opts;
+    if (ParseCommandLine(static_cast<int>(argv.size()), argv.data(), opts, std::cerr) != PARSE_OK)
+      return -1;
+    return RunClient(opts, static_cast<int>(argv.size()), argv.data());
+  };
+
+  if (client({app.string()}) != 0 || !fs::exists(dir / "app.bc"))
+    Fail("without -o, the client did not write app.bc");
+  if (client({"--emit=obj", "-o", (dir / "out.o").string(), app.string()}) != 0 ||
+      !fs::exists(dir / "out.o"))
+    Fail("the client did not write -o out.o");
+
+  // More clients at once than the server has workers
+  std::vector<std::thread> clients;
+  std::vector<int> statuses(32, -1);
+  for (size_t i = 0; i < statuses.size(); ++i) {
+    clients.emplace_back([&, i] {
+      fs::path output = dir / ("concurrent" + std::to_string(i) + ".bc");
+      statuses[i] = client({"-o", output.string(), app.string()});
+    });
+  }
+  for (auto &thread : clients)
+    thread.join();
+  if (std::count(statuses.begin(), statuses.end(), 0) != int(statuses.size()))
+    Fail("not every concurrent client was served");
+
+  // A second server leaves the live one's socket alone
+  if (RunServer(server_opts) == 0 || !Answers(socket_path))
+    Fail("a second server took over the socket");
+  if (client({app.string()}) != 0)
+    Fail("the server stopped answering after a second one started");
+}
+
+// A program that goes through every phase: an import, a dropped
+// declaration and loops for the optimizer
+const char *kPhases = "use lib;\n\n"
+                      "unused :: proc() -> int {\n  return 2;\n}\n\n"
+                      "main :: proc() -> int {\n  let sum: i64 = 0;\n"
+                      "  for i: i64 in 0..100 {\n    sum = sum + i;\n  }\n"
+                      "  return i32(sum) + a();\n}\n";
+
+void TimeTraceScenario(const fs::path &dir) {
+  WriteFile(dir / "lib.ch", kLibrary);
+  WriteFile(dir / "app.ch", kPhases);
+  CompilerOptions opts;
+  opts.inputs.push_back((dir / "app.ch").string());
+  opts.opt_level = 2;
+  opts.time_trace = (dir / "trace.json").string();
+  if (RunDriver(opts) != 0) {
+    Fail("the driver failed");
+    return;
+  }
+
+  std::ifstream in(dir / "trace.json");
+  std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (trace.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 0) != 0 ||
+      trace.size() < 4 || trace.compare(trace.size() - 4, 4, "\n]}\n") != 0)
+    Fail("the trace is not a Chrome trace object:\n" + trace);
+  for (const char *phase : {"compile", "parse", "imports", "dce", "codegen", "optimize", "emit"}) {
+    if (!Count(trace, std::string("\"cat\":\"phase\",\"name\":\"") + phase + "\""))
+      Fail(std::string("the trace lacks the ") + phase + " phase");
+  }
+  if (!Count(trace, "\"cat\":\"pass\""))
+    Fail("the trace lacks optimization passes");
+}
+
+void MemReportScenario(const fs::path &dir) {
+  WriteFile(dir / "lib.ch", kLibrary);
+  WriteFile(dir / "app.ch", kPhases);
+  CompilerOptions opts;
+  opts.inputs.push_back((dir / "app.ch").string());
+  opts.opt_level = 2;
+  opts.mem_report = true;
+
+  // The driver prints the report to stderr
+  std::stringstream report;
+  std::streambuf *stderr_buf = std::cerr.rdbuf(report.rdbuf());
+  int status = RunDriver(opts);
+  std::cerr.rdbuf(stderr_buf);
+  if (status != 0) {
+    Fail("the driver failed:\n" + report.str());
+    return;
+  }
+
+  MemoryTracker &tracker = MemoryTracker::Get();
+  for (MemoryPhase phase : {MEM_PARSE, MEM_IMPORTS, MEM_CODEGEN, MEM_OPTIMIZE, MEM_EMIT}) {
+    if (!tracker.Stats(phase).allocations)
+      Fail(std::string("no allocations counted in the ") + GetMemoryPhaseName(phase) + " phase");
+  }
+  if (tracker.PeakLiveBytes() <= 0)
+    Fail("no peak heap size");
+  for (const char *text : {"Charlie memory report", "\nparse ", "\ncodegen ", "\ntotal ",
+                           "AST nodes"}) {
+    if (!Count(report.str(), text))
+      Fail(std::string("the report lacks '") + text + "':\n" + report.str());
+  }
+}
+
+bool RunScenario(const char *name, void (*scenario)(const fs::path &)) {
+  char dir[] = "/tmp/charlie-test-XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return false;
+  }
+  scenario(dir);
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  if (gFailures)
+    fprintf(stderr, "[Test Error] %s scenario failed\n", name);
+  return gFailures == 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && !strcmp(argv[1], "--cache"))
+    return RunScenario("cache", CacheScenario) ? 0 : 1;
+  if (argc == 2 && !strcmp(argv[1], "--chi"))
+    return RunScenario("chi", ChiScenario) ? 0 : 1;
+  if (argc == 2 && !strcmp(argv[1], "--driver"))
+    return RunScenario("driver", DriverScenario) ? 0 : 1;
+  if (argc == 2 && !strcmp(argv[1], "--server"))
+    return RunScenario("server", ServerScenario) ? 0 : 1;
+  if (argc == 2 && !strcmp(argv[1], "--time-trace"))
+    return RunScenario("time trace", TimeTraceScenario) ? 0 : 1;
+  if (argc == 2 && !strcmp(argv[1], "--mem-report"))
+    return RunScenario("memory report", MemReportScenario) ? 0 : 1;
+
+  struct Expectation {
+    std::string kind, value;
+  };
+  std::vector<Expectation> expectations;
+  bool fail = false, repeatable = false;
+  int i = 1;
+  for (; i < argc && strcmp(argv[i], "--"); ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg == "--fail")
+      fail = true;
+    else if (arg == "--repeatable")
+      repeatable = true;
+    else if (arg.rfind("--", 0) == 0 && eq != std::string::npos)
+      expectations.push_back({arg.substr(2, eq - 2), arg.substr(eq + 1)});
+    else {
+      fprintf(stderr, "[Test Error] Unknown expectation '%s'\n", arg.c_str());
+      return 1;
+    }
+  }
+
+  // What follows -- is a charlie command line
+  std::vector<char *> charlie_argv = {argv[0]};
+  for (++i; i < argc; ++i)
+    charlie_argv.push_back(argv[i]);
+  CompilerOptions opts;
+  if (ParseCommandLine(static_cast<int>(charlie_argv.size()), charlie_argv.data(), opts,
+                       std::cerr) != PARSE_OK ||
+      opts.inputs.size() != 1) {
+    fprintf(stderr, "[Test Error] Expected charlie options and one input after --\n");
+    return 1;
+  }
+  const std::string &input = opts.inputs[0];
+
+  // Shared by every compilation, like a driver or server worker does
+  CompileContext cc;
+  std::string ir, diag;
+  bool compiled = Compile(input, opts, CompilerOptions::EMIT_LLVM_IR, cc, ir, diag);
+  if (compiled == fail)
+    Fail(fail ? "compilation succeeded" : "compilation failed:\n" + diag);
+  if (compiled)
+    Verify(ir);
+
+  if (compiled && repeatable) {
+    std::string again;
+    Compile(input, opts, CompilerOptions::EMIT_LLVM_IR, cc, again, diag);
+    if (again != ir)
+      Fail("compiling again gives different IR:\n" + again);
+  }
+
+  for (const auto &e : expectations) {
+    if (e.kind == "diag") {
+      if (diag.find(e.value) == std::string::npos)
+        Fail("diagnostics lack '" + e.value + "':\n" + diag);
+    } else if (!compiled) {
+      continue;
+    } else if (e.kind == "ir") {
+      if (!Count(ir, e.value))
+        Fail("IR lacks '" + e.value + "'");
+    } else if (e.kind == "ir-once") {
+      if (size_t n = Count(ir, e.value); n != 1)
+        Fail("IR has '" + e.value + "' " + std::to_string(n) + " times, expected once");
+    } else if (e.kind == "no-ir") {
+      if (Count(ir, e.value))
+        Fail("IR has '" + e.value + "'");
+    } else if (e.kind == "exit") {
+      std::string object;
+      int exit_code;
+      if (!Compile(input, opts, CompilerOptions::EMIT_OBJECT, cc, object, diag))
+        Fail("compilation to an object failed:\n" + diag);
+      else if (RunObject(object, exit_code) && exit_code != atoi(e.value.c_str()))
+        Fail("main() returned " + std::to_string(exit_code) + ", expected " + e.value);
+    } else if (e.kind == "interp") {
+      std::stringstream out, interp_diag;
+      int exit_code;
+      if (!InterpretFile(input, opts, out, interp_diag, exit_code))
+        Fail("interpreting failed:\n" + interp_diag.str());
+      else if (exit_code != atoi(e.value.c_str()))
+        Fail("main() returned " + std::to_string(exit_code) + " on the interpreter, expected " +
+             e.value);
+    } else {
+      Fail("unknown expectation '--" + e.kind + "'");
+    }
+  }
+  return gFailures ? 1 : 0;
+}